@@ -549,6 +549,37 @@
  * 20161018.1 (2.5.0-dev)  Dropped ap_has_cntrls(), ap_scan_http_uri_safe(),
  *                         ap_get_http_token() and http_stricturi conf member.
  *                         Added ap_scan_vchar_obstext()
+ * 20161018.2 (2.5.0-dev)  Add zerocopy to core_server_config
+ * 20161018.3 (2.5.0-dev)  Add ap_get_known_header_in() and
+ *                         known_headers_in to core_request_config
+ * 20161018.4 (2.5.0-dev)  Add ap_recent_clf_date() and AP_CLF_DATE_LEN
+ * 20161018.5 (2.5.0-dev)  Add ap_init_merge_cache(),
+ *                         ap_get_merge_cache_stats() and
+ *                         merge_cache_size{,_set} to core_server_config
+ * 20161018.6 (2.5.0-dev)  Add ap_proxy_index_workers() and windex to
+ *                         proxy_balancer and proxy_server_conf
+ * 20161018.7 (2.5.0-dev)  Add shared_{pool,min,max,ttl} to proxy_worker_shared,
+ *                         spool to proxy_worker, proxy_shared_pool_stats,
+ *                         ap_proxy_init_shared_pools() and
+ *                         ap_proxy_shared_pool_stats()
+ * 20161018.8 (2.5.0-dev)  Add lat_ewma and lat_stamp to proxy_worker_shared,
+ *                         served and flags to proxy_balancer_method,
+ *                         PROXY_LBMETHOD_NOLOCK
+ * 20161018.9 (2.5.0-dev)  Add ap_proxy_atomic_add_int(),
+ *                         ap_proxy_atomic_add_size(),
+ *                         ap_proxy_atomic_dec_size() and
+ *                         ap_proxy_atomic_add_off()
+ * 20161018.10 (2.5.0-dev) Add pipeline to proxy_worker_shared, pipeline to
+ *                         proxy_worker, pipe_* and pipelined fields to
+ *                         proxy_conn_rec, ap_proxy_pipeline_open(),
+ *                         ap_proxy_pipeline_join() and ap_proxy_pipeline_wait()
+ * 20161018.11 (2.5.0-dev) Add multiplex to proxy_worker_shared
+ * 20161018.12 (2.5.0-dev) Add latency histograms to proxy_worker_shared,
+ *                         started to proxy_conn_rec, ap_proxy_latency_add(),
+ *                         ap_proxy_latency_stats(), ap_proxy_latency_name()
+ * 20161018.13 (2.5.0-dev) Add prewarm to proxy_worker_shared, acquired and
+ *                         demand to proxy_conn_pool, ap_proxy_prewarm_worker()
+ * 20161018.14 (2.5.0-dev) Add CONN_SENSE_WANT_ERRQUEUE to conn_sense_e
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503235UL /* "AP25" */
@@ -556,7 +587,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20161018
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 1                 /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 14                /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
@@ -433,6 +433,11 @@ typedef struct {
     /** Should addition of charset= be suppressed for this request?
      */
     int suppress_charset;
+
+    /** Index of the known headers in headers_in, see
+     * ap_get_known_header_in()
+     */
+    struct ap_known_headers_t *known_headers_in;
 } core_request_config;
 
 /* Standard entries that are guaranteed to be accessible via
@@ -758,6 +763,16 @@ typedef struct {
     int protocols_honor_order;
     int async_filter;
     unsigned int async_filter_set:1;
+
+#define AP_ZEROCOPY_UNSET    0
+#define AP_ZEROCOPY_ENABLE   1
+#define AP_ZEROCOPY_DISABLE  2
+    int zerocopy;
+
+    /** Maximum number of per-dir config merges cached by each child
+     * (main server only), see ap_init_merge_cache() */
+    int merge_cache_size;
+    unsigned int merge_cache_size_set:1;
 } core_server_config;
 
 /* for AddOutputFiltersByType in core.c */
@@ -778,6 +793,7 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
                                   ap_input_mode_t mode, apr_read_type_e block,
                                   apr_off_t readbytes);
 apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *b);
+int ap_core_output_pending(conn_rec *c);
 
 
 AP_DECLARE(const char*) ap_get_server_protocol(server_rec* s);
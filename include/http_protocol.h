@@ -82,6 +82,38 @@ AP_DECLARE(void) ap_get_mime_headers(request_rec *r);
 AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r,
                                           apr_bucket_brigade *bb);
 
+/**
+ * Request headers which can be retrieved in constant time with
+ * ap_get_known_header_in().
+ */
+typedef enum {
+    AP_KNOWN_HEADER_HOST,
+    AP_KNOWN_HEADER_CONNECTION,
+    AP_KNOWN_HEADER_UPGRADE,
+    AP_KNOWN_HEADER_CONTENT_LENGTH,
+    AP_KNOWN_HEADER_CONTENT_TYPE,
+    AP_KNOWN_HEADER_TRANSFER_ENCODING,
+    AP_KNOWN_HEADER_EXPECT,
+    AP_KNOWN_HEADER_ACCEPT_ENCODING,
+    AP_KNOWN_HEADER_RANGE,
+    AP_KNOWN_HEADER_COOKIE,
+    AP_KNOWN_HEADER_USER_AGENT,
+    AP_KNOWN_HEADERS_COUNT
+} ap_known_header_e;
+
+/**
+ * Get a known request header, like apr_table_get(r->headers_in, name).
+ * The position of the known headers in r->headers_in is indexed when the
+ * headers are read, and re-indexed only if the table changed since (by
+ * the addition or removal of fields, the value of a field can be modified
+ * freely).
+ * @param r The current request
+ * @param which The header to get
+ * @return The value of the (first) header, or NULL if not present
+ */
+AP_DECLARE(const char *) ap_get_known_header_in(request_rec *r,
+                                                ap_known_header_e which);
+
 /* Finish up stuff after a request */
 
 /**
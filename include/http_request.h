@@ -240,6 +240,32 @@ AP_DECLARE(void) ap_clear_auth_internal(void);
  */
 AP_DECLARE(void) ap_setup_auth_internal(apr_pool_t *ptemp);
 
+/**
+ * Set up the cache of the per-dir config merges of this child, which
+ * are reused across requests (up to PerDirMergeCacheSize merges) when
+ * they involve configuration sections only (i.e. not .htaccess files).
+ * This is an internal function, called by the core at child init.
+ * @param pchild The child pool, the cache is dropped with it
+ * @param s The main server
+ */
+AP_DECLARE(void) ap_init_merge_cache(apr_pool_t *pchild, server_rec *s);
+
+/**
+ * Statistics of the per-dir config merge cache of this child.
+ */
+typedef struct ap_merge_cache_stats_t {
+    apr_uint32_t hits;      /**< Merges found in the cache */
+    apr_uint32_t misses;    /**< Cacheable merges not found in the cache */
+    apr_uint32_t entries;   /**< Merges in the cache */
+    apr_uint32_t size;      /**< Maximum merges in the cache, 0 if disabled */
+} ap_merge_cache_stats_t;
+
+/**
+ * Get the statistics of the per-dir config merge cache of this child.
+ * @param stats The statistics
+ */
+AP_DECLARE(void) ap_get_merge_cache_stats(ap_merge_cache_stats_t *stats);
+
 /**
  * Register an authentication or authorization provider with the global
  * provider pool.
@@ -1248,7 +1248,10 @@ typedef enum  {
 typedef enum  {
     CONN_SENSE_DEFAULT,
     CONN_SENSE_WANT_READ,       /* next event must be read */
-    CONN_SENSE_WANT_WRITE       /* next event must be write */
+    CONN_SENSE_WANT_WRITE,      /* next event must be write */
+    CONN_SENSE_WANT_ERRQUEUE    /* next event must be the socket's error
+                                 * queue (POLLERR), e.g. MSG_ZEROCOPY
+                                 * completions */
 } conn_sense_e;
 
 /**
@@ -48,6 +48,9 @@ extern "C" {
 /* Use more compact ISO 8601 format */
 #define AP_CTIME_OPTION_COMPACT 0x2
 
+/* Length of a Common Log Format timestamp, including the trailing \0 */
+#define AP_CLF_DATE_LEN 29
+
 
 /**
  * convert a recent time to its human readable components in local timezone
@@ -57,7 +60,8 @@ extern "C" {
  * @note This is a faster alternative to apr_time_exp_lt that uses
  *       a cache of pre-exploded time structures.  It is useful for things
  *       that need to explode the current time multiple times per second,
- *       like loggers.
+ *       like loggers.  The formatting functions below are cached per
+ *       thread and per second, prefer them when the format fits.
  * @return APR_SUCCESS iff successful
  */
 AP_DECLARE(apr_status_t) ap_explode_recent_localtime(apr_time_exp_t *tm,
@@ -109,6 +113,14 @@ AP_DECLARE(apr_status_t) ap_recent_ctime_ex(char *date_str, apr_time_t t,
  */
 AP_DECLARE(apr_status_t) ap_recent_rfc822_date(char *date_str, apr_time_t t);
 
+/**
+ * format a recent timestamp in the Common Log Format, in local timezone
+ * @param date_str String to write to (must have length >= AP_CLF_DATE_LEN)
+ * @param t the time to convert
+ * @note example: "[08/Jan/2000:19:31:41 +0100]"
+ */
+AP_DECLARE(apr_status_t) ap_recent_clf_date(char *date_str, apr_time_t t);
+
 /**
  * Force an unset TZ to UTC
  * @param p the pool to use
@@ -19,6 +19,9 @@
 #include "cache_util.h"
 #include <ap_provider.h>
 
+#include "apr_hash.h"
+#include "apr_shm.h"
+
 APLOG_USE_MODULE(cache);
 
 /* -------------------------------------------------------------- */
@@ -236,6 +239,116 @@ CACHE_DECLARE(apr_int64_t) ap_cache_current_age(cache_info *info,
     return apr_time_sec(current_age);
 }
 
+/*
+ * The cache locks: a table in shared memory of the cache keys in flight,
+ * that is being fetched from the backend by one request to be cached.
+ * A slot is claimed with a compare-and-swap of the hash of the key, and
+ * released by setting it back to zero. Its generation changes with every
+ * claim, so that a waiter notices a new fill even if the slot was taken
+ * again for the same key meanwhile.
+ *
+ * Only a few slots are probed for a key, if none is free the request goes
+ * ahead without a lock. Two keys with the same hash share their lock,
+ * which may make a request wait for nothing, but no longer than the
+ * CacheLockWait.
+ */
+#define CACHE_LOCK_SLOTS    4096
+#define CACHE_LOCK_PROBES   8
+#define CACHE_LOCK_TRIES    4
+#define CACHE_LOCK_POLL_MAX apr_time_from_msec(50)
+
+typedef struct {
+    volatile apr_uint32_t hash; /* hash of the key in flight, 0 if free */
+    volatile apr_uint32_t gen;  /* changes with every claim */
+    volatile apr_time_t stamp;  /* when claimed, 0 once released */
+} cache_lock_slot;
+
+typedef struct {
+    cache_lock_slot *slot;      /* the slot we hold, NULL once released */
+    cache_lock_slot *wait;      /* the slot held by someone else */
+    apr_uint32_t hash;
+    apr_uint32_t gen;
+} cache_lock_rec;
+
+static apr_shm_t *cache_lock_shm = NULL;
+static cache_lock_slot *cache_lock_slots = NULL;
+
+static apr_status_t cache_lock_cleanup(void *dummy)
+{
+    cache_lock_shm = NULL;
+    cache_lock_slots = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t cache_lock_init(apr_pool_t *pconf, server_rec *s)
+{
+    cache_server_conf *conf =
+        (cache_server_conf *)ap_get_module_config(s->module_config,
+                                                  &cache_module);
+    apr_size_t size = CACHE_LOCK_SLOTS * sizeof(cache_lock_slot);
+    server_rec *vs;
+    apr_status_t rv;
+
+    for (vs = s; vs; vs = vs->next) {
+        cache_server_conf *vconf =
+            (cache_server_conf *)ap_get_module_config(vs->module_config,
+                                                      &cache_module);
+        if (vconf->lock) {
+            break;
+        }
+    }
+    if (!vs) {
+        /* no locks configured, leave */
+        return APR_SUCCESS;
+    }
+
+    apr_pool_cleanup_register(pconf, NULL, cache_lock_cleanup,
+                              apr_pool_cleanup_null);
+
+    /* Use anonymous shm by default, fall back on name-based. */
+    rv = apr_shm_create(&cache_lock_shm, size, NULL, pconf);
+    if (APR_STATUS_IS_ENOTIMPL(rv) && conf->lockpath) {
+        const char *fname = apr_pstrcat(pconf, conf->lockpath, ".shm", NULL);
+
+        apr_shm_remove(fname, pconf);
+        rv = apr_shm_create(&cache_lock_shm, size, fname, pconf);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(03555)
+                     "could not create the shared memory of the cache locks");
+        return rv;
+    }
+    cache_lock_slots = apr_shm_baseaddr_get(cache_lock_shm);
+    memset(cache_lock_slots, 0, size);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t cache_lock_release(void *data)
+{
+    cache_lock_rec *lock = data;
+    cache_lock_slot *slot = lock->slot;
+
+    if (slot) {
+        lock->slot = NULL;
+
+        /* unless taken over as too old */
+        if (apr_atomic_read32(&slot->gen) == lock->gen) {
+            slot->stamp = 0;
+            apr_atomic_xchg32(&slot->hash, 0);
+        }
+    }
+    return APR_SUCCESS;
+}
+
+static apr_uint32_t cache_lock_hash(const char *key)
+{
+    apr_ssize_t len = APR_HASH_KEY_STRING;
+    apr_uint32_t hash = apr_hashfunc_default(key, &len);
+
+    return hash ? hash : 1;
+}
+
 /**
  * Try obtain a cache wide lock on the given cache key.
  *
@@ -243,42 +356,40 @@ CACHE_DECLARE(apr_int64_t) ap_cache_current_age(cache_info *info,
  * proceed to the backend. If we return APR_EEXIST, then the lock is
  * already locked, someone else has gone to refresh the backend data
  * already, so we must return stale data with a warning in the mean
- * time. If we return anything else, then something has gone pear
- * shaped, and we allow the request through to the backend regardless.
+ * time, or wait for the fill with cache_wait_lock(). If we return
+ * anything else, then something has gone pear shaped, and we allow the
+ * request through to the backend regardless.
  *
- * This lock is created from the request pool, meaning that should
- * something go wrong and the lock isn't deleted on return of the
+ * This lock is tied to the request pool, meaning that should
+ * something go wrong and the lock isn't released on return of the
  * request headers from the backend for whatever reason, at worst the
- * lock will be cleaned up when the request dies or finishes.
+ * lock will be released when the request dies or finishes.
  *
- * If something goes truly bananas and the lock isn't deleted when the
- * request dies, the lock will be trashed when its max-age is reached,
- * or when a request arrives containing a Cache-Control: no-cache. At
- * no point is it possible for this lock to permanently deny access to
+ * If something goes truly bananas and the lock isn't released when the
+ * request dies, the lock will be taken over when its max-age is reached.
+ * At no point is it possible for this lock to permanently deny access to
  * the backend.
  */
 apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
         request_rec *r)
 {
-    apr_status_t status;
-    const char *lockname;
-    const char *path;
-    char dir[5];
     apr_time_t now = apr_time_now();
-    apr_finfo_t finfo;
-    apr_file_t *lockfile;
+    cache_lock_rec *lock;
+    cache_lock_slot *slot, *free_slot;
+    apr_uint32_t hash, gen;
+    apr_time_t stamp;
     void *dummy;
+    int i, tries;
 
-    finfo.mtime = 0;
-
-    if (!conf || !conf->lock || !conf->lockpath) {
+    if (!conf || !conf->lock || !cache_lock_slots) {
         /* no locks configured, leave */
         return APR_SUCCESS;
     }
 
     /* lock already obtained earlier? if so, success */
-    apr_pool_userdata_get(&dummy, CACHE_LOCKFILE_KEY, r->pool);
-    if (dummy) {
+    apr_pool_userdata_get(&dummy, CACHE_LOCK_KEY, r->pool);
+    lock = dummy;
+    if (lock && lock->slot) {
         return APR_SUCCESS;
     }
 
@@ -304,77 +415,122 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
             cache_generate_key(r, r->pool, &cache->key);
         }
     }
+    hash = cache_lock_hash(cache->key);
 
-    /* create a hashed filename from the key, and save it for later */
-    lockname = ap_cache_generate_name(r->pool, 0, 0, cache->key);
+    if (!lock) {
+        lock = apr_pcalloc(r->pool, sizeof(*lock));
+        apr_pool_userdata_set(lock, CACHE_LOCK_KEY, cache_lock_release,
+                              r->pool);
+    }
+    lock->wait = NULL;
+    lock->hash = hash;
 
-    /* lock files represent discrete just-went-stale URLs "in flight", so
-     * we support a simple two level directory structure, more is overkill.
-     */
-    dir[0] = '/';
-    dir[1] = lockname[0];
-    dir[2] = '/';
-    dir[3] = lockname[1];
-    dir[4] = 0;
-
-    /* make the directories */
-    path = apr_pstrcat(r->pool, conf->lockpath, dir, NULL);
-    if (APR_SUCCESS != (status = apr_dir_make_recursive(path,
-            APR_UREAD|APR_UWRITE|APR_UEXECUTE, r->pool))) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00778)
-                "Could not create a cache lock directory: %s",
-                path);
-        return status;
-    }
-    lockname = apr_pstrcat(r->pool, path, "/", lockname, NULL);
-    apr_pool_userdata_set(lockname, CACHE_LOCKNAME_KEY, NULL, r->pool);
-
-    /* is an existing lock file too old? */
-    status = apr_stat(&finfo, lockname,
-                APR_FINFO_MTIME | APR_FINFO_NLINK, r->pool);
-    if (!(APR_STATUS_IS_ENOENT(status)) && APR_SUCCESS != status) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00779)
-                "Could not stat a cache lock file: %s",
-                lockname);
-        return status;
-    }
-    if ((status == APR_SUCCESS) && (((now - finfo.mtime) > conf->lockmaxage)
-                                  || (now < finfo.mtime))) {
-        ap_log_rerror(APLOG_MARK, APLOG_INFO, status, r, APLOGNO(00780)
-                "Cache lock file for '%s' too old, removing: %s",
-                r->uri, lockname);
-        apr_file_remove(lockname, r->pool);
-    }
-
-    /* try obtain a lock on the file */
-    if (APR_SUCCESS == (status = apr_file_open(&lockfile, lockname,
-            APR_WRITE | APR_CREATE | APR_EXCL | APR_DELONCLOSE,
-            APR_UREAD | APR_UWRITE, r->pool))) {
-        apr_pool_userdata_set(lockfile, CACHE_LOCKFILE_KEY, NULL, r->pool);
-    }
-    return status;
+    for (tries = 0; tries < CACHE_LOCK_TRIES; tries++) {
+        /* is the key already in flight? */
+        free_slot = NULL;
+        for (i = 0; i < CACHE_LOCK_PROBES; i++) {
+            slot = &cache_lock_slots[(hash + i) % CACHE_LOCK_SLOTS];
+            if (apr_atomic_read32(&slot->hash) == hash) {
+                break;
+            }
+            if (!free_slot && !apr_atomic_read32(&slot->hash)) {
+                free_slot = slot;
+            }
+        }
+
+        if (i < CACHE_LOCK_PROBES) {
+            /* the stamp is set once the generation is, and reset before
+             * the release: look again while it's being claimed/released.
+             */
+            stamp = slot->stamp;
+            if (!stamp) {
+                continue;
+            }
+            gen = apr_atomic_read32(&slot->gen);
+
+            /* is the existing lock too old? */
+            if (((now - stamp) > conf->lockmaxage || now < stamp)
+                    && apr_atomic_cas32(&slot->gen, gen + 1, gen) == gen) {
+                ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(00780)
+                        "Cache lock for '%s' too old, taking it over: %s",
+                        r->uri, cache->key);
+                slot->stamp = now;
+                lock->slot = slot;
+                lock->gen = gen + 1;
+                return APR_SUCCESS;
+            }
+
+            /* remember what to wait for */
+            lock->wait = slot;
+            lock->gen = gen;
+            return APR_EEXIST;
+        }
+
+        if (!free_slot) {
+            /* no room: go ahead without a lock */
+            return APR_SUCCESS;
+        }
+        if (!apr_atomic_cas32(&free_slot->hash, hash, 0)) {
+            lock->gen = apr_atomic_inc32(&free_slot->gen) + 1;
+            free_slot->stamp = now;
+            lock->slot = free_slot;
+            return APR_SUCCESS;
+        }
+        /* raced, maybe with a request for the same key: look again */
+    }
 
+    /* still contended, go ahead without a lock */
+    return APR_SUCCESS;
 }
 
 /**
- * Remove the cache lock, if present.
- *
- * First, try to close the file handle, whose delete-on-close should
- * kill the file. Otherwise, just delete the file by name.
- *
- * If no lock name has yet been calculated, do the calculation of the
- * lock name first before trying to delete the file.
+ * Wait for the fill of the key which cache_try_lock() found locked,
+ * backing off from 1ms to CACHE_LOCK_POLL_MAX between the polls.
+ */
+apr_status_t cache_wait_lock(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r, apr_time_t deadline)
+{
+    apr_interval_time_t delay = apr_time_from_msec(1);
+    cache_lock_rec *lock;
+    cache_lock_slot *slot;
+    void *dummy;
+
+    apr_pool_userdata_get(&dummy, CACHE_LOCK_KEY, r->pool);
+    lock = dummy;
+    if (!lock || !lock->wait) {
+        return APR_SUCCESS;
+    }
+    slot = lock->wait;
+    lock->wait = NULL;
+
+    while (apr_atomic_read32(&slot->hash) == lock->hash
+           && apr_atomic_read32(&slot->gen) == lock->gen) {
+        apr_time_t now = apr_time_now();
+
+        if (now >= deadline) {
+            return APR_TIMEUP;
+        }
+        apr_sleep(MIN(delay, deadline - now));
+        if (delay < CACHE_LOCK_POLL_MAX) {
+            delay *= 2;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+/**
+ * Release the cache lock, if held.
  *
  * If an optional bucket brigade is passed, the lock will only be
- * removed if the bucket brigade contains an EOS bucket.
+ * released if the bucket brigade contains an EOS bucket.
  */
 apr_status_t cache_remove_lock(cache_server_conf *conf,
         cache_request_rec *cache, request_rec *r, apr_bucket_brigade *bb)
 {
     void *dummy;
-    const char *lockname;
 
-    if (!conf || !conf->lock || !conf->lockpath) {
+    if (!conf || !conf->lock) {
         /* no locks configured, leave */
         return APR_SUCCESS;
     }
@@ -391,41 +547,17 @@ apr_status_t cache_remove_lock(cache_server_conf *conf,
             }
         }
         if (!eos_found) {
-            /* no eos found in brigade, don't delete anything just yet,
+            /* no eos found in brigade, don't release anything just yet,
              * we are not done.
              */
             return APR_SUCCESS;
         }
     }
-    apr_pool_userdata_get(&dummy, CACHE_LOCKFILE_KEY, r->pool);
+    apr_pool_userdata_get(&dummy, CACHE_LOCK_KEY, r->pool);
     if (dummy) {
-        return apr_file_close((apr_file_t *)dummy);
-    }
-    apr_pool_userdata_get(&dummy, CACHE_LOCKNAME_KEY, r->pool);
-    lockname = (const char *)dummy;
-    if (!lockname) {
-        char dir[5];
-
-        /* create the key if it doesn't exist */
-        if (!cache->key) {
-            cache_generate_key(r, r->pool, &cache->key);
-        }
-
-        /* create a hashed filename from the key, and save it for later */
-        lockname = ap_cache_generate_name(r->pool, 0, 0, cache->key);
-
-        /* lock files represent discrete just-went-stale URLs "in flight", so
-         * we support a simple two level directory structure, more is overkill.
-         */
-        dir[0] = '/';
-        dir[1] = lockname[0];
-        dir[2] = '/';
-        dir[3] = lockname[1];
-        dir[4] = 0;
-
-        lockname = apr_pstrcat(r->pool, conf->lockpath, dir, "/", lockname, NULL);
+        return cache_lock_release(dummy);
     }
-    return apr_file_remove(lockname, r->pool);
+    return APR_SUCCESS;
 }
 
 int ap_cache_check_no_cache(cache_request_rec *cache, request_rec *r)
@@ -732,22 +864,21 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
      * the first request comes back with either new content or confirmation
      * that the stale content is still fresh.
      *
-     * To achieve this, we create a very simple file based lock based on
-     * the key of the cached object. We attempt to open the lock file with
-     * exclusive write access. If we succeed, woohoo! we're first, and we
-     * follow the stale path to the backend server. If we fail, oh well,
-     * we follow the fresh path, and avoid being a thundering herd.
+     * To achieve this, we take a very simple lock in shared memory based
+     * on the key of the cached object. If we get it, woohoo! we're first,
+     * and we follow the stale path to the backend server. If we fail, oh
+     * well, we follow the fresh path, and avoid being a thundering herd.
      *
      * The lock lives only as long as the stale request that went on ahead.
-     * If the request succeeds, the lock is deleted. If the request fails,
-     * the lock is deleted, and another request gets to make a new lock
+     * If the request succeeds, the lock is released. If the request fails,
+     * the lock is released, and another request gets to take the lock
      * and try again.
      *
      * At any time, a request marked "no-cache" will force a refresh,
      * ignoring the lock, ensuring an extended lockout is impossible.
      *
-     * A lock that exceeds a maximum age will be deleted, and another
-     * request gets to make a new lock and try again.
+     * A lock that exceeds a maximum age will be taken over by the next
+     * request, which gets to try again.
      */
     status = cache_try_lock(conf, cache, r);
     if (APR_SUCCESS == status) {
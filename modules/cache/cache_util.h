@@ -92,12 +92,12 @@ extern "C" {
 #define DEFAULT_CACHE_EXPIRE    MSEC_ONE_HR
 #define DEFAULT_CACHE_LMFACTOR  (0.1)
 #define DEFAULT_CACHE_MAXAGE    5
+#define DEFAULT_CACHE_LOCKWAIT  5
 #define DEFAULT_X_CACHE         0
 #define DEFAULT_X_CACHE_DETAIL  0
 #define DEFAULT_CACHE_STALE_ON_ERROR 1
 #define DEFAULT_CACHE_LOCKPATH "mod_cache-lock"
-#define CACHE_LOCKNAME_KEY "mod_cache-lockname"
-#define CACHE_LOCKFILE_KEY "mod_cache-lockfile"
+#define CACHE_LOCK_KEY "mod_cache-lock"
 #define CACHE_CTX_KEY "mod_cache-ctx"
 #define CACHE_SEPARATOR ", \t"
 
@@ -126,6 +126,7 @@ typedef struct {
     apr_array_header_t *ignore_session_id;
     const char *lockpath;
     apr_time_t lockmaxage;
+    apr_time_t lockwait;
     apr_uri_t *base_uri;
     /** ignore client's requests for uncached responses */
     unsigned int ignorecachecontrol:1;
@@ -152,6 +153,7 @@ typedef struct {
     unsigned int lock_set:1;
     unsigned int lockpath_set:1;
     unsigned int lockmaxage_set:1;
+    unsigned int lockwait_set:1;
     unsigned int x_cache_set:1;
     unsigned int x_cache_detail_set:1;
 } cache_server_conf;
@@ -260,41 +262,51 @@ int ap_cache_check_no_store(cache_request_rec *cache, request_rec *r);
 int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
         request_rec *r);
 
+/**
+ * Create the shared memory of the cache locks, if any server has
+ * CacheLock enabled.
+ */
+apr_status_t cache_lock_init(apr_pool_t *pconf, server_rec *s);
+
 /**
  * Try obtain a cache wide lock on the given cache key.
  *
  * If we return APR_SUCCESS, we obtained the lock, and we are clear to
- * proceed to the backend. If we return APR_EEXISTS, then the lock is
+ * proceed to the backend. If we return APR_EEXIST, then the lock is
  * already locked, someone else has gone to refresh the backend data
  * already, so we must return stale data with a warning in the mean
- * time. If we return anything else, then something has gone pear
- * shaped, and we allow the request through to the backend regardless.
+ * time, or wait for the fill with cache_wait_lock(). If we return
+ * anything else, then something has gone pear shaped, and we allow the
+ * request through to the backend regardless.
  *
- * This lock is created from the request pool, meaning that should
- * something go wrong and the lock isn't deleted on return of the
+ * This lock is tied to the request pool, meaning that should
+ * something go wrong and the lock isn't released on return of the
  * request headers from the backend for whatever reason, at worst the
- * lock will be cleaned up when the request is dies or finishes.
+ * lock will be released when the request dies or finishes.
  *
- * If something goes truly bananas and the lock isn't deleted when the
- * request dies, the lock will be trashed when its max-age is reached,
- * or when a request arrives containing a Cache-Control: no-cache. At
- * no point is it possible for this lock to permanently deny access to
+ * If something goes truly bananas and the lock isn't released when the
+ * request dies, the lock will be taken over when its max-age is reached.
+ * At no point is it possible for this lock to permanently deny access to
  * the backend.
  */
 apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
         request_rec *r);
 
 /**
- * Remove the cache lock, if present.
- *
- * First, try to close the file handle, whose delete-on-close should
- * kill the file. Otherwise, just delete the file by name.
+ * Wait for the fill of the key which cache_try_lock() found locked.
  *
- * If no lock name has yet been calculated, do the calculation of the
- * lock name first before trying to delete the file.
+ * Returns APR_SUCCESS as soon as the lock is released or taken anew,
+ * the cache should then be looked up again, or APR_TIMEUP if it is
+ * still held at the given deadline.
+ */
+apr_status_t cache_wait_lock(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r, apr_time_t deadline);
+
+/**
+ * Release the cache lock, if held.
  *
  * If an optional bucket brigade is passed, the lock will only be
- * removed if the bucket brigade contains an EOS bucket.
+ * released if the bucket brigade contains an EOS bucket.
  */
 apr_status_t cache_remove_lock(cache_server_conf *conf,
         cache_request_rec *cache, request_rec *r, apr_bucket_brigade *bb);
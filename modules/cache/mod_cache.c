@@ -80,6 +80,48 @@ static const char *MOD_CACHE_ENTITY_HEADERS[] = {
  * caching goals where the admin understands what they are doing.
  */
 
+/*
+ * On a miss, check whether another request is already fetching this url
+ * from the backend to cache it. If so, rather than following it there,
+ * wait up to CacheLockWait for it to finish and look the cache up again,
+ * once: should the entity still not be there, it was not cacheable or
+ * took too long, and we go on as on any other miss.
+ */
+static int cache_wait_fill(cache_server_conf *conf, cache_request_rec *cache,
+                           request_rec *r)
+{
+    apr_status_t rv;
+
+    /* a client forcing a reload doesn't wait for anyone */
+    if (!conf->lock || !conf->lockwait || !ap_cache_check_no_cache(cache, r)) {
+        return DECLINED;
+    }
+
+    rv = cache_try_lock(conf, cache, r);
+    if (!APR_STATUS_IS_EEXIST(rv)) {
+        return DECLINED;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r, APLOGNO(03556)
+            "Cache locked for url, waiting for the response: %s", r->uri);
+
+    rv = cache_wait_lock(conf, cache, r, apr_time_now() + conf->lockwait);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(03557)
+                "Cache still locked for url after CacheLockWait: %s", r->uri);
+        return DECLINED;
+    }
+
+    /* cache_select() may have added conditional headers */
+    if (cache->stale_headers) {
+        r->headers_in = cache->stale_headers;
+        cache->stale_headers = NULL;
+    }
+    cache->stale_handle = NULL;
+
+    return cache_select(cache, r);
+}
+
 static int cache_quick_handler(request_rec *r, int lookup)
 {
     apr_status_t rv;
@@ -177,6 +219,9 @@ static int cache_quick_handler(request_rec *r, int lookup)
      *   return OK
      */
     rv = cache_select(cache, r);
+    if (rv == DECLINED && !lookup) {
+        rv = cache_wait_fill(conf, cache, r);
+    }
     if (rv != OK) {
         if (rv == DECLINED) {
             if (!lookup) {
@@ -184,7 +229,8 @@ static int cache_quick_handler(request_rec *r, int lookup)
                 /* try to obtain a cache lock at this point. if we succeed,
                  * we are the first to try and cache this url. if we fail,
                  * it means someone else is already trying to cache this
-                 * url, and we should just let the request through to the
+                 * url, and waiting for it above did not get us the entity,
+                 * so we should just let the request through to the
                  * backend without any attempt to cache. this stops
                  * duplicated simultaneous attempts to cache an entity.
                  */
@@ -477,13 +523,17 @@ static int cache_handler(request_rec *r)
      *   return OK
      */
     rv = cache_select(cache, r);
+    if (rv == DECLINED) {
+        rv = cache_wait_fill(conf, cache, r);
+    }
     if (rv != OK) {
         if (rv == DECLINED) {
 
             /* try to obtain a cache lock at this point. if we succeed,
              * we are the first to try and cache this url. if we fail,
              * it means someone else is already trying to cache this
-             * url, and we should just let the request through to the
+             * url, and waiting for it above did not get us the entity,
+             * so we should just let the request through to the
              * backend without any attempt to cache. this stops
              * duplicated simultaneous attempts to cache an entity.
              */
@@ -2028,6 +2078,7 @@ static void * create_cache_config(apr_pool_t *p, server_rec *s)
     ps->lock_set = 0;
     ps->lockpath = ap_runtime_dir_relative(p, DEFAULT_CACHE_LOCKPATH);
     ps->lockmaxage = apr_time_from_sec(DEFAULT_CACHE_MAXAGE);
+    ps->lockwait = apr_time_from_sec(DEFAULT_CACHE_LOCKWAIT);
     ps->x_cache = DEFAULT_X_CACHE;
     ps->x_cache_detail = DEFAULT_X_CACHE_DETAIL;
     return ps;
@@ -2076,6 +2127,10 @@ static void * merge_cache_config(apr_pool_t *p, void *basev, void *overridesv)
         (overrides->lockmaxage_set == 0)
         ? base->lockmaxage
         : overrides->lockmaxage;
+    ps->lockwait =
+        (overrides->lockwait_set == 0)
+        ? base->lockwait
+        : overrides->lockwait;
     ps->quick =
         (overrides->quick_set == 0)
         ? base->quick
@@ -2427,6 +2482,24 @@ static const char *set_cache_lock_maxage(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static const char *set_cache_lock_wait(cmd_parms *parms, void *dummy,
+                                       const char *arg)
+{
+    cache_server_conf *conf;
+    apr_int64_t seconds;
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    seconds = apr_atoi64(arg);
+    if (seconds < 0) {
+        return "CacheLockWait value must be a positive integer";
+    }
+    conf->lockwait = apr_time_from_sec(seconds);
+    conf->lockwait_set = 1;
+    return NULL;
+}
+
 static const char *set_cache_x_cache(cmd_parms *parms, void *dummy, int flag)
 {
 
@@ -2515,6 +2588,10 @@ static int cache_post_config(apr_pool_t *p, apr_pool_t *plog,
     if (!cache_generate_key) {
         cache_generate_key = cache_generate_key_default;
     }
+
+    if (cache_lock_init(p, s) != APR_SUCCESS) {
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
     return OK;
 }
 
@@ -2582,6 +2659,10 @@ static const command_rec cache_cmds[] =
                   "DefaultRuntimeDir setting."),
     AP_INIT_TAKE1("CacheLockMaxAge", set_cache_lock_maxage, NULL, RSRC_CONF,
                   "Maximum age of any thundering herd lock."),
+    AP_INIT_TAKE1("CacheLockWait", set_cache_lock_wait, NULL, RSRC_CONF,
+                  "Maximum time in seconds to wait for the request holding "
+                  "the thundering herd lock to cache the entity. Zero does "
+                  "not wait."),
     AP_INIT_FLAG("CacheHeader", set_cache_x_cache, NULL, RSRC_CONF | ACCESS_CONF,
                  "Add a X-Cache header to responses. Default is off."),
     AP_INIT_FLAG("CacheDetailHeader", set_cache_x_cache_detail, NULL,
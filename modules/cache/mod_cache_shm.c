@@ -0,0 +1,1579 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "apr_strings.h"
+#include "apr_buckets.h"
+#include "apr_hash.h"
+#include "apr_shm.h"
+#include "apr_atomic.h"
+#include "httpd.h"
+#include "http_config.h"
+#include "http_log.h"
+#include "http_core.h"
+#include "http_protocol.h"
+#include "ap_provider.h"
+#include "util_mutex.h"
+
+#include "mod_cache.h"
+#include "mod_status.h"
+
+/*
+ * mod_cache_shm: Shared Memory Based HTTP 1.1 Cache.
+ *
+ * The cache is one shared memory segment split into shards, each with its
+ * own mutex, hash table, entry slots and chunks of CACHE_SHM_CHUNK_SIZE
+ * bytes.  The data of an entry is a chain of chunks holding:
+ *
+ *   the key (cache_shm_entry_t::key_len bytes)
+ *   the header block (cache_shm_entry_t::header_len bytes)
+ *   the body (cache_shm_entry_t::body_len bytes)
+ *
+ * The header block is stored already serialized in table form: the number
+ * of response headers and of request headers (two apr_uint32_t), followed
+ * by as many NUL terminated name and value pairs.  A hit only copies it to
+ * the request pool and points the tables at it, and the body is handed out
+ * as buckets referring to the chunks themselves.  Such buckets, like the
+ * request which opened the entry, pin it: a pinned entry which is replaced
+ * or removed is only unlinked, and freed when the last pin goes.
+ *
+ * A response with a Vary header is stored twice, as in mod_cache_socache:
+ * under the URL key, an entry flagged CACHE_SHM_VARY whose header block is
+ * the list of the varying request headers, and under the key regenerated
+ * from their values, the response itself.
+ *
+ * When a shard runs out of chunks, its CLOCK hand sweeps the entry slots,
+ * clearing the referenced bit of the entries hit since the last pass and
+ * evicting the first unpinned entry found without it.
+ */
+
+module AP_MODULE_DECLARE_DATA cache_shm_module;
+
+#define CACHE_SHM_CHUNK_SIZE 4096
+#define CACHE_SHM_MIN_CHUNKS 16
+#define CACHE_SHM_NONE       APR_UINT32_MAX
+
+/* Entry slot states */
+#define CACHE_SHM_FREE    0
+#define CACHE_SHM_WRITING 1 /* allocated, being copied outside the lock */
+#define CACHE_SHM_READY   2
+#define CACHE_SHM_DEAD    3 /* unlinked, freed when no longer pinned */
+
+/* Entry flags */
+#define CACHE_SHM_VARY        0x1
+#define CACHE_SHM_HEADER_ONLY 0x2
+
+/*
+ * cache_shm_entry_t
+ * An entry slot, in shared memory
+ */
+typedef struct cache_shm_entry_t
+{
+    apr_uint32_t hash; /* hash of the key */
+    apr_uint32_t next; /* next entry of the hash bucket, or next free slot */
+    apr_uint32_t first; /* first chunk of the data */
+    apr_uint32_t nchunks; /* number of chunks of the data */
+    apr_uint32_t state; /* CACHE_SHM_* state */
+    apr_uint32_t flags; /* CACHE_SHM_VARY and CACHE_SHM_HEADER_ONLY */
+    volatile apr_uint32_t pins; /* requests and buckets using the entry */
+    apr_uint32_t referenced; /* hit since the last pass of the CLOCK hand */
+    apr_uint32_t key_len; /* length of the key */
+    apr_uint32_t header_len; /* length of the header block */
+    apr_off_t body_len; /* length of the body */
+    cache_info info; /* the cache_info of the response */
+} cache_shm_entry_t;
+
+/*
+ * cache_shm_header_t
+ * The head of a shard, in shared memory
+ */
+typedef struct cache_shm_header_t
+{
+    apr_uint32_t free_chunk; /* first free chunk */
+    apr_uint32_t free_chunks; /* number of free chunks */
+    apr_uint32_t free_entry; /* first free entry slot */
+    apr_uint32_t hand; /* the CLOCK hand */
+    apr_uint32_t entries; /* number of entries linked in the hash table */
+    unsigned long stores;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} cache_shm_header_t;
+
+/*
+ * cache_shm_shard_t
+ * A shard, as mapped by this process
+ */
+typedef struct cache_shm_shard_t
+{
+    cache_shm_header_t *header;
+    apr_uint32_t *buckets; /* hash table, first entry of each bucket */
+    apr_uint32_t *chunk_next; /* next chunk of each chunk */
+    cache_shm_entry_t *entries; /* entry slots, as many as chunks */
+    char *chunks; /* the chunks */
+    apr_global_mutex_t *mutex;
+} cache_shm_shard_t;
+
+typedef struct cache_shm_t
+{
+    apr_shm_t *shm;
+    apr_size_t size; /* size of the segment */
+    apr_uint32_t nshards; /* number of shards */
+    apr_uint32_t nchunks; /* number of chunks per shard */
+    cache_shm_shard_t *shards;
+} cache_shm_t;
+
+/*
+ * cache_shm_object_t
+ * Pointed to by cache_object_t::vobj
+ */
+typedef struct cache_shm_object_t
+{
+    const char *name; /* Requested URI without vary bits - suitable for mortals. */
+    const char *key; /* URI with Vary bits (if present) */
+    char *header; /* header block to store */
+    apr_size_t header_len; /* length of the header block */
+    apr_uint32_t flags; /* CACHE_SHM_* flags to store */
+    apr_bucket_brigade *body; /* body to store */
+    apr_off_t body_len; /* length of the body to store */
+    unsigned int newbody :1; /* whether a new body is present */
+    unsigned int done :1; /* Is the attempt to cache complete? */
+
+    /* The entry opened by open_entity(), pinned until the request is done */
+    cache_shm_shard_t *shard;
+    cache_shm_entry_t *entry;
+    cache_shm_entry_t opened; /* copy of the entry when it was opened */
+} cache_shm_object_t;
+
+/*
+ * mod_cache_shm configuration
+ */
+#define DEFAULT_SHM_SIZE (32*1024*1024)
+#define DEFAULT_SHARDS 16
+#define DEFAULT_MAX_SIZE (1024*1024)
+
+typedef struct cache_shm_conf
+{
+    apr_size_t size; /* size of the shared memory segment */
+    int shards; /* number of shards */
+} cache_shm_conf;
+
+typedef struct cache_shm_dir_conf
+{
+    apr_off_t max; /* maximum size of an entry (key, headers and body) */
+    unsigned int max_set :1;
+} cache_shm_dir_conf;
+
+/* The cache, and the type of the shards' mutexes */
+static const char * const cache_shm_id = "cache-shm";
+static cache_shm_t *cache_shm = NULL;
+
+/*
+ * Shared memory layout and accessors
+ */
+
+static apr_size_t shard_size(apr_uint32_t nchunks)
+{
+    return APR_ALIGN_DEFAULT(sizeof(cache_shm_header_t))
+         + APR_ALIGN_DEFAULT(nchunks * sizeof(apr_uint32_t)) * 2
+         + APR_ALIGN_DEFAULT(nchunks * sizeof(cache_shm_entry_t))
+         + (apr_size_t)nchunks * CACHE_SHM_CHUNK_SIZE;
+}
+
+static void shard_init(cache_shm_shard_t *shard, char *base,
+        apr_uint32_t nchunks)
+{
+    apr_uint32_t i;
+
+    shard->header = (cache_shm_header_t *)base;
+    base += APR_ALIGN_DEFAULT(sizeof(cache_shm_header_t));
+    shard->buckets = (apr_uint32_t *)base;
+    base += APR_ALIGN_DEFAULT(nchunks * sizeof(apr_uint32_t));
+    shard->chunk_next = (apr_uint32_t *)base;
+    base += APR_ALIGN_DEFAULT(nchunks * sizeof(apr_uint32_t));
+    shard->entries = (cache_shm_entry_t *)base;
+    base += APR_ALIGN_DEFAULT(nchunks * sizeof(cache_shm_entry_t));
+    shard->chunks = base;
+
+    /* Everything free, in order so that the first allocations are
+     * contiguous.
+     */
+    memset(shard->header, 0, sizeof(cache_shm_header_t));
+    memset(shard->entries, 0, nchunks * sizeof(cache_shm_entry_t));
+    for (i = 0; i < nchunks; i++) {
+        shard->buckets[i] = CACHE_SHM_NONE;
+        shard->chunk_next[i] = i + 1;
+        shard->entries[i].next = i + 1;
+    }
+    shard->chunk_next[nchunks - 1] = CACHE_SHM_NONE;
+    shard->entries[nchunks - 1].next = CACHE_SHM_NONE;
+    shard->header->free_chunks = nchunks;
+}
+
+static apr_uint32_t key_hash(const char *key, apr_size_t len)
+{
+    apr_ssize_t klen = len;
+
+    return apr_hashfunc_default(key, &klen);
+}
+
+static APR_INLINE cache_shm_shard_t *key_shard(apr_uint32_t hash)
+{
+    return &cache_shm->shards[hash % cache_shm->nshards];
+}
+
+static APR_INLINE apr_uint32_t *key_bucket(cache_shm_shard_t *shard,
+        apr_uint32_t hash)
+{
+    return &shard->buckets[(hash / cache_shm->nshards) % cache_shm->nchunks];
+}
+
+/*
+ * Walking the data of an entry
+ */
+typedef struct cache_shm_cursor_t
+{
+    cache_shm_shard_t *shard;
+    apr_uint32_t chunk; /* current chunk */
+    apr_size_t offset; /* offset in the current chunk */
+} cache_shm_cursor_t;
+
+static void cursor_seek(cache_shm_cursor_t *c, cache_shm_shard_t *shard,
+        apr_uint32_t first, apr_off_t offset)
+{
+    c->shard = shard;
+    c->chunk = first;
+    while (offset >= CACHE_SHM_CHUNK_SIZE) {
+        c->chunk = shard->chunk_next[c->chunk];
+        offset -= CACHE_SHM_CHUNK_SIZE;
+    }
+    c->offset = (apr_size_t)offset;
+}
+
+/* Return the next contiguous piece of at most len (> 0) bytes of the data,
+ * which may span the chunks allocated next to each other.
+ */
+static apr_size_t cursor_next(cache_shm_cursor_t *c, char **ptr,
+        apr_size_t len)
+{
+    apr_uint32_t *chunk_next = c->shard->chunk_next;
+    apr_size_t n = 0;
+
+    if (c->offset == CACHE_SHM_CHUNK_SIZE) {
+        c->chunk = chunk_next[c->chunk];
+        c->offset = 0;
+    }
+    *ptr = c->shard->chunks + (apr_size_t)c->chunk * CACHE_SHM_CHUNK_SIZE
+           + c->offset;
+
+    for (;;) {
+        apr_size_t avail = CACHE_SHM_CHUNK_SIZE - c->offset;
+
+        if (avail >= len - n) {
+            c->offset += len - n;
+            return len;
+        }
+        n += avail;
+        c->offset = CACHE_SHM_CHUNK_SIZE;
+        if (chunk_next[c->chunk] != c->chunk + 1) {
+            return n;
+        }
+        c->chunk++;
+        c->offset = 0;
+    }
+}
+
+static void cursor_write(cache_shm_cursor_t *c, const char *data,
+        apr_size_t len)
+{
+    while (len) {
+        char *ptr;
+        apr_size_t n = cursor_next(c, &ptr, len);
+
+        memcpy(ptr, data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+static void cursor_read(cache_shm_cursor_t *c, char *data, apr_size_t len)
+{
+    while (len) {
+        char *ptr;
+        apr_size_t n = cursor_next(c, &ptr, len);
+
+        memcpy(data, ptr, n);
+        data += n;
+        len -= n;
+    }
+}
+
+static int cursor_cmp(cache_shm_cursor_t *c, const char *data, apr_size_t len)
+{
+    while (len) {
+        char *ptr;
+        apr_size_t n = cursor_next(c, &ptr, len);
+
+        if (memcmp(ptr, data, n)) {
+            return 1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Entry management, with the shard locked
+ */
+
+static cache_shm_entry_t *entry_find(cache_shm_shard_t *shard,
+        apr_uint32_t hash, const char *key, apr_size_t len)
+{
+    apr_uint32_t i;
+
+    for (i = *key_bucket(shard, hash); i != CACHE_SHM_NONE;
+         i = shard->entries[i].next) {
+        cache_shm_entry_t *e = &shard->entries[i];
+
+        if (e->hash == hash && e->key_len == len) {
+            cache_shm_cursor_t c;
+
+            cursor_seek(&c, shard, e->first, 0);
+            if (!cursor_cmp(&c, key, len)) {
+                return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void entry_unlink(cache_shm_shard_t *shard, cache_shm_entry_t *e)
+{
+    apr_uint32_t i = (apr_uint32_t)(e - shard->entries);
+    apr_uint32_t *p = key_bucket(shard, e->hash);
+
+    while (*p != i) {
+        p = &shard->entries[*p].next;
+    }
+    *p = e->next;
+    shard->header->entries--;
+}
+
+static void entry_free(cache_shm_shard_t *shard, cache_shm_entry_t *e)
+{
+    cache_shm_header_t *header = shard->header;
+    apr_uint32_t last = e->first;
+
+    while (shard->chunk_next[last] != CACHE_SHM_NONE) {
+        last = shard->chunk_next[last];
+    }
+    shard->chunk_next[last] = header->free_chunk;
+    header->free_chunk = e->first;
+    header->free_chunks += e->nchunks;
+
+    e->state = CACHE_SHM_FREE;
+    e->next = header->free_entry;
+    header->free_entry = (apr_uint32_t)(e - shard->entries);
+}
+
+/* Take an entry out of the lookups, and free it unless pinned */
+static void entry_remove(cache_shm_shard_t *shard, cache_shm_entry_t *e)
+{
+    entry_unlink(shard, e);
+    if (apr_atomic_read32(&e->pins)) {
+        e->state = CACHE_SHM_DEAD;
+    }
+    else {
+        entry_free(shard, e);
+    }
+}
+
+/* Move the CLOCK hand to the next victim and free it.  Returns zero if
+ * every entry is pinned or being written.
+ */
+static int shard_evict(cache_shm_shard_t *shard)
+{
+    cache_shm_header_t *header = shard->header;
+    apr_uint32_t n;
+
+    for (n = 2 * cache_shm->nchunks; n; n--) {
+        cache_shm_entry_t *e = &shard->entries[header->hand];
+
+        if (++header->hand == cache_shm->nchunks) {
+            header->hand = 0;
+        }
+        if (e->state == CACHE_SHM_FREE || e->state == CACHE_SHM_WRITING
+                || apr_atomic_read32(&e->pins)) {
+            continue;
+        }
+        if (e->state == CACHE_SHM_DEAD) {
+            /* its last pin went while it was being unlinked */
+            entry_free(shard, e);
+            return 1;
+        }
+        if (e->referenced) {
+            e->referenced = 0;
+            continue;
+        }
+        entry_unlink(shard, e);
+        entry_free(shard, e);
+        header->evictions++;
+        return 1;
+    }
+    return 0;
+}
+
+static void entry_unpin(cache_shm_shard_t *shard, cache_shm_entry_t *e)
+{
+    if (!apr_atomic_dec32(&e->pins) && e->state == CACHE_SHM_DEAD
+            && apr_global_mutex_lock(shard->mutex) == APR_SUCCESS) {
+        if (e->state == CACHE_SHM_DEAD && !apr_atomic_read32(&e->pins)) {
+            entry_free(shard, e);
+        }
+        apr_global_mutex_unlock(shard->mutex);
+    }
+}
+
+static apr_status_t unpin_entry(void *data)
+{
+    cache_shm_object_t *sobj = data;
+
+    entry_unpin(sobj->shard, sobj->entry);
+    return APR_SUCCESS;
+}
+
+/*
+ * The body buckets, referring to the chunks of a pinned entry
+ */
+typedef struct cache_shm_extent_t
+{
+    apr_bucket_refcount refcount;
+    cache_shm_shard_t *shard;
+    cache_shm_entry_t *entry;
+    const char *base;
+} cache_shm_extent_t;
+
+static apr_status_t extent_bucket_read(apr_bucket *b, const char **str,
+        apr_size_t *len, apr_read_type_e block)
+{
+    cache_shm_extent_t *x = b->data;
+
+    *str = x->base + b->start;
+    *len = b->length;
+    return APR_SUCCESS;
+}
+
+static void extent_bucket_destroy(void *data)
+{
+    cache_shm_extent_t *x = data;
+
+    if (apr_bucket_shared_destroy(x)) {
+        entry_unpin(x->shard, x->entry);
+        apr_bucket_free(x);
+    }
+}
+
+static const apr_bucket_type_t bucket_type_cache_shm = {
+    "CACHE_SHM", 5, APR_BUCKET_DATA,
+    extent_bucket_destroy,
+    extent_bucket_read,
+    apr_bucket_setaside_noop,
+    apr_bucket_shared_split,
+    apr_bucket_shared_copy
+};
+
+static apr_bucket *extent_bucket_create(cache_shm_shard_t *shard,
+        cache_shm_entry_t *e, const char *base, apr_size_t len,
+        apr_bucket_alloc_t *list)
+{
+    apr_bucket *b = apr_bucket_alloc(sizeof(*b), list);
+    cache_shm_extent_t *x = apr_bucket_alloc(sizeof(*x), list);
+
+    APR_BUCKET_INIT(b);
+    b->free = apr_bucket_free;
+    b->list = list;
+
+    /* the entry is pinned by the request, so it can't go in between */
+    apr_atomic_inc32(&e->pins);
+    x->shard = shard;
+    x->entry = e;
+    x->base = base;
+
+    b = apr_bucket_shared_make(b, x, 0, len);
+    b->type = &bucket_type_cache_shm;
+    return b;
+}
+
+/*
+ * Header blocks
+ */
+
+static char *make_header_block(apr_pool_t *p, apr_table_t *out,
+        apr_table_t *in, apr_size_t *len)
+{
+    const apr_array_header_t *arrs[2];
+    apr_uint32_t counts[2] = { 0, 0 };
+    apr_size_t size = sizeof(counts);
+    char *block, *ptr;
+    int i, t;
+
+    arrs[0] = apr_table_elts(out);
+    arrs[1] = apr_table_elts(in);
+    for (t = 0; t < 2; t++) {
+        const apr_table_entry_t *elts = (apr_table_entry_t *)arrs[t]->elts;
+
+        for (i = 0; i < arrs[t]->nelts; i++) {
+            if (elts[i].key != NULL) {
+                size += strlen(elts[i].key) + strlen(elts[i].val) + 2;
+                counts[t]++;
+            }
+        }
+    }
+
+    block = ptr = apr_palloc(p, size);
+    memcpy(ptr, counts, sizeof(counts));
+    ptr += sizeof(counts);
+    for (t = 0; t < 2; t++) {
+        const apr_table_entry_t *elts = (apr_table_entry_t *)arrs[t]->elts;
+
+        for (i = 0; i < arrs[t]->nelts; i++) {
+            if (elts[i].key != NULL) {
+                ptr = apr_cpystrn(ptr, elts[i].key, size) + 1;
+                ptr = apr_cpystrn(ptr, elts[i].val, size) + 1;
+            }
+        }
+    }
+
+    *len = size;
+    return block;
+}
+
+static apr_status_t read_header_block(apr_pool_t *p, const char *block,
+        apr_size_t len, apr_table_t **out, apr_table_t **in)
+{
+    const char *end = block + len;
+    apr_uint32_t counts[2], i;
+    int t;
+
+    if (len < sizeof(counts)) {
+        return APR_EGENERAL;
+    }
+    memcpy(counts, block, sizeof(counts));
+    block += sizeof(counts);
+
+    for (t = 0; t < 2; t++) {
+        apr_table_t *table = apr_table_make(p, counts[t]);
+
+        for (i = 0; i < counts[t]; i++) {
+            const char *key = block, *val;
+
+            if (!(val = memchr(key, '\0', end - key))
+                    || !(block = memchr(++val, '\0', end - val))) {
+                return APR_EGENERAL;
+            }
+            block++;
+            apr_table_addn(table, key, val);
+        }
+        *(t ? in : out) = table;
+    }
+
+    return APR_SUCCESS;
+}
+
+static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
+        apr_array_header_t *varray, const char *oldkey)
+{
+    struct iovec *iov;
+    int i, k;
+    int nvec;
+    const char *header;
+    const char **elts;
+
+    nvec = (varray->nelts * 2) + 1;
+    iov = apr_palloc(p, sizeof(struct iovec) * nvec);
+    elts = (const char **) varray->elts;
+
+    /* See mod_cache_socache's regen_key() for the limits of this */
+    for (i = 0, k = 0; i < varray->nelts; i++) {
+        header = apr_table_get(headers, elts[i]);
+        if (!header) {
+            header = "";
+        }
+        iov[k].iov_base = (char*) elts[i];
+        iov[k].iov_len = strlen(elts[i]);
+        k++;
+        iov[k].iov_base = (char*) header;
+        iov[k].iov_len = strlen(header);
+        k++;
+    }
+    iov[k].iov_base = (char*) oldkey;
+    iov[k].iov_len = strlen(oldkey);
+    k++;
+
+    return apr_pstrcatv(p, iov, k, NULL);
+}
+
+static int array_alphasort(const void *fn1, const void *fn2)
+{
+    return strcmp(*(char**) fn1, *(char**) fn2);
+}
+
+static void tokens_to_array(apr_pool_t *p, const char *data,
+        apr_array_header_t *arr)
+{
+    char *token;
+
+    while ((token = ap_get_list_item(p, &data)) != NULL) {
+        *((const char **) apr_array_push(arr)) = token;
+    }
+
+    /* Sort it so that "Vary: A, B" and "Vary: B, A" are stored the same. */
+    qsort((void *) arr->elts, arr->nelts, sizeof(char *), array_alphasort);
+}
+
+/*
+ * Lookups and stores
+ */
+
+/* Find and pin the entry of a key, and copy it to *copy */
+static cache_shm_entry_t *lookup_entry(request_rec *r, const char *key,
+        cache_shm_shard_t **pshard, cache_shm_entry_t *copy)
+{
+    apr_size_t len = strlen(key);
+    apr_uint32_t hash = key_hash(key, len);
+    cache_shm_shard_t *shard = key_shard(hash);
+    cache_shm_entry_t *e;
+    apr_status_t rv;
+
+    rv = apr_global_mutex_lock(shard->mutex);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03528)
+                "could not acquire lock, ignoring: %s", key);
+        return NULL;
+    }
+    e = entry_find(shard, hash, key, len);
+    if (e) {
+        apr_atomic_inc32(&e->pins);
+        e->referenced = 1;
+        memcpy(copy, e, sizeof(*copy));
+        if (!(e->flags & CACHE_SHM_VARY)) {
+            shard->header->hits++;
+        }
+    }
+    else {
+        shard->header->misses++;
+    }
+    apr_global_mutex_unlock(shard->mutex);
+
+    *pshard = shard;
+    return e;
+}
+
+/* Copy the header block of a pinned entry to the pool */
+static char *read_entry_header(apr_pool_t *p, cache_shm_shard_t *shard,
+        const cache_shm_entry_t *copy)
+{
+    cache_shm_cursor_t c;
+    char *block = apr_palloc(p, copy->header_len + 1);
+
+    if (copy->header_len) {
+        cursor_seek(&c, shard, copy->first, copy->key_len);
+        cursor_read(&c, block, copy->header_len);
+    }
+    block[copy->header_len] = '\0';
+    return block;
+}
+
+static void remove_key(request_rec *r, const char *key)
+{
+    apr_size_t len = strlen(key);
+    apr_uint32_t hash = key_hash(key, len);
+    cache_shm_shard_t *shard = key_shard(hash);
+    cache_shm_entry_t *e;
+    apr_status_t rv;
+
+    rv = apr_global_mutex_lock(shard->mutex);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03529)
+                "could not acquire lock, ignoring: %s", key);
+        return;
+    }
+    e = entry_find(shard, hash, key, len);
+    if (e) {
+        entry_remove(shard, e);
+    }
+    apr_global_mutex_unlock(shard->mutex);
+}
+
+/*
+ * Store an entry, replacing any entry of the same key.  The chunks are
+ * allocated (evicting as needed) and the entry linked with the shard
+ * locked, but the data is copied in between, unlocked.  With_body takes
+ * the body from sobj: the new one if any, else the one of the opened
+ * entry (revalidation).
+ */
+static apr_status_t store_entry(request_rec *r, cache_shm_object_t *sobj,
+        const char *key, apr_uint32_t flags, const cache_info *info,
+        const char *header, apr_size_t header_len, int with_body)
+{
+    apr_size_t key_len = strlen(key);
+    apr_uint32_t hash = key_hash(key, key_len);
+    cache_shm_shard_t *shard = key_shard(hash);
+    cache_shm_header_t *sh = shard->header;
+    cache_shm_entry_t *e, *old;
+    cache_shm_cursor_t c;
+    apr_off_t body_len = 0, total;
+    apr_uint32_t need, last, n;
+    apr_status_t rv, status;
+
+    if (with_body) {
+        if (sobj->newbody) {
+            body_len = sobj->body_len;
+        }
+        else if (sobj->entry) {
+            body_len = sobj->opened.body_len;
+        }
+    }
+    total = key_len + header_len + body_len;
+    if (total > (apr_off_t)(cache_shm->nchunks / 2) * CACHE_SHM_CHUNK_SIZE) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03530)
+                "URL '%s' too large for a shard, ignoring "
+                "(%" APR_OFF_T_FMT " bytes)", key, total);
+        return APR_ENOSPC;
+    }
+    need = (apr_uint32_t)((total + CACHE_SHM_CHUNK_SIZE - 1)
+                          / CACHE_SHM_CHUNK_SIZE);
+
+    rv = apr_global_mutex_lock(shard->mutex);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03531)
+                "could not acquire lock, ignoring: %s", key);
+        return rv;
+    }
+    while (sh->free_chunks < need) {
+        if (!shard_evict(shard)) {
+            apr_global_mutex_unlock(shard->mutex);
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03532)
+                    "no room left in the shard for URL '%s', ignoring", key);
+            return APR_ENOSPC;
+        }
+    }
+
+    /* There are always as many free slots as free chunks */
+    e = &shard->entries[sh->free_entry];
+    sh->free_entry = e->next;
+    e->first = last = sh->free_chunk;
+    for (n = 1; n < need; n++) {
+        last = shard->chunk_next[last];
+    }
+    sh->free_chunk = shard->chunk_next[last];
+    shard->chunk_next[last] = CACHE_SHM_NONE;
+    sh->free_chunks -= need;
+    e->nchunks = need;
+    e->state = CACHE_SHM_WRITING;
+    apr_global_mutex_unlock(shard->mutex);
+
+    e->hash = hash;
+    e->flags = flags;
+    e->pins = 0;
+    e->referenced = 0;
+    e->key_len = (apr_uint32_t)key_len;
+    e->header_len = (apr_uint32_t)header_len;
+    e->body_len = body_len;
+    memcpy(&e->info, info, sizeof(cache_info));
+
+    cursor_seek(&c, shard, e->first, 0);
+    cursor_write(&c, key, key_len);
+    cursor_write(&c, header, header_len);
+    if (body_len && sobj->newbody) {
+        apr_bucket *b;
+
+        for (b = APR_BRIGADE_FIRST(sobj->body);
+             b != APR_BRIGADE_SENTINEL(sobj->body);
+             b = APR_BUCKET_NEXT(b)) {
+            const char *str;
+            apr_size_t len;
+
+            rv = apr_bucket_read(b, &str, &len, APR_BLOCK_READ);
+            if (rv != APR_SUCCESS) {
+                break;
+            }
+            cursor_write(&c, str, len);
+        }
+    }
+    else if (body_len) {
+        /* the opened entry is pinned, and immutable */
+        cache_shm_cursor_t from;
+        apr_off_t left = body_len;
+
+        cursor_seek(&from, sobj->shard, sobj->opened.first,
+                    sobj->opened.key_len + sobj->opened.header_len);
+        while (left) {
+            char *ptr;
+            apr_size_t len = cursor_next(&from, &ptr, (apr_size_t)left);
+
+            cursor_write(&c, ptr, len);
+            left -= len;
+        }
+    }
+
+    status = apr_global_mutex_lock(shard->mutex);
+    if (status != APR_SUCCESS) {
+        /* left in the WRITING state, i.e. leaked until restart */
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(03533)
+                "could not acquire lock, entry lost: %s", key);
+        return APR_EGENERAL;
+    }
+    if (rv != APR_SUCCESS) {
+        entry_free(shard, e);
+    }
+    else {
+        old = entry_find(shard, hash, key, key_len);
+        if (old) {
+            entry_remove(shard, old);
+        }
+        e->state = CACHE_SHM_READY;
+        e->next = *key_bucket(shard, hash);
+        *key_bucket(shard, hash) = (apr_uint32_t)(e - shard->entries);
+        sh->entries++;
+        sh->stores++;
+    }
+    apr_global_mutex_unlock(shard->mutex);
+
+    return rv;
+}
+
+/*
+ * Hook and mod_cache callback functions
+ */
+static int create_entity(cache_handle_t *h, request_rec *r, const char *key,
+        apr_off_t len, apr_bucket_brigade *bb)
+{
+    cache_shm_dir_conf *dconf =
+            ap_get_module_config(r->per_dir_config, &cache_shm_module);
+    cache_object_t *obj;
+    cache_shm_object_t *sobj;
+
+    if (!cache_shm) {
+        return DECLINED;
+    }
+
+    /* we don't support caching of range requests (yet) */
+    if (r->status == HTTP_PARTIAL_CONTENT) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03534)
+                "URL %s partial content response not cached",
+                key);
+        return DECLINED;
+    }
+
+    /* The body is kept in memory until committed, so an unknown length
+     * is fine: store_body() gives up if it goes over the limit.
+     */
+    if (len > dconf->max) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03535)
+                "URL '%s' body larger than limit, ignoring "
+                "(%" APR_OFF_T_FMT " > %" APR_OFF_T_FMT ")",
+                key, len, dconf->max);
+        return DECLINED;
+    }
+
+    /* Allocate and initialize cache_object_t and cache_shm_object_t */
+    h->cache_obj = obj = apr_pcalloc(r->pool, sizeof(*obj));
+    obj->vobj = sobj = apr_pcalloc(r->pool, sizeof(*sobj));
+
+    obj->key = apr_pstrdup(r->pool, key);
+    sobj->key = obj->key;
+    sobj->name = obj->key;
+
+    return OK;
+}
+
+static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
+{
+    cache_object_t *obj;
+    cache_shm_object_t *sobj;
+    cache_shm_shard_t *shard;
+    cache_shm_entry_t *e, copy;
+    const char *nkey = key;
+    char *block;
+
+    h->cache_obj = NULL;
+
+    if (!cache_shm) {
+        return DECLINED;
+    }
+
+    e = lookup_entry(r, key, &shard, &copy);
+    if (!e) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03536)
+                "Key not found in cache: %s", key);
+        return DECLINED;
+    }
+
+    if (copy.flags & CACHE_SHM_VARY) {
+        apr_array_header_t *varray = apr_array_make(r->pool, 5, sizeof(char*));
+        char *name, *end;
+
+        block = read_entry_header(r->pool, shard, &copy);
+        entry_unpin(shard, e);
+        for (name = block, end = block + copy.header_len; name < end;
+             name += strlen(name) + 1) {
+            *((const char **) apr_array_push(varray)) = name;
+        }
+        nkey = regen_key(r->pool, r->headers_in, varray, key);
+
+        e = lookup_entry(r, nkey, &shard, &copy);
+        if (!e) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03537)
+                    "Key not found in cache: %s", nkey);
+            return DECLINED;
+        }
+        if (copy.flags & CACHE_SHM_VARY) {
+            entry_unpin(shard, e);
+            return DECLINED;
+        }
+    }
+
+    /* Create and init the cache object */
+    obj = apr_pcalloc(r->pool, sizeof(cache_object_t));
+    sobj = apr_pcalloc(r->pool, sizeof(cache_shm_object_t));
+    sobj->shard = shard;
+    sobj->entry = e;
+    memcpy(&sobj->opened, &copy, sizeof(copy));
+    apr_pool_cleanup_register(r->pool, sobj, unpin_entry,
+                              apr_pool_cleanup_null);
+
+    obj->key = nkey;
+    sobj->key = nkey;
+    sobj->name = key;
+    sobj->flags = copy.flags;
+    memcpy(&obj->info, &copy.info, sizeof(cache_info));
+
+    /* Is this a cached HEAD request? */
+    if ((copy.flags & CACHE_SHM_HEADER_ONLY) && !r->header_only) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03538)
+                "HEAD request cached, non-HEAD requested, ignoring: %s",
+                nkey);
+        return DECLINED;
+    }
+
+    block = read_entry_header(r->pool, shard, &copy);
+    if (read_header_block(r->pool, block, copy.header_len, &h->resp_hdrs,
+                          &h->req_hdrs) != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(03539)
+                "Cache entry for key '%s' headers unreadable, removing", nkey);
+        remove_key(r, nkey);
+        return DECLINED;
+    }
+
+    /* make the configuration stick */
+    h->cache_obj = obj;
+    obj->vobj = sobj;
+
+    return OK;
+}
+
+static int remove_entity(cache_handle_t *h)
+{
+    /* Null out the cache object pointer so next time we start from scratch  */
+    h->cache_obj = NULL;
+    return OK;
+}
+
+static int remove_url(cache_handle_t *h, request_rec *r)
+{
+    cache_shm_object_t *sobj;
+
+    sobj = (cache_shm_object_t *) h->cache_obj->vobj;
+    if (!sobj) {
+        return DECLINED;
+    }
+
+    /* Remove the key from the cache */
+    remove_key(r, sobj->key);
+
+    return OK;
+}
+
+static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
+{
+    /* we recalled the headers during open_entity, so do nothing */
+    return APR_SUCCESS;
+}
+
+static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p,
+        apr_bucket_brigade *bb)
+{
+    cache_shm_object_t *sobj = (cache_shm_object_t*) h->cache_obj->vobj;
+    cache_shm_cursor_t c;
+    apr_off_t left;
+
+    if (!sobj->entry || !(left = sobj->opened.body_len)) {
+        return APR_SUCCESS;
+    }
+
+    /* hand out the chunks as they are, one bucket per contiguous run */
+    cursor_seek(&c, sobj->shard, sobj->opened.first,
+                sobj->opened.key_len + sobj->opened.header_len);
+    while (left) {
+        char *ptr;
+        apr_size_t len = cursor_next(&c, &ptr, (apr_size_t)left);
+
+        APR_BRIGADE_INSERT_TAIL(bb, extent_bucket_create(sobj->shard,
+                sobj->entry, ptr, len, bb->bucket_alloc));
+        left -= len;
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_headers(cache_handle_t *h, request_rec *r,
+        cache_info *info)
+{
+    cache_shm_dir_conf *dconf =
+            ap_get_module_config(r->per_dir_config, &cache_shm_module);
+    cache_object_t *obj = h->cache_obj;
+    cache_shm_object_t *sobj = (cache_shm_object_t*) obj->vobj;
+    apr_table_t *headers_out, *headers_in;
+    const char *vary;
+    apr_status_t rv;
+
+    memcpy(&h->cache_obj->info, info, sizeof(cache_info));
+
+    headers_out = ap_cache_cacheable_headers_out(r);
+    headers_in = ap_cache_cacheable_headers_in(r);
+
+    vary = apr_table_get(headers_out, "Vary");
+    if (vary) {
+        apr_array_header_t* varray;
+        const char **elts;
+        char *block, *ptr;
+        apr_size_t len = 0;
+        int i;
+
+        varray = apr_array_make(r->pool, 6, sizeof(char*));
+        tokens_to_array(r->pool, vary, varray);
+
+        elts = (const char **) varray->elts;
+        for (i = 0; i < varray->nelts; i++) {
+            len += strlen(elts[i]) + 1;
+        }
+        block = ptr = apr_palloc(r->pool, len + 1);
+        for (i = 0; i < varray->nelts; i++) {
+            ptr = apr_cpystrn(ptr, elts[i], len + 1) + 1;
+        }
+
+        rv = store_entry(r, sobj, sobj->name, CACHE_SHM_VARY, info,
+                         block, len, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(03540)
+                    "Vary not written to cache, ignoring: %s", obj->key);
+            return rv;
+        }
+
+        obj->key = sobj->key = regen_key(r->pool, headers_in, varray,
+                sobj->name);
+    }
+
+    if (r->header_only && r->status != HTTP_NOT_MODIFIED) {
+        sobj->flags |= CACHE_SHM_HEADER_ONLY;
+    }
+    sobj->flags &= ~CACHE_SHM_VARY;
+
+    sobj->header = make_header_block(r->pool, headers_out, headers_in,
+                                     &sobj->header_len);
+    if (strlen(sobj->key) + sobj->header_len > dconf->max) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03541)
+                "URL '%s' headers larger than limit, ignoring", sobj->key);
+        return APR_EGENERAL;
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_body(cache_handle_t *h, request_rec *r,
+        apr_bucket_brigade *in, apr_bucket_brigade *out)
+{
+    apr_bucket *e;
+    apr_status_t rv = APR_SUCCESS;
+    cache_shm_object_t *sobj = (cache_shm_object_t *) h->cache_obj->vobj;
+    cache_shm_dir_conf *dconf =
+            ap_get_module_config(r->per_dir_config, &cache_shm_module);
+    apr_off_t max = dconf->max - strlen(sobj->key) - sobj->header_len;
+    int seen_eos = 0;
+
+    if (!sobj->newbody) {
+        sobj->body = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+        sobj->body_len = 0;
+        sobj->newbody = 1;
+    }
+
+    while (APR_SUCCESS == rv && !APR_BRIGADE_EMPTY(in)) {
+        const char *str;
+        apr_size_t length;
+
+        e = APR_BRIGADE_FIRST(in);
+
+        /* are we done completely? if so, pass any trailing buckets right through */
+        if (sobj->done) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            continue;
+        }
+
+        /* have we seen eos yet? */
+        if (APR_BUCKET_IS_EOS(e)) {
+            seen_eos = 1;
+            sobj->done = 1;
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            break;
+        }
+
+        /* honour flush buckets, we'll get called again */
+        if (APR_BUCKET_IS_FLUSH(e)) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            break;
+        }
+
+        /* metadata buckets are preserved as is */
+        if (APR_BUCKET_IS_METADATA(e)) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            continue;
+        }
+
+        /* read the bucket, keep a copy until the commit */
+        rv = apr_bucket_read(e, &str, &length, APR_BLOCK_READ);
+        APR_BUCKET_REMOVE(e);
+        APR_BRIGADE_INSERT_TAIL(out, e);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03542)
+                    "Error when reading bucket for URL %s",
+                    h->cache_obj->key);
+            apr_brigade_cleanup(sobj->body);
+            return rv;
+        }
+
+        /* don't write empty buckets to the cache */
+        if (!length) {
+            continue;
+        }
+
+        sobj->body_len += length;
+        if (sobj->body_len > max) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03543)
+                    "URL %s failed the size check "
+                    "(%" APR_OFF_T_FMT " > %" APR_OFF_T_FMT ")",
+                    h->cache_obj->key, sobj->body_len, max);
+            apr_brigade_cleanup(sobj->body);
+            return APR_EGENERAL;
+        }
+        rv = apr_brigade_write(sobj->body, NULL, NULL, str, length);
+    }
+
+    /* Was this the final bucket? If yes, perform sanity checks.
+     */
+    if (seen_eos) {
+        const char *cl_header = apr_table_get(r->headers_out, "Content-Length");
+
+        if (r->connection->aborted || r->no_cache) {
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(03544)
+                    "Discarding body for URL %s "
+                    "because connection has been aborted.",
+                    h->cache_obj->key);
+            apr_brigade_cleanup(sobj->body);
+            return APR_EGENERAL;
+        }
+        if (cl_header) {
+            apr_off_t cl;
+            char *cl_endp;
+            if (apr_strtoff(&cl, cl_header, &cl_endp, 10) != APR_SUCCESS
+                    || *cl_endp != '\0' || cl != sobj->body_len) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03545)
+                        "URL %s didn't receive complete response, not caching",
+                        h->cache_obj->key);
+                apr_brigade_cleanup(sobj->body);
+                return APR_EGENERAL;
+            }
+        }
+
+        /* All checks were fine, we're good to go when the commit comes */
+    }
+
+    return rv;
+}
+
+static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
+{
+    cache_object_t *obj = h->cache_obj;
+    cache_shm_object_t *sobj = (cache_shm_object_t *) obj->vobj;
+    apr_status_t rv;
+
+    rv = store_entry(r, sobj, sobj->key, sobj->flags, &obj->info,
+                     sobj->header, sobj->header_len, 1);
+    if (sobj->body) {
+        apr_brigade_cleanup(sobj->body);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(03546)
+                "could not write to cache, ignoring: %s", sobj->key);
+
+        /* For safety, remove any existing entry on failure, just in case
+         * it could not be revalidated successfully.
+         */
+        remove_key(r, sobj->key);
+        return rv;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03547)
+            "commit_entity: Headers and body for URL %s cached.",
+            sobj->name);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t invalidate_entity(cache_handle_t *h, request_rec *r)
+{
+    cache_shm_object_t *sobj = (cache_shm_object_t *) h->cache_obj->vobj;
+    apr_status_t rv;
+
+    /* mark the entity as invalidated, in place */
+    h->cache_obj->info.control.invalidated = 1;
+    if (!sobj->entry) {
+        return APR_SUCCESS;
+    }
+
+    rv = apr_global_mutex_lock(sobj->shard->mutex);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03548)
+                "could not acquire lock, ignoring: %s", sobj->key);
+        return rv;
+    }
+    if (sobj->entry->state == CACHE_SHM_READY) {
+        sobj->entry->info.control.invalidated = 1;
+    }
+    apr_global_mutex_unlock(sobj->shard->mutex);
+
+    return APR_SUCCESS;
+}
+
+static void *create_dir_config(apr_pool_t *p, char *dummy)
+{
+    cache_shm_dir_conf *dconf = apr_pcalloc(p, sizeof(cache_shm_dir_conf));
+
+    dconf->max = DEFAULT_MAX_SIZE;
+
+    return dconf;
+}
+
+static void *merge_dir_config(apr_pool_t *p, void *basev, void *addv)
+{
+    cache_shm_dir_conf *new = apr_pcalloc(p, sizeof(cache_shm_dir_conf));
+    cache_shm_dir_conf *add = (cache_shm_dir_conf *) addv;
+    cache_shm_dir_conf *base = (cache_shm_dir_conf *) basev;
+
+    new->max = (add->max_set == 0) ? base->max : add->max;
+    new->max_set = add->max_set || base->max_set;
+
+    return new;
+}
+
+static void *create_config(apr_pool_t *p, server_rec *s)
+{
+    cache_shm_conf *conf = apr_pcalloc(p, sizeof(cache_shm_conf));
+
+    conf->size = DEFAULT_SHM_SIZE;
+    conf->shards = DEFAULT_SHARDS;
+
+    return conf;
+}
+
+/*
+ * mod_cache_shm configuration directives handlers.
+ */
+static const char *set_cache_size(cmd_parms *cmd, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_conf *conf = ap_get_module_config(cmd->server->module_config,
+            &cache_shm_module);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_off_t size;
+
+    if (err) {
+        return err;
+    }
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS
+            || size < 1024 * 1024 || size > APR_SIZE_MAX) {
+        return "CacheShmSize argument must be the size in bytes of the "
+               "shared memory of the cache, at least 1048576";
+    }
+    conf->size = (apr_size_t)size;
+    return NULL;
+}
+
+static const char *set_cache_shards(cmd_parms *cmd, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_conf *conf = ap_get_module_config(cmd->server->module_config,
+            &cache_shm_module);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err) {
+        return err;
+    }
+    conf->shards = atoi(arg);
+    if (conf->shards < 1 || conf->shards > 1024) {
+        return "CacheShmShards must be between 1 and 1024";
+    }
+    return NULL;
+}
+
+static const char *set_cache_max(cmd_parms *parms, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_dir_conf *dconf = (cache_shm_dir_conf *) in_struct_ptr;
+
+    if (apr_strtoff(&dconf->max, arg, NULL, 10) != APR_SUCCESS
+            || dconf->max < 1024 || dconf->max > APR_UINT32_MAX) {
+        return "CacheShmMaxSize argument must be a integer representing "
+               "the max size of a cached entry (headers and body), at least 1024 "
+               "and at most " APR_STRINGIFY(APR_UINT32_MAX);
+    }
+    dconf->max_set = 1;
+    return NULL;
+}
+
+static apr_status_t destroy_cache(void *data)
+{
+    cache_shm = NULL;
+    return APR_SUCCESS;
+}
+
+static int shm_status_hook(request_rec *r, int flags)
+{
+    cache_shm_header_t stats;
+    apr_uint32_t i;
+
+    if (!cache_shm) {
+        return DECLINED;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    for (i = 0; i < cache_shm->nshards; i++) {
+        cache_shm_shard_t *shard = &cache_shm->shards[i];
+        apr_status_t rv = apr_global_mutex_lock(shard->mutex);
+
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03549)
+                    "could not acquire lock for cache status");
+            continue;
+        }
+        stats.free_chunks += shard->header->free_chunks;
+        stats.entries += shard->header->entries;
+        stats.stores += shard->header->stores;
+        stats.hits += shard->header->hits;
+        stats.misses += shard->header->misses;
+        stats.evictions += shard->header->evictions;
+        apr_global_mutex_unlock(shard->mutex);
+    }
+
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("<hr>\n"
+                 "<table cellspacing=0 cellpadding=0>\n"
+                 "<tr><td bgcolor=\"#000000\">\n"
+                 "<b><font color=\"#ffffff\" face=\"Arial,Helvetica\">"
+                 "mod_cache_shm Status:</font></b>\n"
+                 "</td></tr>\n"
+                 "<tr><td bgcolor=\"#ffffff\">\n", r);
+        ap_rprintf(r, "shared memory: <b>%" APR_SIZE_T_FMT "</b> bytes, "
+                   "shards: <b>%u</b>, chunks per shard: <b>%u</b> of "
+                   "<b>%d</b> bytes<br>", cache_shm->size, cache_shm->nshards,
+                   cache_shm->nchunks, CACHE_SHM_CHUNK_SIZE);
+        ap_rprintf(r, "current entries: <b>%u</b>, free chunks: <b>%u</b><br>",
+                   stats.entries, stats.free_chunks);
+        ap_rprintf(r, "total entries stored since starting: <b>%lu</b><br>",
+                   stats.stores);
+        ap_rprintf(r, "total entries evicted since starting: <b>%lu</b><br>",
+                   stats.evictions);
+        ap_rprintf(r, "total lookups since starting: <b>%lu</b> hit, "
+                   "<b>%lu</b> miss<br>", stats.hits, stats.misses);
+        ap_rputs("</td></tr>\n</table>\n", r);
+    }
+    else {
+        ap_rputs("ModCacheShmStatus\n", r);
+        ap_rprintf(r, "CacheSharedMemory: %" APR_SIZE_T_FMT "\n",
+                   cache_shm->size);
+        ap_rprintf(r, "CacheShards: %u\n", cache_shm->nshards);
+        ap_rprintf(r, "CacheChunksPerShard: %u\n", cache_shm->nchunks);
+        ap_rprintf(r, "CacheFreeChunks: %u\n", stats.free_chunks);
+        ap_rprintf(r, "CacheCurrentEntries: %u\n", stats.entries);
+        ap_rprintf(r, "CacheStoreCount: %lu\n", stats.stores);
+        ap_rprintf(r, "CacheEvictCount: %lu\n", stats.evictions);
+        ap_rprintf(r, "CacheRetrieveHitCount: %lu\n", stats.hits);
+        ap_rprintf(r, "CacheRetrieveMissCount: %lu\n", stats.misses);
+    }
+
+    return OK;
+}
+
+static void shm_status_register(apr_pool_t *p)
+{
+    APR_OPTIONAL_HOOK(ap, status_hook, shm_status_hook, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+static int shm_precfg(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptmp)
+{
+    apr_status_t rv = ap_mutex_register(pconf, cache_shm_id, NULL,
+            APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(03550)
+        "failed to register %s mutex", cache_shm_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    /* Register to handle mod_status status page generation */
+    shm_status_register(pconf);
+
+    return OK;
+}
+
+static int shm_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptmp, server_rec *base_server)
+{
+    cache_shm_conf *conf = ap_get_module_config(base_server->module_config,
+            &cache_shm_module);
+    cache_shm_t *cache;
+    apr_size_t per_chunk, ssize;
+    apr_uint64_t nchunks;
+    apr_status_t rv;
+    char *base;
+    apr_uint32_t i;
+
+    apr_pool_cleanup_register(pconf, NULL, destroy_cache,
+                              apr_pool_cleanup_null);
+
+    per_chunk = CACHE_SHM_CHUNK_SIZE + sizeof(cache_shm_entry_t)
+                + 2 * sizeof(apr_uint32_t);
+    nchunks = conf->size / conf->shards / per_chunk;
+    if (nchunks < CACHE_SHM_MIN_CHUNKS || nchunks >= CACHE_SHM_NONE) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, base_server, APLOGNO(03551)
+                "CacheShmSize %" APR_SIZE_T_FMT " does not fit %d shards",
+                conf->size, conf->shards);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    cache = apr_pcalloc(pconf, sizeof(*cache));
+    cache->nshards = conf->shards;
+    cache->nchunks = (apr_uint32_t)nchunks;
+    cache->shards = apr_pcalloc(pconf, cache->nshards
+                                       * sizeof(cache_shm_shard_t));
+    ssize = APR_ALIGN_DEFAULT(shard_size(cache->nchunks));
+    cache->size = ssize * cache->nshards;
+
+    /* Use anonymous shm by default, fall back on name-based. */
+    rv = apr_shm_create(&cache->shm, cache->size, NULL, pconf);
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        const char *fname = ap_runtime_dir_relative(pconf, "cache-shm.shm");
+
+        if (fname) {
+            apr_shm_remove(fname, pconf);
+            rv = apr_shm_create(&cache->shm, cache->size, fname, pconf);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, base_server, APLOGNO(03552)
+                "could not allocate %" APR_SIZE_T_FMT " bytes of shared "
+                "memory for the cache", cache->size);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    base = apr_shm_baseaddr_get(cache->shm);
+    for (i = 0; i < cache->nshards; i++) {
+        cache_shm_shard_t *shard = &cache->shards[i];
+
+        shard_init(shard, base + i * ssize, cache->nchunks);
+        rv = ap_global_mutex_create(&shard->mutex, NULL, cache_shm_id,
+                apr_psprintf(pconf, "%u", i), base_server, pconf, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(03553)
+            "failed to create %s mutex", cache_shm_id);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+    }
+
+    cache_shm = cache;
+
+    return OK;
+}
+
+static void shm_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv;
+    apr_uint32_t i;
+
+    if (!cache_shm) {
+        return;
+    }
+    for (i = 0; i < cache_shm->nshards; i++) {
+        cache_shm_shard_t *shard = &cache_shm->shards[i];
+        const char *lock = apr_global_mutex_lockfile(shard->mutex);
+
+        rv = apr_global_mutex_child_init(&shard->mutex, lock, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(03554)
+                    "failed to initialise mutex in child_init");
+        }
+    }
+}
+
+static const command_rec cache_shm_cmds[] =
+{
+    AP_INIT_TAKE1("CacheShmSize", set_cache_size, NULL, RSRC_CONF,
+            "The size in bytes of the shared memory of the cache"),
+    AP_INIT_TAKE1("CacheShmShards", set_cache_shards, NULL, RSRC_CONF,
+            "The number of independently locked parts of the cache"),
+    AP_INIT_TAKE1("CacheShmMaxSize", set_cache_max, NULL, RSRC_CONF | ACCESS_CONF,
+            "The maximum cache entry size (headers and body) to cache a document"),
+    { NULL }
+};
+
+static const cache_provider cache_shm_provider =
+{
+    &remove_entity, &store_headers, &store_body, &recall_headers, &recall_body,
+    &create_entity, &open_entity, &remove_url, &commit_entity,
+    &invalidate_entity
+};
+
+static void cache_shm_register_hook(apr_pool_t *p)
+{
+    /* cache initializer */
+    ap_register_provider(p, CACHE_PROVIDER_GROUP, "shm", "0",
+            &cache_shm_provider);
+    ap_hook_pre_config(shm_precfg, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(shm_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(shm_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(cache_shm) = { STANDARD20_MODULE_STUFF,
+    create_dir_config,  /* create per-directory config structure */
+    merge_dir_config, /* merge per-directory config structures */
+    create_config, /* create per-server config structure */
+    NULL, /* merge per-server config structures */
+    cache_shm_cmds, /* command apr_table_t */
+    cache_shm_register_hook /* register hooks */
+};
@@ -28,10 +28,21 @@
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 #include "apr_general.h"
+#include "apr_atomic.h"
+#include "apr_thread_proc.h"
 
 #if APR_HAVE_LIMITS_H
 #include <limits.h>
 #endif
+#if APR_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if APR_HAVE_SIGNAL_H
+#include <signal.h>
+#endif
+#if APR_HAVE_ERRNO_H
+#include <errno.h>
+#endif
 
 #include "ap_socache.h"
 
@@ -52,19 +63,16 @@
 #define ALIGNED_SUBCACHE_SIZE APR_ALIGN_DEFAULT(sizeof(SHMCBSubcache))
 #define ALIGNED_INDEX_SIZE APR_ALIGN_DEFAULT(sizeof(SHMCBIndex))
 
+/* Spins on a busy subcache lock before yielding the CPU */
+#define SHMCB_LOCK_SPINS 100
+
+/* How long a subcache lock may be held before its owner is checked */
+#define SHMCB_LOCK_STALE apr_time_from_sec(1)
+
 /*
  * Header structure - the start of the shared-mem segment
  */
 typedef struct {
-    /* Stats for cache operations */
-    unsigned long stat_stores;
-    unsigned long stat_replaced;
-    unsigned long stat_expiries;
-    unsigned long stat_scrolled;
-    unsigned long stat_retrieves_hit;
-    unsigned long stat_retrieves_miss;
-    unsigned long stat_removes_hit;
-    unsigned long stat_removes_miss;
     /* Number of subcaches */
     unsigned int subcache_num;
     /* How many indexes each subcache's queue has */
@@ -82,10 +90,21 @@ typedef struct {
  * indexes then data
  */
 typedef struct {
+    /* The pid of the process operating on the subcache, or zero */
+    volatile apr_uint32_t lock;
     /* The start position and length of the cyclic buffer of indexes */
     unsigned int idx_pos, idx_used;
     /* Same for the data area */
     unsigned int data_pos, data_used;
+    /* Stats for cache operations, summed up by the status */
+    unsigned long stat_stores;
+    unsigned long stat_replaced;
+    unsigned long stat_expiries;
+    unsigned long stat_scrolled;
+    unsigned long stat_retrieves_hit;
+    unsigned long stat_retrieves_miss;
+    unsigned long stat_removes_hit;
+    unsigned long stat_removes_miss;
 } SHMCBSubcache;
 
 /*
@@ -127,6 +146,12 @@ struct ap_socache_instance_t {
  *
  * Each subcache is prefixed by the SHMCBSubcache structure.
  *
+ * Each subcache has its own lock, so the operations on different
+ * subcaches run concurrently, in any process or thread, and the
+ * provider needs no global mutex (AP_SOCACHE_FLAG_NOTMPSAFE is not set).
+ * The lock is a spinlock held for the time of a few memcpy()s, see
+ * shmcb_subcache_lock().
+ *
  * The subcache's "Data" segment is a single cyclic data buffer, of
  * total size header->subcache_data_size; data inside is referenced
  * using byte offsets. The offset marking the beginning of the cyclic
@@ -252,6 +277,65 @@ static int shmcb_cyclic_memcmp(unsigned int buf_size, unsigned char *data,
 }
 
 
+#if defined(WIN32) || defined(NETWARE)
+#define shmcb_lock_owner_alive(pid) 1
+#else
+static int shmcb_lock_owner_alive(apr_uint32_t pid)
+{
+    return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+}
+#endif
+
+/* The lock of a subcache holds the pid of its owner, and is only ever
+ * taken when zero so the threads of a process exclude each other too.
+ * Should the owner crash while holding it, the subcache would be locked
+ * out forever, so when it is busy for too long and the owner is gone the
+ * lock is taken over and the subcache, possibly half updated, emptied.
+ */
+static void shmcb_subcache_lock(server_rec *s, SHMCBHeader *header,
+                                SHMCBSubcache *subcache)
+{
+    apr_uint32_t self = (apr_uint32_t)getpid(), owner;
+    apr_time_t busy = 0;
+    int spins = 0;
+
+    while ((owner = apr_atomic_cas32(&subcache->lock, self, 0)) != 0) {
+        if (++spins < SHMCB_LOCK_SPINS) {
+            continue;
+        }
+        spins = 0;
+#if APR_HAS_THREADS
+        apr_thread_yield();
+#else
+        apr_sleep(1000);
+#endif
+        if (!busy) {
+            busy = apr_time_now();
+        }
+        else if (apr_time_now() - busy > SHMCB_LOCK_STALE
+                 && owner != self && !shmcb_lock_owner_alive(owner)
+                 && apr_atomic_cas32(&subcache->lock, self, owner) == owner) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(03527)
+                         "socache subcache %u was locked by dead process "
+                         "%u, emptied",
+                         (unsigned int)(((unsigned char *)subcache
+                                         - (unsigned char *)header
+                                         - ALIGNED_HEADER_SIZE)
+                                        / header->subcache_size),
+                         (unsigned int)owner);
+            subcache->idx_used = 0;
+            subcache->data_used = 0;
+            break;
+        }
+    }
+}
+
+static APR_INLINE void shmcb_subcache_unlock(SHMCBSubcache *subcache)
+{
+    /* A full barrier, the updates must be visible before */
+    apr_atomic_xchg32(&subcache->lock, 0);
+}
+
 /* Prototypes for low-level subcache operations */
 static void shmcb_subcache_expire(server_rec *, SHMCBHeader *, SHMCBSubcache *,
                                   apr_time_t);
@@ -423,14 +507,6 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
     }
     /* OK, we're sorted */
     ctx->header = header = shm_segment;
-    header->stat_stores = 0;
-    header->stat_replaced = 0;
-    header->stat_expiries = 0;
-    header->stat_scrolled = 0;
-    header->stat_retrieves_hit = 0;
-    header->stat_retrieves_miss = 0;
-    header->stat_removes_hit = 0;
-    header->stat_removes_miss = 0;
     header->subcache_num = num_subcache;
     /* Convert the subcache size (in bytes) to a value that is suitable for
      * structure alignment on the host platform, by rounding down if necessary. */
@@ -461,8 +537,7 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
     /* The header is done, make the caches empty */
     for (loop = 0; loop < header->subcache_num; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
-        subcache->idx_pos = subcache->idx_used = 0;
-        subcache->data_pos = subcache->data_used = 0;
+        memset(subcache, 0, sizeof(*subcache));
     }
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(00830)
                  "Shared memory socache initialised");
@@ -499,19 +574,22 @@ static apr_status_t socache_shmcb_store(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
+    shmcb_subcache_lock(s, header, subcache);
     tryreplace = shmcb_subcache_remove(s, header, subcache, id, idlen);
     if (shmcb_subcache_store(s, header, subcache, encoded,
                              len_encoded, id, idlen, expiry)) {
+        shmcb_subcache_unlock(subcache);
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00833)
                      "can't store an socache entry!");
         return APR_ENOSPC;
     }
     if (tryreplace == 0) {
-        header->stat_replaced++;
+        subcache->stat_replaced++;
     }
     else {
-        header->stat_stores++;
+        subcache->stat_stores++;
     }
+    shmcb_subcache_unlock(subcache);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00834)
                  "leaving socache_shmcb_store successfully");
     return APR_SUCCESS;
@@ -532,12 +610,14 @@ static apr_status_t socache_shmcb_retrieve(ap_socache_instance_t *ctx,
                  SHMCB_MASK_DBG(header, id));
 
     /* Get the entry corresponding to the id, if it exists. */
+    shmcb_subcache_lock(s, header, subcache);
     rv = shmcb_subcache_retrieve(s, header, subcache, id, idlen,
                                  dest, destlen);
     if (rv == 0)
-        header->stat_retrieves_hit++;
+        subcache->stat_retrieves_hit++;
     else
-        header->stat_retrieves_miss++;
+        subcache->stat_retrieves_miss++;
+    shmcb_subcache_unlock(subcache);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00836)
                  "leaving socache_shmcb_retrieve successfully");
 
@@ -560,13 +640,15 @@ static apr_status_t socache_shmcb_remove(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
+    shmcb_subcache_lock(s, header, subcache);
     if (shmcb_subcache_remove(s, header, subcache, id, idlen) == 0) {
-        header->stat_removes_hit++;
+        subcache->stat_removes_hit++;
         rv = APR_SUCCESS;
     } else {
-        header->stat_removes_miss++;
+        subcache->stat_removes_miss++;
         rv = APR_NOTFOUND;
     }
+    shmcb_subcache_unlock(subcache);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00839)
                  "leaving socache_shmcb_remove successfully");
 
@@ -583,16 +665,27 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
     apr_time_t now = apr_time_now();
     double expiry_total = 0;
     int index_pct, cache_pct;
+    SHMCBSubcache stats;
 
     AP_DEBUG_ASSERT(header->subcache_num > 0);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00840) "inside shmcb_status");
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
-     * pointer arithmetic. The rest of our logic uses read-only header data so
-     * doesn't need the lock. */
+    /* Perform the iteration of each subcache inside its lock to avoid
+     * corruption or invalid pointer arithmetic. The rest of our logic uses
+     * read-only header data so doesn't need the lock. */
     /* Iterate over the subcaches */
+    memset(&stats, 0, sizeof(stats));
     for (loop = 0; loop < header->subcache_num; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
+        shmcb_subcache_lock(s, header, subcache);
         shmcb_subcache_expire(s, header, subcache, now);
+        stats.stat_stores += subcache->stat_stores;
+        stats.stat_replaced += subcache->stat_replaced;
+        stats.stat_expiries += subcache->stat_expiries;
+        stats.stat_scrolled += subcache->stat_scrolled;
+        stats.stat_retrieves_hit += subcache->stat_retrieves_hit;
+        stats.stat_retrieves_miss += subcache->stat_retrieves_miss;
+        stats.stat_removes_hit += subcache->stat_removes_hit;
+        stats.stat_removes_miss += subcache->stat_removes_miss;
         total += subcache->idx_used;
         cache_total += subcache->data_used;
         if (subcache->idx_used) {
@@ -606,6 +699,7 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
             else
                 min_expiry = ((idx_expiry < min_expiry) ? idx_expiry : min_expiry);
         }
+        shmcb_subcache_unlock(subcache);
     }
     index_pct = (100 * total) / (header->index_num *
                                  header->subcache_num);
@@ -633,19 +727,19 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
         ap_rprintf(r, "index usage: <b>%d%%</b>, cache usage: <b>%d%%</b><br>",
                    index_pct, cache_pct);
         ap_rprintf(r, "total entries stored since starting: <b>%lu</b><br>",
-                   header->stat_stores);
+                   stats.stat_stores);
         ap_rprintf(r, "total entries replaced since starting: <b>%lu</b><br>",
-                   header->stat_replaced);
+                   stats.stat_replaced);
         ap_rprintf(r, "total entries expired since starting: <b>%lu</b><br>",
-                   header->stat_expiries);
+                   stats.stat_expiries);
         ap_rprintf(r, "total (pre-expiry) entries scrolled out of the cache: "
-                   "<b>%lu</b><br>", header->stat_scrolled);
+                   "<b>%lu</b><br>", stats.stat_scrolled);
         ap_rprintf(r, "total retrieves since starting: <b>%lu</b> hit, "
-                   "<b>%lu</b> miss<br>", header->stat_retrieves_hit,
-                   header->stat_retrieves_miss);
+                   "<b>%lu</b> miss<br>", stats.stat_retrieves_hit,
+                   stats.stat_retrieves_miss);
         ap_rprintf(r, "total removes since starting: <b>%lu</b> hit, "
-                   "<b>%lu</b> miss<br>", header->stat_removes_hit,
-                   header->stat_removes_miss);
+                   "<b>%lu</b> miss<br>", stats.stat_removes_hit,
+                   stats.stat_removes_miss);
     }
     else {
         ap_rputs("CacheType: SHMCB\n", r);
@@ -665,14 +759,14 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
 
         ap_rprintf(r, "CacheIndexUsage: %d%%\n", index_pct);
         ap_rprintf(r, "CacheUsage: %d%%\n", cache_pct);
-        ap_rprintf(r, "CacheStoreCount: %lu\n", header->stat_stores);
-        ap_rprintf(r, "CacheReplaceCount: %lu\n", header->stat_replaced);
-        ap_rprintf(r, "CacheExpireCount: %lu\n", header->stat_expiries);
-        ap_rprintf(r, "CacheDiscardCount: %lu\n", header->stat_scrolled);
-        ap_rprintf(r, "CacheRetrieveHitCount: %lu\n", header->stat_retrieves_hit);
-        ap_rprintf(r, "CacheRetrieveMissCount: %lu\n", header->stat_retrieves_miss);
-        ap_rprintf(r, "CacheRemoveHitCount: %lu\n", header->stat_removes_hit);
-        ap_rprintf(r, "CacheRemoveMissCount: %lu\n", header->stat_removes_miss);
+        ap_rprintf(r, "CacheStoreCount: %lu\n", stats.stat_stores);
+        ap_rprintf(r, "CacheReplaceCount: %lu\n", stats.stat_replaced);
+        ap_rprintf(r, "CacheExpireCount: %lu\n", stats.stat_expiries);
+        ap_rprintf(r, "CacheDiscardCount: %lu\n", stats.stat_scrolled);
+        ap_rprintf(r, "CacheRetrieveHitCount: %lu\n", stats.stat_retrieves_hit);
+        ap_rprintf(r, "CacheRetrieveMissCount: %lu\n", stats.stat_retrieves_miss);
+        ap_rprintf(r, "CacheRemoveHitCount: %lu\n", stats.stat_removes_hit);
+        ap_rprintf(r, "CacheRemoveMissCount: %lu\n", stats.stat_removes_miss);
     }
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00841) "leaving shmcb_status");
 }
@@ -688,14 +782,21 @@ static apr_status_t socache_shmcb_iterate(ap_socache_instance_t *instance,
     apr_status_t rv = APR_SUCCESS;
     apr_size_t buflen = 0;
     unsigned char *buf = NULL;
-
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
-     * pointer arithmetic. The rest of our logic uses read-only header data so
-     * doesn't need the lock. */
+    SHMCBSubcache *copy = apr_palloc(pool, header->subcache_size);
+
+    /* Iterate over a copy of each subcache, taken inside its lock to avoid
+     * corruption or invalid pointer arithmetic, so that the iterator isn't
+     * called with the lock held.  The entries found stale are then only
+     * marked removed in the copy, the next store will reclaim them anyway.
+     * The rest of our logic uses read-only header data so doesn't need the
+     * lock. */
     /* Iterate over the subcaches */
     for (loop = 0; loop < header->subcache_num && rv == APR_SUCCESS; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
-        rv = shmcb_subcache_iterate(instance, s, userctx, header, subcache,
+        shmcb_subcache_lock(s, header, subcache);
+        memcpy(copy, subcache, header->subcache_size);
+        shmcb_subcache_unlock(subcache);
+        rv = shmcb_subcache_iterate(instance, s, userctx, header, copy,
                                     iterator, &buf, &buflen, pool, now);
     }
     return rv;
@@ -746,7 +847,7 @@ static void shmcb_subcache_expire(server_rec *s, SHMCBHeader *header,
         subcache->data_used -= diff;
         subcache->data_pos = idx->data_pos;
     }
-    header->stat_expiries += expired;
+    subcache->stat_expiries += expired;
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00843)
                  "we now have %u socache entries", subcache->idx_used);
 }
@@ -802,7 +903,7 @@ static int shmcb_subcache_store(server_rec *s, SHMCBHeader *header,
                                                       header->subcache_data_size);
             subcache->data_pos = idx2->data_pos;
             /* Stats */
-            header->stat_scrolled++;
+            subcache->stat_scrolled++;
             /* Loop admin */
             idx = idx2;
             loop++;
@@ -902,7 +1003,7 @@ static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
             else {
                 /* Already stale, quietly remove and treat as not-found */
                 idx->removed = 1;
-                header->stat_expiries++;
+                subcache->stat_expiries++;
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00850)
                              "shmcb_subcache_retrieve discarding expired entry");
                 return -1;
@@ -1026,7 +1127,7 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
             else {
                 /* Already stale, quietly remove and treat as not-found */
                 idx->removed = 1;
-                header->stat_expiries++;
+                subcache->stat_expiries++;
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00856)
                              "shmcb_subcache_iterate discarding expired entry");
             }
@@ -1041,7 +1142,7 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
 
 static const ap_socache_provider_t socache_shmcb = {
     "shmcb",
-    AP_SOCACHE_FLAG_NOTMPSAFE,
+    0,
     socache_shmcb_create,
     socache_shmcb_init,
     socache_shmcb_destroy,
@@ -38,6 +38,7 @@
 #include "http_config.h"
 #include "http_log.h"
 #include "http_core.h"
+#include "http_protocol.h"
 #include "apr_lib.h"
 #include "apr_strings.h"
 #include "apr_general.h"
@@ -737,7 +738,8 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
         if (!apr_table_get(r->subprocess_env, "force-gzip")) {
             const char *accepts;
             /* if they don't have the line, then they can't play */
-            accepts = apr_table_get(r->headers_in, "Accept-Encoding");
+            accepts = ap_get_known_header_in(r,
+                                             AP_KNOWN_HEADER_ACCEPT_ENCODING);
             if (accepts == NULL) {
                 ap_remove_output_filter(f);
                 return ap_pass_brigade(f->next, bb);
@@ -59,6 +59,7 @@
 #include "http_core.h"
 #include "http_protocol.h"
 #include "http_main.h"
+#include "http_request.h"
 #include "ap_mpm.h"
 #include "util_script.h"
 #include <time.h>
@@ -203,6 +204,7 @@ static int status_handler(request_rec *r)
     int *thread_busy_buffer = NULL;
     clock_t tu, ts, tcu, tcs;
     ap_generation_t mpm_generation, worker_generation;
+    ap_merge_cache_stats_t merge_cache;
 #ifdef HAVE_TIMES
     float tick;
     int times_per_thread;
@@ -518,6 +520,23 @@ static int status_handler(request_rec *r)
 
             ap_rputs("</dt>\n", r);
         } /* short_report */
+
+        ap_get_merge_cache_stats(&merge_cache);
+        if (merge_cache.size) {
+            if (short_report) {
+                ap_rprintf(r, "MergeCacheEntries: %u\n"
+                              "MergeCacheHits: %u\n"
+                              "MergeCacheMisses: %u\n",
+                           merge_cache.entries, merge_cache.hits,
+                           merge_cache.misses);
+            }
+            else {
+                ap_rprintf(r, "<dt>Per-directory merge cache (this child): "
+                              "%u/%u entries, %u hits, %u misses</dt>\n",
+                           merge_cache.entries, merge_cache.size,
+                           merge_cache.hits, merge_cache.misses);
+            }
+        }
     } /* ap_extended_status */
 
     if (!short_report)
@@ -329,8 +329,8 @@ apr_status_t ap_http_filter(ap_filter_t *f, apr_bucket_brigade *b,
             ctx->limit = 0;
         }
 
-        tenc = apr_table_get(f->r->headers_in, "Transfer-Encoding");
-        lenp = apr_table_get(f->r->headers_in, "Content-Length");
+        tenc = ap_get_known_header_in(f->r, AP_KNOWN_HEADER_TRANSFER_ENCODING);
+        lenp = ap_get_known_header_in(f->r, AP_KNOWN_HEADER_CONTENT_LENGTH);
 
         if (tenc) {
             if (ap_cstr_casecmp(tenc, "chunked") == 0 /* fast path */
@@ -1544,8 +1544,10 @@ AP_DECLARE(int) ap_discard_request_body(request_rec *r)
 
 AP_DECLARE(int) ap_setup_client_block(request_rec *r, int read_policy)
 {
-    const char *tenc = apr_table_get(r->headers_in, "Transfer-Encoding");
-    const char *lenp = apr_table_get(r->headers_in, "Content-Length");
+    const char *tenc = ap_get_known_header_in(r,
+                                        AP_KNOWN_HEADER_TRANSFER_ENCODING);
+    const char *lenp = ap_get_known_header_in(r,
+                                        AP_KNOWN_HEADER_CONTENT_LENGTH);
 
     r->read_body = read_policy;
     r->read_chunked = 0;
@@ -221,7 +221,7 @@ AP_DECLARE(int) ap_set_keepalive(request_rec *r)
     int wimpy = ap_find_token(r->pool,
                               apr_table_get(r->headers_out, "Connection"),
                               "close");
-    const char *conn = apr_table_get(r->headers_in, "Connection");
+    const char *conn = ap_get_known_header_in(r, AP_KNOWN_HEADER_CONNECTION);
 
     /* The following convoluted conditional determines whether or not
      * the current connection should remain persistent after this response
@@ -376,7 +376,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_unmodified_since(request_rec *r,
 
         if ((ius != APR_DATE_BAD) && (mtime > ius)) {
             if (reqtime < mtime + 60) {
-                if (apr_table_get(r->headers_in, "Range")) {
+                if (ap_get_known_header_in(r, AP_KNOWN_HEADER_RANGE)) {
                     /* weak matches not allowed with Range requests */
                     return AP_CONDITION_NOMATCH;
                 }
@@ -414,7 +414,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_none_match(request_rec *r,
          */
         if (r->method_number == M_GET) {
             if ((etag = apr_table_get(headers, "ETag")) != NULL) {
-                if (apr_table_get(r->headers_in, "Range")) {
+                if (ap_get_known_header_in(r, AP_KNOWN_HEADER_RANGE)) {
                     if (ap_find_etag_strong(r->pool, if_nonematch, etag)) {
                         return AP_CONDITION_STRONG;
                     }
@@ -467,7 +467,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_modified_since(request_rec *r,
 
         if (ims >= mtime && ims <= reqtime) {
             if (reqtime < mtime + 60) {
-                if (apr_table_get(r->headers_in, "Range")) {
+                if (ap_get_known_header_in(r, AP_KNOWN_HEADER_RANGE)) {
                     /* weak matches not allowed with Range requests */
                     return AP_CONDITION_NOMATCH;
                 }
@@ -493,7 +493,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_range(request_rec *r,
     const char *if_range, *etag;
 
     if ((if_range = apr_table_get(r->headers_in, "If-Range"))
-            && apr_table_get(r->headers_in, "Range")) {
+            && ap_get_known_header_in(r, AP_KNOWN_HEADER_RANGE)) {
         if (if_range[0] == '"') {
 
             if ((etag = apr_table_get(headers, "ETag"))
@@ -1089,7 +1089,7 @@ static const char *get_canned_error_string(int status,
                "request-header field overlap the current extent\n"
                "of the selected resource.</p>\n");
     case HTTP_EXPECTATION_FAILED:
-        s1 = apr_table_get(r->headers_in, "Expect");
+        s1 = ap_get_known_header_in(r, AP_KNOWN_HEADER_EXPECT);
         if (s1)
             s1 = apr_pstrcat(p,
                      "<p>The expectation given in the Expect request-header\n"
@@ -86,7 +86,8 @@ static proxy_worker *find_best_bybusyness(proxy_balancer *balancer,
                  */
                 if (PROXY_WORKER_IS_USABLE(*worker)) {
 
-                    (*worker)->s->lbstatus += (*worker)->s->lbfactor;
+                    ap_proxy_atomic_add_int(&(*worker)->s->lbstatus,
+                                            (*worker)->s->lbfactor);
                     total_factor += (*worker)->s->lbfactor;
 
                     if (!mycandidate
@@ -107,7 +108,7 @@ static proxy_worker *find_best_bybusyness(proxy_balancer *balancer,
     } while (cur_lbset <= max_lbset && !mycandidate);
 
     if (mycandidate) {
-        mycandidate->s->lbstatus -= total_factor;
+        ap_proxy_atomic_add_int(&mycandidate->s->lbstatus, -total_factor);
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(01212)
                      "proxy: bybusyness selected worker \"%s\" : busy %" APR_SIZE_T_FMT " : lbstatus %d",
                      mycandidate->s->name, mycandidate->s->busy, mycandidate->s->lbstatus);
@@ -141,7 +142,10 @@ static const proxy_balancer_method bybusyness =
     &find_best_bybusyness,
     NULL,
     &reset,
-    &age
+    &age,
+    NULL,
+    NULL,
+    PROXY_LBMETHOD_NOLOCK
 };
 
 static void register_hook(apr_pool_t *p)
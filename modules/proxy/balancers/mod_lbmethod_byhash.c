@@ -0,0 +1,461 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Consistent hashing scheduler: the members of the balancer are placed on
+ * a ring of points (more points for higher lbfactors), and a request goes
+ * to the owner of the first point following the hash of its key.  A member
+ * which is unusable or too busy (bounded loads) is skipped, so its keys
+ * spill over to the next points while the others don't move.
+ *
+ * The ring is built by each process from the workers of the balancer
+ * (the shared slots), and rebuilt when they change.  It lives in the
+ * balancer's context and, like the elections, is protected by the
+ * balancer lock taken by find_best_worker().
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "ap_expr.h"
+#include "apr_version.h"
+#include "ap_hooks.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_byhash_module;
+
+static int (*ap_proxy_retry_worker_fn)(const char *proxy_function,
+        proxy_worker *worker, server_rec *s) = NULL;
+
+/* Points of the workers with the highest lbfactor */
+#define BYHASH_POINTS 160
+
+/* Default BalancerHashBound */
+#define BYHASH_BOUND 125
+
+typedef struct {
+    ap_expr_info_t *key;
+    int bound;
+    unsigned int key_set:1;
+    unsigned int bound_set:1;
+} byhash_dir_conf;
+
+typedef struct {
+    apr_uint32_t hash;
+    int index;              /* in balancer->workers */
+} byhash_point;
+
+typedef struct {
+    const proxy_balancer_method *method;
+    apr_time_t wupdated;
+    apr_uint32_t signature;
+    int nworkers;
+    int npoints;
+    byhash_point *points;
+} byhash_ring;
+
+static const proxy_balancer_method byhash;
+
+static APR_INLINE apr_uint32_t hash_mix(apr_uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static apr_uint32_t hash_string(const char *s)
+{
+    apr_uint32_t h = 2166136261U;   /* FNV-1a */
+
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619U;
+    }
+    return hash_mix(h);
+}
+
+static int point_cmp(const void *a, const void *b)
+{
+    const byhash_point *pa = a, *pb = b;
+
+    if (pa->hash != pb->hash) {
+        return pa->hash < pb->hash ? -1 : 1;
+    }
+    return pa->index - pb->index;
+}
+
+/* Something which changes when the points would */
+static apr_uint32_t ring_signature(proxy_balancer *balancer)
+{
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    apr_uint32_t sig = balancer->workers->nelts;
+    int i;
+
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        sig = sig * 31 + workers[i]->s->lbfactor;
+    }
+    return sig;
+}
+
+static byhash_ring *get_ring(proxy_balancer *balancer, server_rec *s)
+{
+    byhash_ring *ring = balancer->context;
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    apr_uint32_t sig = ring_signature(balancer);
+    int i, j, n, max_factor = 1;
+
+    if (ring && ring->method == &byhash
+        && ring->nworkers == balancer->workers->nelts
+        && ring->wupdated == balancer->wupdated
+        && ring->signature == sig) {
+        return ring;
+    }
+    if (!ring || ring->method != &byhash) {
+        /* A ring per balancer, for the life of the process */
+        ring = ap_calloc(1, sizeof(*ring));
+        ring->method = &byhash;
+        balancer->context = ring;
+    }
+    else {
+        free(ring->points);
+        ring->points = NULL;
+    }
+
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        if (workers[i]->s->lbfactor > max_factor) {
+            max_factor = workers[i]->s->lbfactor;
+        }
+    }
+    n = 0;
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        n += (BYHASH_POINTS * workers[i]->s->lbfactor + max_factor - 1)
+             / max_factor;
+    }
+    ring->points = ap_malloc((n ? n : 1) * sizeof(byhash_point));
+    n = 0;
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        /* Hash the name, not the position, for all the children (and
+         * the restarts) to agree on the ring.
+         */
+        apr_uint32_t h = hash_string(workers[i]->s->name);
+        int points = (BYHASH_POINTS * workers[i]->s->lbfactor
+                      + max_factor - 1) / max_factor;
+
+        for (j = 0; j < points; j++, n++) {
+            ring->points[n].hash = hash_mix(h + j * 0x9e3779b9U);
+            ring->points[n].index = i;
+        }
+    }
+    qsort(ring->points, n, sizeof(byhash_point), point_cmp);
+
+    ring->npoints = n;
+    ring->nworkers = balancer->workers->nelts;
+    ring->wupdated = balancer->wupdated;
+    ring->signature = sig;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03507)
+                 "proxy: byhash ring of BALANCER (%s) built with %d points "
+                 "for %d workers", balancer->s->name, n, ring->nworkers);
+
+    return ring;
+}
+
+/* The first point at or after hash, wrapping around */
+static int ring_lookup(const byhash_ring *ring, apr_uint32_t hash)
+{
+    int lo = 0, hi = ring->npoints;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < hash) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo < ring->npoints ? lo : 0;
+}
+
+static proxy_worker *find_best_byhash(proxy_balancer *balancer,
+                                request_rec *r)
+{
+    int i, n;
+    proxy_worker **worker;
+    proxy_worker *mycandidate = NULL;
+    proxy_worker *spillover = NULL;
+    char *eligible;
+    int cur_lbset = 0;
+    int max_lbset = 0;
+    int checking_standby;
+    int checked_standby;
+    apr_uint64_t total_busy = 0, total_factor = 0;
+    byhash_dir_conf *conf = ap_get_module_config(r->per_dir_config,
+                                                 &lbmethod_byhash_module);
+    const byhash_ring *ring;
+    const char *key;
+    apr_uint32_t hash;
+
+    if (!ap_proxy_retry_worker_fn) {
+        ap_proxy_retry_worker_fn =
+                APR_RETRIEVE_OPTIONAL_FN(ap_proxy_retry_worker);
+        if (!ap_proxy_retry_worker_fn) {
+            /* can only happen if mod_proxy isn't loaded */
+            return NULL;
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(03508)
+                 "proxy: Entering byhash for BALANCER (%s)",
+                 balancer->s->name);
+
+    /* Mark the usable workers of the first lbset which has some */
+    eligible = apr_pcalloc(r->pool, balancer->workers->nelts);
+    n = 0;
+    do {
+
+        checking_standby = checked_standby = 0;
+        while (!n && !checked_standby) {
+
+            worker = (proxy_worker **)balancer->workers->elts;
+            for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+                if  (!checking_standby) {    /* first time through */
+                    if ((*worker)->s->lbset > max_lbset)
+                        max_lbset = (*worker)->s->lbset;
+                }
+                if (
+                    ((*worker)->s->lbset != cur_lbset) ||
+                    (checking_standby ? !PROXY_WORKER_IS_STANDBY(*worker) : PROXY_WORKER_IS_STANDBY(*worker)) ||
+                    (PROXY_WORKER_IS_DRAINING(*worker))
+                    ) {
+                    continue;
+                }
+
+                /* If the worker is in error state run
+                 * retry on that worker. It will be marked as
+                 * operational if the retry timeout is elapsed.
+                 * The worker might still be unusable, but we try
+                 * anyway.
+                 */
+                if (!PROXY_WORKER_IS_USABLE(*worker)) {
+                    ap_proxy_retry_worker_fn("BALANCER", *worker, r->server);
+                }
+
+                /* Take into calculation only the workers that are
+                 * not in error state or not disabled.
+                 */
+                if (PROXY_WORKER_IS_USABLE(*worker)) {
+                    eligible[i] = 1;
+                    total_busy += (*worker)->s->busy;
+                    total_factor += (*worker)->s->lbfactor;
+                    n++;
+                }
+
+            }
+
+            checked_standby = checking_standby++;
+
+        }
+
+        cur_lbset++;
+
+    } while (cur_lbset <= max_lbset && !n);
+
+    if (!n) {
+        return NULL;
+    }
+
+    if (conf->key) {
+        const char *err = NULL;
+
+        key = ap_expr_str_exec(r, conf->key, &err);
+        if (err) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(03509)
+                          "BalancerHashKey: could not evaluate the key "
+                          "expression for URI '%s': %s", r->uri, err);
+            key = r->unparsed_uri;
+        }
+    }
+    else {
+        key = r->unparsed_uri;
+    }
+    hash = hash_string(key ? key : "");
+
+    ring = get_ring(balancer, r->server);
+    worker = (proxy_worker **)balancer->workers->elts;
+    if (ring->npoints) {
+        int pos = ring_lookup(ring, hash);
+
+        for (i = 0; i < ring->npoints; i++) {
+            proxy_worker *w = worker[ring->points[pos].index];
+
+            if (eligible[ring->points[pos].index]) {
+                /* Bounded loads: accept the worker if its pending
+                 * requests stay below bound percent of its share (by
+                 * lbfactor) of all of them, this one included, rounded up.
+                 */
+                apr_uint64_t capacity = 0;
+
+                if (conf->bound) {
+                    apr_uint64_t div = 100 * total_factor;
+                    capacity = ((apr_uint64_t)conf->bound * (total_busy + 1)
+                                * w->s->lbfactor + div - 1) / div;
+                }
+                if (!conf->bound || (apr_uint64_t)w->s->busy < capacity) {
+                    mycandidate = w;
+                    break;
+                }
+                if (!spillover) {
+                    spillover = w;
+                }
+            }
+            if (++pos == ring->npoints) {
+                pos = 0;
+            }
+        }
+    }
+    if (!mycandidate) {
+        /* Everyone is above the bound (or the ring is empty) */
+        mycandidate = spillover;
+        for (i = 0; !mycandidate && i < balancer->workers->nelts; i++) {
+            if (eligible[i]) {
+                mycandidate = worker[i];
+            }
+        }
+    }
+
+    if (mycandidate) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(03510)
+                     "proxy: byhash selected worker \"%s\" : busy %" APR_SIZE_T_FMT " : key hash %08x",
+                     mycandidate->s->name, mycandidate->s->busy, hash);
+
+    }
+
+    return mycandidate;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    int i;
+    proxy_worker **worker;
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        (*worker)->s->lbstatus = 0;
+        (*worker)->s->busy = 0;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method byhash =
+{
+    "byhash",
+    &find_best_byhash,
+    NULL,
+    &reset,
+    &age
+};
+
+static void *create_byhash_dir_config(apr_pool_t *p, char *dummy)
+{
+    byhash_dir_conf *conf = apr_pcalloc(p, sizeof(byhash_dir_conf));
+
+    conf->bound = BYHASH_BOUND;
+    return conf;
+}
+
+static void *merge_byhash_dir_config(apr_pool_t *p, void *basev, void *addv)
+{
+    byhash_dir_conf *base = (byhash_dir_conf *)basev;
+    byhash_dir_conf *add = (byhash_dir_conf *)addv;
+    byhash_dir_conf *conf = apr_palloc(p, sizeof(byhash_dir_conf));
+
+    conf->key = add->key_set ? add->key : base->key;
+    conf->key_set = add->key_set || base->key_set;
+    conf->bound = add->bound_set ? add->bound : base->bound;
+    conf->bound_set = add->bound_set || base->bound_set;
+    return conf;
+}
+
+static const char *set_hash_key(cmd_parms *cmd, void *dconf, const char *arg)
+{
+    byhash_dir_conf *conf = dconf;
+    const char *err = NULL;
+
+    conf->key = ap_expr_parse_cmd(cmd, arg, AP_EXPR_FLAG_STRING_RESULT,
+                                  &err, NULL);
+    if (err) {
+        return apr_psprintf(cmd->pool,
+                            "Could not parse hash key expression '%s': %s",
+                            arg, err);
+    }
+    conf->key_set = 1;
+    return NULL;
+}
+
+static const char *set_hash_bound(cmd_parms *cmd, void *dconf,
+                                  const char *arg)
+{
+    byhash_dir_conf *conf = dconf;
+
+    if (!strcasecmp(arg, "off")) {
+        conf->bound = 0;
+    }
+    else {
+        conf->bound = atoi(arg);
+        if (conf->bound < 100) {
+            return "BalancerHashBound must be Off or a percentage of at "
+                   "least 100";
+        }
+    }
+    conf->bound_set = 1;
+    return NULL;
+}
+
+static const command_rec byhash_cmds[] =
+{
+    AP_INIT_TAKE1("BalancerHashKey", set_hash_key, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "Expression giving the key hashed by lbmethod=byhash "
+                  "(default: the request URI)"),
+    AP_INIT_TAKE1("BalancerHashBound", set_hash_bound, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "Maximum load of a worker, in percent of the average, "
+                  "before its keys spill over to the next ones, or Off"),
+    {NULL}
+};
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "byhash", "0", &byhash);
+}
+
+AP_DECLARE_MODULE(lbmethod_byhash) = {
+    STANDARD20_MODULE_STUFF,
+    create_byhash_dir_config,   /* create per-directory config structure */
+    merge_byhash_dir_config,    /* merge per-directory config structures */
+    NULL,                       /* create per-server config structure */
+    NULL,                       /* merge per-server config structures */
+    byhash_cmds,                /* command apr_table_t */
+    register_hook               /* register hooks */
+};
@@ -0,0 +1,300 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latency aware scheduler: every worker keeps a decaying moving average of
+ * its response time (in the shared lat_ewma/lat_stamp fields, updated from
+ * proxy_balancer_post_request() through served()), and the elections pick
+ * two usable workers at random, keeping the one with the lowest
+ *   latency * (busy + 1) / lbfactor
+ * cost ("power of two choices").  Nothing here needs the balancer lock:
+ * the average is updated atomically and a stale read only skews a choice.
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_version.h"
+#include "apr_atomic.h"
+#include "ap_hooks.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_bylatency_module;
+
+static int (*ap_proxy_retry_worker_fn)(const char *proxy_function,
+        proxy_worker *worker, server_rec *s) = NULL;
+
+/* Time constant of the decay (msec): an average which is not refreshed
+ * is halved after BYLATENCY_DECAY (and divided by n + 1 after n times
+ * that), so that a worker which was slow once gets a chance to be elected
+ * (and measured) again.
+ */
+#define BYLATENCY_DECAY     10000
+
+/* Weight of a new sample, in 1/BYLATENCY_SCALE */
+#define BYLATENCY_WEIGHT    2
+#define BYLATENCY_SCALE     16
+
+/* Response time accounted for a failed request (usec), if longer */
+#define BYLATENCY_PENALTY   apr_time_from_sec(1)
+
+static apr_uint32_t random_state;
+
+/* Cheap, lock free and good enough to pick the candidates */
+static apr_uint32_t random_pick(apr_uint32_t n)
+{
+    apr_uint32_t x = apr_atomic_add32(&random_state, 0x9e3779b9);
+
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return (apr_uint32_t)(((apr_uint64_t)x * n) >> 32);
+}
+
+static apr_uint32_t now_msec(void)
+{
+    return (apr_uint32_t)apr_time_as_msec(apr_time_now());
+}
+
+/* The average updated at stamp, decayed up to now */
+static apr_uint32_t decay(apr_uint32_t ewma, apr_uint32_t stamp,
+                          apr_uint32_t now)
+{
+    apr_uint32_t elapsed = now - stamp;
+
+    /* a stamp in the future (another child was quicker) is now */
+    if (elapsed > 0 && elapsed < APR_UINT32_MAX / 2) {
+        ewma = (apr_uint32_t)((apr_uint64_t)ewma * BYLATENCY_DECAY
+                              / (BYLATENCY_DECAY + elapsed));
+    }
+    return ewma;
+}
+
+/* Lower is better */
+static apr_uint64_t worker_cost(proxy_worker *worker, apr_uint32_t now)
+{
+    apr_uint64_t cost = decay(apr_atomic_read32(&worker->s->lat_ewma),
+                              apr_atomic_read32(&worker->s->lat_stamp), now);
+
+    return (cost + 1) * (worker->s->busy + 1);
+}
+
+static int better_candidate(proxy_worker *a, proxy_worker *b,
+                            apr_uint32_t now)
+{
+    int fa = a->s->lbfactor > 0 ? a->s->lbfactor : 1;
+    int fb = b->s->lbfactor > 0 ? b->s->lbfactor : 1;
+
+    return worker_cost(a, now) * fb < worker_cost(b, now) * fa;
+}
+
+static proxy_worker *find_best_bylatency(proxy_balancer *balancer,
+                                request_rec *r)
+{
+    int i, n;
+    proxy_worker **worker;
+    proxy_worker **candidates;
+    proxy_worker *mycandidate = NULL;
+    int cur_lbset = 0;
+    int max_lbset = 0;
+    int checking_standby;
+    int checked_standby;
+
+    if (!ap_proxy_retry_worker_fn) {
+        ap_proxy_retry_worker_fn =
+                APR_RETRIEVE_OPTIONAL_FN(ap_proxy_retry_worker);
+        if (!ap_proxy_retry_worker_fn) {
+            /* can only happen if mod_proxy isn't loaded */
+            return NULL;
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(03505)
+                 "proxy: Entering bylatency for BALANCER (%s)",
+                 balancer->s->name);
+
+    candidates = apr_palloc(r->pool, balancer->workers->nelts
+                                     * sizeof(proxy_worker *));
+
+    /* Collect the usable workers of the first lbset which has some */
+    n = 0;
+    do {
+
+        checking_standby = checked_standby = 0;
+        while (!n && !checked_standby) {
+
+            worker = (proxy_worker **)balancer->workers->elts;
+            for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+                if  (!checking_standby) {    /* first time through */
+                    if ((*worker)->s->lbset > max_lbset)
+                        max_lbset = (*worker)->s->lbset;
+                }
+                if (
+                    ((*worker)->s->lbset != cur_lbset) ||
+                    (checking_standby ? !PROXY_WORKER_IS_STANDBY(*worker) : PROXY_WORKER_IS_STANDBY(*worker)) ||
+                    (PROXY_WORKER_IS_DRAINING(*worker))
+                    ) {
+                    continue;
+                }
+
+                /* If the worker is in error state run
+                 * retry on that worker. It will be marked as
+                 * operational if the retry timeout is elapsed.
+                 * The worker might still be unusable, but we try
+                 * anyway.
+                 */
+                if (!PROXY_WORKER_IS_USABLE(*worker)) {
+                    ap_proxy_retry_worker_fn("BALANCER", *worker, r->server);
+                }
+
+                /* Take into calculation only the workers that are
+                 * not in error state or not disabled.
+                 */
+                if (PROXY_WORKER_IS_USABLE(*worker)) {
+                    candidates[n++] = *worker;
+                }
+
+            }
+
+            checked_standby = checking_standby++;
+
+        }
+
+        cur_lbset++;
+
+    } while (cur_lbset <= max_lbset && !n);
+
+    if (n == 1) {
+        mycandidate = candidates[0];
+    }
+    else if (n > 1) {
+        apr_uint32_t now = now_msec();
+        int first = random_pick(n);
+        int second = random_pick(n - 1);
+
+        if (second >= first) {
+            second++;
+        }
+        mycandidate = candidates[first];
+        if (better_candidate(candidates[second], mycandidate, now)) {
+            mycandidate = candidates[second];
+        }
+    }
+
+    if (mycandidate) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(03506)
+                     "proxy: bylatency selected worker \"%s\" : busy %" APR_SIZE_T_FMT " : latency %u",
+                     mycandidate->s->name, mycandidate->s->busy,
+                     apr_atomic_read32(&mycandidate->s->lat_ewma));
+
+    }
+
+    return mycandidate;
+}
+
+static apr_status_t served(proxy_balancer *balancer, proxy_worker *worker,
+                           request_rec *r, apr_interval_time_t elapsed)
+{
+    apr_uint32_t now = now_msec();
+    apr_uint32_t ewma, stamp, sample, update;
+
+    if (elapsed < 0) {
+        elapsed = 0;
+    }
+    if (r->status == HTTP_BAD_GATEWAY
+        || r->status == HTTP_SERVICE_UNAVAILABLE
+        || r->status == HTTP_GATEWAY_TIME_OUT
+        || apr_table_get(r->notes, "proxy_timedout")) {
+        /* Don't let a failing worker look fast */
+        if (elapsed < BYLATENCY_PENALTY) {
+            elapsed = BYLATENCY_PENALTY;
+        }
+    }
+    sample = elapsed < APR_UINT32_MAX ? (apr_uint32_t)elapsed : APR_UINT32_MAX;
+
+    /* Retry if someone else updated the average in the meantime */
+    do {
+        ewma = apr_atomic_read32(&worker->s->lat_ewma);
+        stamp = apr_atomic_read32(&worker->s->lat_stamp);
+        if (!stamp) {
+            update = sample; /* first measure */
+        }
+        else {
+            update = (apr_uint32_t)(((apr_uint64_t)decay(ewma, stamp, now)
+                                     * (BYLATENCY_SCALE - BYLATENCY_WEIGHT)
+                                     + (apr_uint64_t)sample * BYLATENCY_WEIGHT)
+                                    / BYLATENCY_SCALE);
+        }
+    } while (apr_atomic_cas32(&worker->s->lat_ewma, update, ewma) != ewma);
+    apr_atomic_set32(&worker->s->lat_stamp, now ? now : 1);
+
+    return APR_SUCCESS;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    int i;
+    proxy_worker **worker;
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        (*worker)->s->lbstatus = 0;
+        (*worker)->s->busy = 0;
+        apr_atomic_set32(&(*worker)->s->lat_ewma, 0);
+        apr_atomic_set32(&(*worker)->s->lat_stamp, 0);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method bylatency =
+{
+    "bylatency",
+    &find_best_bylatency,
+    NULL,
+    &reset,
+    &age,
+    NULL,
+    &served,
+    PROXY_LBMETHOD_NOLOCK
+};
+
+static void child_init(apr_pool_t *p, server_rec *s)
+{
+    /* Don't let the children make the same choices */
+    ap_random_insecure_bytes(&random_state, sizeof(random_state));
+}
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "bylatency", "0", &bylatency);
+    ap_hook_child_init(child_init, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(lbmethod_bylatency) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,       /* create per-directory config structure */
+    NULL,       /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    NULL,       /* command apr_table_t */
+    register_hook /* register hooks */
+};
@@ -69,6 +69,9 @@ static int (*ap_proxy_retry_worker_fn)(const char *proxy_function,
  *
  *   b a d c d a c d b d ...
  *
+ * The additions and the subtraction are atomic, so concurrent elections
+ * (which don't take the balancer lock) still keep the sum of lbstatus,
+ * they may only occasionally elect the same worker.
  */
 
 static proxy_worker *find_best_byrequests(proxy_balancer *balancer,
@@ -126,7 +129,8 @@ static proxy_worker *find_best_byrequests(proxy_balancer *balancer,
                  * not in error state or not disabled.
                  */
                 if (PROXY_WORKER_IS_USABLE(*worker)) {
-                    (*worker)->s->lbstatus += (*worker)->s->lbfactor;
+                    ap_proxy_atomic_add_int(&(*worker)->s->lbstatus,
+                                            (*worker)->s->lbfactor);
                     total_factor += (*worker)->s->lbfactor;
                     if (!mycandidate || (*worker)->s->lbstatus > mycandidate->s->lbstatus)
                         mycandidate = *worker;
@@ -138,7 +142,7 @@ static proxy_worker *find_best_byrequests(proxy_balancer *balancer,
     } while (cur_lbset <= max_lbset && !mycandidate);
 
     if (mycandidate) {
-        mycandidate->s->lbstatus -= total_factor;
+        ap_proxy_atomic_add_int(&mycandidate->s->lbstatus, -total_factor);
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(01208)
                      "proxy: byrequests selected worker \"%s\" : busy %" APR_SIZE_T_FMT " : lbstatus %d",
                      mycandidate->s->name, mycandidate->s->busy, mycandidate->s->lbstatus);
@@ -177,7 +181,10 @@ static const proxy_balancer_method byrequests =
     &find_best_byrequests,
     NULL,
     &reset,
-    &age
+    &age,
+    NULL,
+    NULL,
+    PROXY_LBMETHOD_NOLOCK
 };
 
 static void register_hook(apr_pool_t *p)
@@ -146,7 +146,10 @@ static const proxy_balancer_method bytraffic =
     &find_best_bytraffic,
     NULL,
     &reset,
-    &age
+    &age,
+    NULL,
+    NULL,
+    PROXY_LBMETHOD_NOLOCK
 };
 
 static void register_hook(apr_pool_t *p)
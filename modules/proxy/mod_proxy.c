@@ -19,6 +19,7 @@
 #include "apr_optional.h"
 #include "scoreboard.h"
 #include "mod_status.h"
+#include "mod_watchdog.h"
 #include "proxy_util.h"
 
 #if (MODULE_MAGIC_NUMBER_MAJOR > 20020903)
@@ -53,7 +54,7 @@ proxy_hcmethods_t PROXY_DECLARE_DATA proxy_hcmethods[] = {
         {OPTIONS, "OPTIONS", 1},
         {HEAD, "HEAD", 1},
         {GET, "GET", 1},
-        {CPING, "CPING", 0},
+        {CPING, "CPING", 1},
         {PROVIDER, "PROVIDER", 0},
         {EOT, NULL, 1}
 };
@@ -222,6 +223,65 @@ static const char *set_worker_param(apr_pool_t *p,
             return "EnableReuse must be On|Off";
         worker->s->disablereuse_set = 1;
     }
+    else if (!strcasecmp(key, "sharedpool")) {
+        /* Idle connections shared by all the children
+         */
+        if (!strcasecmp(val, "on"))
+            worker->s->shared_pool = 1;
+        else if (!strcasecmp(val, "off"))
+            worker->s->shared_pool = 0;
+        else
+            return "SharedPool must be On|Off";
+    }
+    else if (!strcasecmp(key, "sharedmin")) {
+        /* Parked connections kept regardless of sharedttl
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "SharedMin must be a positive number";
+        worker->s->shared_min = ival;
+    }
+    else if (!strcasecmp(key, "sharedmax")) {
+        /* Maximum number of parked connections
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "SharedMax must be a positive number";
+        worker->s->shared_max = ival;
+    }
+    else if (!strcasecmp(key, "sharedttl")) {
+        /* Time to live of the parked connections
+         */
+        if (ap_timeout_parameter_parse(val, &timeout, "s") != APR_SUCCESS)
+            return "SharedTTL has wrong format";
+        if (timeout < 1000)
+            return "SharedTTL must be at least one millisecond";
+        worker->s->shared_ttl = timeout;
+    }
+    else if (!strcasecmp(key, "pipeline")) {
+        /* Maximum number of requests pipelined per connection
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "Pipeline must be a positive number";
+        worker->s->pipeline = ival;
+    }
+    else if (!strcasecmp(key, "multiplex")) {
+        /* Maximum number of requests multiplexed per connection
+         */
+        ival = atoi(val);
+        if (ival < 0 || ival > 65535)
+            return "Multiplex must be a number between 0 and 65535";
+        worker->s->multiplex = ival;
+    }
+    else if (!strcasecmp(key, "prewarm")) {
+        /* Maximum number of idle connections established ahead
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "Prewarm must be a positive number";
+        worker->s->prewarm = ival;
+    }
     else if (!strcasecmp(key, "route")) {
         /* Worker route.
          */
@@ -1293,7 +1353,12 @@ cleanup:
      * But only do the above if access_status is not OK and not DONE, because
      * in this case r->status might contain the true status and overwriting
      * it with OK or DONE would be wrong.
+     * A SUSPENDED handler does this itself once the response is there.
      */
+    if (access_status == SUSPENDED) {
+        AP_PROXY_RUN_FINISHED(r, attempts, access_status);
+        return access_status;
+    }
     if ((access_status != OK) && (access_status != DONE)) {
         saved_status = r->status;
         r->status = access_status;
@@ -2760,6 +2825,117 @@ PROXY_DECLARE(const char *) ap_proxy_ssl_val(apr_pool_t *p, server_rec *s,
         return NULL;
 }
 
+#define PROXY_PREWARM_WATCHDOG_NAME "_proxy_prewarm_"
+
+static APR_INLINE void prewarm_worker(apr_hash_t *done, proxy_worker *worker,
+                                      server_rec *s, apr_pool_t *p)
+{
+    /* The workers of the main server are merged in the vhosts, where they
+     * share their slot (worker->s) but have a connection pool of their own.
+     */
+    if (worker->s->prewarm && worker->cp
+            && !apr_hash_get(done, &worker->cp, sizeof(worker->cp))) {
+        apr_hash_set(done, &worker->cp, sizeof(worker->cp), worker);
+        ap_proxy_prewarm_worker(worker, s, p);
+    }
+}
+
+static apr_status_t proxy_prewarm_callback(int state, void *data,
+                                           apr_pool_t *pool)
+{
+    server_rec *s;
+    apr_hash_t *done;
+
+    if (state != AP_WATCHDOG_STATE_RUNNING) {
+        return APR_SUCCESS;
+    }
+
+    done = apr_hash_make(pool);
+    for (s = data; s; s = s->next) {
+        proxy_server_conf *sconf =
+            ap_get_module_config(s->module_config, &proxy_module);
+        proxy_worker *worker = (proxy_worker *)sconf->workers->elts;
+        proxy_balancer *balancer = (proxy_balancer *)sconf->balancers->elts;
+        int i, n;
+
+        for (i = 0; i < sconf->workers->nelts; ++i, ++worker) {
+            prewarm_worker(done, worker, s, pool);
+        }
+        for (i = 0; i < sconf->balancers->nelts; ++i, ++balancer) {
+            proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; ++n) {
+                prewarm_worker(done, workers[n], s, pool);
+            }
+        }
+    }
+    return APR_SUCCESS;
+}
+
+static int proxy_prewarm_needed(server_rec *s)
+{
+    for (; s; s = s->next) {
+        proxy_server_conf *sconf =
+            ap_get_module_config(s->module_config, &proxy_module);
+        proxy_worker *worker = (proxy_worker *)sconf->workers->elts;
+        proxy_balancer *balancer = (proxy_balancer *)sconf->balancers->elts;
+        int i, n;
+
+        for (i = 0; i < sconf->workers->nelts; ++i, ++worker) {
+            if (worker->s->prewarm) {
+                return 1;
+            }
+        }
+        for (i = 0; i < sconf->balancers->nelts; ++i, ++balancer) {
+            proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; ++n) {
+                if (workers[n]->s->prewarm) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* Run the prewarming in (each of) the children, if any worker needs it */
+static int proxy_prewarm_init(apr_pool_t *pconf, server_rec *main_s)
+{
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
+    ap_watchdog_t *watchdog;
+    apr_status_t rv;
+
+    if (!proxy_prewarm_needed(main_s)) {
+        return OK;
+    }
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register_callback = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!wd_get_instance || !wd_register_callback) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, main_s, APLOGNO(03524)
+                     "mod_watchdog is required for the prewarm parameter, "
+                     "ignored");
+        return OK;
+    }
+
+    rv = wd_get_instance(&watchdog, PROXY_PREWARM_WATCHDOG_NAME, 0, 0, pconf);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, main_s, APLOGNO(03525)
+                     "Failed to create watchdog instance (%s)",
+                     PROXY_PREWARM_WATCHDOG_NAME);
+        return !OK;
+    }
+    rv = wd_register_callback(watchdog, AP_WD_TM_INTERVAL, main_s,
+                              proxy_prewarm_callback);
+    if (rv != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rv)) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, main_s, APLOGNO(03526)
+                     "Failed to register watchdog callback (%s)",
+                     PROXY_PREWARM_WATCHDOG_NAME);
+        return !OK;
+    }
+    return OK;
+}
+
 static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                              apr_pool_t *ptemp, server_rec *main_s)
 {
@@ -2786,6 +2962,7 @@ static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
             ap_get_module_config(s->module_config, &proxy_module);
         ap_conf_vector_t **sections =
             (ap_conf_vector_t **)sconf->sec_proxy->elts;
+        proxy_balancer *balancer = (proxy_balancer *)sconf->balancers->elts;
 
         for (i = 0; i < sconf->sec_proxy->nelts; ++i) {
             rc = proxy_run_section_post_config(pconf, ptemp, plog,
@@ -2794,9 +2971,23 @@ static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                 return rc;
             }
         }
+
+        /* Index the workers by name for ap_proxy_get_worker() */
+        ap_proxy_index_workers(pconf, NULL, sconf);
+        for (i = 0; i < sconf->balancers->nelts; ++i, ++balancer) {
+            ap_proxy_index_workers(pconf, balancer, sconf);
+        }
     }
 
-    return OK;
+    /* The shared connection pools must be inherited by the children */
+    if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_CREATE_PRE_CONFIG) {
+        rv = ap_proxy_init_shared_pools(pconf, main_s);
+        if (rv != APR_SUCCESS) {
+            return !OK;
+        }
+    }
+
+    return proxy_prewarm_init(pconf, main_s);
 }
 
 /*
@@ -2844,6 +3035,7 @@ static int proxy_status_hook(request_rec *r, int flags)
                      "<th>Sch</th><th>Host</th><th>Stat</th>"
                      "<th>Route</th><th>Redir</th>"
                      "<th>F</th><th>Set</th><th>Acc</th><th>Wr</th><th>Rd</th>"
+                     "<th>Conn</th><th>TTFB</th><th>Tot</th>"
                      "</tr>\n", r);
         }
         else {
@@ -2853,6 +3045,8 @@ static int proxy_status_hook(request_rec *r, int flags)
         worker = (proxy_worker **)balancer->workers->elts;
         for (n = 0; n < balancer->workers->nelts; n++) {
             char fbuf[50];
+            proxy_latency_stats st;
+            int l;
             if (!(flags & AP_STATUS_SHORT)) {
                 ap_rvputs(r, "<tr>\n<td>", (*worker)->s->scheme, "</td>", NULL);
                 ap_rvputs(r, "<td>", (*worker)->s->hostname, "</td><td>", NULL);
@@ -2867,6 +3061,16 @@ static int proxy_status_hook(request_rec *r, int flags)
                 ap_rputs("</td><td>", r);
                 ap_rputs(apr_strfsize((*worker)->s->read, fbuf), r);
                 ap_rputs("</td>\n", r);
+                for (l = 0; l < PROXY_LATENCY_MAX; l++) {
+                    ap_proxy_latency_stats(*worker, l, &st);
+                    if (st.count) {
+                        ap_rprintf(r, "<td>%.1f / %.1f</td>",
+                                   st.p50 / 1000.0, st.p99 / 1000.0);
+                    }
+                    else {
+                        ap_rputs("<td>-</td>", r);
+                    }
+                }
 
                 /* TODO: Add the rest of dynamic worker data */
                 ap_rputs("</tr>\n", r);
@@ -2883,6 +3087,20 @@ static int proxy_status_hook(request_rec *r, int flags)
                            i, n, apr_strfsize((*worker)->s->transferred, fbuf));
                 ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]Rcvd: %s\n",
                            i, n, apr_strfsize((*worker)->s->read, fbuf));
+                for (l = 0; l < PROXY_LATENCY_MAX; l++) {
+                    const char *name = ap_proxy_latency_name(l);
+                    ap_proxy_latency_stats(*worker, l, &st);
+                    ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]%sCount: %u\n",
+                               i, n, name, st.count);
+                    ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]%sP50: %"
+                                  APR_TIME_T_FMT "\n", i, n, name, st.p50);
+                    ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]%sP90: %"
+                                  APR_TIME_T_FMT "\n", i, n, name, st.p90);
+                    ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]%sP99: %"
+                                  APR_TIME_T_FMT "\n", i, n, name, st.p99);
+                    ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]%sP999: %"
+                                  APR_TIME_T_FMT "\n", i, n, name, st.p999);
+                }
                 /* TODO: Add the rest of dynamic worker data */
             }
 
@@ -2906,6 +3124,9 @@ static int proxy_status_hook(request_rec *r, int flags)
                  "<tr><th>Acc</th><td>Number of uses</td></tr>\n"
                  "<tr><th>Wr</th><td>Number of bytes transferred</td></tr>\n"
                  "<tr><th>Rd</th><td>Number of bytes read</td></tr>\n"
+                 "<tr><th>Conn</th><td>Connect time, p50 / p99 (ms)</td></tr>\n"
+                 "<tr><th>TTFB</th><td>Time to first byte of the response, p50 / p99 (ms)</td></tr>\n"
+                 "<tr><th>Tot</th><td>Time to whole response, p50 / p99 (ms)</td></tr>\n"
                  "</table>", r);
     }
 
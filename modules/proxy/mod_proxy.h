@@ -199,6 +199,8 @@ typedef struct {
     unsigned int inherit_set:1;
     unsigned int ppinherit:1;
     unsigned int ppinherit_set:1;
+    struct proxy_worker_index *windex; /* workers by name, see
+                                        * ap_proxy_index_workers() */
 } proxy_server_conf;
 
 
@@ -275,6 +277,14 @@ typedef struct {
                                 * and its scpool/bucket_alloc (NULL before),
                                 * must be left cleaned when used (locally).
                                 */
+    apr_uint32_t pipe_sent;    /* Requests pipelined on this connection */
+    apr_uint32_t pipe_valid;   /* ... whose responses can still be read */
+    apr_uint32_t pipe_turn;    /* Request whose response is being read */
+    apr_uint32_t pipe_pending; /* Requests not released yet */
+    unsigned int pipelined:1;  /* Requests are pipelined on this connection,
+                                * the pipe_* fields are protected by the
+                                * worker's pipeline mutex */
+    apr_time_t   started;      /* Request sent, for the latency histograms */
 } proxy_conn_rec;
 
 typedef struct {
@@ -288,6 +298,8 @@ struct proxy_conn_pool {
     apr_sockaddr_t *addr;   /* Preparsed remote address info */
     apr_reslist_t  *res;    /* Connection resource list */
     proxy_conn_rec *conn;   /* Single connection for prefork mpm */
+    apr_uint32_t   acquired; /* Connections acquired since the last prewarm */
+    apr_uint32_t   demand;  /* Decaying average of the above (prewarm) */
 };
 
 /* worker status bits */
@@ -385,6 +397,28 @@ typedef struct {
     unsigned int fnv;
 } proxy_hashes ;
 
+/* Latency histograms (usec), HDR style: values are counted in one of the
+ * 2^PROXY_LATENCY_SUB_BITS linear sub-buckets of their power of two, hence
+ * within 12.5%, up to 2^PROXY_LATENCY_MAX_BITS usec (~268s, longer ones
+ * are counted in the last bucket).
+ */
+#define PROXY_LATENCY_SUB_BITS  3
+#define PROXY_LATENCY_MAX_BITS  28
+#define PROXY_LATENCY_BUCKETS   ((PROXY_LATENCY_MAX_BITS - \
+                                  PROXY_LATENCY_SUB_BITS + 1) \
+                                 << PROXY_LATENCY_SUB_BITS)
+
+typedef enum {
+    PROXY_LATENCY_CONNECT,      /* establishment of the connections */
+    PROXY_LATENCY_TTFB,         /* request sent to first response byte */
+    PROXY_LATENCY_TOTAL,        /* request sent to response complete */
+    PROXY_LATENCY_MAX
+} proxy_latency_e;
+
+typedef struct {
+    apr_uint32_t    counts[PROXY_LATENCY_BUCKETS];
+} proxy_latency_hist;
+
 /* Runtime worker status information. Shared in scoreboard */
 typedef struct {
     char      name[PROXY_WORKER_MAX_NAME_SIZE];
@@ -450,6 +484,19 @@ typedef struct {
     unsigned int     was_malloced:1;
     unsigned int     is_name_matchable:1;
     char      secret[PROXY_WORKER_MAX_SECRET_SIZE]; /* authentication secret (e.g. AJP13) */
+    apr_interval_time_t shared_ttl; /* time to live of the connections parked
+                                     * in the shared pool */
+    int             shared_min; /* parked connections kept regardless of shared_ttl */
+    int             shared_max; /* maximum number of parked connections */
+    unsigned int    shared_pool:1; /* idle connections are shared by all children */
+    apr_uint32_t    lat_ewma;   /* decaying average of the response time (usec),
+                                 * maintained by the lbmethods which need it */
+    apr_uint32_t    lat_stamp;  /* last update of lat_ewma (msec, wrapping) */
+    int             pipeline;   /* max requests pipelined per connection (0 = off) */
+    int             multiplex;  /* max requests multiplexed per connection (FCGI) */
+    proxy_latency_hist latency[PROXY_LATENCY_MAX]; /* lock free histograms */
+    int             prewarm;    /* max idle connections established ahead
+                                 * by each child (0 = off) */
 } proxy_worker_shared;
 
 #define ALIGNED_PROXY_WORKER_SHARED_SIZE (APR_ALIGN_DEFAULT(sizeof(proxy_worker_shared)))
@@ -464,8 +511,28 @@ struct proxy_worker {
     apr_thread_mutex_t  *tmutex; /* Thread lock for updating address cache */
     void            *context;   /* general purpose storage */
     ap_conf_vector_t *section_config; /* <Proxy>-section wherein defined */
+    struct proxy_shared_pool *spool; /* shared pool of idle connections */
+    struct proxy_pipeline *pipeline; /* connection open to pipelining */
 };
 
+/* Statistics of the shared pool of idle connections of a worker */
+typedef struct {
+    apr_uint32_t    idle;       /* connections currently parked */
+    apr_uint32_t    parked;     /* connections parked so far */
+    apr_uint32_t    reused;     /* connections taken back */
+    apr_uint32_t    missed;     /* times no connection was parked */
+    apr_uint32_t    expired;    /* parked connections found closed or too old */
+} proxy_shared_pool_stats;
+
+/* Percentiles of a latency histogram of a worker (usec) */
+typedef struct {
+    apr_uint32_t        count;  /* samples */
+    apr_interval_time_t p50;
+    apr_interval_time_t p90;
+    apr_interval_time_t p99;
+    apr_interval_time_t p999;
+} proxy_latency_stats;
+
 /* default to health check every 30 seconds */
 #define HCHECK_WATHCHDOG_DEFAULT_INTERVAL (30)
 /* The watchdog runs every 2 seconds, which is also the minimal check */
@@ -529,6 +596,8 @@ struct proxy_balancer {
     unsigned int growth_set:1;
     unsigned int lbmethod_set:1;
     ap_conf_vector_t *section_config; /* <Proxy>-section wherein defined */
+    struct proxy_worker_index *windex; /* workers by name, see
+                                        * ap_proxy_index_workers() */
 };
 
 struct proxy_balancer_method {
@@ -539,8 +608,19 @@ struct proxy_balancer_method {
     apr_status_t (*reset)(proxy_balancer *balancer, server_rec *s);
     apr_status_t (*age)(proxy_balancer *balancer, server_rec *s);
     apr_status_t (*updatelbstatus)(proxy_balancer *balancer, proxy_worker *elected, server_rec *s);
+    /* Called (without the balancer lock) once the elected worker served
+     * the request, elapsed being the time since it was elected, or NULL */
+    apr_status_t (*served)(proxy_balancer *balancer, proxy_worker *worker,
+                           request_rec *r, apr_interval_time_t elapsed);
+    int             flags;      /* PROXY_LBMETHOD_* */
 };
 
+/* The finder (and updatelbstatus) does its own synchronization, using
+ * the ap_proxy_atomic_*() updates of the workers' counters, so neither
+ * find_best_worker() nor proxy_balancer_pre_request() need to serialize
+ * the elections with the balancer lock */
+#define PROXY_LBMETHOD_NOLOCK   0x01
+
 #define PROXY_THREAD_LOCK(x)      ( (x) && (x)->tmutex ? apr_thread_mutex_lock((x)->tmutex) : APR_SUCCESS)
 #define PROXY_THREAD_UNLOCK(x)    ( (x) && (x)->tmutex ? apr_thread_mutex_unlock((x)->tmutex) : APR_SUCCESS)
 
@@ -726,6 +806,21 @@ PROXY_DECLARE(proxy_worker *) ap_proxy_get_worker(apr_pool_t *p,
                                                   proxy_balancer *balancer,
                                                   proxy_server_conf *conf,
                                                   const char *url);
+
+/**
+ * Index the workers of the balancer (or of the configuration) by name,
+ * for ap_proxy_get_worker() to find them in a time proportional to the
+ * length of the url rather than the number of workers.  The workers
+ * added afterwards (e.g. by the balancer-manager) are looked up linearly
+ * until the next call.
+ * @param p        memory pool to allocate the index from
+ * @param balancer the balancer whose workers to index, or NULL
+ * @param conf     current proxy server configuration
+ * @note Not thread safe, this is meant to be called at post_config time.
+ */
+PROXY_DECLARE(void) ap_proxy_index_workers(apr_pool_t *p,
+                                           proxy_balancer *balancer,
+                                           proxy_server_conf *conf);
 /**
  * Define and Allocate space for the worker to proxy configuration
  * @param p         memory pool to allocate worker from
@@ -978,6 +1073,45 @@ PROXY_DECLARE(int) ap_proxy_release_connection(const char *proxy_function,
                                                proxy_conn_rec *conn,
                                                server_rec *s);
 
+/**
+ * Open a connection to pipelining, once the (first) request has been sent
+ * @param conn    connection, acquired by the caller
+ * @note Nothing is done if the worker does not pipeline, or if another
+ * connection is open already.  Requests of other threads may then be sent
+ * on the connection (ap_proxy_pipeline_join()) until it is released.
+ */
+PROXY_DECLARE(void) ap_proxy_pipeline_open(proxy_conn_rec *conn);
+
+/**
+ * Pipeline a request on the connection open for the worker, if any
+ * @param worker  worker the request is for
+ * @param conn    connection the request was sent on
+ * @param ticket  position of the request on the connection
+ * @param buf     request to send (headers only)
+ * @param len     length of the request
+ * @param r       current request record
+ * @return        OK if the request was sent, DECLINED otherwise
+ * @note The response can be read after ap_proxy_pipeline_wait(), and the
+ * connection must then be released by ap_proxy_release_connection().
+ */
+PROXY_DECLARE(int) ap_proxy_pipeline_join(proxy_worker *worker,
+                                          proxy_conn_rec **conn,
+                                          apr_uint32_t *ticket,
+                                          const char *buf, apr_size_t len,
+                                          request_rec *r);
+
+/**
+ * Wait for the turn of a pipelined request to read its response
+ * @param conn    connection the request was sent on
+ * @param ticket  position of the request, from ap_proxy_pipeline_join()
+ * @return        APR_SUCCESS, APR_ECONNRESET if the response won't come
+ * (the connection closed before), or APR_TIMEUP if the turn did not come
+ * within the timeout of the connection's socket; the connection is then
+ * released already and the request can be retried on another one.
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_pipeline_wait(proxy_conn_rec *conn,
+                                                   apr_uint32_t ticket);
+
 #define PROXY_CHECK_CONN_EMPTY (1 << 0)
 /**
  * Check a connection to the backend
@@ -1060,6 +1194,71 @@ PROXY_DECLARE(int) ap_proxy_connection_create_ex(const char *proxy_function,
  */
 PROXY_DECLARE(int) ap_proxy_connection_reusable(proxy_conn_rec *conn);
 
+/**
+ * Create the pools of idle connections shared by all the children, for the
+ * workers configured with sharedpool=On.
+ * @param p     pool to allocate the shared pools from (pconf)
+ * @param s     main server
+ * @return      APR_SUCCESS or error code
+ * @note To be called by the parent at post_config time, before the
+ * children are forked.
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_init_shared_pools(apr_pool_t *p,
+                                                       server_rec *s);
+
+/**
+ * Get the statistics of the worker's shared pool of idle connections.
+ * @param worker worker
+ * @param stats  where to store the statistics
+ * @return       APR_SUCCESS, or APR_ENOTIMPL if the worker has no shared pool
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_shared_pool_stats(proxy_worker *worker,
+                                            proxy_shared_pool_stats *stats);
+
+/**
+ * Count a sample in a latency histogram of the worker, lock free.
+ * @param worker  worker
+ * @param which   PROXY_LATENCY_CONNECT, PROXY_LATENCY_TTFB or
+ *                PROXY_LATENCY_TOTAL
+ * @param elapsed the latency
+ */
+PROXY_DECLARE(void) ap_proxy_latency_add(proxy_worker *worker,
+                                         proxy_latency_e which,
+                                         apr_interval_time_t elapsed);
+
+/**
+ * Get the percentiles of a latency histogram of the worker.
+ * @param worker worker
+ * @param which  PROXY_LATENCY_CONNECT, PROXY_LATENCY_TTFB or
+ *               PROXY_LATENCY_TOTAL
+ * @param stats  where to store the percentiles, the upper bound of their
+ *               bucket (or 0 without samples)
+ */
+PROXY_DECLARE(void) ap_proxy_latency_stats(proxy_worker *worker,
+                                           proxy_latency_e which,
+                                           proxy_latency_stats *stats);
+
+/**
+ * Get the name of a latency histogram.
+ * @param which  PROXY_LATENCY_CONNECT, PROXY_LATENCY_TTFB or
+ *               PROXY_LATENCY_TOTAL
+ * @return       "Connect", "TTFB" or "Total"
+ */
+PROXY_DECLARE(const char *) ap_proxy_latency_name(proxy_latency_e which);
+
+/**
+ * Establish idle connections of the worker ahead of the requests, up to
+ * its prewarm parameter as long as the child acquires that many.
+ * @param worker worker
+ * @param s      the server the worker is defined in
+ * @param p      temporary pool
+ * @return       number of connections established
+ * @note Called by the watchdog of each child every second, the rate at
+ *       which the demand is averaged.
+ */
+PROXY_DECLARE(int) ap_proxy_prewarm_worker(proxy_worker *worker,
+                                           server_rec *s, apr_pool_t *p);
+
 /**
  * Signal the upstream chain that the connection to the backend broke in the
  * middle of the response. This is done by sending an error bucket with
@@ -1101,6 +1300,37 @@ PROXY_DECLARE(apr_status_t) ap_proxy_set_wstatus(char c, int set, proxy_worker *
  */
 PROXY_DECLARE(char *) ap_proxy_parse_wstatus(apr_pool_t *p, proxy_worker *w);
 
+/**
+ * Atomically add to an int counter of a worker (e.g. lbstatus)
+ * @param mem  counter to update
+ * @param val  value to add (may be negative)
+ */
+PROXY_DECLARE(void) ap_proxy_atomic_add_int(int *mem, int val);
+
+/**
+ * Atomically add to an apr_size_t counter of a worker (e.g. busy, elected)
+ * @param mem  counter to update
+ * @param val  value to add
+ */
+PROXY_DECLARE(void) ap_proxy_atomic_add_size(apr_size_t *mem, apr_size_t val);
+
+/**
+ * Atomically decrement an apr_size_t counter of a worker, unless it is
+ * already zero
+ * @param mem  counter to update
+ */
+PROXY_DECLARE(void) ap_proxy_atomic_dec_size(apr_size_t *mem);
+
+/**
+ * Atomically add to an apr_off_t counter of a worker (e.g. transferred,
+ * read)
+ * @param mem  counter to update
+ * @param val  value to add
+ * @remark The update is atomic only where apr_off_t has the size of a
+ * pointer, elsewhere it is a plain (racy) addition of the statistic.
+ */
+PROXY_DECLARE(void) ap_proxy_atomic_add_off(apr_off_t *mem, apr_off_t val);
+
 
 /**
  * Sync balancer and workers based on any updates w/i shm
@@ -1261,6 +1491,10 @@ PROXY_DECLARE(apr_status_t) ap_proxy_buckets_lifetime_transform(request_rec *r,
  * @return      apr_status_t of the operation. Could be any error returned from
  *              either the input filter chain of c_i or the output filter chain
  *              of c_o. APR_EPIPE if the outgoing connection was aborted.
+ * @note Where splice(2) is available, once a call has drained the filters
+ *       of c_i and if neither connection has filters other than the core's
+ *       (and mod_logio's), the next calls move the data directly from the
+ *       socket of c_i to the one of c_o, bb_i, bb_o and bsize being unused.
  */
 PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
                                                        request_rec *r,
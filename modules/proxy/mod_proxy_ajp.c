@@ -306,7 +306,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                  */
                 return HTTP_INTERNAL_SERVER_ERROR;
             }
-            conn->worker->s->transferred += bufsiz;
+            ap_proxy_atomic_add_off(&conn->worker->s->transferred, bufsiz);
             send_body = 1;
         }
         else if (content_length > 0) {
@@ -426,7 +426,8 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                         backend_failed = 1;
                         break;
                     }
-                    conn->worker->s->transferred += bufsiz;
+                    ap_proxy_atomic_add_off(&conn->worker->s->transferred,
+                                            bufsiz);
                 } else {
                     /*
                      * something is wrong TC asks for more body but we are
@@ -516,7 +517,8 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                             }
                             apr_brigade_length(output_brigade, 0, &bb_len);
                             if (bb_len != -1)
-                                conn->worker->s->read += bb_len;
+                                ap_proxy_atomic_add_off(
+                                        &conn->worker->s->read, bb_len);
                         }
                         if (headers_sent) {
                             if (ap_pass_brigade(r->output_filters,
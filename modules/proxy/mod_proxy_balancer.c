@@ -343,8 +343,9 @@ static proxy_worker *find_best_worker(proxy_balancer *balancer,
 {
     proxy_worker *candidate = NULL;
     apr_status_t rv;
+    int locked = !(balancer->lbmethod->flags & PROXY_LBMETHOD_NOLOCK);
 
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01163)
                       "%s: Lock failed for find_best_worker()",
                       balancer->s->name);
@@ -354,9 +355,9 @@ static proxy_worker *find_best_worker(proxy_balancer *balancer,
     candidate = (*balancer->lbmethod->finder)(balancer, r);
 
     if (candidate)
-        candidate->s->elected++;
+        ap_proxy_atomic_add_size(&candidate->s->elected, 1);
 
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01164)
                       "%s: Unlock failed for find_best_worker()",
                       balancer->s->name);
@@ -455,13 +456,28 @@ static void force_recovery(proxy_balancer *balancer, server_rec *s)
     }
 }
 
+/* Whether force_recovery() may change something, it stops at the first
+ * worker not in error.
+ */
+static int recovery_needed(proxy_balancer *balancer)
+{
+    proxy_worker **worker = (proxy_worker **)balancer->workers->elts;
+
+    return (balancer->workers->nelts > 0
+            && ((*worker)->s->status & PROXY_WORKER_IN_ERROR));
+}
+
+static int is_lock_free(proxy_balancer *balancer)
+{
+    return (balancer->lbmethod
+            && (balancer->lbmethod->flags & PROXY_LBMETHOD_NOLOCK));
+}
+
 static apr_status_t decrement_busy_count(void *worker_)
 {
     proxy_worker *worker = worker_;
-    
-    if (worker->s->busy) {
-        worker->s->busy--;
-    }
+
+    ap_proxy_atomic_dec_size(&worker->s->busy);
 
     return APR_SUCCESS;
 }
@@ -476,6 +492,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
     char *route = NULL;
     const char *sticky = NULL;
     apr_status_t rv;
+    int locked;
 
     *worker = NULL;
     /* Step 1: check if the url is for us
@@ -487,21 +504,40 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         !(*balancer = ap_proxy_get_balancer(r->pool, conf, *url, 1)))
         return DECLINED;
 
-    /* Step 2: Lock the LoadBalancer
+    /* Step 2: Lock the LoadBalancer.  If its lbmethod is lock free, the
+     * counters used by the elections are updated atomically and the lock
+     * is only needed (and held) while the workers are recovered or the
+     * member list is synced.
      * XXX: perhaps we need the process lock here
      */
-    if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01166)
-                      "%s: Lock failed for pre_request", (*balancer)->s->name);
-        return DECLINED;
-    }
+    locked = !is_lock_free(*balancer)
+             || (*balancer)->s->wupdated != (*balancer)->wupdated
+             || recovery_needed(*balancer);
+    if (locked) {
+        if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01166)
+                          "%s: Lock failed for pre_request",
+                          (*balancer)->s->name);
+            return DECLINED;
+        }
+
+        /* Step 3: force recovery */
+        force_recovery(*balancer, r->server);
 
-    /* Step 3: force recovery */
-    force_recovery(*balancer, r->server);
+        /* Step 3.5: Update member list for the balancer */
+        /* TODO: Implement as provider! */
+        ap_proxy_sync_balancer(*balancer, r->server, conf);
 
-    /* Step 3.5: Update member list for the balancer */
-    /* TODO: Implement as provider! */
-    ap_proxy_sync_balancer(*balancer, r->server, conf);
+        /* The sync may have changed the lbmethod */
+        if (is_lock_free(*balancer)) {
+            locked = 0;
+            if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03559)
+                              "%s: Unlock failed for pre_request",
+                              (*balancer)->s->name);
+            }
+        }
+    }
 
     /* Step 4: find the session route */
     runtime = find_session_route(*balancer, r, &route, &sticky, url);
@@ -524,14 +560,15 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
                  * not in error state or not disabled.
                  */
                 if (PROXY_WORKER_IS_USABLE(*workers)) {
-                    (*workers)->s->lbstatus += (*workers)->s->lbfactor;
+                    ap_proxy_atomic_add_int(&(*workers)->s->lbstatus,
+                                            (*workers)->s->lbfactor);
                     total_factor += (*workers)->s->lbfactor;
                 }
                 workers++;
             }
-            runtime->s->lbstatus -= total_factor;
+            ap_proxy_atomic_add_int(&runtime->s->lbstatus, -total_factor);
         }
-        runtime->s->elected++;
+        ap_proxy_atomic_add_size(&runtime->s->elected, 1);
 
         *worker = runtime;
     }
@@ -555,7 +592,8 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01167)
                           "%s: All workers are in error state for route (%s)",
                           (*balancer)->s->name, route);
-            if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+            if (locked
+                && (rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01168)
                               "%s: Unlock failed for pre_request",
                               (*balancer)->s->name);
@@ -564,7 +602,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         }
     }
 
-    if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01169)
                       "%s: Unlock failed for pre_request",
                       (*balancer)->s->name);
@@ -598,10 +636,18 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         *worker = runtime;
     }
 
-    (*worker)->s->busy++;
+    ap_proxy_atomic_add_size(&(*worker)->s->busy, 1);
     apr_pool_cleanup_register(r->pool, *worker, decrement_busy_count,
                               apr_pool_cleanup_null);
 
+    /* Remember when the worker was elected for the lbmethod's served() */
+    if ((*balancer)->lbmethod && (*balancer)->lbmethod->served) {
+        apr_time_t *elected = apr_palloc(r->pool, sizeof(*elected));
+        *elected = apr_time_now();
+        ap_set_module_config(r->request_config, &proxy_balancer_module,
+                             elected);
+    }
+
     /* Add balancer/worker info to env. */
     apr_table_setn(r->subprocess_env,
                    "BALANCER_NAME", (*balancer)->s->name);
@@ -642,6 +688,15 @@ static int proxy_balancer_post_request(proxy_worker *worker,
 
     apr_status_t rv;
 
+    if (balancer->lbmethod && balancer->lbmethod->served) {
+        apr_time_t *elected = ap_get_module_config(r->request_config,
+                                                   &proxy_balancer_module);
+        if (elected) {
+            balancer->lbmethod->served(balancer, worker, r,
+                                       apr_time_now() - *elected);
+        }
+    }
+
     if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01173)
                       "%s: Lock failed for post_request",
@@ -838,6 +893,20 @@ static int balancer_post_config(apr_pool_t *pconf, apr_pool_t *plog,
 
             balancer->max_workers = balancer->workers->nelts + balancer->growth;
 
+            /* Room for all the workers, so that the ones added at runtime
+             * by ap_proxy_sync_balancer() never move the array under the
+             * lock free elections.  The array is grown in place since it
+             * is shared by the copies of the balancer in the vhosts.
+             */
+            if (balancer->workers->nalloc < balancer->max_workers) {
+                char *elts = apr_pcalloc(pconf, balancer->max_workers
+                                                * sizeof(proxy_worker *));
+                memcpy(elts, balancer->workers->elts,
+                       balancer->workers->nelts * sizeof(proxy_worker *));
+                balancer->workers->elts = elts;
+                balancer->workers->nalloc = balancer->max_workers;
+            }
+
             /* Create global mutex */
             rv = ap_global_mutex_create(&(balancer->gmutex), NULL, balancer_mutex_type,
                                         balancer->s->sname, s, pconf, 0);
@@ -995,6 +1064,50 @@ static void push2table(const char *input, apr_table_t *params,
  * TODO:
  *   /.../<whatever>/balancer/worker/nonce
  */
+static void latency_xml(request_rec *r, proxy_worker *worker)
+{
+    static const char *const tags[PROXY_LATENCY_MAX] = {
+        "connect", "ttfb", "total"
+    };
+    proxy_latency_stats st;
+    int i;
+
+    ap_rputs("          <httpd:latency>\n", r);
+    for (i = 0; i < PROXY_LATENCY_MAX; i++) {
+        ap_proxy_latency_stats(worker, i, &st);
+        ap_rprintf(r,
+                   "            <httpd:%s>\n"
+                   "              <httpd:count>%u</httpd:count>\n"
+                   "              <httpd:p50>%" APR_TIME_T_FMT "</httpd:p50>\n"
+                   "              <httpd:p90>%" APR_TIME_T_FMT "</httpd:p90>\n"
+                   "              <httpd:p99>%" APR_TIME_T_FMT "</httpd:p99>\n"
+                   "              <httpd:p999>%" APR_TIME_T_FMT "</httpd:p999>\n"
+                   "            </httpd:%s>\n",
+                   tags[i], st.count, st.p50, st.p90, st.p99, st.p999,
+                   tags[i]);
+    }
+    ap_rputs("          </httpd:latency>\n", r);
+}
+
+/* Continues an open cell, as the rest of the worker row */
+static void latency_html(request_rec *r, proxy_worker *worker)
+{
+    proxy_latency_stats st;
+    int i;
+
+    for (i = 0; i < PROXY_LATENCY_MAX; i++) {
+        ap_proxy_latency_stats(worker, i, &st);
+        if (!st.count) {
+            ap_rputs("</td><td>-", r);
+            continue;
+        }
+        ap_rprintf(r, "</td><td title='p50 / p90 / p99 / p99.9 of %u'>"
+                   "%.1f / %.1f / %.1f / %.1f", st.count,
+                   st.p50 / 1000.0, st.p90 / 1000.0,
+                   st.p99 / 1000.0, st.p999 / 1000.0);
+    }
+}
+
 static int balancer_handler(request_rec *r)
 {
     void *sconf;
@@ -1005,6 +1118,8 @@ static int balancer_handler(request_rec *r)
     apr_table_t *params;
     int i, n;
     int ok2change = 1;
+    int has_spool;
+    proxy_shared_pool_stats spstats;
     const char *name;
     const char *action;
     apr_status_t rv;
@@ -1160,7 +1275,9 @@ static int balancer_handler(request_rec *r)
         if ((val = apr_table_get(params, "w_hm"))) {
             proxy_hcmethods_t *method = proxy_hcmethods;
             for (; method->name; method++) {
-                if (!ap_cstr_casecmp(method->name, val) && method->implemented)
+                if (!ap_cstr_casecmp(method->name, val) && method->implemented
+                        && (method->method != CPING
+                            || !strcasecmp(wsel->s->scheme, "ajp")))
                     wsel->s->method = method->method;
             }
         }
@@ -1177,7 +1294,8 @@ static int balancer_handler(request_rec *r)
                 *wsel->s->hcexpr = '\0';
         }
         /* If the health check method doesn't support an expr, then null it */
-        if (wsel->s->method == NONE || wsel->s->method == TCP) {
+        if (wsel->s->method == NONE || wsel->s->method == TCP
+                || wsel->s->method == CPING) {
             *wsel->s->hcexpr = '\0';
         }
         /* if enabling, we need to reset all lb params */
@@ -1435,6 +1553,19 @@ static int balancer_handler(request_rec *r)
                            worker->s->busy);
                 ap_rprintf(r, "          <httpd:lbset>%d</httpd:lbset>\n",
                            worker->s->lbset);
+                if (ap_proxy_shared_pool_stats(worker, &spstats) == APR_SUCCESS) {
+                    ap_rprintf(r,
+                               "          <httpd:shared_pool>\n"
+                               "            <httpd:idle>%u</httpd:idle>\n"
+                               "            <httpd:parked>%u</httpd:parked>\n"
+                               "            <httpd:reused>%u</httpd:reused>\n"
+                               "            <httpd:missed>%u</httpd:missed>\n"
+                               "            <httpd:expired>%u</httpd:expired>\n"
+                               "          </httpd:shared_pool>\n",
+                               spstats.idle, spstats.parked, spstats.reused,
+                               spstats.missed, spstats.expired);
+                }
+                latency_xml(r, worker);
                 /* End proxy_worker_stat */
                 if (!ap_cstr_casecmp(worker->s->scheme, "ajp")) {
                     ap_rputs("          <httpd:flushpackets>", r);
@@ -1578,13 +1709,21 @@ static int balancer_handler(request_rec *r)
                 "<th>Worker URL</th>"
                 "<th>Route</th><th>RouteRedir</th>"
                 "<th>Factor</th><th>Set</th><th>Status</th>"
-                "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>", r);
+                "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>"
+                "<th>Connect (ms)</th><th>TTFB (ms)</th><th>Total (ms)</th>", r);
             if (set_worker_hc_param_f) {
                 ap_rputs("<th>HC Method</th><th>HC Interval</th><th>Passes</th><th>Fails</th><th>HC uri</th><th>HC Expr</th>", r);
             }
+            workers = (proxy_worker **)balancer->workers->elts;
+            for (has_spool = n = 0; n < balancer->workers->nelts; n++) {
+                if (workers[n]->spool) {
+                    ap_rputs("<th>Pooled</th><th>Reused</th><th>Missed</th><th>Expired</th>", r);
+                    has_spool = 1;
+                    break;
+                }
+            }
             ap_rputs("</tr>\n", r);
 
-            workers = (proxy_worker **)balancer->workers->elts;
             for (n = 0; n < balancer->workers->nelts; n++) {
                 char fbuf[50];
                 worker = *workers;
@@ -1610,6 +1749,7 @@ static int balancer_handler(request_rec *r)
                 ap_rputs(apr_strfsize(worker->s->transferred, fbuf), r);
                 ap_rputs("</td><td>", r);
                 ap_rputs(apr_strfsize(worker->s->read, fbuf), r);
+                latency_html(r, worker);
                 if (set_worker_hc_param_f) {
                     ap_rprintf(r, "</td><td>%s</td>", ap_proxy_show_hcmethod(worker->s->method));
                     ap_rprintf(r, "<td>%d</td>", (int)apr_time_sec(worker->s->interval));
@@ -1618,6 +1758,16 @@ static int balancer_handler(request_rec *r)
                     ap_rprintf(r, "<td>%s</td>", worker->s->hcuri);
                     ap_rprintf(r, "<td>%s", worker->s->hcexpr);
                 }
+                if (has_spool) {
+                    if (ap_proxy_shared_pool_stats(worker, &spstats) == APR_SUCCESS) {
+                        ap_rprintf(r, "</td><td>%u</td><td>%u</td><td>%u</td>"
+                                   "<td>%u", spstats.idle, spstats.reused,
+                                   spstats.missed, spstats.expired);
+                    }
+                    else {
+                        ap_rputs("</td><td>-</td><td>-</td><td>-</td><td>-", r);
+                    }
+                }
                 ap_rputs("</td></tr>\n", r);
 
                 ++workers;
@@ -1670,7 +1820,9 @@ static int balancer_handler(request_rec *r)
                 ap_rputs("<tr><td colspan='2'>\n<table align='center'><tr><th>Health Check param</th><th>Value</th></tr>\n", r);
                 ap_rputs("<tr><td>Method</td><td><select name='w_hm'>\n", r);
                 for (; method->name; method++) {
-                    if (method->implemented) {
+                    if (method->implemented
+                            && (method->method != CPING
+                                || !strcasecmp(wsel->s->scheme, "ajp"))) {
                         ap_rprintf(r, "<option value='%s' %s >%s</option>\n",
                                 method->name,
                                 (wsel->s->method == method->method) ? "selected" : "",
@@ -17,6 +17,7 @@
 #include "mod_proxy.h"
 #include "util_fcgi.h"
 #include "util_script.h"
+#include "apr_thread_cond.h"
 
 module AP_MODULE_DECLARE_DATA proxy_fcgi_module;
 
@@ -24,6 +25,63 @@ typedef struct {
     int need_dirwalk;
 } fcgi_req_config_t;
 
+/*
+ * Multiplexing (multiplex=N): when the application accepts it (see
+ * FCGI_MPXS_CONNS in mux_negotiate()), up to N requests share a backend
+ * connection, each with its own request id.  The records are sent whole
+ * by one thread at a time, and read by whichever of the requests' threads
+ * needs one, the records of the other requests being queued for them
+ * (mux_get_data()), so no thread is dedicated to the connections.  The
+ * records queued for a request are limited (FCGI_MUX_MAX_QUEUED), the
+ * connection is not read further until it consumes them, so a slow client
+ * holds the application back as without multiplexing.
+ */
+typedef struct fcgi_mux_chunk fcgi_mux_chunk;
+struct fcgi_mux_chunk {
+    fcgi_mux_chunk *next;
+    apr_size_t len, pos;
+    char data[1];               /* a whole record (header included) */
+};
+
+#define FCGI_SLOT_FREE    0
+#define FCGI_SLOT_BUSY    1
+#define FCGI_SLOT_ABORTED 2     /* until its FCGI_END_REQUEST */
+
+#define FCGI_MUX_MAX_QUEUED (4 * AP_IOBUFSIZE)
+
+typedef struct {
+    fcgi_mux_chunk *first, *last;
+    apr_size_t queued;          /* bytes of the records queued */
+    int state;
+    int ended;                  /* FCGI_END_REQUEST queued */
+} fcgi_mux_slot;
+
+typedef struct fcgi_mux fcgi_mux;
+typedef struct fcgi_mux_conn fcgi_mux_conn;
+struct fcgi_mux_conn {
+    fcgi_mux_conn *next;
+    fcgi_mux *mux;
+    proxy_conn_rec *conn;       /* conn->data points back here */
+    fcgi_mux_slot *slots;       /* by request id - 1 */
+    int nslots;
+    int busy;                   /* slots not free */
+    int requests;               /* requests using the connection */
+    apr_status_t error;         /* once broken */
+    unsigned int reading:1;     /* a thread is reading a record */
+    unsigned int writing:1;     /* a thread is sending a record */
+    unsigned int broken:1;
+};
+
+/* Per worker (and child), in worker->context */
+struct fcgi_mux {
+    apr_thread_mutex_t *mutex;  /* protects all but the socket I/O */
+    apr_thread_cond_t *cond;    /* broadcast when any state changes */
+    fcgi_mux_conn *conns;
+    int limit;                  /* requests per connection, 0 when the
+                                 * application does not multiplex, -1
+                                 * until asked */
+};
+
 /*
  * Canonicalise http-like URLs.
  * scheme is the scheme for the URL
@@ -133,6 +191,43 @@ static int proxy_fcgi_canon(request_rec *r, char *url)
     return OK;
 }
 
+/* The records of the requests multiplexed on a connection are sent whole,
+ * one at a time.
+ */
+static apr_status_t mux_write_lock(fcgi_mux_conn *mc)
+{
+    fcgi_mux *mux = mc->mux;
+    apr_status_t rv = APR_SUCCESS;
+
+    apr_thread_mutex_lock(mux->mutex);
+    while (mc->writing && !mc->broken) {
+        apr_thread_cond_wait(mux->cond, mux->mutex);
+    }
+    if (mc->broken) {
+        rv = mc->error;
+    }
+    else {
+        mc->writing = 1;
+    }
+    apr_thread_mutex_unlock(mux->mutex);
+
+    return rv;
+}
+
+static void mux_write_unlock(fcgi_mux_conn *mc, apr_status_t rv)
+{
+    fcgi_mux *mux = mc->mux;
+
+    apr_thread_mutex_lock(mux->mutex);
+    mc->writing = 0;
+    if (rv != APR_SUCCESS && !mc->broken) {
+        mc->broken = 1;
+        mc->error = rv;
+    }
+    apr_thread_cond_broadcast(mux->cond);
+    apr_thread_mutex_unlock(mux->mutex);
+}
+
 /* Wrapper for apr_socket_sendv that handles updating the worker stats. */
 static apr_status_t send_data(proxy_conn_rec *conn,
                               struct iovec *vec,
@@ -143,11 +238,17 @@ static apr_status_t send_data(proxy_conn_rec *conn,
     apr_size_t written = 0, to_write = 0;
     int i, offset;
     apr_socket_t *s = conn->sock;
+    fcgi_mux_conn *mc = conn->data;
 
     for (i = 0; i < nvec; i++) {
         to_write += vec[i].iov_len;
     }
 
+    if (mc && (rv = mux_write_lock(mc)) != APR_SUCCESS) {
+        *len = 0;
+        return rv;
+    }
+
     offset = 0;
     while (to_write) {
         apr_size_t n = 0;
@@ -172,27 +273,236 @@ static apr_status_t send_data(proxy_conn_rec *conn,
         }
     }
 
-    conn->worker->s->transferred += written;
+    if (mc) {
+        mux_write_unlock(mc, rv);
+    }
+
+    ap_proxy_atomic_add_off(&conn->worker->s->transferred, written);
     *len = written;
 
     return rv;
 }
 
 /* Wrapper for apr_socket_recv that handles updating the worker stats. */
-static apr_status_t get_data(proxy_conn_rec *conn,
-                             char *buffer,
-                             apr_size_t *buflen)
+static apr_status_t recv_data(proxy_conn_rec *conn,
+                              char *buffer,
+                              apr_size_t *buflen)
 {
     apr_status_t rv = apr_socket_recv(conn->sock, buffer, buflen);
 
     if (rv == APR_SUCCESS) {
-        conn->worker->s->read += *buflen;
+        ap_proxy_atomic_add_off(&conn->worker->s->read, *buflen);
+    }
+
+    return rv;
+}
+
+static apr_status_t recv_data_full(proxy_conn_rec *conn,
+                                   char *buffer,
+                                   apr_size_t buflen)
+{
+    apr_size_t readlen;
+    apr_size_t cumulative_len = 0;
+    apr_status_t rv;
+
+    do {
+        readlen = buflen - cumulative_len;
+        rv = recv_data(conn, buffer + cumulative_len, &readlen);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        cumulative_len += readlen;
+    } while (cumulative_len < buflen);
+
+    return APR_SUCCESS;
+}
+
+/* Reads the next record of a multiplexed connection and queues it for its
+ * request, or returns APR_EAGAIN if none is readable and !block, or
+ * APR_TIMEUP if none came in time (the connection is still usable).
+ * A record for another request than the caller's (request_id) waits for
+ * that request to consume its queue first, if full.  Called and returning
+ * with the mux mutex held, when no other thread is reading.
+ */
+static apr_status_t mux_read_record(fcgi_mux_conn *mc,
+                                    apr_uint16_t request_id, int block)
+{
+    fcgi_mux *mux = mc->mux;
+    proxy_conn_rec *conn = mc->conn;
+    fcgi_mux_chunk *chunk = NULL;
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    unsigned char version, type, plen;
+    apr_uint16_t rid, clen;
+    apr_status_t rv = APR_SUCCESS;
+    int idle = 0;
+
+    mc->reading = 1;
+    apr_thread_mutex_unlock(mux->mutex);
+
+    if (!block) {
+        apr_pollfd_t pfd;
+        apr_int32_t n;
+
+        memset(&pfd, 0, sizeof(pfd));
+        pfd.desc_type = APR_POLL_SOCKET;
+        pfd.desc.s = conn->sock;
+        pfd.reqevents = APR_POLLIN;
+        if (apr_poll(&pfd, 1, &n, 0) != APR_SUCCESS) {
+            rv = APR_EAGAIN;
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        apr_size_t readlen = AP_FCGI_HEADER_LEN;
+
+        rv = recv_data(conn, (char *)farray, &readlen);
+        if (rv == APR_SUCCESS && readlen < AP_FCGI_HEADER_LEN) {
+            rv = recv_data_full(conn, (char *)farray + readlen,
+                                AP_FCGI_HEADER_LEN - readlen);
+        }
+        else if (APR_STATUS_IS_TIMEUP(rv)) {
+            /* Timed out between two records, nothing is lost */
+            idle = 1;
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        ap_fcgi_header_fields_from_array(&version, &type, &rid,
+                                         &clen, &plen, farray);
+        if (version != AP_FCGI_VERSION_1) {
+            rv = APR_EINVAL;
+        }
+    }
+    if (rv == APR_SUCCESS && rid && rid != request_id && rid <= mc->nslots) {
+        fcgi_mux_slot *slot = &mc->slots[rid - 1];
+
+        apr_thread_mutex_lock(mux->mutex);
+        while (slot->state == FCGI_SLOT_BUSY && !mc->broken
+               && slot->queued >= FCGI_MUX_MAX_QUEUED) {
+            apr_thread_cond_wait(mux->cond, mux->mutex);
+        }
+        apr_thread_mutex_unlock(mux->mutex);
+    }
+    if (rv == APR_SUCCESS) {
+        apr_size_t len = AP_FCGI_HEADER_LEN + clen + plen;
+
+        chunk = ap_malloc(APR_OFFSETOF(fcgi_mux_chunk, data) + len);
+        chunk->next = NULL;
+        chunk->len = len;
+        chunk->pos = 0;
+        memcpy(chunk->data, farray, AP_FCGI_HEADER_LEN);
+        rv = recv_data_full(conn, chunk->data + AP_FCGI_HEADER_LEN,
+                            clen + plen);
     }
 
+    apr_thread_mutex_lock(mux->mutex);
+    mc->reading = 0;
+    if (rv == APR_SUCCESS) {
+        fcgi_mux_slot *slot = NULL;
+
+        if (rid && rid <= mc->nslots) {
+            slot = &mc->slots[rid - 1];
+        }
+        if (slot && slot->state == FCGI_SLOT_BUSY) {
+            if (slot->last) {
+                slot->last->next = chunk;
+            }
+            else {
+                slot->first = chunk;
+            }
+            slot->last = chunk;
+            slot->queued += chunk->len;
+            chunk = NULL;
+            if (type == AP_FCGI_END_REQUEST) {
+                slot->ended = 1;
+            }
+        }
+        else if (slot && slot->state == FCGI_SLOT_ABORTED
+                 && type == AP_FCGI_END_REQUEST) {
+            slot->state = FCGI_SLOT_FREE;
+            mc->busy--;
+        }
+        /* else a management record or the rest of an aborted request */
+    }
+    else if (!APR_STATUS_IS_EAGAIN(rv) && !idle) {
+        mc->broken = 1;
+        mc->error = rv;
+    }
+    free(chunk);
+    apr_thread_cond_broadcast(mux->cond);
+
     return rv;
 }
 
+/* Reads the (queued) records of a request on a multiplexed connection */
+static apr_status_t mux_get_data(fcgi_mux_conn *mc,
+                                 apr_uint16_t request_id,
+                                 char *buffer,
+                                 apr_size_t *buflen)
+{
+    fcgi_mux *mux = mc->mux;
+    fcgi_mux_slot *slot = &mc->slots[request_id - 1];
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t len = 0;
+
+    apr_thread_mutex_lock(mux->mutex);
+    while (!slot->first && !mc->broken) {
+        if (mc->reading) {
+            apr_thread_cond_wait(mux->cond, mux->mutex);
+        }
+        else if (APR_STATUS_IS_TIMEUP(rv = mux_read_record(mc, request_id,
+                                                           1))) {
+            /* Only this request times out, the others go on */
+            break;
+        }
+        else {
+            rv = APR_SUCCESS;
+        }
+    }
+    while (len < *buflen && slot->first) {
+        fcgi_mux_chunk *chunk = slot->first;
+        apr_size_t n = chunk->len - chunk->pos;
+
+        if (n > *buflen - len) {
+            n = *buflen - len;
+        }
+        memcpy(buffer + len, chunk->data + chunk->pos, n);
+        chunk->pos += n;
+        len += n;
+        if (slot->queued >= FCGI_MUX_MAX_QUEUED
+                && slot->queued - n < FCGI_MUX_MAX_QUEUED) {
+            /* The reader may be waiting for us */
+            apr_thread_cond_broadcast(mux->cond);
+        }
+        slot->queued -= n;
+        if (chunk->pos == chunk->len) {
+            slot->first = chunk->next;
+            if (!slot->first) {
+                slot->last = NULL;
+            }
+            free(chunk);
+        }
+    }
+    if (!len && rv == APR_SUCCESS) {
+        rv = mc->error;
+    }
+    apr_thread_mutex_unlock(mux->mutex);
+
+    *buflen = len;
+    return rv;
+}
+
+static apr_status_t get_data(proxy_conn_rec *conn,
+                             apr_uint16_t request_id,
+                             char *buffer,
+                             apr_size_t *buflen)
+{
+    if (conn->data) {
+        return mux_get_data(conn->data, request_id, buffer, buflen);
+    }
+    return recv_data(conn, buffer, buflen);
+}
+
 static apr_status_t get_data_full(proxy_conn_rec *conn,
+                                  apr_uint16_t request_id,
                                   char *buffer,
                                   apr_size_t buflen)
 {
@@ -202,7 +512,7 @@ static apr_status_t get_data_full(proxy_conn_rec *conn,
 
     do {
         readlen = buflen - cumulative_len;
-        rv = get_data(conn, buffer + cumulative_len, &readlen);
+        rv = get_data(conn, request_id, buffer + cumulative_len, &readlen);
         if (rv != APR_SUCCESS) {
             return rv;
         }
@@ -212,6 +522,46 @@ static apr_status_t get_data_full(proxy_conn_rec *conn,
     return APR_SUCCESS;
 }
 
+/* Wrapper for apr_poll, on a multiplexed connection the socket is always
+ * writable (sends block) and readable if some record is queued for the
+ * request, the ones readable already are read first.
+ */
+static apr_status_t poll_data(proxy_conn_rec *conn,
+                              apr_uint16_t request_id,
+                              apr_pollfd_t *pfd,
+                              apr_interval_time_t timeout)
+{
+    fcgi_mux_conn *mc = conn->data;
+    fcgi_mux_slot *slot;
+    apr_int32_t n;
+
+    if (!mc) {
+        return apr_poll(pfd, 1, &n, timeout);
+    }
+
+    if (!(pfd->reqevents & APR_POLLOUT)) {
+        /* get_data() waits for the records */
+        pfd->rtnevents = APR_POLLIN;
+        return APR_SUCCESS;
+    }
+    slot = &mc->slots[request_id - 1];
+    pfd->rtnevents = APR_POLLOUT;
+    apr_thread_mutex_lock(mc->mux->mutex);
+    /* The application may wait for its output to be read before it
+     * reads more input.
+     */
+    while (!slot->first && !mc->broken && !mc->reading
+           && mux_read_record(mc, request_id, 0) == APR_SUCCESS) {
+        continue;
+    }
+    if (slot->first || mc->broken) {
+        pfd->rtnevents |= APR_POLLIN;
+    }
+    apr_thread_mutex_unlock(mc->mux->mutex);
+
+    return APR_SUCCESS;
+}
+
 static apr_status_t send_begin_request(proxy_conn_rec *conn,
                                        apr_uint16_t request_id)
 {
@@ -226,7 +576,8 @@ static apr_status_t send_begin_request(proxy_conn_rec *conn,
                            sizeof(abrb), 0);
 
     ap_fcgi_fill_in_request_body(&brb, AP_FCGI_RESPONDER,
-                                 ap_proxy_connection_reusable(conn)
+                                 (conn->data
+                                  || ap_proxy_connection_reusable(conn))
                                      ? AP_FCGI_KEEP_CONN : 0);
 
     ap_fcgi_header_to_array(&header, farray);
@@ -475,13 +826,12 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
     while (! done) {
         apr_interval_time_t timeout;
         apr_size_t len;
-        int n;
 
         /* We need SOME kind of timeout here, or virtually anything will
          * cause timeout errors. */
         apr_socket_timeout_get(conn->sock, &timeout);
 
-        rv = apr_poll(&pfd, 1, &n, timeout);
+        rv = poll_data(conn, request_id, &pfd, timeout);
         if (rv != APR_SUCCESS) {
             if (APR_STATUS_IS_EINTR(rv)) {
                 continue;
@@ -581,7 +931,8 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
             unsigned char type, version;
 
             /* First, we grab the header... */
-            rv = get_data_full(conn, (char *) farray, AP_FCGI_HEADER_LEN);
+            rv = get_data_full(conn, request_id, (char *) farray,
+                               AP_FCGI_HEADER_LEN);
             if (rv != APR_SUCCESS) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01067)
                               "Failed to read FastCGI header");
@@ -620,7 +971,7 @@ recv_again:
              * recv call, this will eventually change when we move to real
              * nonblocking recv calls. */
             if (readbuflen != 0) {
-                rv = get_data(conn, iobuf, &readbuflen);
+                rv = get_data(conn, request_id, iobuf, &readbuflen);
                 if (rv != APR_SUCCESS) {
                     *err = "reading response body";
                     break;
@@ -790,7 +1141,7 @@ recv_again:
             }
 
             if (plen) {
-                rv = get_data_full(conn, iobuf, plen);
+                rv = get_data_full(conn, request_id, iobuf, plen);
                 if (rv != APR_SUCCESS) {
                     ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02537)
                                   "Error occurred reading padding");
@@ -819,14 +1170,12 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
                            conn_rec *origin,
                            proxy_dir_conf *conf,
                            apr_uri_t *uri,
-                           char *url, char *server_portstr)
+                           char *url, char *server_portstr,
+                           apr_uint16_t request_id)
 {
     /* Request IDs are arbitrary numbers that we assign to a
-     * single request. This would allow multiplex/pipelining of
-     * multiple requests to the same FastCGI connection, but
-     * we don't support that, and always use a value of '1' to
-     * keep things simple. */
-    apr_uint16_t request_id = 1;
+     * single request, always '1' unless the connection is
+     * multiplexed. */
     apr_status_t rv;
     apr_pool_t *temp_pool;
     const char *err;
@@ -888,6 +1237,298 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
 
 #define FCGI_SCHEME "FCGI"
 
+/* Returns the multiplexing state of the worker, or NULL if multiplexing
+ * is not configured (or possible).
+ */
+static fcgi_mux *mux_get(proxy_worker *worker)
+{
+#if APR_HAS_THREADS
+    fcgi_mux *mux = worker->context;
+
+    if (mux || worker->s->multiplex <= 1 || !worker->s->hmax
+            || !worker->s->is_address_reusable || worker->s->disablereuse) {
+        return mux;
+    }
+
+    apr_thread_mutex_lock(worker->tmutex);
+    if (!worker->context) {
+        mux = apr_pcalloc(worker->cp->pool, sizeof(*mux));
+        mux->limit = -1;
+        if (apr_thread_mutex_create(&mux->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                    worker->cp->pool) == APR_SUCCESS
+                && apr_thread_cond_create(&mux->cond,
+                                          worker->cp->pool) == APR_SUCCESS) {
+            worker->context = mux;
+        }
+    }
+    mux = worker->context;
+    apr_thread_mutex_unlock(worker->tmutex);
+
+    return mux;
+#else
+    return NULL;
+#endif
+}
+
+/* Decodes the length of a name or value (FCGI_GET_VALUES_RESULT) */
+static int mux_pair_len(const unsigned char **pos, const unsigned char *end,
+                        apr_size_t *len)
+{
+    const unsigned char *p = *pos;
+
+    if (p >= end) {
+        return 0;
+    }
+    if (*p & 0x80) {
+        if (end - p < 4) {
+            return 0;
+        }
+        *len = ((apr_size_t)(p[0] & 0x7f) << 24) | ((apr_size_t)p[1] << 16)
+               | ((apr_size_t)p[2] << 8) | p[3];
+        *pos = p + 4;
+    }
+    else {
+        *len = *p;
+        *pos = p + 1;
+    }
+    return 1;
+}
+
+/* Asks the application (FCGI_GET_VALUES) whether it accepts multiplexed
+ * connections, once per child.  Returns the number of requests to
+ * multiplex per connection, 0 for none, or -1 if the connection failed.
+ */
+static int mux_negotiate(fcgi_mux *mux, proxy_conn_rec *conn,
+                         request_rec *r)
+{
+    static const char names[] = "\017\000FCGI_MPXS_CONNS"
+                                "\015\000FCGI_MAX_REQS";
+    struct iovec vec[2];
+    ap_fcgi_header header;
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    unsigned char version, type, plen;
+    apr_uint16_t rid, clen;
+    const unsigned char *pos, *end;
+    unsigned char *body = NULL;
+    int mpxs = 0, max_reqs = 0, limit;
+    apr_status_t rv;
+    apr_size_t len;
+
+    apr_thread_mutex_lock(mux->mutex);
+    limit = mux->limit;
+    apr_thread_mutex_unlock(mux->mutex);
+    if (limit >= 0) {
+        return limit;
+    }
+
+    ap_fcgi_fill_in_header(&header, AP_FCGI_GET_VALUES, 0,
+                           sizeof(names) - 1, 0);
+    ap_fcgi_header_to_array(&header, farray);
+    vec[0].iov_base = (void *)farray;
+    vec[0].iov_len = sizeof(farray);
+    vec[1].iov_base = (void *)names;
+    vec[1].iov_len = sizeof(names) - 1;
+
+    rv = send_data(conn, vec, 2, &len);
+    if (rv == APR_SUCCESS) {
+        rv = get_data_full(conn, 0, (char *)farray, AP_FCGI_HEADER_LEN);
+    }
+    if (rv == APR_SUCCESS) {
+        ap_fcgi_header_fields_from_array(&version, &type, &rid,
+                                         &clen, &plen, farray);
+        if (version != AP_FCGI_VERSION_1 || rid != 0) {
+            rv = APR_EINVAL;
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        body = apr_palloc(r->pool, clen + plen + 1);
+        rv = get_data_full(conn, 0, (char *)body, clen + plen);
+    }
+    if (rv != APR_SUCCESS) {
+        /* Don't ask again, the application may not answer */
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03513)
+                      "FCGI_GET_VALUES to %s failed, not multiplexing",
+                      conn->hostname);
+        apr_thread_mutex_lock(mux->mutex);
+        mux->limit = 0;
+        apr_thread_mutex_unlock(mux->mutex);
+        return -1;
+    }
+
+    /* FCGI_UNKNOWN_TYPE or anything else means no multiplexing */
+    if (type == AP_FCGI_GET_VALUES_RESULT) {
+        apr_size_t nlen, vlen;
+
+        pos = body;
+        end = body + clen;
+        while (mux_pair_len(&pos, end, &nlen)
+               && mux_pair_len(&pos, end, &vlen)
+               && nlen + vlen <= (apr_size_t)(end - pos)) {
+            const char *value = apr_pstrmemdup(r->pool,
+                                               (const char *)pos + nlen,
+                                               vlen);
+
+            if (nlen == 15 && !memcmp(pos, "FCGI_MPXS_CONNS", 15)) {
+                mpxs = atoi(value);
+            }
+            else if (nlen == 13 && !memcmp(pos, "FCGI_MAX_REQS", 13)) {
+                max_reqs = atoi(value);
+            }
+            pos += nlen + vlen;
+        }
+    }
+
+    limit = 0;
+    if (mpxs > 0) {
+        limit = conn->worker->s->multiplex;
+        if (max_reqs > 0 && max_reqs < limit) {
+            limit = max_reqs;
+        }
+        if (limit > 65535) {
+            limit = 65535;
+        }
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(03514)
+                  "application %s: FCGI_MPXS_CONNS=%d FCGI_MAX_REQS=%d, "
+                  "multiplexing %d requests per connection",
+                  conn->hostname, mpxs, max_reqs, limit);
+
+    apr_thread_mutex_lock(mux->mutex);
+    mux->limit = limit;
+    apr_thread_mutex_unlock(mux->mutex);
+    return limit;
+}
+
+/* Takes a request id on a multiplexed connection, if one can take more */
+static fcgi_mux_conn *mux_join(fcgi_mux *mux, apr_uint16_t *request_id)
+{
+    fcgi_mux_conn *mc;
+    int i;
+
+    apr_thread_mutex_lock(mux->mutex);
+    for (mc = mux->conns; mc; mc = mc->next) {
+        if (!mc->broken && mc->busy < mc->nslots) {
+            break;
+        }
+    }
+    if (mc) {
+        for (i = 0; mc->slots[i].state != FCGI_SLOT_FREE; ++i)
+            ;
+        mc->slots[i].state = FCGI_SLOT_BUSY;
+        mc->slots[i].ended = 0;
+        mc->busy++;
+        mc->requests++;
+        *request_id = i + 1;
+    }
+    apr_thread_mutex_unlock(mux->mutex);
+
+    return mc;
+}
+
+/* Makes a connection multiplexed, for the request id 1 */
+static fcgi_mux_conn *mux_open(fcgi_mux *mux, proxy_conn_rec *conn,
+                               int limit)
+{
+    fcgi_mux_conn *mc = ap_calloc(1, sizeof(*mc));
+
+    mc->mux = mux;
+    mc->conn = conn;
+    mc->slots = ap_calloc(limit, sizeof(*mc->slots));
+    mc->nslots = limit;
+    mc->slots[0].state = FCGI_SLOT_BUSY;
+    mc->busy = mc->requests = 1;
+    conn->data = mc;
+
+    apr_thread_mutex_lock(mux->mutex);
+    mc->next = mux->conns;
+    mux->conns = mc;
+    apr_thread_mutex_unlock(mux->mutex);
+
+    return mc;
+}
+
+static void mux_free_records(fcgi_mux_slot *slot)
+{
+    while (slot->first) {
+        fcgi_mux_chunk *chunk = slot->first;
+        slot->first = chunk->next;
+        free(chunk);
+    }
+    slot->last = NULL;
+    slot->queued = 0;
+}
+
+/* Gives back the request id, aborting the request if it did not end.
+ * Returns the connection to release if this was the last request on it.
+ */
+static proxy_conn_rec *mux_leave(fcgi_mux_conn *mc,
+                                 apr_uint16_t request_id)
+{
+    fcgi_mux *mux = mc->mux;
+    fcgi_mux_slot *slot = &mc->slots[request_id - 1];
+    proxy_conn_rec *conn = NULL;
+    int abort;
+
+    apr_thread_mutex_lock(mux->mutex);
+    mux_free_records(slot);
+    abort = (!slot->ended && !mc->broken && mc->requests > 1);
+    if (abort) {
+        slot->state = FCGI_SLOT_ABORTED;
+    }
+    else if (slot->ended || mc->broken) {
+        slot->state = FCGI_SLOT_FREE;
+        mc->busy--;
+    }
+    else {
+        /* Last one, the connection will be closed */
+        slot->state = FCGI_SLOT_ABORTED;
+    }
+    /* The reader may be waiting for our records to be consumed */
+    apr_thread_cond_broadcast(mux->cond);
+    apr_thread_mutex_unlock(mux->mutex);
+
+    if (abort) {
+        /* Let the application know, the others continue */
+        struct iovec vec[1];
+        ap_fcgi_header header;
+        unsigned char farray[AP_FCGI_HEADER_LEN];
+        apr_size_t len;
+
+        ap_fcgi_fill_in_header(&header, AP_FCGI_ABORT_REQUEST, request_id,
+                               0, 0);
+        ap_fcgi_header_to_array(&header, farray);
+        vec[0].iov_base = (void *)farray;
+        vec[0].iov_len = sizeof(farray);
+        send_data(mc->conn, vec, 1, &len);
+    }
+
+    apr_thread_mutex_lock(mux->mutex);
+    if (--mc->requests == 0) {
+        fcgi_mux_conn **pmc;
+
+        for (pmc = &mux->conns; *pmc != mc; pmc = &(*pmc)->next)
+            ;
+        *pmc = mc->next;
+        conn = mc->conn;
+    }
+    apr_thread_mutex_unlock(mux->mutex);
+
+    if (conn) {
+        int i;
+
+        /* Reusable if all the requests ended */
+        conn->close = (mc->broken || mc->busy > 0);
+        conn->data = NULL;
+        for (i = 0; i < mc->nslots; ++i) {
+            mux_free_records(&mc->slots[i]);
+        }
+        free(mc->slots);
+        free(mc);
+    }
+    return conn;
+}
+
+
 /*
  * This handles fcgi:(dest) URLs
  */
@@ -901,6 +1542,11 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
     conn_rec *origin = NULL;
     proxy_conn_rec *backend = NULL;
     apr_uri_t *uri;
+    fcgi_mux *mux;
+    fcgi_mux_conn *mc;
+    apr_uint16_t request_id = 1;
+    char *orig_url = url;
+    int limit;
 
     proxy_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
                                                  &proxy_module);
@@ -952,7 +1598,22 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
         backend->close = 0;
     }
 
-    /* Step Two: Make the Connection */
+    /* Step Two: Make the Connection, or share one */
+    mux = mux_get(worker);
+    if (mux && (mc = mux_join(mux, &request_id)) != NULL) {
+        proxy_conn_rec *conn;
+
+        /* Keep ours for later */
+        backend->close = 0;
+
+        status = fcgi_do_request(p, r, mc->conn, origin, dconf, uri, url,
+                                 server_portstr, request_id);
+        conn = mux_leave(mc, request_id);
+        if (conn) {
+            ap_proxy_release_connection(FCGI_SCHEME, conn, r->server);
+        }
+        goto cleanup;
+    }
     if (ap_proxy_check_connection(FCGI_SCHEME, backend, r->server, 0,
                                   PROXY_CHECK_CONN_EMPTY)
             && ap_proxy_connect_backend(FCGI_SCHEME, backend, worker,
@@ -964,12 +1625,52 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
         goto cleanup;
     }
 
+    if (mux) {
+        limit = mux_negotiate(mux, backend, r);
+        if (limit < 0) {
+            /* The application won't be asked again, serve the request
+             * without multiplexing on a new connection since it may still
+             * be reading the FCGI_GET_VALUES record (or be gone).
+             */
+            backend->close = 1;
+            url = orig_url;
+            status = ap_proxy_determine_connection(p, r, conf, worker,
+                                                   backend, uri, &url,
+                                                   proxyname, proxyport,
+                                                   server_portstr,
+                                                   sizeof(server_portstr));
+            if (status != OK) {
+                goto cleanup;
+            }
+            backend->close = !(worker->s->disablereuse_set
+                               && !worker->s->disablereuse);
+            if (ap_proxy_connect_backend(FCGI_SCHEME, backend, worker,
+                                         r->server)) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(03558)
+                              "failed to reconnect to backend: %s",
+                              backend->hostname);
+                status = HTTP_SERVICE_UNAVAILABLE;
+                goto cleanup;
+            }
+        }
+        else if (limit > 1) {
+            /* Step Three: Process the Request, others may join */
+            mc = mux_open(mux, backend, limit);
+            status = fcgi_do_request(p, r, backend, origin, dconf, uri, url,
+                                     server_portstr, 1);
+            backend = mux_leave(mc, 1);
+            goto cleanup;
+        }
+    }
+
     /* Step Three: Process the Request */
     status = fcgi_do_request(p, r, backend, origin, dconf, uri, url,
-                             server_portstr);
+                             server_portstr, request_id);
 
 cleanup:
-    ap_proxy_release_connection(FCGI_SCHEME, backend, r->server);
+    if (backend) {
+        ap_proxy_release_connection(FCGI_SCHEME, backend, r->server);
+    }
     return status;
 }
 
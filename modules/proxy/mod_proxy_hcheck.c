@@ -17,6 +17,7 @@
 #include "mod_watchdog.h"
 #include "ap_slotmem.h"
 #include "ap_expr.h"
+#include "apr_poll.h"
 #if APR_HAS_THREADS
 #include "apr_thread_pool.h"
 #endif
@@ -26,6 +27,11 @@ module AP_MODULE_DECLARE_DATA proxy_hcheck_module;
 #define HCHECK_WATHCHDOG_NAME ("_proxy_hcheck_")
 #define HC_THREADPOOL_SIZE (16)
 
+/* How long the event driven checks run for each watchdog call, and the
+ * most of a response they read */
+#define HC_EVENT_SLICE apr_time_from_msec(500)
+#define HC_EVENT_BUFSIZE_MAX (64 * 1024)
+
 /* Why? So we can easily set/clear HC_USE_THREADS during dev testing */
 #if APR_HAS_THREADS
 #define HC_USE_THREADS 1
@@ -59,6 +65,11 @@ typedef struct {
     apr_thread_pool_t *hctp;
     int tpsize;
     server_rec *s;
+    apr_pool_t *evpool;          /* event driven checks' pool */
+    apr_pollset_t *pollset;      /* ... their sockets */
+    apr_hash_t *events;          /* ... hc_event_t by worker */
+    apr_array_header_t *heap;    /* ... hc_event_t* by time */
+    apr_time_t scanned;          /* last scan of the workers */
 } sctx_t;
 
 /* Used in the HC worker via the context field */
@@ -75,6 +86,44 @@ typedef struct {
     apr_time_t now;
 } baton_t;
 
+typedef enum {
+    HC_EV_IDLE,
+    HC_EV_CONNECT,
+    HC_EV_SEND,
+    HC_EV_RECV
+} hc_ev_state_e;
+
+/* An event driven check */
+typedef struct {
+    proxy_worker *worker;       /* The checked worker */
+    proxy_worker *hc;           /* ... and its hc worker */
+    hc_ev_state_e state;
+    apr_time_t when;            /* Next run, or deadline while running */
+    int heap;                   /* Index in sctx_t->heap */
+    apr_socket_t *sock;         /* Kept between runs if reusable */
+    apr_pool_t *spool;          /* ... and its pool */
+    apr_pollfd_t pfd;
+    int reused;                 /* Running on a kept connection */
+    /* Below is per run (reset by hc_event_start) */
+    apr_pool_t *ptemp;
+    hcmethod_t method;
+    apr_time_t started;
+    const char *req;
+    apr_size_t reqlen, sent;
+    char *buf;
+    apr_size_t len, size, scan;
+    apr_size_t hdrlen;          /* Length of the headers, once complete */
+    apr_off_t bodylen;          /* Length of the body, -1 until EOF */
+    int status;
+    const char *status_line;
+    apr_table_t *headers;
+    int keepalive;
+} hc_event_t;
+
+/* AJP13 CPING and the expected CPONG */
+static const char hc_cping[] = { 0x12, 0x34, 0x00, 0x01, 0x0A };
+static const char hc_cpong[] = { 'A', 'B', 0x00, 0x01, 0x09 };
+
 static void *hc_create_config(apr_pool_t *p, server_rec *s)
 {
     sctx_t *ctx = (sctx_t *) apr_palloc(p, sizeof(sctx_t));
@@ -85,6 +134,11 @@ static void *hc_create_config(apr_pool_t *p, server_rec *s)
     ctx->hcworkers = apr_hash_make(p);
     ctx->tpsize = HC_THREADPOOL_SIZE;
     ctx->s = s;
+    ctx->evpool = NULL;
+    ctx->pollset = NULL;
+    ctx->events = NULL;
+    ctx->heap = NULL;
+    ctx->scanned = 0;
 
     return ctx;
 }
@@ -114,6 +168,10 @@ static const char *set_worker_hc_param(apr_pool_t *p,
         template = (hc_template_t *)ctx->templates->elts;
         for (ival = 0; ival < ctx->templates->nelts; ival++, template++) {
             if (!ap_cstr_casecmp(template->name, val)) {
+                if (worker && template->method == CPING
+                        && strcasecmp(worker->s->scheme, "ajp")) {
+                    return "Health check method CPING is for ajp:// workers only";
+                }
                 if (worker) {
                     worker->s->method = template->method;
                     worker->s->interval = template->interval;
@@ -142,6 +200,10 @@ static const char *set_worker_hc_param(apr_pool_t *p,
                     return apr_psprintf(p, "Health check method %s not (yet) implemented",
                                         val);
                 }
+                if (worker && method->method == CPING
+                        && strcasecmp(worker->s->scheme, "ajp")) {
+                    return "Health check method CPING is for ajp:// workers only";
+                }
                 if (worker) {
                     worker->s->method = method->method;
                 } else {
@@ -560,6 +622,49 @@ static apr_status_t hc_check_tcp(sctx_t *ctx, apr_pool_t *ptemp, proxy_worker *w
     return backend_cleanup("HCTCP", backend, ctx->s, status);
 }
 
+/*
+ * Send the AJP13 CPING to the backend server associated w/ worker, and
+ * wait for the CPONG (up to the ping timeout, if any).
+ */
+static apr_status_t hc_check_cping(sctx_t *ctx, apr_pool_t *ptemp, proxy_worker *worker)
+{
+    int status;
+    proxy_conn_rec *backend = NULL;
+    proxy_worker *hc;
+    char buf[sizeof(hc_cpong)];
+    apr_size_t len, done;
+    apr_status_t rv = APR_SUCCESS;
+
+    hc = hc_get_hcworker(ctx, worker, ptemp);
+
+    status = hc_get_backend("HCCPING", &backend, hc, ctx);
+    if (status == OK) {
+        status = ap_proxy_connect_backend("HCCPING", backend, hc, ctx->s);
+    }
+    if (status != OK) {
+        return backend_cleanup("HCCPING", backend, ctx->s, status);
+    }
+    if (worker->s->ping_timeout_set) {
+        /* The connection is closed after the check */
+        apr_socket_timeout_set(backend->sock, worker->s->ping_timeout);
+    }
+
+    for (done = 0; rv == APR_SUCCESS && done < sizeof(hc_cping); done += len) {
+        len = sizeof(hc_cping) - done;
+        rv = apr_socket_send(backend->sock, hc_cping + done, &len);
+    }
+    for (done = 0; rv == APR_SUCCESS && done < sizeof(buf); done += len) {
+        len = sizeof(buf) - done;
+        rv = apr_socket_recv(backend->sock, buf + done, &len);
+    }
+    if (rv != APR_SUCCESS || memcmp(buf, hc_cpong, sizeof(hc_cpong))) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ctx->s, APLOGNO(03560)
+                     "CPING/CPONG failed for %s", worker->s->name);
+        status = !OK;
+    }
+    return backend_cleanup("HCCPING", backend, ctx->s, status);
+}
+
 static void hc_send(sctx_t *ctx, apr_pool_t *ptemp, const char *out, proxy_conn_rec *backend)
 {
     apr_bucket_brigade *tmp_bb = apr_brigade_create(ptemp, ctx->ba);
@@ -674,11 +779,45 @@ static int hc_read_body (sctx_t *ctx, request_rec *r)
     return (rv == APR_SUCCESS ? OK : !OK);
 }
 
+/*
+ * If we have Conditions, then apply those to the response in r,
+ * otherwise any status code 2xx or 3xx is considered "passing"
+ */
+static int hc_evaluate(sctx_t *ctx, proxy_worker *worker, proxy_worker *hc,
+                       request_rec *r)
+{
+    hc_condition_t *cond;
+    int status = OK;
+
+    if (*worker->s->hcexpr &&
+            (cond = (hc_condition_t *)apr_table_get(ctx->conditions, worker->s->hcexpr)) != NULL) {
+        const char *err;
+        int ok = ap_expr_exec(r, cond->pexpr, &err);
+        if (ok > 0) {
+            status = OK;
+            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
+                         "Condition %s for %s (%s): passed", worker->s->hcexpr,
+                         hc->s->name, worker->s->name);
+        } else if (ok < 0 || err) {
+            status = !OK;
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, ctx->s, APLOGNO(03301)
+                         "Error on checking condition %s for %s (%s): %s", worker->s->hcexpr,
+                         hc->s->name, worker->s->name, err);
+        } else {
+            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
+                         "Condition %s for %s (%s) : failed", worker->s->hcexpr,
+                         hc->s->name, worker->s->name);
+            status = !OK;
+        }
+    } else if (r->status < 200 || r->status > 399) {
+        status = !OK;
+    }
+    return status;
+}
+
 /*
  * Send the HTTP OPTIONS, HEAD or GET request to the backend
- * server associated w/ worker. If we have Conditions,
- * then apply those to the resulting response, otherwise
- * any status code 2xx or 3xx is considered "passing"
+ * server associated w/ worker, and evaluate the response.
  */
 static apr_status_t hc_check_http(sctx_t *ctx, apr_pool_t *ptemp, proxy_worker *worker)
 {
@@ -688,7 +827,6 @@ static apr_status_t hc_check_http(sctx_t *ctx, apr_pool_t *ptemp, proxy_worker *
     conn_rec c;
     request_rec *r;
     wctx_t *wctx;
-    hc_condition_t *cond;
     const char *method = NULL;
 
     hc = hc_get_hcworker(ctx, worker, ptemp);
@@ -751,30 +889,48 @@ static apr_status_t hc_check_http(sctx_t *ctx, apr_pool_t *ptemp, proxy_worker *
         }
     }
 
-    if (*worker->s->hcexpr &&
-            (cond = (hc_condition_t *)apr_table_get(ctx->conditions, worker->s->hcexpr)) != NULL) {
-        const char *err;
-        int ok = ap_expr_exec(r, cond->pexpr, &err);
-        if (ok > 0) {
-            status = OK;
-            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
-                         "Condition %s for %s (%s): passed", worker->s->hcexpr,
-                         hc->s->name, worker->s->name);
-        } else if (ok < 0 || err) {
-            status = !OK;
-            ap_log_error(APLOG_MARK, APLOG_INFO, 0, ctx->s, APLOGNO(03301)
-                         "Error on checking condition %s for %s (%s): %s", worker->s->hcexpr,
-                         hc->s->name, worker->s->name, err);
-        } else {
-            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
-                         "Condition %s for %s (%s) : failed", worker->s->hcexpr,
-                         hc->s->name, worker->s->name);
-            status = !OK;
+    status = hc_evaluate(ctx, worker, hc, r);
+    return backend_cleanup("HCOH", backend, ctx->s, status);
+}
+
+/*
+ * Account for the result of a check, and enable or disable the worker
+ * accordingly.
+ */
+static void hc_update_worker(sctx_t *ctx, proxy_worker *worker,
+                             apr_status_t rv, apr_time_t now,
+                             const char *prefix)
+{
+    server_rec *s = ctx->s;
+
+    /* what state are we in ? */
+    if (PROXY_WORKER_IS_HCFAILED(worker)) {
+        if (rv == APR_SUCCESS) {
+            worker->s->pcount += 1;
+            if (worker->s->pcount >= worker->s->passes) {
+                ap_proxy_set_wstatus(PROXY_WORKER_HC_FAIL_FLAG, 0, worker);
+                ap_proxy_set_wstatus(PROXY_WORKER_IN_ERROR_FLAG, 0, worker);
+                worker->s->pcount = 0;
+                ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03302)
+                             "%sHealth check ENABLING %s", prefix,
+                             worker->s->name);
+
+            }
+        }
+    } else {
+        if (rv != APR_SUCCESS) {
+            worker->s->error_time = now;
+            worker->s->fcount += 1;
+            if (worker->s->fcount >= worker->s->fails) {
+                ap_proxy_set_wstatus(PROXY_WORKER_HC_FAIL_FLAG, 1, worker);
+                worker->s->fcount = 0;
+                ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03303)
+                             "%sHealth check DISABLING %s", prefix,
+                             worker->s->name);
+            }
         }
-    } else if (r->status < 200 || r->status > 399) {
-        status = !OK;
     }
-    return backend_cleanup("HCOH", backend, ctx->s, status);
+    worker->s->updated = now;
 }
 
 static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
@@ -800,6 +956,10 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
              rv = hc_check_http(ctx, ptemp, worker);
              break;
 
+        case CPING:
+            rv = hc_check_cping(ctx, ptemp, worker);
+            break;
+
         default:
             rv = APR_ENOTIMPL;
             break;
@@ -811,36 +971,670 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
         apr_pool_destroy(ptemp);
         return NULL;
     }
-    /* what state are we in ? */
-    if (PROXY_WORKER_IS_HCFAILED(worker)) {
+    hc_update_worker(ctx, worker, rv, now, (thread ? "Threaded " : ""));
+    apr_pool_destroy(ptemp);
+    return NULL;
+}
+
+/*
+ * The event driven checks: TCP, CPING and plain HTTP checks need neither
+ * a thread nor a proxy_conn_rec each, so they are all run by the watchdog
+ * thread itself as non-blocking state machines on a single pollset. They
+ * are timed by a heap ordered by their next run (or deadline while they
+ * are running), each worker being checked on its own interval with some
+ * jitter such that the workers configured alike are not checked in
+ * bursts, and the connection is kept for the next run when the backend
+ * allows it.
+ */
+#define HC_HEAP(ctx) ((hc_event_t **)(ctx)->heap->elts)
+
+static void hc_heap_set(sctx_t *ctx, int i, hc_event_t *ev)
+{
+    HC_HEAP(ctx)[i] = ev;
+    ev->heap = i;
+}
+
+/* Move ev where it belongs in the heap after its time changed */
+static void hc_heap_fix(sctx_t *ctx, hc_event_t *ev)
+{
+    hc_event_t **heap = HC_HEAP(ctx);
+    int n = ctx->heap->nelts, i = ev->heap;
+
+    while (i > 0 && heap[(i - 1) / 2]->when > ev->when) {
+        hc_heap_set(ctx, i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= n) {
+            break;
+        }
+        if (c + 1 < n && heap[c + 1]->when < heap[c]->when) {
+            c++;
+        }
+        if (heap[c]->when >= ev->when) {
+            break;
+        }
+        hc_heap_set(ctx, i, heap[c]);
+        i = c;
+    }
+    hc_heap_set(ctx, i, ev);
+}
+
+static int hc_event_capable(proxy_worker *worker)
+{
+    switch (worker->s->method) {
+        case TCP:
+        case CPING:
+            return 1;
+
+        case OPTIONS:
+        case HEAD:
+        case GET:
+            /* TLS needs mod_ssl's filters, hence hc_check_http() */
+            return strcmp(worker->s->scheme, "https") != 0;
+
+        default:
+            return 0;
+    }
+}
+
+/* Spread the first runs over the interval, then +/- 5% */
+static void hc_event_schedule(sctx_t *ctx, hc_event_t *ev, apr_time_t now,
+                              int first)
+{
+    apr_uint32_t interval = (apr_uint32_t)apr_time_as_msec(ev->worker->s->interval);
+    apr_uint32_t msec;
+
+    if (first) {
+        msec = ap_random_pick(0, interval);
+    }
+    else {
+        msec = interval - interval / 20 + ap_random_pick(0, interval / 10);
+    }
+    ev->when = now + apr_time_from_msec(msec);
+    hc_heap_fix(ctx, ev);
+}
+
+static void hc_event_deadline(sctx_t *ctx, hc_event_t *ev, apr_time_t now,
+                              int connect)
+{
+    proxy_worker *worker = ev->worker;
+    apr_interval_time_t timeout;
+
+    if (connect && worker->s->conn_timeout_set) {
+        timeout = worker->s->conn_timeout;
+    }
+    else if (!connect && ev->method == CPING && worker->s->ping_timeout_set) {
+        timeout = worker->s->ping_timeout;
+    }
+    else if (worker->s->timeout_set) {
+        timeout = worker->s->timeout;
+    }
+    else {
+        timeout = ctx->s->timeout;
+    }
+    ev->when = now + timeout;
+    hc_heap_fix(ctx, ev);
+}
+
+/* (Re)register the socket for events, or unregister it if 0 */
+static apr_status_t hc_event_poll(sctx_t *ctx, hc_event_t *ev,
+                                  apr_int16_t events)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if (ev->pfd.reqevents == events) {
+        return APR_SUCCESS;
+    }
+    if (ev->pfd.reqevents) {
+        apr_pollset_remove(ctx->pollset, &ev->pfd);
+        ev->pfd.reqevents = 0;
+    }
+    if (events) {
+        ev->pfd.p = ev->spool;
+        ev->pfd.desc_type = APR_POLL_SOCKET;
+        ev->pfd.desc.s = ev->sock;
+        ev->pfd.reqevents = events;
+        ev->pfd.client_data = ev;
+        rv = apr_pollset_add(ctx->pollset, &ev->pfd);
+        if (rv != APR_SUCCESS) {
+            ev->pfd.reqevents = 0;
+        }
+    }
+    return rv;
+}
+
+static void hc_event_close(sctx_t *ctx, hc_event_t *ev)
+{
+    if (ev->sock) {
+        hc_event_poll(ctx, ev, 0);
+        apr_pool_destroy(ev->spool); /* closes the socket */
+        ev->spool = NULL;
+        ev->sock = NULL;
+    }
+    ev->reused = 0;
+}
+
+/* Parse the status line and headers, ev->hdrlen long */
+static int hc_event_headers(sctx_t *ctx, hc_event_t *ev)
+{
+    char *line, *next, *end;
+    const char *val;
+
+    /* Up to the last header's CRLF */
+    next = apr_pstrmemdup(ev->ptemp, ev->buf, ev->hdrlen - 2);
+    line = next;
+    if ((next = strstr(line, "\r\n"))) {
+        *next = '\0';
+        next += 2;
+    }
+    ap_log_error(APLOG_MARK, APLOG_TRACE7, 0, ctx->s, "%s", line);
+    if (!apr_date_checkmask(line, "HTTP/#.# ###*") || line[5] != '1') {
+        return !OK;
+    }
+    ev->status = atoi(&line[9]);
+    ev->status_line = &line[9];
+
+    ev->headers = apr_table_make(ev->ptemp, 10);
+    while ((line = next) && *line) {
+        char *value;
+        if ((next = strstr(line, "\r\n"))) {
+            *next = '\0';
+            next += 2;
+        }
+        if (!(value = strchr(line, ':'))) {
+            return !OK;
+        }
+        ap_log_error(APLOG_MARK, APLOG_TRACE7, 0, ctx->s, "%s", line);
+        *value = '\0';
+        ++value;
+        while (apr_isspace(*value))
+            ++value;            /* Skip to start of value   */
+        for (end = value + strlen(value); end > value && apr_isspace(end[-1]); --end)
+            ;
+        *end = '\0';
+        apr_table_add(ev->headers, line, value);
+    }
+
+    /* We asked for keep-alive with HTTP/1.0, which persists only if the
+     * backend agrees and the body is delimited.
+     */
+    val = apr_table_get(ev->headers, "Connection");
+    ev->keepalive = (val && ap_find_token(ev->ptemp, val, "keep-alive"));
+    if (ev->method == HEAD || ev->status == HTTP_NO_CONTENT
+            || ev->status == HTTP_NOT_MODIFIED) {
+        ev->bodylen = 0;
+    }
+    else if (!apr_table_get(ev->headers, "Transfer-Encoding")
+             && (val = apr_table_get(ev->headers, "Content-Length"))) {
+        if (apr_strtoff(&ev->bodylen, val, &end, 10) || *end
+                || ev->bodylen < 0) {
+            return !OK;
+        }
+    }
+    else {
+        ev->bodylen = -1;
+        ev->keepalive = 0;
+    }
+    return OK;
+}
+
+/* Whether the response is complete (> 0), partial (0) or invalid (< 0) */
+static int hc_event_response(sctx_t *ctx, hc_event_t *ev, int eof)
+{
+    apr_size_t i;
+
+    if (ev->method == CPING) {
+        if (ev->len < sizeof(hc_cpong)) {
+            return eof ? -1 : 0;
+        }
+        if (ev->len > sizeof(hc_cpong)
+                || memcmp(ev->buf, hc_cpong, sizeof(hc_cpong))) {
+            return -1;
+        }
+        ev->keepalive = 1;
+        return 1;
+    }
+
+    if (!ev->hdrlen) {
+        for (i = ev->scan; i + 4 <= ev->len; i++) {
+            if (ev->buf[i] == '\r' && !memcmp(ev->buf + i, "\r\n\r\n", 4)) {
+                break;
+            }
+        }
+        if (i + 4 > ev->len) {
+            ev->scan = i;
+            return eof ? -1 : 0;
+        }
+        ev->hdrlen = i + 4;
+        if (hc_event_headers(ctx, ev) != OK) {
+            return -1;
+        }
+    }
+    if (ev->bodylen >= 0) {
+        if ((apr_off_t)(ev->len - ev->hdrlen) < ev->bodylen) {
+            return eof ? -1 : 0;
+        }
+        if ((apr_off_t)(ev->len - ev->hdrlen) > ev->bodylen) {
+            ev->keepalive = 0; /* out of sync */
+        }
+        return 1;
+    }
+    return eof; /* read until closed */
+}
+
+/* Run the conditions on a dummy request with the response */
+static int hc_event_evaluate(sctx_t *ctx, hc_event_t *ev)
+{
+    conn_rec *c = apr_pcalloc(ev->ptemp, sizeof(conn_rec));
+    apr_size_t len = ev->len - ev->hdrlen;
+    request_rec *r;
+
+    c->pool = ev->ptemp;
+    c->base_server = ctx->s;
+    c->client_addr = ev->hc->cp->addr;
+    apr_sockaddr_ip_get(&c->client_ip, c->client_addr);
+    c->notes = apr_table_make(ev->ptemp, 1);
+    c->conn_config = ap_create_conn_config(ev->ptemp);
+
+    r = create_request_rec(ev->ptemp, c, ap_proxy_show_hcmethod(ev->method));
+    r->status = ev->status;
+    r->status_line = ev->status_line;
+    r->headers_out = ev->headers;
+    if (ev->bodylen >= 0 && (apr_off_t)len > ev->bodylen) {
+        len = (apr_size_t)ev->bodylen;
+    }
+    if (ev->method == GET && len) {
+        APR_BRIGADE_INSERT_TAIL(r->kept_body,
+                                apr_bucket_transient_create(ev->buf + ev->hdrlen,
+                                                            len, c->bucket_alloc));
+    }
+    return hc_evaluate(ctx, ev->worker, ev->hc, r);
+}
+
+static void hc_event_connect(sctx_t *ctx, hc_event_t *ev, apr_time_t now);
+
+static void hc_event_finish(sctx_t *ctx, hc_event_t *ev, apr_status_t rv,
+                            apr_time_t now)
+{
+    proxy_worker *worker = ev->worker;
+
+    if (rv != APR_SUCCESS && ev->reused && !ev->len
+            && !APR_STATUS_IS_TIMEUP(rv)) {
+        /* The backend closed the kept connection in the meantime, which
+         * says nothing about its health, retry on a new one.
+         */
+        ap_log_error(APLOG_MARK, APLOG_TRACE2, rv, ctx->s,
+                     "Health check %s for %s: kept connection closed, "
+                     "retrying", ap_proxy_show_hcmethod(ev->method),
+                     worker->s->name);
+        hc_event_connect(ctx, ev, now);
+        return;
+    }
+    hc_event_poll(ctx, ev, 0);
+    ev->state = HC_EV_IDLE;
+
+    if (rv == APR_SUCCESS && ev->method != TCP && ev->method != CPING
+            && hc_event_evaluate(ctx, ev) != OK) {
+        rv = APR_EGENERAL;
+    }
+    if (rv != APR_SUCCESS || !ev->keepalive
+            || !worker->s->is_address_reusable || worker->s->disablereuse) {
+        hc_event_close(ctx, ev);
+    }
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ctx->s, APLOGNO(03515)
+                 "Health check %s Status (%d) for %s.",
+                 ap_proxy_show_hcmethod(ev->method),
+                 rv == APR_SUCCESS ? OK : !OK, worker->s->name);
+
+    hc_update_worker(ctx, worker, rv, ev->started, "Event ");
+    apr_pool_destroy(ev->ptemp);
+    ev->ptemp = NULL;
+    hc_event_schedule(ctx, ev, ev->started, 0);
+}
+
+static void hc_event_send(sctx_t *ctx, hc_event_t *ev, apr_time_t now)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if (ev->state != HC_EV_SEND) {
+        ev->state = HC_EV_SEND;
+        hc_event_deadline(ctx, ev, now, 0);
+    }
+    while (ev->sent < ev->reqlen) {
+        apr_size_t n = ev->reqlen - ev->sent;
+        rv = apr_socket_send(ev->sock, ev->req + ev->sent, &n);
+        ev->sent += n;
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+    }
+    if (APR_STATUS_IS_EAGAIN(rv)) {
+        rv = hc_event_poll(ctx, ev, APR_POLLOUT);
+    }
+    else if (rv == APR_SUCCESS) {
+        ev->state = HC_EV_RECV;
+        hc_event_deadline(ctx, ev, now, 0);
+        rv = hc_event_poll(ctx, ev, APR_POLLIN);
+    }
+    if (rv != APR_SUCCESS) {
+        hc_event_finish(ctx, ev, rv, now);
+    }
+}
+
+static void hc_event_recv(sctx_t *ctx, hc_event_t *ev, apr_time_t now)
+{
+    apr_status_t rv;
+    int done;
+
+    for (;;) {
+        apr_size_t n;
+        if (ev->len == ev->size) {
+            char *buf;
+            if (ev->size >= HC_EVENT_BUFSIZE_MAX) {
+                /* That's enough for a check */
+                ev->keepalive = 0;
+                hc_event_finish(ctx, ev, (ev->hdrlen ? APR_SUCCESS : APR_ENOSPC),
+                                now);
+                return;
+            }
+            buf = apr_palloc(ev->ptemp, ev->size * 2);
+            memcpy(buf, ev->buf, ev->len);
+            ev->buf = buf;
+            ev->size *= 2;
+        }
+        n = ev->size - ev->len;
+        rv = apr_socket_recv(ev->sock, ev->buf + ev->len, &n);
+        ev->len += n;
+        if (rv != APR_SUCCESS && !APR_STATUS_IS_EOF(rv)) {
+            break;
+        }
+        done = hc_event_response(ctx, ev, APR_STATUS_IS_EOF(rv));
+        if (done) {
+            hc_event_finish(ctx, ev, (done > 0 ? APR_SUCCESS : APR_EGENERAL),
+                            now);
+            return;
+        }
+    }
+    if (!APR_STATUS_IS_EAGAIN(rv)) {
+        hc_event_finish(ctx, ev, rv, now);
+    }
+}
+
+static void hc_event_connected(sctx_t *ctx, hc_event_t *ev, apr_time_t now)
+{
+    if (ev->method == TCP) {
+        /* "are you up": yes */
+        hc_event_finish(ctx, ev, APR_SUCCESS, now);
+        return;
+    }
+    hc_event_send(ctx, ev, now);
+}
+
+static void hc_event_connect(sctx_t *ctx, hc_event_t *ev, apr_time_t now)
+{
+    proxy_worker *hc = ev->hc;
+    apr_status_t rv = APR_EGENERAL;
+
+    hc_event_close(ctx, ev);
+    ev->state = HC_EV_CONNECT;
+    ev->sent = 0;
+    if (hc_determine_connection(ctx, hc) != OK) {
+        hc_event_finish(ctx, ev, rv, now);
+        return;
+    }
+
+    apr_pool_create(&ev->spool, ctx->evpool);
+    apr_pool_tag(ev->spool, "hc_event_socket");
+    rv = apr_socket_create(&ev->sock, hc->cp->addr->family, SOCK_STREAM,
+                           APR_PROTO_TCP, ev->spool);
+    if (rv == APR_SUCCESS) {
+        apr_socket_opt_set(ev->sock, APR_TCP_NODELAY, 1);
+        apr_socket_timeout_set(ev->sock, 0);
+        rv = apr_socket_connect(ev->sock, hc->cp->addr);
         if (rv == APR_SUCCESS) {
-            worker->s->pcount += 1;
-            if (worker->s->pcount >= worker->s->passes) {
-                ap_proxy_set_wstatus(PROXY_WORKER_HC_FAIL_FLAG, 0, worker);
-                ap_proxy_set_wstatus(PROXY_WORKER_IN_ERROR_FLAG, 0, worker);
-                worker->s->pcount = 0;
-                ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03302)
-                             "%sHealth check ENABLING %s", (thread ? "Threaded " : ""),
-                             worker->s->name);
+            hc_event_connected(ctx, ev, now);
+            return;
+        }
+        if (APR_STATUS_IS_EINPROGRESS(rv)) {
+            rv = hc_event_poll(ctx, ev, APR_POLLOUT);
+            if (rv == APR_SUCCESS) {
+                hc_event_deadline(ctx, ev, now, 1);
+                return;
+            }
+        }
+    }
+    else {
+        apr_pool_destroy(ev->spool);
+        ev->spool = NULL;
+        ev->sock = NULL;
+    }
+    hc_event_finish(ctx, ev, rv, now);
+}
+
+static void hc_event_start(sctx_t *ctx, hc_event_t *ev, apr_time_t now)
+{
+    proxy_worker *worker = ev->worker;
+    wctx_t *wctx = (wctx_t *)ev->hc->context;
+    const char *method;
+
+    if (PROXY_WORKER_IS(worker, PROXY_WORKER_STOPPED)
+            || !hc_event_capable(worker)) {
+        /* Not (or no more) for us, but it may come back */
+        hc_event_close(ctx, ev);
+        hc_event_schedule(ctx, ev, now, 0);
+        return;
+    }
+    ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
+                 "Event health checking %s", worker->s->name);
+
+    apr_pool_create(&ev->ptemp, ctx->evpool);
+    apr_pool_tag(ev->ptemp, "hc_event");
+    ev->method = worker->s->method;
+    ev->started = now;
+    ev->size = HUGE_STRING_LEN;
+    ev->buf = apr_palloc(ev->ptemp, ev->size);
+    ev->len = ev->scan = ev->hdrlen = 0;
+    ev->bodylen = -1;
+    ev->status = 0;
+    ev->status_line = NULL;
+    ev->headers = NULL;
+    ev->keepalive = 0;
+    ev->sent = 0;
+
+    switch (ev->method) {
+        case TCP:
+            ev->req = NULL;
+            ev->reqlen = 0;
+            break;
+
+        case CPING:
+            ev->req = hc_cping;
+            ev->reqlen = sizeof(hc_cping);
+            break;
+
+        default:
+            method = ap_proxy_show_hcmethod(ev->method);
+            if (ev->method == OPTIONS) {
+                ev->req = apr_psprintf(ev->ptemp,
+                                       "OPTIONS * HTTP/1.0\r\nHost: %s:%d\r\n"
+                                       "Connection: keep-alive\r\n\r\n",
+                                       ev->hc->s->hostname, (int)ev->hc->s->port);
+            }
+            else {
+                ev->req = apr_psprintf(ev->ptemp,
+                                       "%s %s%s%s HTTP/1.0\r\nHost: %s:%d\r\n"
+                                       "Connection: keep-alive\r\n\r\n",
+                                       method,
+                                       (wctx->path ? wctx->path : ""),
+                                       (wctx->path && *worker->s->hcuri ? "/" : "" ),
+                                       (*worker->s->hcuri ? worker->s->hcuri : ""),
+                                       ev->hc->s->hostname, (int)ev->hc->s->port);
+            }
+            ev->reqlen = strlen(ev->req);
+            ap_log_error(APLOG_MARK, APLOG_TRACE7, 0, ctx->s, "%s", ev->req);
+            break;
+    }
+
+    if (ev->sock && ev->method != TCP) {
+        ev->reused = 1;
+        hc_event_send(ctx, ev, now);
+    }
+    else {
+        hc_event_connect(ctx, ev, now);
+    }
+}
+
+static void hc_event_io(sctx_t *ctx, hc_event_t *ev, apr_time_t now)
+{
+    apr_status_t rv;
+
+    switch (ev->state) {
+        case HC_EV_CONNECT:
+            /* Completes the connection, or tells why it failed */
+            rv = apr_socket_connect(ev->sock, ev->hc->cp->addr);
+            if (rv == APR_SUCCESS) {
+                hc_event_connected(ctx, ev, now);
+            }
+            else {
+                hc_event_finish(ctx, ev, rv, now);
+            }
+            break;
+
+        case HC_EV_SEND:
+            hc_event_send(ctx, ev, now);
+            break;
+
+        case HC_EV_RECV:
+            hc_event_recv(ctx, ev, now);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static apr_status_t hc_event_add(sctx_t *ctx, proxy_worker *worker,
+                                 apr_time_t now)
+{
+    hc_event_t *ev;
+    apr_status_t rv;
+
+    if (apr_hash_get(ctx->events, &worker, sizeof(worker))) {
+        return APR_SUCCESS;
+    }
+    if ((rv = hc_init_worker(ctx, worker)) != APR_SUCCESS) {
+        return rv;
+    }
+    ev = apr_pcalloc(ctx->evpool, sizeof(hc_event_t));
+    ev->worker = worker;
+    ev->hc = hc_get_hcworker(ctx, worker, ctx->evpool);
+    ev->state = HC_EV_IDLE;
+    *(hc_event_t **)apr_array_push(ctx->heap) = ev;
+    ev->heap = ctx->heap->nelts - 1;
+    hc_event_schedule(ctx, ev, now, 1);
+    apr_hash_set(ctx->events, &ev->worker, sizeof(worker), ev);
+    return APR_SUCCESS;
+}
+
+/* Run the event driven checks until the given time */
+static void hc_event_run(sctx_t *ctx, apr_time_t until)
+{
+    for (;;) {
+        apr_time_t now = apr_time_now();
+        apr_interval_time_t timeout;
+        const apr_pollfd_t *pfds;
+        apr_int32_t i, n;
+        hc_event_t *ev;
+        apr_status_t rv;
 
+        /* Start the due checks, and fail the late ones */
+        while (ctx->heap->nelts && (ev = HC_HEAP(ctx)[0])->when <= now) {
+            if (ev->state == HC_EV_IDLE) {
+                hc_event_start(ctx, ev, now);
+            }
+            else {
+                hc_event_finish(ctx, ev, APR_TIMEUP, now);
             }
         }
-    } else {
+        if (!ctx->heap->nelts || now >= until) {
+            break;
+        }
+        timeout = until - now;
+        if (timeout > HC_HEAP(ctx)[0]->when - now) {
+            timeout = HC_HEAP(ctx)[0]->when - now;
+        }
+
+        rv = apr_pollset_poll(ctx->pollset, timeout, &n, &pfds);
         if (rv != APR_SUCCESS) {
-            worker->s->error_time = now;
-            worker->s->fcount += 1;
-            if (worker->s->fcount >= worker->s->fails) {
-                ap_proxy_set_wstatus(PROXY_WORKER_HC_FAIL_FLAG, 1, worker);
-                worker->s->fcount = 0;
-                ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03303)
-                             "%sHealth check DISABLING %s", (thread ? "Threaded " : ""),
-                             worker->s->name);
+            if (!APR_STATUS_IS_TIMEUP(rv) && !APR_STATUS_IS_EINTR(rv)) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, ctx->s, APLOGNO(03516)
+                             "apr_pollset_poll() failed");
+                break;
+            }
+            continue;
+        }
+        now = apr_time_now();
+        for (i = 0; i < n; i++) {
+            ev = (hc_event_t *)pfds[i].client_data;
+            /* Its socket may have changed since (retry) */
+            if (pfds[i].desc.s == ev->sock) {
+                hc_event_io(ctx, ev, now);
             }
         }
     }
-    worker->s->updated = now;
-    apr_pool_destroy(ptemp);
-    return NULL;
+}
+
+static void hc_event_init(sctx_t *ctx)
+{
+    proxy_server_conf *conf;
+    proxy_balancer *balancer;
+    apr_allocator_t *allocator;
+    apr_uint32_t size = HC_THREADPOOL_SIZE;
+    apr_status_t rv;
+    int i;
+
+    /* Room for all the workers, including the ones to come */
+    conf = (proxy_server_conf *) ap_get_module_config(ctx->s->module_config, &proxy_module);
+    balancer = (proxy_balancer *)conf->balancers->elts;
+    for (i = 0; i < conf->balancers->nelts; i++, balancer++) {
+        size += balancer->max_workers;
+    }
+
+    /* Own allocator, hc_check() threads are using ctx->p's */
+    apr_allocator_create(&allocator);
+    apr_pool_create_ex(&ctx->evpool, ctx->p, NULL, allocator);
+    apr_allocator_owner_set(allocator, ctx->evpool);
+    apr_pool_tag(ctx->evpool, "hc_event");
+
+    rv = apr_pollset_create(&ctx->pollset, size, ctx->evpool, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, rv, ctx->s, APLOGNO(03517)
+                     "apr_pollset_create() failed, event driven health "
+                     "checks disabled");
+        apr_pool_destroy(ctx->evpool);
+        ctx->evpool = NULL;
+        ctx->pollset = NULL;
+        return;
+    }
+    ctx->events = apr_hash_make(ctx->evpool);
+    ctx->heap = apr_array_make(ctx->evpool, size, sizeof(hc_event_t *));
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->s, APLOGNO(03518)
+                 "Event driven health checks enabled (%s, %u)",
+                 apr_pollset_method_name(ctx->pollset), size);
+}
+
+static void hc_event_fini(sctx_t *ctx)
+{
+    if (ctx->evpool) {
+        /* closes everything */
+        apr_pool_destroy(ctx->evpool);
+        ctx->evpool = NULL;
+    }
+    ctx->pollset = NULL;
+    ctx->events = NULL;
+    ctx->heap = NULL;
 }
 
 static apr_status_t hc_watchdog_callback(int state, void *data,
@@ -857,6 +1651,7 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03258)
                          "%s watchdog started.",
                          HCHECK_WATHCHDOG_NAME);
+            hc_event_init(ctx);
 #if HC_USE_THREADS
             if (ctx->tpsize) {
                 rv =  apr_thread_pool_create(&ctx->hctp, ctx->tpsize,
@@ -882,6 +1677,16 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
             break;
 
         case AP_WATCHDOG_STATE_RUNNING:
+            /* We are called every AP_WD_TM_SLICE to run the event driven
+             * checks, but look for the due workers as before.
+             */
+            if (now < ctx->scanned + apr_time_from_sec(HCHECK_WATHCHDOG_INTERVAL)) {
+                if (ctx->pollset) {
+                    hc_event_run(ctx, now + HC_EVENT_SLICE);
+                }
+                break;
+            }
+            ctx->scanned = now;
             /* loop thru all workers */
             ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
                          "Run of %s watchdog.",
@@ -899,7 +1704,13 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                     workers = (proxy_worker **)balancer->workers->elts;
                     for (n = 0; n < balancer->workers->nelts; n++) {
                         worker = *workers;
-                        if (!PROXY_WORKER_IS(worker, PROXY_WORKER_STOPPED) &&
+                        if (ctx->pollset && hc_event_capable(worker)) {
+                            /* Timed by the engine, from now on */
+                            if ((rv = hc_event_add(ctx, worker, now)) != APR_SUCCESS) {
+                                return rv;
+                            }
+                        }
+                        else if (!PROXY_WORKER_IS(worker, PROXY_WORKER_STOPPED) &&
                            (worker->s->method != NONE) &&
                            (now > worker->s->updated + worker->s->interval)) {
                             baton_t *baton;
@@ -934,6 +1745,9 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                 }
                 /* s = s->next; */
             }
+            if (ctx->pollset) {
+                hc_event_run(ctx, now + HC_EVENT_SLICE);
+            }
             break;
 
         case AP_WATCHDOG_STATE_STOPPING:
@@ -948,6 +1762,7 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
             }
 #endif
             ctx->hctp = NULL;
+            hc_event_fini(ctx);
             break;
     }
     return rv;
@@ -982,7 +1797,7 @@ static int hc_post_config(apr_pool_t *p, apr_pool_t *plog,
         return !OK;
     }
     rv = hc_watchdog_register_callback(ctx->watchdog,
-            apr_time_from_sec(HCHECK_WATHCHDOG_INTERVAL),
+            AP_WD_TM_SLICE,
             ctx,
             hc_watchdog_callback);
     if (rv) {
@@ -18,12 +18,35 @@
 
 #include "mod_proxy.h"
 #include "ap_regex.h"
+#include "ap_mpm.h"
+#include "mpm_common.h"
 
 module AP_MODULE_DECLARE_DATA proxy_http_module;
 
 static int (*ap_proxy_clear_connection_fn)(request_rec *r, apr_table_t *headers) =
         NULL;
 
+static int mpm_can_suspend = 0;
+
+typedef struct {
+    int async;                          /* ProxyHTTPAsync */
+    apr_interval_time_t async_delay;    /* ProxyHTTPAsyncDelay */
+    unsigned int async_set:1;
+    unsigned int async_delay_set:1;
+} proxy_http_dir_conf;
+
+/* State of a request suspended while waiting for the response */
+typedef struct {
+    request_rec *r;
+    proxy_conn_rec *backend;
+    proxy_worker *worker;
+    proxy_server_conf *conf;
+    const char *proxy_function;
+    char *server_portstr;
+    apr_interval_time_t timeout;
+    apr_pool_t *pool;           /* for the MPM registration */
+} proxy_http_baton_t;
+
 static apr_status_t ap_proxy_http_cleanup(const char *scheme,
                                           request_rec *r,
                                           proxy_conn_rec *backend);
@@ -229,6 +252,9 @@ static void terminate_headers(apr_bucket_alloc_t *bucket_alloc,
 
 #define MAX_MEM_SPOOL 16384
 
+/* Most of a pipelined response held before writing it to the client */
+#define MAX_MEM_PIPELINE (4 * MAX_MEM_SPOOL)
+
 static int stream_reqbody_chunked(apr_pool_t *p,
                                            request_rec *r,
                                            proxy_conn_rec *p_conn,
@@ -1274,6 +1300,10 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
     apr_interval_time_t old_timeout = 0;
     proxy_dir_conf *dconf;
     int do_100_continue;
+    /* Backend may be released before we are done */
+    apr_time_t started = backend->started;
+
+    backend->started = 0;
 
     dconf = ap_get_module_config(r->per_dir_config, &proxy_module);
 
@@ -1374,7 +1404,12 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                                  "Error reading from remote server");
         }
         /* XXX: Is this a real headers length send from remote? */
-        backend->worker->s->read += len;
+        ap_proxy_atomic_add_off(&backend->worker->s->read, len);
+
+        if (started && !interim_response) {
+            ap_proxy_latency_add(worker, PROXY_LATENCY_TTFB,
+                                 apr_time_now() - started);
+        }
 
         /* Is it an HTTP/1 response?
          * This is buggy if we ever see an HTTP/1.10
@@ -1708,6 +1743,17 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                 /* read the body, pass it to the output filters */
                 apr_read_type_e mode = APR_NONBLOCK_READ;
                 int finish = FALSE;
+                /* Hold the response of a pipelined connection until it is
+                 * read entirely (up to MAX_MEM_PIPELINE), so that the turn
+                 * of the next request passes without waiting for the client.
+                 */
+                int hold = backend->pipelined;
+                apr_bucket_brigade *hold_bb = NULL;
+                apr_off_t held = 0;
+
+                if (hold) {
+                    hold_bb = apr_brigade_create(p, c->bucket_alloc);
+                }
 
                 /* Handle the case where the error document is itself reverse
                  * proxied and was successful. We must maintain any previous
@@ -1733,6 +1779,11 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                     if (mode == APR_NONBLOCK_READ
                         && (APR_STATUS_IS_EAGAIN(rv)
                             || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)))) {
+                        if (hold) {
+                            /* nothing to flush yet, wait for the backend */
+                            mode = APR_BLOCK_READ;
+                            continue;
+                        }
                         /* flush to the client and switch to blocking mode */
                         e = apr_bucket_flush_create(c->bucket_alloc);
                         APR_BRIGADE_INSERT_TAIL(bb, e);
@@ -1746,6 +1797,9 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                         continue;
                     }
                     else if (rv == APR_EOF) {
+                        if (hold) {
+                            ap_pass_brigade(r->output_filters, hold_bb);
+                        }
                         backend->close = 1;
                         break;
                     }
@@ -1768,6 +1822,9 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                          * through a response, our only option is to
                          * disconnect the client too.
                          */
+                        if (hold) {
+                            APR_BRIGADE_PREPEND(bb, hold_bb);
+                        }
                         e = ap_bucket_error_create(HTTP_GATEWAY_TIME_OUT, NULL,
                                 r->pool, c->bucket_alloc);
                         APR_BRIGADE_INSERT_TAIL(bb, e);
@@ -1789,7 +1846,8 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                     }
 
                     apr_brigade_length(bb, 0, &readbytes);
-                    backend->worker->s->read += readbytes;
+                    ap_proxy_atomic_add_off(&backend->worker->s->read,
+                                            readbytes);
 #if DEBUGGING
                     {
                     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01111)
@@ -1804,6 +1862,27 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                     /* Switch the allocator lifetime of the buckets */
                     ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
 
+                    if (hold) {
+                        /* the backend connection goes on, so the held
+                         * buckets must live as long as the request.
+                         */
+                        for (e = APR_BRIGADE_FIRST(pass_bb); e
+                                != APR_BRIGADE_SENTINEL(pass_bb); e
+                                = APR_BUCKET_NEXT(e)) {
+                            apr_bucket_setaside(e, r->pool);
+                        }
+                        apr_brigade_cleanup(bb);
+                        APR_BRIGADE_CONCAT(hold_bb, pass_bb);
+                        held += readbytes;
+                        if (!APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(hold_bb))
+                                && held < MAX_MEM_PIPELINE) {
+                            continue;
+                        }
+                        /* all read, or too much to hold: pass it on */
+                        APR_BRIGADE_CONCAT(pass_bb, hold_bb);
+                        hold = 0;
+                    }
+
                     /* found the last brigade? */
                     if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(pass_bb))) {
 
@@ -1906,6 +1985,10 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
         return DONE;
     }
 
+    if (started) {
+        ap_proxy_latency_add(worker, PROXY_LATENCY_TOTAL,
+                             apr_time_now() - started);
+    }
     return OK;
 }
 
@@ -1917,6 +2000,303 @@ apr_status_t ap_proxy_http_cleanup(const char *scheme, request_rec *r,
     return OK;
 }
 
+/*
+ * Asynchronous wait for the response.
+ *
+ * Once the request has been sent, if the backend has not started to
+ * answer within ProxyHTTPAsyncDelay, the handler returns SUSPENDED and
+ * the backend socket is registered with the MPM, so that no thread is
+ * tied up until the response (headers) arrive.  The registration is
+ * done by the suspend_connection hook, when the MPM is done with the
+ * connection, such that the callback can't resume it too early.  The
+ * response is then processed as usual by the thread running the
+ * callback.
+ */
+static int proxy_http_can_suspend(request_rec *r, proxy_worker *worker)
+{
+    conn_rec *c = r->connection;
+    proxy_http_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
+                                                      &proxy_http_module);
+
+    /* Only initial requests of plain async connections can be suspended,
+     * 100-continue pings keep using their own (ping) timeout.
+     */
+    return (dconf->async > 0 && mpm_can_suspend
+            && c->cs && !c->master && !c->clogging_input_filters
+            && !r->main && !r->prev
+            && !PROXY_DO_100_CONTINUE(worker, r));
+}
+
+/* What proxy_handler() does after the scheme handler, which it skipped
+ * for SUSPENDED.  There is no failing over to another worker from here,
+ * proxy_handler() would do it for HTTP_SERVICE_UNAVAILABLE only which
+ * the response can't get (no 100-continue ping when suspended).
+ */
+static int proxy_http_async_post_request(proxy_http_baton_t *baton,
+                                         int status)
+{
+    request_rec *r = baton->r;
+    proxy_worker *worker = baton->worker;
+    proxy_balancer *balancer = worker->balancer;
+
+    if ((status == HTTP_INTERNAL_SERVER_ERROR
+         || status == HTTP_SERVICE_UNAVAILABLE)
+            && !apr_table_get(r->notes, "proxy-error-override")
+            && balancer
+            && !(worker->s->status & PROXY_WORKER_IGNORE_ERRORS)) {
+        worker->s->status |= PROXY_WORKER_IN_ERROR;
+        worker->s->error_time = apr_time_now();
+    }
+
+    if (status != OK && status != DONE) {
+        int saved_status = r->status;
+
+        r->status = status;
+        ap_proxy_post_request(worker, balancer, r, baton->conf);
+        if (r->status == status) {
+            r->status = saved_status;
+        }
+    }
+    else {
+        ap_proxy_post_request(worker, balancer, r, baton->conf);
+    }
+
+    proxy_run_request_status(&status, r);
+    return status;
+}
+
+static void proxy_http_async_finish(proxy_http_baton_t *baton, int status)
+{
+    request_rec *r = baton->r;
+    conn_rec *c = r->connection;
+
+    if (status != OK) {
+        baton->backend->close = 1;
+    }
+    ap_proxy_http_cleanup(baton->proxy_function, r, baton->backend);
+    status = proxy_http_async_post_request(baton, status);
+
+    /* What ap_process_async_request() would have done */
+    if (status != OK && status != DONE) {
+        r->status = HTTP_OK;
+    }
+    ap_die(status, r);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(r->invoke_mtx);
+#endif
+    ap_process_request_after_handler(r); /* don't touch baton or r after here */
+    ap_mpm_resume_suspended(c);
+}
+
+static void proxy_http_async_callback(void *b)
+{
+    proxy_http_baton_t *baton = b;
+    request_rec *r = baton->r;
+    int status;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(r->invoke_mtx);
+#endif
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "HTTP: resuming on response from %s", baton->backend->hostname);
+
+    status = ap_proxy_http_process_response(r->pool, r, &baton->backend,
+                                            baton->worker, baton->conf,
+                                            baton->server_portstr);
+    proxy_http_async_finish(baton, status);
+}
+
+static void proxy_http_async_timeout(void *b)
+{
+    proxy_http_baton_t *baton = b;
+    request_rec *r = baton->r;
+    int status;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(r->invoke_mtx);
+#endif
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(03499)
+                  "error reading status line from remote "
+                  "server %s:%d", baton->backend->hostname,
+                  baton->backend->port);
+    apr_table_setn(r->notes, "proxy_timedout", "1");
+    proxy_run_detach_backend(r, baton->backend);
+    status = ap_proxyerror(r, HTTP_GATEWAY_TIME_OUT,
+                           "Error reading from remote server");
+    proxy_http_async_finish(baton, status);
+}
+
+static void proxy_http_suspend_connection(conn_rec *c, request_rec *r)
+{
+    proxy_http_baton_t *baton;
+    apr_array_header_t *pfds;
+    apr_pollfd_t *pfd;
+    apr_status_t rv;
+
+    baton = ap_get_module_config(c->conn_config, &proxy_http_module);
+    if (!baton) {
+        return;
+    }
+    ap_set_module_config(c->conn_config, &proxy_http_module, NULL);
+
+    pfds = apr_array_make(baton->pool, 1, sizeof(apr_pollfd_t));
+    pfd = apr_array_push(pfds);
+    pfd->p = baton->pool;
+    pfd->desc_type = APR_POLL_SOCKET;
+    pfd->reqevents = APR_POLLIN;
+    pfd->desc.s = baton->backend->sock;
+
+    rv = ap_mpm_register_poll_callback_timeout(pfds,
+                                               proxy_http_async_callback,
+                                               proxy_http_async_timeout,
+                                               baton, baton->timeout);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, baton->r, APLOGNO(03500)
+                      "HTTP: can't wait asynchronously for the response "
+                      "from %s", baton->backend->hostname);
+        /* The timeout callback, if any, is still armed and will end the
+         * request, otherwise wait here.
+         */
+        if (baton->timeout <= 0) {
+            proxy_http_async_callback(baton);
+        }
+    }
+}
+
+static int proxy_http_suspend(request_rec *r, proxy_conn_rec *backend,
+                              proxy_worker *worker, proxy_server_conf *conf,
+                              const char *proxy_function,
+                              const char *server_portstr)
+{
+    proxy_http_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
+                                                      &proxy_http_module);
+    proxy_http_baton_t *baton;
+    apr_pollfd_t pfd;
+    apr_int32_t nfds;
+    apr_status_t rv;
+
+    /* Anything (or error) from the backend already? */
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.p = r->pool;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.reqevents = APR_POLLIN;
+    pfd.desc.s = backend->sock;
+    rv = apr_poll(&pfd, 1, &nfds, dconf->async_delay);
+    if (!APR_STATUS_IS_TIMEUP(rv)) {
+        return DECLINED;
+    }
+
+    baton = apr_pcalloc(r->pool, sizeof(*baton));
+    baton->r = r;
+    baton->backend = backend;
+    baton->worker = worker;
+    baton->conf = conf;
+    baton->proxy_function = proxy_function;
+    baton->server_portstr = apr_pstrdup(r->pool, server_portstr);
+    apr_socket_timeout_get(backend->sock, &baton->timeout);
+    apr_pool_create(&baton->pool, r->pool);
+    apr_pool_tag(baton->pool, "proxy_http_async");
+
+    /* Registered by proxy_http_suspend_connection() */
+    ap_set_module_config(r->connection->conn_config, &proxy_http_module,
+                         baton);
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "HTTP: suspending until the response from %s",
+                  backend->hostname);
+    return SUSPENDED;
+}
+
+/*
+ * Pipelining (pipeline=) of the requests which can be sent again should
+ * the connection close before their response: idempotent and bodyless.
+ */
+static int proxy_http_can_pipeline(request_rec *r, proxy_worker *worker,
+                                   proxy_conn_rec *backend, int toclose,
+                                   enum rb_methods rb_method,
+                                   const char *old_cl_val,
+                                   const char *old_te_val,
+                                   apr_bucket_brigade *input_brigade)
+{
+    return (worker->pipeline && !backend->is_ssl && !toclose
+            && r->method_number == M_GET && !r->main
+            && rb_method == RB_STREAM_CL && !old_cl_val && !old_te_val
+            && !APR_BRIGADE_EMPTY(input_brigade)
+            && APR_BUCKET_IS_EOS(APR_BRIGADE_FIRST(input_brigade))
+            && !PROXY_DO_100_CONTINUE(worker, r)
+            && !apr_table_get(r->subprocess_env, "proxy-sendextracrlf")
+            && !proxy_http_can_suspend(r, worker));
+}
+
+/* Returns DECLINED if the request was not (or could not be) pipelined,
+ * it's then to be sent on a connection of its own.
+ */
+static int proxy_http_pipeline(apr_pool_t *p, request_rec *r,
+                               proxy_worker *worker,
+                               proxy_server_conf *conf,
+                               const char *proxy_function,
+                               apr_bucket_brigade *header_brigade,
+                               char *server_portstr)
+{
+    proxy_conn_rec *backend;
+    apr_uint32_t ticket;
+    apr_status_t rv;
+    apr_size_t len;
+    char *buf, *req;
+    int status;
+
+    /* The request as stream_reqbody_cl() sends it, header_brigade is left
+     * untouched for the fallback.
+     */
+    if (apr_brigade_pflatten(header_brigade, &buf, &len, p) != APR_SUCCESS) {
+        return DECLINED;
+    }
+    req = apr_palloc(p, len + 2);
+    memcpy(req, buf, len);
+    memcpy(req + len, ASCII_CRLF, 2);
+
+    if (ap_proxy_pipeline_join(worker, &backend, &ticket, req, len + 2,
+                               r) != OK) {
+        return DECLINED;
+    }
+    backend->started = apr_time_now();
+    rv = ap_proxy_pipeline_wait(backend, ticket);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r,
+                      "HTTP: pipelined connection to %s %s, "
+                      "sending the request again", worker->s->hostname,
+                      APR_STATUS_IS_TIMEUP(rv) ? "timed out" : "closed early");
+        return DECLINED;
+    }
+
+    /* Our turn, unless the backend closed before answering */
+    rv = ap_get_brigade(backend->connection->input_filters, backend->tmp_bb,
+                        AP_MODE_SPECULATIVE, APR_BLOCK_READ, 1);
+    if (rv == APR_SUCCESS && !APR_BRIGADE_EMPTY(backend->tmp_bb)
+            && APR_BUCKET_IS_EOS(APR_BRIGADE_FIRST(backend->tmp_bb))) {
+        rv = APR_EOF;
+    }
+    apr_brigade_cleanup(backend->tmp_bb);
+    if (rv == APR_EOF || APR_STATUS_IS_ECONNRESET(rv)) {
+        backend->close = 1;
+        ap_proxy_release_connection(proxy_function, backend, r->server);
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r,
+                      "HTTP: pipelined connection to %s closed before "
+                      "the response, sending the request again",
+                      worker->s->hostname);
+        return DECLINED;
+    }
+
+    status = ap_proxy_http_process_response(p, r, &backend, worker,
+                                            conf, server_portstr);
+    if (backend) {
+        if (status != OK)
+            backend->close = 1;
+        ap_proxy_http_cleanup(proxy_function, r, backend);
+    }
+    return status;
+}
+
 /*
  * This handles http:// URLs, and other URLs using a remote proxy over http
  * If proxyhost is NULL, then contact the server directly, otherwise
@@ -1947,6 +2327,7 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     char *locurl = url;
     int flushall = 0;
     int toclose = 0;
+    int pipeline;
     /*
      * Use a shorter-lived pool to reduce memory usage
      * and avoid a memory leak
@@ -2048,6 +2429,19 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     toclose = backend->close;
     backend->close = 0;
 
+    /* Pipeline the request on a connection busy with other requests, when
+     * allowed, rather than connecting a new one.
+     */
+    pipeline = proxy_http_can_pipeline(r, worker, backend, toclose,
+                                       rb_method, old_cl_val, old_te_val,
+                                       input_brigade);
+    if (pipeline && !backend->sock) {
+        status = proxy_http_pipeline(p, r, worker, conf, proxy_function,
+                                     header_brigade, server_portstr);
+        if (status != DECLINED)
+            goto cleanup;
+    }
+
     while (retry < 2) {
         conn_rec *backconn;
 
@@ -2109,6 +2503,7 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
          * On the off-chance that we forced a 100-Continue as a
          * kinda HTTP ping test, allow for retries
          */
+        backend->started = apr_time_now();
         if ((status = ap_proxy_http_request(p, r, backend,
                                             header_brigade, input_brigade,
                                             old_cl_val, old_te_val, rb_method,
@@ -2127,7 +2522,19 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
             }
         }
 
-        /* Step Five: Receive the Response... Fall thru to cleanup */
+        if (pipeline) {
+            ap_proxy_pipeline_open(backend);
+        }
+
+        /* Step Five: Receive the Response... Fall thru to cleanup,
+         * unless we can wait for it asynchronously.
+         */
+        if (proxy_http_can_suspend(r, worker)
+                && proxy_http_suspend(r, backend, worker, conf,
+                                      proxy_function,
+                                      server_portstr) == SUSPENDED) {
+            return SUSPENDED;
+        }
         status = ap_proxy_http_process_response(p, r, &backend, worker,
                                                 conf, server_portstr);
 
@@ -2165,12 +2572,74 @@ static int proxy_http_post_config(apr_pool_t *pconf, apr_pool_t *plog,
         }
     }
 
+    if (ap_mpm_query(AP_MPMQ_CAN_SUSPEND, &mpm_can_suspend) != APR_SUCCESS) {
+        mpm_can_suspend = 0;
+    }
+
     return OK;
 }
 
+static void *create_proxy_http_dir_config(apr_pool_t *p, char *dummy)
+{
+    proxy_http_dir_conf *new = apr_pcalloc(p, sizeof(proxy_http_dir_conf));
+
+    return new;
+}
+
+static void *merge_proxy_http_dir_config(apr_pool_t *p, void *basev,
+                                         void *addv)
+{
+    proxy_http_dir_conf *new = apr_pcalloc(p, sizeof(proxy_http_dir_conf));
+    proxy_http_dir_conf *base = (proxy_http_dir_conf *)basev;
+    proxy_http_dir_conf *add = (proxy_http_dir_conf *)addv;
+
+    new->async = add->async_set ? add->async : base->async;
+    new->async_set = add->async_set || base->async_set;
+    new->async_delay = add->async_delay_set ? add->async_delay
+                                            : base->async_delay;
+    new->async_delay_set = add->async_delay_set || base->async_delay_set;
+
+    return new;
+}
+
+static const char *set_async(cmd_parms *cmd, void *conf, int flag)
+{
+    proxy_http_dir_conf *dconf = conf;
+
+    dconf->async = flag;
+    dconf->async_set = 1;
+    return NULL;
+}
+
+static const char *set_async_delay(cmd_parms *cmd, void *conf,
+                                   const char *arg)
+{
+    proxy_http_dir_conf *dconf = conf;
+
+    if (ap_timeout_parameter_parse(arg, &dconf->async_delay, "s")
+            != APR_SUCCESS || dconf->async_delay < 0) {
+        return "ProxyHTTPAsyncDelay timeout has wrong format";
+    }
+    dconf->async_delay_set = 1;
+    return NULL;
+}
+
+static const command_rec proxy_http_cmds[] =
+{
+    AP_INIT_FLAG("ProxyHTTPAsync", set_async, NULL, RSRC_CONF|ACCESS_CONF,
+                 "Whether to release the thread while waiting for the "
+                 "response, if the MPM supports it"),
+    AP_INIT_TAKE1("ProxyHTTPAsyncDelay", set_async_delay, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "Time to wait for the response before going asynchronous"),
+    {NULL}
+};
+
 static void ap_proxy_http_register_hook(apr_pool_t *p)
 {
     ap_hook_post_config(proxy_http_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_suspend_connection(proxy_http_suspend_connection, NULL, NULL,
+                               APR_HOOK_MIDDLE);
     proxy_hook_scheme_handler(proxy_http_handler, NULL, NULL, APR_HOOK_FIRST);
     proxy_hook_canon_handler(proxy_http_canon, NULL, NULL, APR_HOOK_FIRST);
     warn_rx = ap_pregcomp(p, "[0-9]{3}[ \t]+[^ \t]+[ \t]+\"[^\"]*\"([ \t]+\"([^\"]+)\")?", 0);
@@ -2178,11 +2647,11 @@ static void ap_proxy_http_register_hook(apr_pool_t *p)
 
 AP_DECLARE_MODULE(proxy_http) = {
     STANDARD20_MODULE_STUFF,
-    NULL,              /* create per-directory config structure */
-    NULL,              /* merge per-directory config structures */
+    create_proxy_http_dir_config, /* create per-directory config structure */
+    merge_proxy_http_dir_config,  /* merge per-directory config structures */
     NULL,              /* create per-server config structure */
     NULL,              /* merge per-server config structures */
-    NULL,              /* command apr_table_t */
+    proxy_http_cmds,   /* command apr_table_t */
     ap_proxy_http_register_hook/* register hooks */
 };
 
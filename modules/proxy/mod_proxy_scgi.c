@@ -124,7 +124,7 @@ static apr_status_t bucket_socket_ex_read(apr_bucket *a, const char **str,
         apr_bucket_heap *h;
 
         /* count for stats */
-        *data->counter += *len;
+        ap_proxy_atomic_add_off(data->counter, *len);
 
         /* Change the current bucket to refer to what we read */
         a = apr_bucket_heap_make(a, buf, *len, apr_bucket_free);
@@ -241,7 +241,7 @@ static int sendall(proxy_conn_rec *conn, const char *buf, apr_size_t length,
         }
 
         /* count for stats */
-        conn->worker->s->transferred += written;
+        ap_proxy_atomic_add_off(&conn->worker->s->transferred, written);
         buf += written;
         length -= written;
     }
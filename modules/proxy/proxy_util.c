@@ -20,6 +20,10 @@
 #include "scoreboard.h"
 #include "apr_version.h"
 #include "apr_hash.h"
+#include "apr_atomic.h"
+#include "apr_poll.h"
+#include "apr_shm.h"
+#include "apr_thread_cond.h"
 #include "proxy_util.h"
 #include "ajp.h"
 #include "scgi.h"
@@ -36,6 +40,15 @@
 #if APR_HAVE_SYS_UN_H
 #include <sys/un.h>
 #endif
+#if APR_HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#if APR_HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#if APR_HAVE_ERRNO_H
+#include <errno.h>
+#endif
 #if (APR_MAJOR_VERSION < 2)
 #include "apr_support.h"        /* for apr_wait_for_io_or_timeout() */
 #endif
@@ -1313,6 +1326,9 @@ static apr_status_t conn_pool_cleanup(void *theworker)
     return APR_SUCCESS;
 }
 
+/* Fixed point precision of proxy_conn_pool->demand */
+#define PROXY_PREWARM_SHIFT 4
+
 static void init_conn_pool(apr_pool_t *p, proxy_worker *worker)
 {
     apr_pool_t *pool;
@@ -1342,6 +1358,421 @@ PROXY_DECLARE(int) ap_proxy_connection_reusable(proxy_conn_rec *conn)
     return ! (conn->close || !worker->s->is_address_reusable || worker->s->disablereuse);
 }
 
+/*
+ * Shared pool of idle connections (sharedpool=On).
+ *
+ * The idle connections of a worker are parked in the receive queue of a
+ * Unix datagram socketpair created before the children are forked: the
+ * releasing child sends the descriptor (SCM_RIGHTS, as mod_proxy_fdpass
+ * does) with the time it was parked, and any child can take the oldest
+ * one back by receiving it.  The kernel is thus the broker, there is no
+ * process to run nor lock to take, while the limits and statistics are
+ * maintained atomically in shared memory.  Only plain (non TLS)
+ * connections can be shared, the TLS state lives in the child.
+ */
+#if APR_HAVE_SYS_UN_H && defined(SCM_RIGHTS)
+#define PROXY_HAVE_SHARED_POOL 1
+#endif
+
+struct proxy_shared_pool {
+    int fd[2];                      /* parked to [0], taken back from [1] */
+    proxy_shared_pool_stats *stats; /* in shared memory (if available) */
+};
+
+#if PROXY_HAVE_SHARED_POOL
+
+static apr_status_t shared_pool_cleanup(void *data)
+{
+    struct proxy_shared_pool *spool = data;
+
+    close(spool->fd[0]);
+    close(spool->fd[1]);
+    return APR_SUCCESS;
+}
+
+static apr_status_t shared_pool_create(apr_pool_t *p, proxy_worker *worker,
+                                       proxy_shared_pool_stats *stats)
+{
+    struct proxy_shared_pool *spool;
+    int i;
+
+    spool = apr_pcalloc(p, sizeof(*spool));
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, spool->fd) < 0) {
+        return errno;
+    }
+    for (i = 0; i < 2; ++i) {
+        int flags = fcntl(spool->fd[i], F_GETFL);
+        fcntl(spool->fd[i], F_SETFL, flags | O_NONBLOCK);
+        fcntl(spool->fd[i], F_SETFD, FD_CLOEXEC);
+    }
+    if (worker->s->shared_max) {
+        /* Room for that many (tiny) datagrams, best effort */
+        int size = worker->s->shared_max * 1024;
+        setsockopt(spool->fd[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+    apr_pool_cleanup_register(p, spool, shared_pool_cleanup,
+                              apr_pool_cleanup_null);
+
+    spool->stats = stats;
+    worker->spool = spool;
+    return APR_SUCCESS;
+}
+
+/* Park the connection's socket, the caller still has to close its own */
+static int shared_pool_park(proxy_conn_rec *conn)
+{
+    proxy_worker *worker = conn->worker;
+    struct proxy_shared_pool *spool = worker->spool;
+    proxy_shared_pool_stats *stats = spool->stats;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    apr_os_sock_t fd;
+    apr_time_t now;
+
+    if (conn->is_ssl || conn->forward
+            || apr_os_sock_get(&fd, conn->sock) != APR_SUCCESS) {
+        return 0;
+    }
+    if (apr_atomic_inc32(&stats->idle) >= (apr_uint32_t)worker->s->shared_max
+            && worker->s->shared_max) {
+        apr_atomic_dec32(&stats->idle);
+        return 0;
+    }
+
+    /* The next owner sets its own timeout, hand it blocking like a new one */
+    apr_socket_timeout_set(conn->sock, -1);
+
+    now = apr_time_now();
+    iov.iov_base = &now;
+    iov.iov_len = sizeof(now);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if (sendmsg(spool->fd[0], &msg, 0) < 0) {
+        /* Full (EAGAIN), the connection will be closed */
+        apr_atomic_dec32(&stats->idle);
+        return 0;
+    }
+    apr_atomic_inc32(&stats->parked);
+    return 1;
+}
+
+/* Take back the oldest parked socket which is still usable */
+static apr_status_t shared_pool_checkout(proxy_conn_rec *conn, server_rec *s)
+{
+    proxy_worker *worker = conn->worker;
+    struct proxy_shared_pool *spool = worker->spool;
+    proxy_shared_pool_stats *stats = spool->stats;
+    int flags = 0;
+
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+    for (;;) {
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct cmsghdr *cmsg;
+        struct msghdr msg;
+        struct iovec iov;
+        apr_os_sock_info_t info;
+        apr_socket_t *sock;
+        apr_pollfd_t pfd;
+        apr_int32_t nfds;
+        apr_time_t parked;
+        apr_uint32_t idle;
+        int fd;
+
+        iov.iov_base = &parked;
+        iov.iov_len = sizeof(parked);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        if (recvmsg(spool->fd[1], &msg, flags) != sizeof(parked)) {
+            if (errno == EINTR) {
+                continue;
+            }
+            apr_atomic_inc32(&stats->missed);
+            return APR_ENOSOCKET;
+        }
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+                  || cmsg->cmsg_type != SCM_RIGHTS) {
+            /* The descriptor was dropped (MSG_CTRUNC, e.g. at our fd
+             * limit), still the entry left the pool.
+             */
+            apr_atomic_dec32(&stats->idle);
+            apr_atomic_inc32(&stats->missed);
+            continue;
+        }
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+#ifndef MSG_CMSG_CLOEXEC
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+        idle = apr_atomic_add32(&stats->idle, (apr_uint32_t)-1) - 1;
+
+        if (worker->s->shared_ttl
+                && apr_time_now() - parked > worker->s->shared_ttl
+                && idle >= (apr_uint32_t)worker->s->shared_min) {
+            close(fd);
+            apr_atomic_inc32(&stats->expired);
+            continue;
+        }
+
+        memset(&info, 0, sizeof(info));
+        info.os_sock = &fd;
+        info.type = SOCK_STREAM;
+        if (conn->uds_path) {
+            info.family = AF_UNIX;
+        }
+        else {
+            info.family = conn->addr->family;
+            info.protocol = APR_PROTO_TCP;
+        }
+        if (apr_os_sock_make(&sock, &info, conn->scpool) != APR_SUCCESS) {
+            close(fd);
+            continue;
+        }
+
+        /* An idle connection has nothing to read, not even EOF */
+        pfd.p = conn->scpool;
+        pfd.desc_type = APR_POLL_SOCKET;
+        pfd.reqevents = APR_POLLIN;
+        pfd.desc.s = sock;
+        if (!APR_STATUS_IS_TIMEUP(apr_poll(&pfd, 1, &nfds, 0))) {
+            apr_socket_close(sock);
+            apr_atomic_inc32(&stats->expired);
+            continue;
+        }
+
+        ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
+                     "reusing shared backend connection to %s",
+                     worker->s->hostname);
+        apr_atomic_inc32(&stats->reused);
+        conn->sock = sock;
+        conn->connection = NULL;
+        return APR_SUCCESS;
+    }
+}
+
+#endif /* PROXY_HAVE_SHARED_POOL */
+
+static void collect_shared_workers(apr_array_header_t *workers,
+                                   proxy_worker *worker)
+{
+    if (worker->s->shared_pool && worker->s->is_address_reusable
+            && !worker->s->disablereuse) {
+        APR_ARRAY_PUSH(workers, proxy_worker *) = worker;
+    }
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_init_shared_pools(apr_pool_t *p,
+                                                       server_rec *s)
+{
+    apr_array_header_t *workers = apr_array_make(p, 0, sizeof(proxy_worker *));
+    int i, n;
+    server_rec *sr;
+#if PROXY_HAVE_SHARED_POOL
+    proxy_shared_pool_stats *stats;
+    apr_hash_t *spools;
+    apr_shm_t *shm;
+    int count = 0;
+#endif
+
+    for (sr = s; sr; sr = sr->next) {
+        proxy_server_conf *conf = ap_get_module_config(sr->module_config,
+                                                       &proxy_module);
+        proxy_balancer *balancer = (proxy_balancer *)conf->balancers->elts;
+
+        for (i = 0; i < conf->workers->nelts; ++i) {
+            collect_shared_workers(workers,
+                    &APR_ARRAY_IDX(conf->workers, i, proxy_worker));
+        }
+        for (i = 0; i < conf->balancers->nelts; ++i, ++balancer) {
+            for (n = 0; n < balancer->workers->nelts; ++n) {
+                collect_shared_workers(workers,
+                        APR_ARRAY_IDX(balancer->workers, n, proxy_worker *));
+            }
+        }
+    }
+    if (apr_is_empty_array(workers)) {
+        return APR_SUCCESS;
+    }
+
+#if PROXY_HAVE_SHARED_POOL
+    /* The workers inherited by virtual hosts are copies sharing the same
+     * worker->s, they share the same pool.
+     */
+    if (apr_shm_create(&shm, workers->nelts * sizeof(*stats), NULL,
+                       p) == APR_SUCCESS) {
+        stats = apr_shm_baseaddr_get(shm);
+        memset(stats, 0, workers->nelts * sizeof(*stats));
+    }
+    else {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(03501)
+                     "no anonymous shared memory, the limits and statistics "
+                     "of the shared connection pools are per child");
+        stats = apr_pcalloc(p, workers->nelts * sizeof(*stats));
+    }
+
+    spools = apr_hash_make(p);
+    for (i = 0; i < workers->nelts; ++i) {
+        proxy_worker *worker = APR_ARRAY_IDX(workers, i, proxy_worker *);
+        proxy_worker *first;
+        apr_status_t rv;
+
+        first = apr_hash_get(spools, &worker->s, sizeof(worker->s));
+        if (first) {
+            worker->spool = first->spool;
+            continue;
+        }
+        rv = shared_pool_create(p, worker, &stats[count++]);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(03502)
+                         "can not create the shared connection pool of "
+                         "worker %s", ap_proxy_worker_name(p, worker));
+            return rv;
+        }
+        apr_hash_set(spools, &worker->s, sizeof(worker->s), worker);
+    }
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03503)
+                 "created %d shared connection pool(s)", count);
+    return APR_SUCCESS;
+#else
+    ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(03504)
+                 "shared connection pools are not supported on this "
+                 "platform, sharedpool is ignored");
+    return APR_SUCCESS;
+#endif
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_shared_pool_stats(proxy_worker *worker,
+                                            proxy_shared_pool_stats *stats)
+{
+    if (!worker->spool) {
+        return APR_ENOTIMPL;
+    }
+    stats->idle = apr_atomic_read32(&worker->spool->stats->idle);
+    stats->parked = apr_atomic_read32(&worker->spool->stats->parked);
+    stats->reused = apr_atomic_read32(&worker->spool->stats->reused);
+    stats->missed = apr_atomic_read32(&worker->spool->stats->missed);
+    stats->expired = apr_atomic_read32(&worker->spool->stats->expired);
+    return APR_SUCCESS;
+}
+
+static unsigned int latency_bucket(apr_interval_time_t elapsed)
+{
+    apr_uint64_t v = (elapsed > 0) ? (apr_uint64_t)elapsed : 0;
+    unsigned int shift = 0;
+
+    if (v >= (APR_UINT64_C(1) << PROXY_LATENCY_MAX_BITS)) {
+        return PROXY_LATENCY_BUCKETS - 1;
+    }
+    if (v < (1 << PROXY_LATENCY_SUB_BITS)) {
+        return (unsigned int)v;
+    }
+    while ((v >> shift) >= (2 << PROXY_LATENCY_SUB_BITS)) {
+        shift++;
+    }
+    /* v >> shift is in [2^SUB_BITS, 2^(SUB_BITS+1)) */
+    return ((shift + 1) << PROXY_LATENCY_SUB_BITS)
+           + (unsigned int)(v >> shift) - (1 << PROXY_LATENCY_SUB_BITS);
+}
+
+/* Highest value counted in the bucket */
+static apr_interval_time_t latency_value(unsigned int bucket)
+{
+    unsigned int shift, sub;
+
+    if (bucket < (2 << PROXY_LATENCY_SUB_BITS)) {
+        return bucket;
+    }
+    shift = (bucket >> PROXY_LATENCY_SUB_BITS) - 1;
+    sub = bucket & ((1 << PROXY_LATENCY_SUB_BITS) - 1);
+    return ((apr_interval_time_t)((1 << PROXY_LATENCY_SUB_BITS) + sub + 1)
+            << shift) - 1;
+}
+
+PROXY_DECLARE(void) ap_proxy_latency_add(proxy_worker *worker,
+                                         proxy_latency_e which,
+                                         apr_interval_time_t elapsed)
+{
+    if (which < PROXY_LATENCY_MAX) {
+        apr_atomic_inc32(&worker->s->latency[which].counts[latency_bucket(elapsed)]);
+    }
+}
+
+PROXY_DECLARE(void) ap_proxy_latency_stats(proxy_worker *worker,
+                                           proxy_latency_e which,
+                                           proxy_latency_stats *stats)
+{
+    apr_uint32_t counts[PROXY_LATENCY_BUCKETS];
+    apr_uint64_t total = 0, sum = 0;
+    apr_uint64_t ranks[4];
+    apr_interval_time_t *values[4];
+    unsigned int i, n = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    if (which >= PROXY_LATENCY_MAX) {
+        return;
+    }
+    /* A snapshot, the counts keep moving */
+    for (i = 0; i < PROXY_LATENCY_BUCKETS; i++) {
+        counts[i] = apr_atomic_read32(&worker->s->latency[which].counts[i]);
+        total += counts[i];
+    }
+    if (!total) {
+        return;
+    }
+    stats->count = (apr_uint32_t)total;
+
+    /* Ranks of the 50th, 90th, 99th and 99.9th percentiles (rounded up) */
+    ranks[0] = (total * 500 + 999) / 1000;
+    ranks[1] = (total * 900 + 999) / 1000;
+    ranks[2] = (total * 990 + 999) / 1000;
+    ranks[3] = (total * 999 + 999) / 1000;
+    values[0] = &stats->p50;
+    values[1] = &stats->p90;
+    values[2] = &stats->p99;
+    values[3] = &stats->p999;
+    for (i = 0; i < PROXY_LATENCY_BUCKETS && n < 4; i++) {
+        sum += counts[i];
+        while (n < 4 && sum >= ranks[n]) {
+            *values[n++] = latency_value(i);
+        }
+    }
+}
+
+PROXY_DECLARE(const char *) ap_proxy_latency_name(proxy_latency_e which)
+{
+    switch (which) {
+    case PROXY_LATENCY_CONNECT:
+        return "Connect";
+    case PROXY_LATENCY_TTFB:
+        return "TTFB";
+    case PROXY_LATENCY_TOTAL:
+        return "Total";
+    default:
+        return "?";
+    }
+}
+
 static apr_status_t connection_cleanup(void *theconn)
 {
     proxy_conn_rec *conn = (proxy_conn_rec *)theconn;
@@ -1385,6 +1816,13 @@ static apr_status_t connection_cleanup(void *theconn)
         socket_cleanup(conn);
         conn->close = 0;
     }
+#if PROXY_HAVE_SHARED_POOL
+    else if (worker->spool && conn->sock) {
+        /* Hand the connection over to the shared pool (or close it) */
+        shared_pool_park(conn);
+        socket_cleanup(conn);
+    }
+#endif
 
     if (worker->s->hmax && worker->cp->res) {
         conn->inreslist = 1;
@@ -1399,6 +1837,215 @@ static apr_status_t connection_cleanup(void *theconn)
     return APR_SUCCESS;
 }
 
+/*
+ * Pipelining (pipeline=N): the bodyless requests of different clients are
+ * sent on the connection open to pipelining without waiting for the
+ * previous responses, up to N requests in flight.  Each request gets a
+ * ticket and the responses are read in that order, each by the thread of
+ * its request, the turn passing to the next ticket when the connection is
+ * released (once the response is read from the backend, mod_proxy_http
+ * holds it until then rather than waiting for the client).  When a
+ * response leaves the connection unusable, the requests sent after it
+ * won't be answered and are retried elsewhere by their threads
+ * (ap_proxy_pipeline_wait() fails), the last one closing the connection.
+ * So are the requests whose turn does not come within the timeout of the
+ * connection, from the first one timing out.  The joining requests are
+ * written to the socket directly, the filters (and pools) of the
+ * connection belong to the reading thread.
+ */
+struct proxy_pipeline {
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;    /* signaled when a turn passes */
+    proxy_conn_rec *open;       /* connection taking requests, if any */
+};
+
+#if APR_HAS_THREADS
+static apr_status_t pipeline_create(apr_pool_t *p, proxy_worker *worker)
+{
+    struct proxy_pipeline *pipeline;
+    apr_status_t rv;
+
+    pipeline = apr_pcalloc(p, sizeof(*pipeline));
+    rv = apr_thread_mutex_create(&pipeline->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                 p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_cond_create(&pipeline->cond, p);
+    }
+    if (rv == APR_SUCCESS) {
+        worker->pipeline = pipeline;
+    }
+    return rv;
+}
+#endif
+
+/* Returns whether other requests still use the connection, otherwise it
+ * is no longer pipelined and can be cleaned up as usual.
+ */
+static int pipeline_release(proxy_conn_rec *conn)
+{
+    struct proxy_pipeline *pipeline = conn->worker->pipeline;
+    int more;
+
+    apr_thread_mutex_lock(pipeline->mutex);
+    if (conn->close || !conn->connection || conn->connection->aborted
+            || conn->connection->keepalive == AP_CONN_CLOSE) {
+        /* No response after this one */
+        if (conn->pipe_valid > conn->pipe_turn + 1) {
+            conn->pipe_valid = conn->pipe_turn + 1;
+        }
+        conn->close = 1;
+    }
+    conn->pipe_turn++;
+    more = (--conn->pipe_pending != 0);
+    if (!more && conn->pipe_valid != conn->pipe_sent) {
+        /* Responses of timed out requests are still to come */
+        conn->close = 1;
+    }
+    if (pipeline->open == conn
+            && (!more || conn->pipe_valid != conn->pipe_sent)) {
+        pipeline->open = NULL;
+    }
+    if (more) {
+        /* The next reader makes its own backend request */
+        if (conn->r) {
+            apr_pool_destroy(conn->r->pool);
+            conn->r = NULL;
+        }
+        apr_thread_cond_broadcast(pipeline->cond);
+    }
+    else {
+        conn->pipelined = 0;
+    }
+    apr_thread_mutex_unlock(pipeline->mutex);
+
+    return more;
+}
+
+PROXY_DECLARE(void) ap_proxy_pipeline_open(proxy_conn_rec *conn)
+{
+    struct proxy_pipeline *pipeline = conn->worker->pipeline;
+
+    if (!pipeline || conn->is_ssl) {
+        return;
+    }
+    apr_thread_mutex_lock(pipeline->mutex);
+    if (!pipeline->open && !conn->pipelined && !conn->close) {
+        conn->pipelined = 1;
+        conn->pipe_sent = conn->pipe_valid = conn->pipe_pending = 1;
+        conn->pipe_turn = 0;
+        pipeline->open = conn;
+    }
+    apr_thread_mutex_unlock(pipeline->mutex);
+}
+
+PROXY_DECLARE(int) ap_proxy_pipeline_join(proxy_worker *worker,
+                                          proxy_conn_rec **conn,
+                                          apr_uint32_t *ticket,
+                                          const char *buf, apr_size_t len,
+                                          request_rec *r)
+{
+    struct proxy_pipeline *pipeline = worker->pipeline;
+    proxy_conn_rec *open;
+    apr_size_t written, total = len;
+    apr_status_t rv = APR_SUCCESS;
+
+    if (!pipeline) {
+        return DECLINED;
+    }
+    apr_thread_mutex_lock(pipeline->mutex);
+    open = pipeline->open;
+    if (!open || open->pipe_valid != open->pipe_sent
+            || open->pipe_pending >= (apr_uint32_t)worker->s->pipeline) {
+        apr_thread_mutex_unlock(pipeline->mutex);
+        return DECLINED;
+    }
+
+    /* Sent under the lock for the requests to be in the order of the
+     * tickets, the reader only needs the mutex to release.
+     */
+    while (len) {
+        written = len;
+        rv = apr_socket_send(open->sock, buf, &written);
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        buf += written;
+        len -= written;
+    }
+    if (rv != APR_SUCCESS) {
+        /* A partial request spoils the next ones, take no more */
+        pipeline->open = NULL;
+        apr_thread_mutex_unlock(pipeline->mutex);
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(03511)
+                      "pipelining to %pI (%s) failed", worker->cp->addr,
+                      worker->s->hostname);
+        return DECLINED;
+    }
+    *ticket = open->pipe_sent++;
+    open->pipe_valid++;
+    open->pipe_pending++;
+    apr_thread_mutex_unlock(pipeline->mutex);
+
+    ap_proxy_atomic_add_off(&worker->s->transferred, total);
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                  "request pipelined to %pI (%s) as #%u",
+                  worker->cp->addr, worker->s->hostname, *ticket);
+    *conn = open;
+    return OK;
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_pipeline_wait(proxy_conn_rec *conn,
+                                                   apr_uint32_t ticket)
+{
+    struct proxy_pipeline *pipeline = conn->worker->pipeline;
+    apr_interval_time_t timeout, left;
+    apr_status_t rv = APR_ECONNRESET;
+    apr_time_t deadline;
+    int last;
+
+    /* No longer than reading the response would wait */
+    apr_socket_timeout_get(conn->sock, &timeout);
+    deadline = apr_time_now() + timeout;
+
+    apr_thread_mutex_lock(pipeline->mutex);
+    while (conn->pipe_turn != ticket && ticket < conn->pipe_valid) {
+        if (timeout < 0) {
+            apr_thread_cond_wait(pipeline->cond, pipeline->mutex);
+            continue;
+        }
+        left = deadline - apr_time_now();
+        if (left <= 0) {
+            /* Give up this ticket and the next ones, whose responses
+             * won't be read: the connection closes after the previous.
+             */
+            conn->pipe_valid = ticket;
+            if (pipeline->open == conn) {
+                pipeline->open = NULL;
+            }
+            apr_thread_cond_broadcast(pipeline->cond);
+            rv = APR_TIMEUP;
+            break;
+        }
+        apr_thread_cond_timedwait(pipeline->cond, pipeline->mutex, left);
+    }
+    if (ticket < conn->pipe_valid) {
+        apr_thread_mutex_unlock(pipeline->mutex);
+        return APR_SUCCESS;
+    }
+
+    /* The connection closed (or timed out) before our response */
+    last = (--conn->pipe_pending == 0);
+    if (last) {
+        conn->pipelined = 0;
+    }
+    apr_thread_mutex_unlock(pipeline->mutex);
+    if (last) {
+        conn->close = 1;
+        connection_cleanup(conn);
+    }
+    return rv;
+}
+
 /* DEPRECATED */
 PROXY_DECLARE(apr_status_t) ap_proxy_ssl_connection_cleanup(proxy_conn_rec *conn,
                                                             request_rec *r)
@@ -1537,6 +2184,141 @@ static int ap_proxy_strcmp_ematch(const char *str, const char *expected)
     return 0;
 }
 
+/*
+ * Index of the workers by name: a radix tree of the plain names, where
+ * the longest prefix of an url is found by walking it, plus the list of
+ * the ap_proxy_strcmp_ematch()able names which still have to be tried
+ * in turn.  Workers are identified by their position in the workers
+ * array of the balancer or the configuration, which is also how ties
+ * are broken (the first one wins, as with the linear scan).
+ */
+typedef struct proxy_worker_node proxy_worker_node;
+struct proxy_worker_node {
+    const char *label;          /* the part of the name(s) on this edge */
+    apr_size_t len;
+    int worker;                 /* index of the worker named so far, or -1 */
+    proxy_worker_node *child;   /* first child */
+    proxy_worker_node *next;    /* next sibling, by first char of label */
+};
+
+struct proxy_worker_index {
+    proxy_worker_node root;
+    apr_array_header_t *matchable;  /* indexes of is_name_matchable ones */
+    int nworkers;                   /* number of workers indexed */
+};
+
+static APR_INLINE proxy_worker *worker_at(proxy_balancer *balancer,
+                                          proxy_server_conf *conf, int i)
+{
+    if (balancer) {
+        return APR_ARRAY_IDX(balancer->workers, i, proxy_worker *);
+    }
+    return &APR_ARRAY_IDX(conf->workers, i, proxy_worker);
+}
+
+static proxy_worker_node *new_worker_node(apr_pool_t *p, const char *label,
+                                          apr_size_t len, int worker)
+{
+    proxy_worker_node *node = apr_pcalloc(p, sizeof(*node));
+    node->label = label;
+    node->len = len;
+    node->worker = worker;
+    return node;
+}
+
+static void index_worker_name(apr_pool_t *p, proxy_worker_node *node,
+                              const char *name, int worker)
+{
+    for (;;) {
+        proxy_worker_node *child, **pchild;
+        apr_size_t n;
+
+        if (!*name) {
+            /* first one wins */
+            if (node->worker < 0) {
+                node->worker = worker;
+            }
+            return;
+        }
+
+        for (pchild = &node->child; (child = *pchild); pchild = &child->next) {
+            if (child->label[0] == name[0]) {
+                break;
+            }
+        }
+        if (!child) {
+            *pchild = new_worker_node(p, apr_pstrdup(p, name), strlen(name),
+                                      worker);
+            return;
+        }
+
+        for (n = 1; n < child->len && name[n] == child->label[n]; ++n)
+            ;
+        if (n < child->len) {
+            /* split the edge where the names diverge */
+            proxy_worker_node *split = new_worker_node(p, child->label, n, -1);
+            child->label += n;
+            child->len -= n;
+            split->child = child;
+            split->next = child->next;
+            child->next = NULL;
+            *pchild = split;
+            child = split;
+        }
+        node = child;
+        name += n;
+    }
+}
+
+PROXY_DECLARE(void) ap_proxy_index_workers(apr_pool_t *p,
+                                           proxy_balancer *balancer,
+                                           proxy_server_conf *conf)
+{
+    apr_array_header_t *workers = balancer ? balancer->workers
+                                           : conf->workers;
+    struct proxy_worker_index *windex;
+    int i;
+
+    windex = apr_pcalloc(p, sizeof(*windex));
+    windex->root.worker = -1;
+    windex->matchable = apr_array_make(p, 0, sizeof(int));
+    for (i = 0; i < workers->nelts; ++i) {
+        proxy_worker *worker = worker_at(balancer, conf, i);
+        if (worker->s->is_name_matchable) {
+            APR_ARRAY_PUSH(windex->matchable, int) = i;
+        }
+        else {
+            index_worker_name(p, &windex->root, worker->s->name, i);
+        }
+    }
+    windex->nworkers = workers->nelts;
+
+    if (balancer) {
+        balancer->windex = windex;
+    }
+    else {
+        conf->windex = windex;
+    }
+}
+
+/* Whether the worker matches the url longer than max_match */
+static APR_INLINE int worker_matches(proxy_worker *worker,
+                                     const char *url_copy, int url_length,
+                                     int min_match, int max_match)
+{
+    int worker_name_length = strlen(worker->s->name);
+
+    return ((worker_name_length <= url_length)
+            && (worker_name_length >= min_match)
+            && (worker_name_length > max_match)
+            && (worker->s->is_name_matchable
+                || strncmp(url_copy, worker->s->name,
+                           worker_name_length) == 0)
+            && (!worker->s->is_name_matchable
+                || ap_proxy_strcmp_ematch(url_copy,
+                                          worker->s->name) == 0));
+}
+
 PROXY_DECLARE(proxy_worker *) ap_proxy_get_worker(apr_pool_t *p,
                                                   proxy_balancer *balancer,
                                                   proxy_server_conf *conf,
@@ -1547,9 +2329,10 @@ PROXY_DECLARE(proxy_worker *) ap_proxy_get_worker(apr_pool_t *p,
     int max_match = 0;
     int url_length;
     int min_match;
-    int worker_name_length;
     const char *c;
     char *url_copy;
+    apr_array_header_t *workers;
+    struct proxy_worker_index *windex;
     int i;
 
     if (!url) {
@@ -1593,38 +2376,68 @@ PROXY_DECLARE(proxy_worker *) ap_proxy_get_worker(apr_pool_t *p,
      */
 
     if (balancer) {
-        proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
-        for (i = 0; i < balancer->workers->nelts; i++, workers++) {
-            worker = *workers;
-            if ( ((worker_name_length = strlen(worker->s->name)) <= url_length)
-                && (worker_name_length >= min_match)
-                && (worker_name_length > max_match)
-                && (worker->s->is_name_matchable
-                    || strncmp(url_copy, worker->s->name,
-                               worker_name_length) == 0)
-                && (!worker->s->is_name_matchable
-                    || ap_proxy_strcmp_ematch(url_copy,
-                                              worker->s->name) == 0) ) {
-                max_worker = worker;
-                max_match = worker_name_length;
+        workers = balancer->workers;
+        windex = balancer->windex;
+    }
+    else {
+        workers = conf->workers;
+        windex = conf->windex;
+    }
+
+    i = 0;
+    if (windex) {
+        proxy_worker_node *node = &windex->root;
+        const char *name = url_copy;
+        int max_index = -1;
+        int *matchable;
+
+        /* Walk the url down the tree, the deepest worker is the longest */
+        for (;;) {
+            proxy_worker_node *child;
+
+            for (child = node->child; child; child = child->next) {
+                if (child->label[0] == *name) {
+                    break;
+                }
+            }
+            if (!child || strncmp(name, child->label, child->len)) {
+                break;
+            }
+            name += child->len;
+            node = child;
+            if (node->worker >= 0 && name - url_copy >= min_match) {
+                max_index = node->worker;
+                max_match = name - url_copy;
             }
         }
-    } else {
-        worker = (proxy_worker *)conf->workers->elts;
-        for (i = 0; i < conf->workers->nelts; i++, worker++) {
-            if ( ((worker_name_length = strlen(worker->s->name)) <= url_length)
-                && (worker_name_length >= min_match)
-                && (worker_name_length > max_match)
-                && (worker->s->is_name_matchable
-                    || strncmp(url_copy, worker->s->name,
-                               worker_name_length) == 0)
-                && (!worker->s->is_name_matchable
-                    || ap_proxy_strcmp_ematch(url_copy,
-                                              worker->s->name) == 0) ) {
-                max_worker = worker;
-                max_match = worker_name_length;
+
+        /* The ematch()able ones which are longer, or as long but first */
+        matchable = (int *)windex->matchable->elts;
+        for (i = 0; i < windex->matchable->nelts; ++i) {
+            worker = worker_at(balancer, conf, matchable[i]);
+            if (worker_matches(worker, url_copy, url_length, min_match,
+                               (matchable[i] < max_index) ? max_match - 1
+                                                          : max_match)) {
+                max_index = matchable[i];
+                max_match = strlen(worker->s->name);
             }
         }
+
+        if (max_index >= 0) {
+            max_worker = worker_at(balancer, conf, max_index);
+        }
+
+        /* The workers added since they were indexed */
+        i = windex->nworkers;
+    }
+
+    for (; i < workers->nelts; i++) {
+        worker = worker_at(balancer, conf, i);
+        if (worker_matches(worker, url_copy, url_length, min_match,
+                           max_match)) {
+            max_worker = worker;
+            max_match = strlen(worker->s->name);
+        }
     }
 
     return max_worker;
@@ -1921,6 +2734,22 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, ser
                 apr_reslist_timeout_set(worker->cp->res, worker->s->acquire);
             }
 
+            /* A new child expects the demand it was configured for */
+            worker->cp->demand = (apr_uint32_t)worker->s->prewarm
+                                 << PROXY_PREWARM_SHIFT;
+
+#if APR_HAS_THREADS
+            if (rv == APR_SUCCESS && worker->s->pipeline > 0
+                    && worker->s->is_address_reusable
+                    && !worker->s->disablereuse && !worker->pipeline) {
+                rv = pipeline_create(worker->cp->pool, worker);
+                if (rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(03512)
+                                 "can not create worker pipeline");
+                }
+            }
+#endif
+
         }
         else {
             void *conn;
@@ -2220,6 +3049,10 @@ PROXY_DECLARE(int) ap_proxy_acquire_connection(const char *proxy_function,
     (*conn)->close  = 0;
     (*conn)->inreslist = 0;
 
+    if (worker->s->prewarm) {
+        apr_atomic_inc32(&worker->cp->acquired);
+    }
+
     return OK;
 }
 
@@ -2230,6 +3063,10 @@ PROXY_DECLARE(int) ap_proxy_release_connection(const char *proxy_function,
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00943)
                 "%s: has released connection for (%s)",
                 proxy_function, conn->worker->s->hostname);
+    if (conn->pipelined && pipeline_release(conn)) {
+        /* Still in use by the next pipelined requests */
+        return OK;
+    }
     connection_cleanup(conn);
 
     return OK;
@@ -2804,12 +3641,32 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
     void *sconf = s->module_config;
     proxy_server_conf *conf =
         (proxy_server_conf *) ap_get_module_config(sconf, &proxy_module);
+    apr_time_t connect_start = 0;
 
     rv = ap_proxy_check_connection(proxy_function, conn, s, 0, 0);
     if (rv == APR_EINVAL) {
         return DECLINED;
     }
 
+#if PROXY_HAVE_SHARED_POOL
+    /* Reuse a connection parked by any child first */
+    if (rv != APR_SUCCESS && worker->spool && (backend_addr || conn->uds_path)
+            && (rv = shared_pool_checkout(conn, s)) == APR_SUCCESS) {
+        if (worker->s->timeout_set) {
+            apr_socket_timeout_set(conn->sock, worker->s->timeout);
+        }
+        else if (conf->timeout_set) {
+            apr_socket_timeout_set(conn->sock, conf->timeout);
+        }
+        else {
+            apr_socket_timeout_set(conn->sock, s->timeout);
+        }
+    }
+#endif
+
+    if (rv != APR_SUCCESS) {
+        connect_start = apr_time_now();
+    }
     while (rv != APR_SUCCESS && (backend_addr || conn->uds_path)) {
 #if APR_HAVE_SYS_UN_H
         if (conn->uds_path)
@@ -2984,6 +3841,11 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
         }
     }
 
+    if (rv == APR_SUCCESS && connect_start) {
+        ap_proxy_latency_add(worker, PROXY_LATENCY_CONNECT,
+                             apr_time_now() - connect_start);
+    }
+
     if (PROXY_WORKER_IS_USABLE(worker)) {
         /*
          * Put the entire worker to error state if
@@ -3152,6 +4014,156 @@ PROXY_DECLARE(int) ap_proxy_connection_create(const char *proxy_function,
     return proxy_connection_create(proxy_function, conn, NULL, s);
 }
 
+/* Establish (and handshake) an idle connection for prewarm, returns
+ * whether it had to.
+ */
+static int prewarm_connection(proxy_conn_rec *conn, server_rec *s)
+{
+    proxy_worker *worker = conn->worker;
+    apr_bucket_brigade *bb;
+    apr_status_t rv;
+
+    /* As ap_proxy_determine_connection() would for the worker, which
+     * then keeps the connection for the requests (but those asking for
+     * another SNI, with ProxyPreserveHost).
+     */
+    if (!conn->hostname) {
+        conn->hostname = apr_pstrdup(conn->pool, worker->s->hostname);
+        conn->port = worker->s->port;
+    }
+    conn->addr = worker->cp->addr;
+    conn->is_ssl = !strcmp(worker->s->scheme, "https");
+    if (conn->is_ssl && !conn->ssl_hostname) {
+        if (conn->sock) {
+            socket_cleanup(conn);
+        }
+        conn->ssl_hostname = apr_pstrdup(conn->scpool, conn->hostname);
+    }
+
+    if (conn->sock && conn->connection
+            && ap_proxy_check_connection("PREWARM", conn, s, 0, 0)
+               == APR_SUCCESS) {
+        return 0;
+    }
+    if (ap_proxy_connect_backend("PREWARM", conn, worker, s) != OK
+            || proxy_connection_create("PREWARM", conn, NULL, s) != OK) {
+        conn->close = 1;
+        return 0;
+    }
+    if (conn->is_ssl) {
+        apr_table_setn(conn->connection->notes, "proxy-request-hostname",
+                       conn->ssl_hostname);
+
+        /* Flushing nothing is enough for mod_ssl to handshake */
+        bb = conn->tmp_bb;
+        APR_BRIGADE_INSERT_TAIL(bb,
+                apr_bucket_flush_create(conn->connection->bucket_alloc));
+        rv = ap_pass_brigade(conn->connection->output_filters, bb);
+        apr_brigade_cleanup(bb);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(03521)
+                         "PREWARM: TLS handshake with %pI (%s) failed",
+                         conn->addr, conn->hostname);
+            conn->close = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Prewarming (prewarm=N): the connections of the worker are established
+ * ahead of the requests so that they don't pay for it, namely the first
+ * ones of a new child (after a restart or when the MPM scales out) which
+ * would otherwise all connect.  Every second the watchdog of the child
+ * takes the target number of idle connections from the reslist (the most
+ * recently used first), reconnects those closed in the meantime and puts
+ * them back.  The target is the decaying average of the connections the
+ * child acquires per second, starting at N and at most N, and no less
+ * than the min parameter (nor more than smax).
+ */
+PROXY_DECLARE(int) ap_proxy_prewarm_worker(proxy_worker *worker,
+                                           server_rec *s, apr_pool_t *p)
+{
+    proxy_conn_pool *cp = worker->cp;
+    proxy_conn_rec **conns;
+    apr_uint32_t acquired;
+    apr_status_t rv;
+    int target, avail, n, i, warmed = 0;
+
+    if (!worker->s->prewarm || !cp || !cp->res || worker->spool
+            || !worker->s->is_address_reusable || worker->s->disablereuse
+            || *worker->s->uds_path || !PROXY_WORKER_IS_USABLE(worker)
+            || (strcmp(worker->s->scheme, "http")
+                && strcmp(worker->s->scheme, "https"))) {
+        return 0;
+    }
+    if (!strcmp(worker->s->scheme, "https") && !ap_proxy_ssl_enable(NULL)) {
+        return 0;
+    }
+
+    acquired = apr_atomic_xchg32(&cp->acquired, 0);
+    cp->demand = (cp->demand * 3 + (acquired << PROXY_PREWARM_SHIFT)) / 4;
+    target = (cp->demand + (1 << PROXY_PREWARM_SHIFT) - 1)
+             >> PROXY_PREWARM_SHIFT;
+    if (target > worker->s->prewarm) {
+        target = worker->s->prewarm;
+    }
+    if (target < worker->s->min) {
+        target = worker->s->min;
+    }
+    if (target > worker->s->smax) {
+        target = worker->s->smax;
+    }
+    /* Never make the requests wait for the connections we hold */
+    avail = worker->s->hmax - apr_reslist_acquired_count(cp->res);
+    if (target > avail) {
+        target = avail;
+    }
+    if (target <= 0) {
+        return 0;
+    }
+
+    if (!cp->addr) {
+        if ((rv = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
+            return 0;
+        }
+        if (!cp->addr) {
+            rv = apr_sockaddr_info_get(&cp->addr, worker->s->hostname,
+                                       APR_UNSPEC, worker->s->port, 0,
+                                       cp->pool);
+        }
+        PROXY_THREAD_UNLOCK(worker);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(03522)
+                         "PREWARM: DNS lookup failure for: %s",
+                         worker->s->hostname);
+            return 0;
+        }
+    }
+
+    conns = apr_palloc(p, target * sizeof(*conns));
+    for (n = 0; n < target; ++n) {
+        if (apr_reslist_acquire(cp->res, (void **)&conns[n]) != APR_SUCCESS) {
+            break;
+        }
+        conns[n]->worker = worker;
+        conns[n]->close = 0;
+        conns[n]->inreslist = 0;
+    }
+    for (i = 0; i < n; ++i) {
+        warmed += prewarm_connection(conns[i], s);
+        connection_cleanup(conns[i]);
+    }
+
+    if (warmed) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03523)
+                     "PREWARM: established %d of %d idle connections "
+                     "for (%s)", warmed, n, worker->s->hostname);
+    }
+    return warmed;
+}
+
 int ap_proxy_lb_workers(void)
 {
     /*
@@ -3255,6 +4267,67 @@ PROXY_DECLARE(char *) ap_proxy_parse_wstatus(apr_pool_t *p, proxy_worker *w)
     return ret;
 }
 
+/*
+ * The counters of the workers live in shm and are updated by all the
+ * threads of all the children without the balancer lock, with the 32bit
+ * atomics of APR, or apr_atomic_casptr() for the ones which have the size
+ * of a pointer.
+ */
+PROXY_DECLARE(void) ap_proxy_atomic_add_int(int *mem, int val)
+{
+    apr_atomic_add32((volatile apr_uint32_t *)mem, (apr_uint32_t)val);
+}
+
+static APR_INLINE apr_size_t atomic_cas_size(apr_size_t *mem,
+                                             apr_size_t with, apr_size_t cmp)
+{
+#if APR_SIZEOF_VOIDP == 4
+    return apr_atomic_cas32((volatile apr_uint32_t *)mem, with, cmp);
+#else
+    return (apr_size_t)(apr_uintptr_t)
+        apr_atomic_casptr((volatile void **)mem, (void *)(apr_uintptr_t)with,
+                          (const void *)(apr_uintptr_t)cmp);
+#endif
+}
+
+PROXY_DECLARE(void) ap_proxy_atomic_add_size(apr_size_t *mem, apr_size_t val)
+{
+    apr_size_t old;
+
+    do {
+        old = *(volatile apr_size_t *)mem;
+    } while (atomic_cas_size(mem, old + val, old) != old);
+}
+
+PROXY_DECLARE(void) ap_proxy_atomic_dec_size(apr_size_t *mem)
+{
+    apr_size_t old;
+
+    do {
+        old = *(volatile apr_size_t *)mem;
+        if (!old) {
+            return;
+        }
+    } while (atomic_cas_size(mem, old - 1, old) != old);
+}
+
+PROXY_DECLARE(void) ap_proxy_atomic_add_off(apr_off_t *mem, apr_off_t val)
+{
+    if (sizeof(apr_off_t) == sizeof(void *)) {
+        apr_off_t old;
+
+        do {
+            old = *(volatile apr_off_t *)mem;
+        } while ((apr_off_t)(apr_uintptr_t)
+                 apr_atomic_casptr((volatile void **)mem,
+                                   (void *)(apr_uintptr_t)(old + val),
+                                   (const void *)(apr_uintptr_t)old) != old);
+    }
+    else {
+        *mem += val;
+    }
+}
+
 PROXY_DECLARE(apr_status_t) ap_proxy_sync_balancer(proxy_balancer *b, server_rec *s,
                                                     proxy_server_conf *conf)
 {
@@ -3311,25 +4384,37 @@ PROXY_DECLARE(apr_status_t) ap_proxy_sync_balancer(proxy_balancer *b, server_rec
             }
         }
         if (!found) {
-            proxy_worker **runtime;
+            proxy_worker *runtime;
             apr_global_mutex_lock(proxy_mutex);
-            runtime = apr_array_push(b->workers);
-            *runtime = apr_palloc(conf->pool, sizeof(proxy_worker));
+            runtime = apr_palloc(conf->pool, sizeof(proxy_worker));
             apr_global_mutex_unlock(proxy_mutex);
-            (*runtime)->hash = shm->hash;
-            (*runtime)->context = NULL;
-            (*runtime)->cp = NULL;
-            (*runtime)->balancer = b;
-            (*runtime)->s = shm;
-            (*runtime)->tmutex = NULL;
-            rv = ap_proxy_initialize_worker(*runtime, s, conf->pool);
+            runtime->hash = shm->hash;
+            runtime->context = NULL;
+            runtime->cp = NULL;
+            runtime->balancer = b;
+            runtime->s = shm;
+            runtime->tmutex = NULL;
+            rv = ap_proxy_initialize_worker(runtime, s, conf->pool);
             if (rv != APR_SUCCESS) {
                 ap_log_error(APLOG_MARK, APLOG_EMERG, rv, s, APLOGNO(00966) "Cannot init worker");
                 return rv;
             }
+            /* Publish the worker once initialized, and before counting
+             * it, for the lock free elections walking the list.  There
+             * is room for max_workers (see balancer_post_config()).
+             */
+            apr_global_mutex_lock(proxy_mutex);
+            if (b->workers->nelts < b->workers->nalloc) {
+                ((proxy_worker **)b->workers->elts)[b->workers->nelts] = runtime;
+                apr_atomic_inc32((volatile apr_uint32_t *)&b->workers->nelts);
+            }
+            else {
+                APR_ARRAY_PUSH(b->workers, proxy_worker *) = runtime;
+            }
+            apr_global_mutex_unlock(proxy_mutex);
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02403)
                          "grabbing shm[%d] (0x%pp) for worker: %s", i, (void *)shm,
-                         (*runtime)->s->name);
+                         runtime->s->name);
         }
     }
     if (b->s->need_reset) {
@@ -3589,7 +4674,7 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
         }
 
         /* Add the Expect header if not already there. */
-        if (((val = apr_table_get(r->headers_in, "Expect")) == NULL)
+        if (((val = ap_get_known_header_in(r, AP_KNOWN_HEADER_EXPECT)) == NULL)
                 || (ap_cstr_casecmp(val, "100-Continue") != 0 /* fast path */
                     && !ap_find_token(r->pool, val, "100-Continue"))) {
             apr_table_mergen(r->headers_in, "Expect", "100-Continue");
@@ -3629,7 +4714,7 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
             /* Add X-Forwarded-Host: so that upstream knows what the
              * original request hostname was.
              */
-            if ((buf = apr_table_get(r->headers_in, "Host"))) {
+            if ((buf = ap_get_known_header_in(r, AP_KNOWN_HEADER_HOST))) {
                 apr_table_mergen(r->headers_in, "X-Forwarded-Host", buf);
             }
 
@@ -3732,7 +4817,8 @@ PROXY_DECLARE(int) ap_proxy_pass_brigade(apr_bucket_alloc_t *bucket_alloc,
     }
     apr_brigade_length(bb, 0, &transferred);
     if (transferred != -1)
-        p_conn->worker->s->transferred += transferred;
+        ap_proxy_atomic_add_off(&p_conn->worker->s->transferred,
+                                transferred);
     status = ap_pass_brigade(origin->output_filters, bb);
     /* Cleanup the brigade now to avoid buckets lifetime
      * issues in case of error returned below. */
@@ -3832,6 +4918,160 @@ PROXY_DECLARE(apr_status_t) ap_proxy_buckets_lifetime_transform(request_rec *r,
     return rv;
 }
 
+#if defined(HAVE_SPLICE) && defined(SPLICE_F_MOVE)
+/*
+ * Once the filters of a tunnel's connections are drained, and if they are
+ * only the core's (and mod_logio's, accounted here), the data can go from
+ * one socket to the other through a pipe with splice(2), without being
+ * copied to userspace nor passed down the filter chains.
+ */
+#define PROXY_USE_SPLICE 1
+#define PROXY_SPLICE_KEY "proxy_splice"
+/* The default pipe capacity on Linux */
+#define PROXY_SPLICE_SIZE (64 * 1024)
+
+typedef struct {
+    conn_rec *c_o;              /* spliced to */
+    int disabled;
+    int fd_i, fd_o;             /* the sockets */
+    apr_os_file_t pipe_r, pipe_w;
+    apr_size_t pending;         /* bytes in the pipe */
+    apr_socket_t *sock_o;
+    APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_in) *add_bytes_in;
+    APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_out) *add_bytes_out;
+} proxy_splice_t;
+
+static void proxy_splice_setup(request_rec *r, conn_rec *c_i, conn_rec *c_o,
+                               const char *name)
+{
+    proxy_splice_t *sp = apr_pcalloc(c_i->pool, sizeof(proxy_splice_t));
+    apr_socket_t *sock_i = ap_get_conn_socket(c_i);
+    apr_file_t *pipe_r, *pipe_w;
+    ap_filter_t *f;
+    int logio = 0;
+
+    sp->c_o = c_o;
+    sp->disabled = 1;
+    apr_pool_userdata_setn(sp, PROXY_SPLICE_KEY, NULL, c_i->pool);
+
+    sp->sock_o = ap_get_conn_socket(c_o);
+    if (!sock_i || !sp->sock_o) {
+        return;
+    }
+    for (f = c_i->input_filters; f; f = f->next) {
+        if (f->frec == ap_core_input_filter_handle) {
+            continue;
+        }
+        if (!strcmp(f->frec->name, "log_input_output")) {
+            logio = 1;
+            continue;
+        }
+        return;
+    }
+    for (f = c_o->output_filters; f; f = f->next) {
+        if (f->frec != ap_core_output_filter_handle) {
+            return;
+        }
+    }
+    if (apr_file_pipe_create_ex(&pipe_r, &pipe_w, APR_FULL_NONBLOCK,
+                                c_i->pool) != APR_SUCCESS) {
+        return;
+    }
+    apr_os_file_get(&sp->pipe_r, pipe_r);
+    apr_os_file_get(&sp->pipe_w, pipe_w);
+    apr_os_sock_get(&sp->fd_i, sock_i);
+    apr_os_sock_get(&sp->fd_o, sp->sock_o);
+    if (logio) {
+        sp->add_bytes_in = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_in);
+    }
+    sp->add_bytes_out = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_out);
+    sp->disabled = 0;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                  "ap_proxy_transfer_between_connections: "
+                  "splicing from %s", name);
+}
+
+static apr_status_t proxy_splice_transfer(request_rec *r, proxy_splice_t *sp,
+                                          conn_rec *c_i, conn_rec *c_o,
+                                          const char *name, int *sent)
+{
+    apr_status_t rv = APR_SUCCESS;
+    ssize_t n;
+
+    for (;;) {
+        if (c_o->aborted) {
+            return APR_EPIPE;
+        }
+        if (!sp->pending) {
+            n = splice(sp->fd_i, NULL, sp->pipe_w, NULL, PROXY_SPLICE_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                rv = errno;
+                if (APR_STATUS_IS_EINTR(rv)) {
+                    continue;
+                }
+                if (!APR_STATUS_IS_EAGAIN(rv)) {
+                    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(03519)
+                                  "ap_proxy_transfer_between_connections: "
+                                  "error on %s - splice", name);
+                    c_i->aborted = 1;
+                }
+                break;
+            }
+            if (n == 0) {
+                rv = APR_EOF;
+                break;
+            }
+            sp->pending = n;
+            if (sp->add_bytes_in) {
+                sp->add_bytes_in(c_i, n);
+            }
+            if (sent) {
+                *sent = 1;
+            }
+        }
+
+        /* Write all of it, blocking (up to the timeout) like the flush
+         * of the bucket path.
+         */
+        while (sp->pending) {
+            n = splice(sp->pipe_r, NULL, sp->fd_o, NULL, sp->pending,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                rv = errno;
+                if (APR_STATUS_IS_EINTR(rv)) {
+                    continue;
+                }
+                if (APR_STATUS_IS_EAGAIN(rv)) {
+                    rv = apr_wait_for_io_or_timeout(NULL, sp->sock_o, 0);
+                    if (rv == APR_SUCCESS) {
+                        continue;
+                    }
+                }
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(03520)
+                              "ap_proxy_transfer_between_connections: "
+                              "error on %s - splice", name);
+                c_o->aborted = 1;
+                return rv;
+            }
+            sp->pending -= n;
+            if (sp->add_bytes_out) {
+                sp->add_bytes_out(c_o, n);
+            }
+        }
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, rv, r,
+                  "ap_proxy_transfer_between_connections complete (splice)");
+
+    if (APR_STATUS_IS_EAGAIN(rv)) {
+        rv = APR_SUCCESS;
+    }
+    return rv;
+}
+#endif /* PROXY_USE_SPLICE */
+
 PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
                                                        request_rec *r,
                                                        conn_rec *c_i,
@@ -3847,6 +5087,14 @@ PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
 #ifdef DEBUGGING
     apr_off_t len;
 #endif
+#ifdef PROXY_USE_SPLICE
+    proxy_splice_t *sp = NULL;
+
+    apr_pool_userdata_get((void **)&sp, PROXY_SPLICE_KEY, c_i->pool);
+    if (sp && sp->c_o == c_o && !sp->disabled) {
+        return proxy_splice_transfer(r, sp, c_i, c_o, name, sent);
+    }
+#endif
 
     do {
         apr_brigade_cleanup(bb_i);
@@ -3910,6 +5158,14 @@ PROXY_DECLARE(apr_status_t) ap_proxy_transfer_between_connections(
                   "ap_proxy_transfer_between_connections complete");
 
     if (APR_STATUS_IS_EAGAIN(rv)) {
+#ifdef PROXY_USE_SPLICE
+        /* Nothing is buffered in the filters now, splice from here if
+         * they allow it.
+         */
+        if (!sp || sp->c_o != c_o) {
+            proxy_splice_setup(r, c_i, c_o, name);
+        }
+#endif
         rv = APR_SUCCESS;
     }
 
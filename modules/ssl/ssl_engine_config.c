@@ -208,6 +208,7 @@ static SSLSrvConfigRec *ssl_config_server_new(apr_pool_t *p)
     sc->compression            = UNSET;
 #endif
     sc->session_tickets        = UNSET;
+    sc->kernel_tls             = UNSET;
 
     modssl_ctx_init_server(sc, p);
 
@@ -336,6 +337,7 @@ void *ssl_config_server_merge(apr_pool_t *p, void *basev, void *addv)
     cfgMergeBool(compression);
 #endif
     cfgMergeBool(session_tickets);
+    cfgMergeBool(kernel_tls);
 
     modssl_ctx_cfg_merge_server(p, base->server, add->server, mrg->server);
 
@@ -786,6 +788,17 @@ const char *ssl_cmd_SSLSessionTickets(cmd_parms *cmd, void *dcfg, int flag)
     return NULL;
 }
 
+const char *ssl_cmd_SSLKernelTLS(cmd_parms *cmd, void *dcfg, int flag)
+{
+#ifdef HAVE_SSL_KTLS
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->kernel_tls = flag ? TRUE : FALSE;
+    return NULL;
+#else
+    return "SSLKernelTLS is not supported by this platform or SSL library";
+#endif
+}
+
 const char *ssl_cmd_SSLInsecureRenegotiation(cmd_parms *cmd, void *dcfg, int flag)
 {
 #ifdef SSL_OP_ALLOW_UNSAFE_LEGACY_RENEGOTIATION
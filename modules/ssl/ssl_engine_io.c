@@ -32,6 +32,19 @@
 #include "mod_ssl_openssl.h"
 #include "apr_date.h"
 
+#ifdef HAVE_SSL_KTLS
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <openssl/kdf.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
 APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(ssl, SSL, int, proxy_post_handshake,
                                     (conn_rec *c,SSL *ssl),
                                     (c,ssl),OK,DECLINED);
@@ -198,11 +211,52 @@ static int bio_filter_out_read(BIO *bio, char *out, int outl)
     return -1;
 }
 
+#ifdef HAVE_SSL_KTLS
+/* Follow the TLS records written by OpenSSL, so that the sequence number
+ * of the next record under the current write keys is known when the
+ * output is handed over to the kernel.
+ */
+static void ssl_ktls_count_records(modssl_ktls_t *ktls,
+                                   const unsigned char *in, apr_size_t inl)
+{
+    while (inl > 0) {
+        if (ktls->body_left) {
+            apr_size_t n = (inl < ktls->body_left) ? inl : ktls->body_left;
+            ktls->body_left -= n;
+            in += n;
+            inl -= n;
+            continue;
+        }
+
+        ktls->hdr[ktls->hdr_len++] = *in++;
+        inl--;
+        if (ktls->hdr_len < sizeof(ktls->hdr)) {
+            continue;
+        }
+
+        /* ChangeCipherSpec: the next record is the first one under
+         * the new keys. */
+        if (ktls->hdr[0] == 20) {
+            ktls->ccs_sent = 1;
+            ktls->seq = 0;
+        }
+        else if (ktls->ccs_sent) {
+            ktls->seq++;
+        }
+        ktls->body_left = (ktls->hdr[3] << 8) | ktls->hdr[4];
+        ktls->hdr_len = 0;
+    }
+}
+#endif
+
 static int bio_filter_out_write(BIO *bio, const char *in, int inl)
 {
     bio_filter_out_ctx_t *outctx = (bio_filter_out_ctx_t *)BIO_get_data(bio);
     apr_bucket *e;
     int need_flush;
+#ifdef HAVE_SSL_KTLS
+    modssl_ktls_t *ktls = outctx->filter_ctx->config->ktls;
+#endif
 
     /* Abort early if the client has initiated a renegotiation. */
     if (outctx->filter_ctx->config->reneg_state == RENEG_ABORT) {
@@ -210,6 +264,18 @@ static int bio_filter_out_write(BIO *bio, const char *in, int inl)
         return -1;
     }
 
+#ifdef HAVE_SSL_KTLS
+    if (ktls) {
+        /* Once offloaded, the kernel owns the record layer and anything
+         * OpenSSL would write is encrypted with stale state. */
+        if (ktls->active) {
+            outctx->rc = APR_ECONNABORTED;
+            return -1;
+        }
+        ssl_ktls_count_records(ktls, (const unsigned char *)in, inl);
+    }
+#endif
+
     /* when handshaking we'll have a small number of bytes.
      * max size SSL will pass us here is about 16k.
      * (16413 bytes to be exact)
@@ -1031,6 +1097,43 @@ static const char ssl_io_filter[] = "SSL/TLS Filter";
 static const char ssl_io_buffer[] = "SSL/TLS Buffer";
 static const char ssl_io_coalesce[] = "SSL/TLS Coalescing Filter";
 
+#ifdef HAVE_SSL_KTLS
+/* Send a close_notify alert through the kernel TLS socket, which needs
+ * the record type to be given as ancillary data. */
+static apr_status_t ssl_ktls_send_close_notify(conn_rec *c)
+{
+    apr_os_sock_t fd;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    unsigned char alert[2] = { 1 /* warning */, 0 /* close_notify */ };
+
+    if (apr_os_sock_get(&fd, ap_get_conn_socket(c)) != APR_SUCCESS) {
+        return APR_EGENERAL;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = alert;
+    iov.iov_len = sizeof(alert);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = 21; /* alert */
+
+    if (sendmsg(fd, &msg, 0) < 0) {
+        return errno;
+    }
+    return APR_SUCCESS;
+}
+#endif
+
 /*
  *  Close the SSL part of the socket connection
  *  (called immediately _before_ the socket is closed)
@@ -1120,6 +1223,21 @@ static void ssl_filter_io_shutdown(ssl_filter_ctx_t *filter_ctx,
         break;
     }
 
+#ifdef HAVE_SSL_KTLS
+    if (sslconn->ktls && sslconn->ktls->active) {
+        /* OpenSSL can't write anymore, send the close notify (if any)
+         * ourselves; the caller flushed the pending output already. */
+        if (!(shutdown_type & SSL_SENT_SHUTDOWN)) {
+            apr_status_t rv = ssl_ktls_send_close_notify(c);
+            if (rv != APR_SUCCESS) {
+                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, rv, c, APLOGNO(03492)
+                              "kernel TLS: failed to send close notify");
+            }
+        }
+        shutdown_type = SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN;
+    }
+#endif
+
     SSL_set_shutdown(ssl, shutdown_type);
     modssl_smart_shutdown(ssl);
 
@@ -1761,6 +1879,181 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
     return ap_pass_brigade(f->next, bb);
 }
 
+#ifdef HAVE_SSL_KTLS
+/* Hand the encryption of the output over to the kernel, for TLSv1.2
+ * AES-GCM connections.  The write key and salt are derived from the
+ * master secret (RFC 5246 section 6.3), the kernel continues the record
+ * sequence where OpenSSL stopped.  Returns nonzero on success.
+ */
+static int ssl_ktls_enable(ssl_filter_ctx_t *filter_ctx, conn_rec *c)
+{
+    modssl_ktls_t *ktls = filter_ctx->config->ktls;
+    SSL *ssl = filter_ctx->pssl;
+    const SSL_CIPHER *cipher;
+    const EVP_MD *md;
+    EVP_PKEY_CTX *pctx;
+    apr_os_sock_t fd;
+    unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+    unsigned char crandom[SSL3_RANDOM_SIZE], srandom[SSL3_RANDOM_SIZE];
+    unsigned char block[2 * 32 + 2 * 4];
+    unsigned char seq[8];
+    size_t master_len, key_len, block_len;
+    int i, nid, ok = 0;
+    union {
+        struct tls12_crypto_info_aes_gcm_128 gcm128;
+        struct tls12_crypto_info_aes_gcm_256 gcm256;
+    } info;
+    socklen_t info_len;
+
+    ktls->tried = 1;
+
+    if (SSL_version(ssl) != TLS1_2_VERSION
+        || !ktls->ccs_sent || ktls->hdr_len || ktls->body_left
+        || !(cipher = SSL_get_current_cipher(ssl))) {
+        return 0;
+    }
+    nid = SSL_CIPHER_get_cipher_nid(cipher);
+    if (nid == NID_aes_128_gcm) {
+        key_len = 16;
+        md = EVP_sha256();
+    }
+    else if (nid == NID_aes_256_gcm) {
+        key_len = 32;
+        md = EVP_sha384();
+    }
+    else {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
+                      "kernel TLS: cipher %s not supported",
+                      SSL_CIPHER_get_name(cipher));
+        return 0;
+    }
+    if (apr_os_sock_get(&fd, ap_get_conn_socket(c)) != APR_SUCCESS) {
+        return 0;
+    }
+
+    /* key_block = PRF(master_secret, "key expansion",
+     *                 server_random + client_random), laid out (AEAD) as
+     * client key, server key, client salt, server salt. */
+    master_len = SSL_SESSION_get_master_key(SSL_get_session(ssl),
+                                            master, sizeof(master));
+    SSL_get_client_random(ssl, crandom, sizeof(crandom));
+    SSL_get_server_random(ssl, srandom, sizeof(srandom));
+    block_len = 2 * key_len + 2 * 4;
+    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, NULL);
+    if (pctx
+        && EVP_PKEY_derive_init(pctx) > 0
+        && EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) > 0
+        && EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master, master_len) > 0
+        && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, "key expansion", 13) > 0
+        && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, srandom,
+                                           sizeof(srandom)) > 0
+        && EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, crandom,
+                                           sizeof(crandom)) > 0
+        && EVP_PKEY_derive(pctx, block, &block_len) > 0) {
+        ok = 1;
+    }
+    EVP_PKEY_CTX_free(pctx);
+    OPENSSL_cleanse(master, sizeof(master));
+    if (!ok) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03493)
+                      "kernel TLS: key derivation failed");
+        return 0;
+    }
+
+    for (i = 7; i >= 0; --i) {
+        seq[i] = (unsigned char)(ktls->seq >> ((7 - i) * 8));
+    }
+    memset(&info, 0, sizeof(info));
+    if (key_len == 16) {
+        info.gcm128.info.version = TLS_1_2_VERSION;
+        info.gcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(info.gcm128.key, block + key_len, key_len);
+        memcpy(info.gcm128.salt, block + 2 * key_len + 4, 4);
+        memcpy(info.gcm128.iv, seq, sizeof(seq));
+        memcpy(info.gcm128.rec_seq, seq, sizeof(seq));
+        info_len = sizeof(info.gcm128);
+    }
+    else {
+        info.gcm256.info.version = TLS_1_2_VERSION;
+        info.gcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(info.gcm256.key, block + key_len, key_len);
+        memcpy(info.gcm256.salt, block + 2 * key_len + 4, 4);
+        memcpy(info.gcm256.iv, seq, sizeof(seq));
+        memcpy(info.gcm256.rec_seq, seq, sizeof(seq));
+        info_len = sizeof(info.gcm256);
+    }
+    OPENSSL_cleanse(block, sizeof(block));
+
+    ok = (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0
+          && setsockopt(fd, SOL_TLS, TLS_TX, &info, info_len) == 0);
+    OPENSSL_cleanse(&info, sizeof(info));
+    if (!ok) {
+        /* The ULP may be attached already, but without TLS_TX
+         * the socket still carries OpenSSL's records untouched. */
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, errno, c, APLOGNO(03494)
+                      "kernel TLS: offload not available");
+        return 0;
+    }
+
+    ktls->active = 1;
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03495)
+                  "kernel TLS: output offloaded (%s, seq %" APR_UINT64_T_FMT ")",
+                  SSL_CIPHER_get_name(cipher), ktls->seq);
+    return 1;
+}
+
+/* Whether all the records written by OpenSSL have reached the socket,
+ * flushing them (blocking) if nothing else is pending downstream.  If
+ * the kernel took over with some of them still set aside by the core,
+ * its own records could be sent first, or plain data appended to them.
+ */
+static int ssl_ktls_flushed(ap_filter_t *f, bio_filter_out_ctx_t *outctx)
+{
+    apr_bucket_brigade *bb = outctx->bb;
+    apr_status_t rv;
+
+    if (!APR_BRIGADE_EMPTY(bb) || ap_filter_should_yield(f->next)) {
+        return 0;
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_flush_create(bb->bucket_alloc));
+    rv = ap_pass_brigade(f->next, bb);
+    apr_brigade_cleanup(bb);
+
+    return rv == APR_SUCCESS && !ap_filter_should_yield(f->next);
+}
+
+/* Output once the kernel encrypts: plain data goes down as is (so that
+ * the core can sendfile), only the close notify needs our care. */
+static apr_status_t ssl_ktls_output(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    ssl_filter_ctx_t *filter_ctx = f->ctx;
+    bio_filter_out_ctx_t *outctx;
+    apr_bucket *e;
+    apr_status_t status;
+
+    for (e = APR_BRIGADE_FIRST(bb);
+         e != APR_BRIGADE_SENTINEL(bb) && !AP_BUCKET_IS_EOC(e);
+         e = APR_BUCKET_NEXT(e))
+        ;
+    if (e == APR_BRIGADE_SENTINEL(bb)) {
+        return ap_pass_brigade(f->next, bb);
+    }
+
+    /* Flush everything before the EOC, then send the alert and
+     * pass the rest. */
+    outctx = (bio_filter_out_ctx_t *)BIO_get_data(filter_ctx->pbioWrite);
+    AP_DEBUG_ASSERT(APR_BRIGADE_EMPTY(outctx->bb));
+    apr_brigade_split_ex(bb, e, outctx->bb);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_flush_create(bb->bucket_alloc));
+    status = ap_pass_brigade(f->next, bb);
+    apr_brigade_cleanup(bb);
+    ssl_filter_io_shutdown(filter_ctx, f->c, status != APR_SUCCESS);
+
+    APR_BRIGADE_CONCAT(bb, outctx->bb);
+    return ap_pass_brigade(f->next, bb);
+}
+#endif
+
 static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                                          apr_bucket_brigade *bb)
 {
@@ -1798,6 +2091,29 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
         return ssl_io_filter_error(f, bb, status, 0);
     }
 
+#ifdef HAVE_SSL_KTLS
+    if (filter_ctx->config->ktls && filter_ctx->config->ktls->active) {
+        return ssl_ktls_output(f, bb);
+    }
+#endif
+
+#ifdef HAVE_SSL_KTLS
+    /* Offload when there is a file to send, which the core can then
+     * sendfile() instead of us reading and encrypting it.  A pending
+     * renegotiation would need OpenSSL to write records again.  This
+     * happens at the start of a brigade only, once the records written
+     * by OpenSSL have all reached the socket.
+     */
+    if (filter_ctx->config->ktls && !filter_ctx->config->ktls->tried
+        && !APR_BRIGADE_EMPTY(bb) && APR_BUCKET_IS_FILE(APR_BRIGADE_FIRST(bb))
+        && filter_ctx->config->reneg_state != RENEG_ALLOW
+        && mySrvConfig(mySrvFromConn(f->c))->kernel_tls == TRUE
+        && ssl_ktls_flushed(f, outctx)
+        && ssl_ktls_enable(filter_ctx, f->c)) {
+        return ssl_ktls_output(f, bb);
+    }
+#endif
+
     while (!APR_BRIGADE_EMPTY(bb) && status == APR_SUCCESS) {
         apr_bucket *bucket = APR_BRIGADE_FIRST(bb);
 
@@ -2111,6 +2427,16 @@ void ssl_io_filter_init(conn_rec *c, request_rec *r, SSL *ssl)
 
     filter_ctx->config          = myConnConfig(c);
 
+#ifdef HAVE_SSL_KTLS
+    /* Records are followed from the start of the handshake, for
+     * connections accepted on a SSLKernelTLS enabled address. */
+    if (mySrvConfig(c->base_server)->kernel_tls == TRUE
+        && !filter_ctx->config->is_proxy && !c->master) {
+        filter_ctx->config->ktls = apr_pcalloc(c->pool,
+                                               sizeof(modssl_ktls_t));
+    }
+#endif
+
     ap_add_output_filter(ssl_io_coalesce, NULL, r, c);
 
     filter_ctx->pOutputFilter   = ap_add_output_filter(ssl_io_filter,
@@ -829,6 +829,18 @@ int ssl_hook_Access(request_rec *r)
      * solution used here is to fill a (bounded) buffer with the
      * request body, and then to reinject that request body later.
      */
+#ifdef HAVE_SSL_KTLS
+    /* OpenSSL can't write the handshake records anymore once the kernel
+     * encrypts the output (SSLKernelTLS). */
+    if (renegotiate && !renegotiate_quick
+        && sslconn->ktls && sslconn->ktls->active) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(03496)
+                      "cannot renegotiate a connection offloaded "
+                      "to kernel TLS");
+        return HTTP_FORBIDDEN;
+    }
+#endif
+
     if (renegotiate && !renegotiate_quick
         && (apr_table_get(r->headers_in, "transfer-encoding")
             || (apr_table_get(r->headers_in, "content-length")
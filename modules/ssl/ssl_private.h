@@ -186,6 +186,12 @@
 #endif
 #endif
 
+/* Kernel TLS offload of the transmit path (Linux), TLSv1.2 AES-GCM only */
+#if defined(HAVE_LINUX_TLS_H) && OPENSSL_VERSION_NUMBER >= 0x10100000L \
+    && !defined(LIBRESSL_VERSION_NUMBER)
+#define HAVE_SSL_KTLS
+#endif
+
 /* Secure Remote Password */
 #if !defined(OPENSSL_NO_SRP) && defined(SSL_CTRL_SET_TLS_EXT_SRP_USERNAME_CB)
 #define HAVE_SRP
@@ -469,6 +475,22 @@ typedef enum {
     SSL_SHUTDOWN_TYPE_ACCURATE
 } ssl_shutdown_type_e;
 
+#ifdef HAVE_SSL_KTLS
+/* State of the kernel TLS offload for a connection */
+typedef struct {
+    int tried;                /* enabling was attempted (once) */
+    int active;               /* the kernel encrypts our output */
+    /* Records written by OpenSSL, to know the sequence number of the next
+     * one under the current write keys (reset by ChangeCipherSpec).
+     */
+    int ccs_sent;
+    apr_uint64_t seq;
+    unsigned char hdr[5];
+    apr_size_t hdr_len;
+    apr_size_t body_left;
+} modssl_ktls_t;
+#endif
+
 typedef struct {
     SSL *ssl;
     const char *client_dn;
@@ -503,6 +525,10 @@ typedef struct {
     SSLDirConfigRec *dc;
     
     const char *cipher_suite; /* cipher suite used in last reneg */
+
+#ifdef HAVE_SSL_KTLS
+    modssl_ktls_t *ktls;      /* SSLKernelTLS state, if enabled */
+#endif
 } SSLConnRec;
 
 /* BIG FAT WARNING: SSLModConfigRec has unusual memory lifetime: it is
@@ -707,6 +733,7 @@ struct SSLSrvConfigRec {
     BOOL             compression;
 #endif
     BOOL             session_tickets;
+    BOOL             kernel_tls;
 };
 
 /**
@@ -766,6 +793,7 @@ const char  *ssl_cmd_SSLCARevocationCheck(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLHonorCipherOrder(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLCompression(cmd_parms *, void *, int flag);
 const char  *ssl_cmd_SSLSessionTickets(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLKernelTLS(cmd_parms *, void *, int flag);
 const char  *ssl_cmd_SSLVerifyClient(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLVerifyDepth(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLSessionCache(cmd_parms *, void *, const char *);
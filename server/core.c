@@ -588,6 +588,10 @@ static void *merge_core_server_configs(apr_pool_t *p, void *basev, void *virtv)
                                        base->async_filter);
     conf->async_filter_set = base->async_filter_set || virt->async_filter_set;
 
+    conf->zerocopy = (virt->zerocopy != AP_ZEROCOPY_UNSET)
+                     ? virt->zerocopy
+                     : base->zerocopy;
+
     return conf;
 }
 
@@ -4467,6 +4471,37 @@ AP_DECLARE(void) ap_register_errorlog_handler(apr_pool_t *p, char *tag,
 }
 
 
+static const char *set_zerocopy(cmd_parms *cmd, void *dummy, int arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    conf->zerocopy = (arg ? AP_ZEROCOPY_ENABLE : AP_ZEROCOPY_DISABLE);
+
+    return NULL;
+}
+
+static const char *set_merge_cache_size(cmd_parms *cmd, void *dummy,
+                                        const char *arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    int n;
+
+    if (err != NULL) {
+        return err;
+    }
+
+    n = atoi(arg);
+    if (n < 0) {
+        return "PerDirMergeCacheSize must be a non-negative integer";
+    }
+    conf->merge_cache_size = n;
+    conf->merge_cache_size_set = 1;
+
+    return NULL;
+}
+
 static const char *set_merge_trailers(cmd_parms *cmd, void *dummy, int arg)
 {
     core_server_config *conf = ap_get_module_config(cmd->server->module_config,
@@ -4758,6 +4793,12 @@ AP_INIT_TAKE1("ProtocolsHonorOrder", set_protocols_honor_order, NULL, RSRC_CONF,
 AP_INIT_TAKE1("AsyncFilter", set_async_filter, NULL, RSRC_CONF,
               "'network', 'connection' (default) or 'request' to limit the "
               "types of filters that support asynchronous handling"),
+AP_INIT_FLAG("EnableZeroCopy", set_zerocopy, NULL, RSRC_CONF,
+             "Controls whether large responses are sent with zero-copy "
+             "(MSG_ZEROCOPY) where available"),
+AP_INIT_TAKE1("PerDirMergeCacheSize", set_merge_cache_size, NULL, RSRC_CONF,
+              "Maximum number of per-directory configuration merges cached "
+              "by each child process, 0 to disable the cache"),
 { NULL }
 };
 
@@ -5417,6 +5458,8 @@ static void core_child_init(apr_pool_t *pchild, server_rec *s)
      */
     proc.pid = getpid();
     apr_random_after_fork(&proc);
+
+    ap_init_merge_cache(pchild, s);
 }
 
 static void core_optional_fn_retrieve(void)
@@ -5575,9 +5618,10 @@ static int core_upgrade_handler(request_rec *r)
         return DECLINED;
     }
     
-    upgrade = apr_table_get(r->headers_in, "Upgrade");
+    upgrade = ap_get_known_header_in(r, AP_KNOWN_HEADER_UPGRADE);
     if (upgrade && *upgrade) {
-        const char *conn = apr_table_get(r->headers_in, "Connection");
+        const char *conn = ap_get_known_header_in(r,
+                                                  AP_KNOWN_HEADER_CONNECTION);
         if (ap_find_token(r->pool, conn, "upgrade")) {
             apr_array_header_t *offers = NULL;
             const char *err;
@@ -5683,6 +5727,8 @@ static void register_hooks(apr_pool_t *p)
                                  APR_HOOK_MIDDLE);
     ap_hook_output_pending(ap_filter_output_pending, NULL, NULL,
             APR_HOOK_MIDDLE);
+    ap_hook_output_pending(ap_core_output_pending, NULL, NULL,
+            APR_HOOK_LAST);
 
     /* register the core's insert_filter hook and register core-provided
      * filters
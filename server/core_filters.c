@@ -54,6 +54,33 @@
 
 #define AP_MIN_SENDFILE_BYTES           (256)
 
+/**
+ * Writes of less than this many bytes are not worth the page pinning and
+ * completion notification of MSG_ZEROCOPY (see EnableZeroCopy).
+ */
+#define AP_MIN_ZEROCOPY_BYTES           (16384)
+
+/**
+ * When a brigade holds more data buckets than can be written with a
+ * single writev(), consecutive buckets smaller than AP_COALESCE_BUCKET_BYTES
+ * are copied together into heap buckets of up to AP_COALESCE_BUFFER_BYTES.
+ */
+#define AP_COALESCE_BUCKET_BYTES        (512)
+#define AP_COALESCE_BUFFER_BYTES        (8192)
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(HAVE_SYS_SOCKET_H)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) \
+    && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define CORE_HAS_ZEROCOPY 1
+#endif
+#endif
+#ifndef CORE_HAS_ZEROCOPY
+#define CORE_HAS_ZEROCOPY 0
+#endif
+
 /**
  * Remove all zero length buckets from the brigade.
  */
@@ -77,10 +104,40 @@ do { \
 #undef APLOG_MODULE_INDEX
 #define APLOG_MODULE_INDEX AP_CORE_MODULE_INDEX
 
+#if CORE_HAS_ZEROCOPY
+/* Maximum number of MSG_ZEROCOPY sends in flight per connection, further
+ * writes are copied until the kernel releases some.
+ */
+#define ZEROCOPY_MAX_BATCHES 64
+/* Give up on zero-copy for a connection whose sends the kernel keeps
+ * copying anyway (e.g. loopback, or a device without scatter-gather).
+ */
+#define ZEROCOPY_MAX_COPIED  8
+
+typedef struct {
+    apr_os_sock_t fd;
+    /* Buckets whose data was sent but may still be referenced by the
+     * kernel, in send order; they are destroyed on completion. */
+    apr_bucket_brigade *pending;
+    struct {
+        apr_uint32_t id;
+        apr_size_t nbuckets;
+    } batches[ZEROCOPY_MAX_BATCHES];
+    unsigned int head, count;
+    apr_uint32_t next_id;   /* id of the next zero-copy send */
+    apr_uint32_t done_id;   /* all sends below this id completed */
+    int copied;
+    int disabled;
+} core_zerocopy_t;
+#else
+typedef void core_zerocopy_t;
+#endif
+
 struct core_output_filter_ctx {
     apr_bucket_brigade *tmp_flush_bb;
     apr_bucket_brigade *empty_bb;
     apr_size_t bytes_written;
+    core_zerocopy_t *zc;
 };
 
 struct core_filter_ctx {
@@ -329,21 +386,31 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
 static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                                              apr_bucket_brigade *bb,
                                              apr_size_t *bytes_written,
+                                             core_zerocopy_t *zc,
                                              conn_rec *c);
 
 static void remove_empty_buckets(apr_bucket_brigade *bb);
 
+static void coalesce_small_buckets(apr_bucket_brigade *bb);
+
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
                                           apr_size_t *bytes_written,
+                                          core_zerocopy_t *zc,
                                           conn_rec *c);
 
 static apr_status_t writev_nonblocking(apr_socket_t *s,
                                        struct iovec *vec, apr_size_t nvec,
                                        apr_bucket_brigade *bb,
                                        apr_size_t *cumulative_bytes_written,
+                                       core_zerocopy_t *zc,
                                        conn_rec *c);
 
+#if CORE_HAS_ZEROCOPY
+static core_zerocopy_t *zerocopy_init(apr_socket_t *s, conn_rec *c);
+static void zerocopy_reap(core_zerocopy_t *zc);
+#endif
+
 #if APR_HAS_SENDFILE
 static apr_status_t sendfile_nonblocking(apr_socket_t *s,
                                          apr_bucket *bucket,
@@ -380,8 +447,18 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
          * allocated from bb->pool which might be wrong.
          */
         ctx->tmp_flush_bb = apr_brigade_create(c->pool, c->bucket_alloc);
+#if CORE_HAS_ZEROCOPY
+        ctx->zc = zerocopy_init(net->client_socket, c);
+#endif
     }
 
+#if CORE_HAS_ZEROCOPY
+    /* Release what the kernel is done with */
+    if (ctx->zc && ctx->zc->count) {
+        zerocopy_reap(ctx->zc);
+    }
+#endif
+
     /* remain compatible with legacy MPMs that passed NULL to this filter */
     if (bb == NULL) {
         if (ctx->empty_bb == NULL) {
@@ -447,7 +524,7 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
                               "flushing now");
         }
         rv = send_brigade_blocking(net->client_socket, bb,
-                                   &(ctx->bytes_written), c);
+                                   &(ctx->bytes_written), ctx->zc, c);
         if (rv != APR_SUCCESS) {
             /* The client has aborted the connection */
             ap_log_cerror(APLOG_MARK, APLOG_TRACE1, rv, c,
@@ -465,7 +542,7 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
     }
 
     rv = send_brigade_nonblocking(net->client_socket, bb, &(ctx->bytes_written),
-            c);
+            ctx->zc, c);
     if ((rv != APR_SUCCESS) && (!APR_STATUS_IS_EAGAIN(rv))) {
         /* The client has aborted the connection */
         ap_log_cerror(
@@ -498,17 +575,34 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
 #endif
 #endif
 
+/* Whether the vector being built can be sent with MSG_ZEROCOPY, i.e. all
+ * its buckets' data stay valid (and unchanged) as long as the buckets do.
+ */
+#if CORE_HAS_ZEROCOPY
+#define ZEROCOPY_BUCKET(b) (APR_BUCKET_IS_HEAP(b) || APR_BUCKET_IS_MMAP(b) \
+                            || APR_BUCKET_IS_IMMORTAL(b))
+#define ZEROCOPY_VEC(zc, ok, len) \
+    (((ok) && (len) >= AP_MIN_ZEROCOPY_BYTES && (zc) && !(zc)->disabled) \
+     ? (zc) : NULL)
+#else
+#define ZEROCOPY_BUCKET(b) 0
+#define ZEROCOPY_VEC(zc, ok, len) NULL
+#endif
+
 static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                                              apr_bucket_brigade *bb,
                                              apr_size_t *bytes_written,
+                                             core_zerocopy_t *zc,
                                              conn_rec *c)
 {
     apr_bucket *bucket, *next;
     apr_status_t rv;
     struct iovec vec[MAX_IOVEC_TO_WRITE];
-    apr_size_t nvec = 0;
+    apr_size_t nvec = 0, nbytes = 0;
+    int zc_ok = 1;
 
     remove_empty_buckets(bb);
+    coalesce_small_buckets(bb);
 
     for (bucket = APR_BRIGADE_FIRST(bb);
          bucket != APR_BRIGADE_SENTINEL(bb);
@@ -528,7 +622,9 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                 (bucket->length >= AP_MIN_SENDFILE_BYTES)) {
                 if (nvec > 0) {
                     (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 1);
-                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                            ZEROCOPY_VEC(zc, zc_ok, nbytes),
+                                            c);
                     if (rv != APR_SUCCESS) {
                         (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 0);
                         return rv;
@@ -557,11 +653,14 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
             if (APR_STATUS_IS_EAGAIN(rv)) {
                 /* Read would block; flush any pending data and retry. */
                 if (nvec) {
-                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                            ZEROCOPY_VEC(zc, zc_ok, nbytes),
+                                            c);
                     if (rv) {
                         return rv;
                     }
-                    nvec = 0;
+                    nvec = nbytes = 0;
+                    zc_ok = 1;
                 }
                 
                 rv = apr_bucket_read(bucket, &data, &length, APR_BLOCK_READ);
@@ -575,8 +674,11 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
             vec[nvec].iov_base = (char *)data;
             vec[nvec].iov_len = length;
             nvec++;
+            nbytes += length;
+            zc_ok = zc_ok && ZEROCOPY_BUCKET(bucket);
             if (nvec == MAX_IOVEC_TO_WRITE) {
-                rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+                rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                        ZEROCOPY_VEC(zc, zc_ok, nbytes), c);
                 nvec = 0;
                 if (rv != APR_SUCCESS) {
                     return rv;
@@ -587,7 +689,8 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
     }
 
     if (nvec > 0) {
-        rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+        rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                ZEROCOPY_VEC(zc, zc_ok, nbytes), c);
         if (rv != APR_SUCCESS) {
             return rv;
         }
@@ -598,6 +701,81 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
     return APR_SUCCESS;
 }
 
+#define COALESCE_BUCKET(b) \
+    ((APR_BUCKET_IS_HEAP(b) || APR_BUCKET_IS_POOL(b) \
+      || APR_BUCKET_IS_TRANSIENT(b) || APR_BUCKET_IS_IMMORTAL(b)) \
+     && (b)->length < AP_COALESCE_BUCKET_BYTES)
+
+static void coalesce_small_buckets(apr_bucket_brigade *bb)
+{
+    apr_bucket *bucket, *next;
+    apr_size_t nvec = 0;
+
+    /* Nothing to gain if the next writev() can take everything */
+    for (bucket = APR_BRIGADE_FIRST(bb);
+         bucket != APR_BRIGADE_SENTINEL(bb) && nvec <= MAX_IOVEC_TO_WRITE;
+         bucket = APR_BUCKET_NEXT(bucket)) {
+        if (!APR_BUCKET_IS_METADATA(bucket)) {
+            nvec++;
+        }
+    }
+    if (nvec <= MAX_IOVEC_TO_WRITE) {
+        return;
+    }
+
+    /* Merge the runs of small buckets found in what the next writev()
+     * will take, metadata buckets (e.g. EOR) end a run.
+     */
+    nvec = 0;
+    for (bucket = APR_BRIGADE_FIRST(bb);
+         bucket != APR_BRIGADE_SENTINEL(bb) && nvec < MAX_IOVEC_TO_WRITE;
+         bucket = next) {
+        apr_bucket *last, *e;
+        apr_size_t total;
+        char *buf;
+
+        next = APR_BUCKET_NEXT(bucket);
+        if (APR_BUCKET_IS_METADATA(bucket)) {
+            continue;
+        }
+        nvec++;
+        if (!COALESCE_BUCKET(bucket)) {
+            continue;
+        }
+
+        total = bucket->length;
+        last = bucket;
+        while (next != APR_BRIGADE_SENTINEL(bb) && COALESCE_BUCKET(next)
+               && total + next->length <= AP_COALESCE_BUFFER_BYTES) {
+            total += next->length;
+            last = next;
+            next = APR_BUCKET_NEXT(next);
+        }
+        if (last == bucket) {
+            continue;
+        }
+
+        buf = apr_bucket_alloc(total, bb->bucket_alloc);
+        total = 0;
+        do {
+            const char *data;
+            apr_size_t length;
+
+            e = bucket;
+            bucket = APR_BUCKET_NEXT(bucket);
+            /* in-memory buckets, can't fail */
+            (void)apr_bucket_read(e, &data, &length, APR_NONBLOCK_READ);
+            memcpy(buf + total, data, length);
+            total += length;
+            apr_bucket_delete(e);
+        } while (e != last);
+
+        e = apr_bucket_heap_create(buf, total, apr_bucket_free,
+                                   bb->bucket_alloc);
+        APR_BUCKET_INSERT_BEFORE(next, e);
+    }
+}
+
 static void remove_empty_buckets(apr_bucket_brigade *bb)
 {
     apr_bucket *bucket;
@@ -610,13 +788,14 @@ static void remove_empty_buckets(apr_bucket_brigade *bb)
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
                                           apr_size_t *bytes_written,
+                                          core_zerocopy_t *zc,
                                           conn_rec *c)
 {
     apr_status_t rv;
 
     rv = APR_SUCCESS;
     while (!APR_BRIGADE_EMPTY(bb)) {
-        rv = send_brigade_nonblocking(s, bb, bytes_written, c);
+        rv = send_brigade_nonblocking(s, bb, bytes_written, zc, c);
         if (rv != APR_SUCCESS) {
             if (APR_STATUS_IS_EAGAIN(rv)) {
                 /* Wait until we can send more data */
@@ -644,10 +823,159 @@ static apr_status_t send_brigade_blocking(apr_socket_t *s,
     return rv;
 }
 
+#if CORE_HAS_ZEROCOPY
+
+static core_zerocopy_t *zerocopy_init(apr_socket_t *s, conn_rec *c)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(c->base_server->module_config);
+    core_zerocopy_t *zc;
+    apr_os_sock_t fd;
+    int one = 1;
+
+    /* The completions raise POLLERR on the socket, which only an async
+     * MPM can be told about (see ap_core_output_pending() below), a sync
+     * one would spin on the keepalive read.
+     */
+    if (conf->zerocopy != AP_ZEROCOPY_ENABLE || !c->cs
+            || apr_os_sock_get(&fd, s) != APR_SUCCESS) {
+        return NULL;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, errno, c, APLOGNO(03497)
+                      "core_output_filter: zero-copy not available");
+        return NULL;
+    }
+
+    zc = apr_pcalloc(c->pool, sizeof(*zc));
+    zc->fd = fd;
+    zc->pending = apr_brigade_create(c->pool, c->bucket_alloc);
+    return zc;
+}
+
+/* Send with MSG_ZEROCOPY, the kernel will notify on the socket's error
+ * queue when it no longer references the data.
+ */
+static apr_status_t zerocopy_sendv(core_zerocopy_t *zc,
+                                   const struct iovec *vec, apr_size_t nvec,
+                                   apr_size_t *len)
+{
+    struct msghdr msg;
+    ssize_t rc;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)vec;
+    msg.msg_iovlen = nvec;
+    do {
+        rc = sendmsg(zc->fd, &msg, MSG_ZEROCOPY);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) {
+        *len = 0;
+        return apr_get_netos_error();
+    }
+    *len = rc;
+    zc->next_id++;
+    return APR_SUCCESS;
+}
+
+/* Read the completions from the error queue, and destroy the buckets of
+ * the completed sends.  For TCP the completions come in order, a range
+ * not contiguous with the previous ones only delays the release to the
+ * end of the connection.
+ */
+static void zerocopy_reap(core_zerocopy_t *zc)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+
+    for (;;) {
+        struct msghdr msg;
+        struct cmsghdr *cm;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *ee;
+
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+#ifdef IPV6_RECVERR
+                && !(cm->cmsg_level == SOL_IPV6
+                     && cm->cmsg_type == IPV6_RECVERR)
+#endif
+                ) {
+                continue;
+            }
+            ee = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            /* [ee_info, ee_data] completed */
+            if ((apr_int32_t)(ee->ee_info - zc->done_id) <= 0
+                    && (apr_int32_t)(ee->ee_data + 1 - zc->done_id) > 0) {
+                zc->done_id = ee->ee_data + 1;
+            }
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                if (++zc->copied >= ZEROCOPY_MAX_COPIED) {
+                    zc->disabled = 1;
+                }
+            }
+            else {
+                zc->copied = 0;
+            }
+        }
+    }
+
+    while (zc->count && (apr_int32_t)(zc->batches[zc->head].id
+                                      - zc->done_id) < 0) {
+        apr_size_t n = zc->batches[zc->head].nbuckets;
+        while (n--) {
+            apr_bucket_delete(APR_BRIGADE_FIRST(zc->pending));
+        }
+        zc->head = (zc->head + 1) % ZEROCOPY_MAX_BATCHES;
+        zc->count--;
+    }
+}
+
+#endif /* CORE_HAS_ZEROCOPY */
+
+/* Keep the connection in write completion while the kernel references
+ * sent data, waiting for the completion notifications (POLLERR) only:
+ * writability or readability (pipelined requests) could wake the MPM up
+ * before any completion, and again and again.
+ */
+int ap_core_output_pending(conn_rec *c)
+{
+#if CORE_HAS_ZEROCOPY
+    ap_filter_t *f;
+    core_output_filter_ctx_t *ctx;
+
+    for (f = c->output_filters; f && f->next; f = f->next)
+        ;
+    if (!f || f->frec != ap_core_output_filter_handle
+            || !(ctx = ((core_net_rec *)f->ctx)->out_ctx)
+            || !ctx->zc || !ctx->zc->count) {
+        return DECLINED;
+    }
+
+    zerocopy_reap(ctx->zc);
+    if (!ctx->zc->count) {
+        return DECLINED;
+    }
+    c->cs->sense = CONN_SENSE_WANT_ERRQUEUE;
+    return OK;
+#else
+    return DECLINED;
+#endif
+}
+
 static apr_status_t writev_nonblocking(apr_socket_t *s,
                                        struct iovec *vec, apr_size_t nvec,
                                        apr_bucket_brigade *bb,
                                        apr_size_t *cumulative_bytes_written,
+                                       core_zerocopy_t *zc,
                                        conn_rec *c)
 {
     apr_status_t rv = APR_SUCCESS, arv;
@@ -670,6 +998,25 @@ static apr_status_t writev_nonblocking(apr_socket_t *s,
     offset = 0;
     while (bytes_written < bytes_to_write) {
         apr_size_t n = 0;
+        apr_bucket_brigade *pending = NULL;
+#if CORE_HAS_ZEROCOPY
+        if (zc && zc->count < ZEROCOPY_MAX_BATCHES) {
+            rv = zerocopy_sendv(zc, vec + offset, nvec - offset, &n);
+            if (n > 0) {
+                /* Keep the sent buckets until the completion */
+                unsigned int tail = (zc->head + zc->count++)
+                                    % ZEROCOPY_MAX_BATCHES;
+                zc->batches[tail].id = zc->next_id - 1;
+                zc->batches[tail].nbuckets = 0;
+                pending = zc->pending;
+            }
+            else if (rv == APR_ENOBUFS) {
+                /* Out of option memory (optmem_max), copy this one */
+                rv = apr_socket_sendv(s, vec + offset, nvec - offset, &n);
+            }
+        }
+        else
+#endif
         rv = apr_socket_sendv(s, vec + offset, nvec - offset, &n);
         if (n > 0) {
             bytes_written += n;
@@ -677,15 +1024,28 @@ static apr_status_t writev_nonblocking(apr_socket_t *s,
                 apr_bucket *bucket = APR_BRIGADE_FIRST(bb);
                 if (APR_BUCKET_IS_METADATA(bucket)) {
                     apr_bucket_delete(bucket);
+                    continue;
+                }
+                if (n < vec[i].iov_len) {
+                    apr_bucket_split(bucket, n);
+                }
+                if (pending) {
+#if CORE_HAS_ZEROCOPY
+                    unsigned int tail = (zc->head + zc->count - 1)
+                                        % ZEROCOPY_MAX_BATCHES;
+                    zc->batches[tail].nbuckets++;
+#endif
+                    APR_BUCKET_REMOVE(bucket);
+                    APR_BRIGADE_INSERT_TAIL(pending, bucket);
                 }
-                else if (n >= vec[i].iov_len) {
+                else {
                     apr_bucket_delete(bucket);
+                }
+                if (n >= vec[i].iov_len) {
                     offset++;
                     n -= vec[i++].iov_len;
                 }
                 else {
-                    apr_bucket_split(bucket, n);
-                    apr_bucket_delete(bucket);
                     vec[i].iov_len -= n;
                     vec[i].iov_base = (char *) vec[i].iov_base + n;
                     break;
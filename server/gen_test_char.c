@@ -55,10 +55,68 @@
 #define T_HTTP_CTRLS          (0x80)
 #define T_VCHAR_OBSTEXT      (0x100)
 
+/* The SIMD scanners in util.c classify 16 or 32 characters at once with
+ * two lookup tables indexed by the low and high nibbles: c belongs to the
+ * class iff (lo[c & 0xf] & hi[c >> 4]) != 0.  Each distinct set of low
+ * nibbles found in a row (high nibble) takes one bit, so the class must
+ * not have more than 8 distinct rows.
+ */
+static int print_nibbles(const char *name, const unsigned short *table,
+                         unsigned short flag)
+{
+    unsigned int rows[16], classes[8];
+    unsigned char lo[16], hi[16];
+    int nclasses = 0, h, l, j;
+
+    memset(lo, 0, sizeof(lo));
+    memset(hi, 0, sizeof(hi));
+    for (h = 0; h < 16; ++h) {
+        rows[h] = 0;
+        for (l = 0; l < 16; ++l) {
+            if (table[h << 4 | l] & flag) {
+                rows[h] |= 1u << l;
+            }
+        }
+        if (!rows[h]) {
+            continue;
+        }
+        for (j = 0; j < nclasses && classes[j] != rows[h]; ++j)
+            ;
+        if (j == nclasses) {
+            if (nclasses == 8) {
+                fprintf(stderr, "gen_test_char: too many rows for %s\n",
+                        name);
+                return -1;
+            }
+            classes[nclasses++] = rows[h];
+        }
+        hi[h] = 1u << j;
+        for (l = 0; l < 16; ++l) {
+            if (rows[h] & (1u << l)) {
+                lo[l] |= 1u << j;
+            }
+        }
+    }
+
+    printf("static const unsigned char test_char_nibbles_%s[2][16] = {\n"
+           "    {", name);
+    for (l = 0; l < 16; ++l) {
+        printf(" 0x%02x%c", lo[l], (l < 15) ? ',' : ' ');
+    }
+    printf("},\n    {");
+    for (h = 0; h < 16; ++h) {
+        printf(" 0x%02x%c", hi[h], (h < 15) ? ',' : ' ');
+    }
+    printf("}\n};\n");
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     unsigned c;
     unsigned short flags;
+    unsigned short table[256];
 
     printf("/* this file is automatically generated by gen_test_char, "
            "do not edit */\n"
@@ -164,10 +222,19 @@ int main(int argc, char *argv[])
             flags |= T_ESCAPE_FORENSIC;
         }
 
+        table[c] = flags;
         printf("0x%03x%c", flags, (c < 255) ? ',' : ' ');
     }
 
     printf("\n};\n");
 
+    printf("\n#ifdef TEST_CHAR_WANT_NIBBLES\n");
+    if (print_nibbles("http_token_stop", table, T_HTTP_TOKEN_STOP)
+            || print_nibbles("http_ctrls", table, T_HTTP_CTRLS)
+            || print_nibbles("vchar_obstext", table, T_VCHAR_OBSTEXT)) {
+        return 1;
+    }
+    printf("#endif\n");
+
     return 0;
 }
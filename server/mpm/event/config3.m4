@@ -6,10 +6,24 @@ APACHE_CHECK_SERF
 if test "$ac_cv_serf" = yes ; then
     APR_ADDTO(MOD_MPM_EVENT_LDADD,[\$(SERF_LIBS)])
 fi
+AC_ARG_WITH(liburing, APACHE_HELP_STRING(--with-liburing,
+            Use liburing for the event MPM io_uring engine (AsyncIOEngine)),
+[
+    if test "$withval" != "no"; then
+        AC_CHECK_HEADERS(liburing.h, [
+            AC_CHECK_LIB(uring, io_uring_queue_init_params, [
+                APR_ADDTO(MOD_MPM_EVENT_LDADD,[-luring])
+                AC_DEFINE(HAVE_LIBURING, 1,
+                          [Define if liburing is available])
+            ])
+        ])
+    fi
+])
+
 APACHE_SUBST(MOD_MPM_EVENT_LDADD)
 
-APACHE_MPM_MODULE(event, $enable_mpm_event, event.lo fdqueue.lo,[
-    AC_CHECK_FUNCS(pthread_kill)
+APACHE_MPM_MODULE(event, $enable_mpm_event, event.lo fdqueue.lo uring.lo,[
+    AC_CHECK_FUNCS(pthread_kill sched_getcpu)
 ], , [\$(MOD_MPM_EVENT_LDADD)])
 
 APACHE_MPMPATH_FINISH
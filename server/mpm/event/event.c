@@ -74,6 +74,9 @@
 #ifdef HAVE_SYS_PROCESSOR_H
 #include <sys/processor.h>      /* for bindprocessor() */
 #endif
+#ifdef HAVE_SCHED_GETCPU
+#include <sched.h>              /* for sched_getcpu() */
+#endif
 
 #if !APR_HAS_THREADS
 #error The Event MPM requires APR threads, but they are unavailable.
@@ -97,6 +100,7 @@
 #include "unixd.h"
 #include "apr_skiplist.h"
 #include "util_time.h"
+#include "uring.h"
 
 #include <signal.h>
 #include <limits.h>             /* for INT_MAX */
@@ -184,10 +188,17 @@ static int dying = 0;
 static int workers_may_exit = 0;
 static int start_thread_may_exit = 0;
 static int listener_may_exit = 0;
-static int listener_is_wakeable = 0;        /* Pollset supports APR_POLLSET_WAKEABLE */
 static int num_listensocks = 0;
-static apr_int32_t conns_this_child;        /* MaxConnectionsPerChild, only access
-                                               in listener thread */
+static int num_shards = 1;                  /* ListenerShards */
+static apr_uint32_t conns_this_child;       /* MaxConnectionsPerChild, (signed)
+                                               decremented by the listeners */
+static apr_uint32_t shards_closed = 0;      /* Number of listeners that closed
+                                               their listening sockets */
+static apr_uint32_t shards_exited = 0;      /* Number of listeners that left
+                                               their main loop */
+static apr_uint32_t shards_not_accepting = 0; /* Number of listeners that
+                                                 disabled their listensocks */
+static apr_uint32_t next_shard = 0;         /* Round robin fallback */
 static apr_uint32_t connection_count = 0;   /* Number of open connections */
 static apr_uint32_t lingering_count = 0;    /* Number of connections in lingering close */
 static apr_uint32_t suspended_count = 0;    /* Number of suspended connections */
@@ -199,26 +210,23 @@ static fd_queue_t *worker_queue;
 static fd_queue_info_t *worker_queue_info;
 static int mpm_state = AP_MPMQ_STARTING;
 
-static apr_thread_mutex_t *timeout_mutex;
-
 module AP_MODULE_DECLARE_DATA mpm_event_module;
 
 /* forward declare */
 struct event_srv_cfg_s;
 typedef struct event_srv_cfg_s event_srv_cfg;
 
-static apr_pollfd_t *listener_pollfd;
-
 /*
- * The pollset for sockets that are in any of the timeout queues. Currently
- * we use the timeout_mutex to make sure that connections are added/removed
- * atomically to/from both event_pollset and a timeout queue. Otherwise
- * some confusion can happen under high load if timeout queues and pollset
- * get out of sync.
- * XXX: It should be possible to make the lock unnecessary in many or even all
- * XXX: cases.
+ * With "AsyncIOEngine io_uring", the listener is driven by io_uring poll
+ * requests instead: descriptors that fire are removed implicitly (oneshot)
+ * and re-armed in batch with the next wait, which saves the epoll_ctl()
+ * calls of the keep-alive and write completion round trips.  The engine
+ * has the same (thread safe) semantics as the pollset, so the timeout
+ * queues and their locking are unaffected.
  */
-static apr_pollset_t *event_pollset;
+#define ASYNC_IO_ENGINE_POLLSET 0
+#define ASYNC_IO_ENGINE_URING   1
+static int async_io_engine = ASYNC_IO_ENGINE_POLLSET; /* AsyncIOEngine */
 
 struct event_conn_state_t {
     /** APR_RING of expiration timeouts */
@@ -244,6 +252,8 @@ struct event_conn_state_t {
     apr_pollfd_t pfd;
     /** public parts of the connection state */
     conn_state_t pub;
+    /** listener shard this connection is pinned to */
+    event_shard_t *shard;
 };
 APR_RING_HEAD(timeout_head_t, event_conn_state_t);
 
@@ -253,20 +263,96 @@ struct timeout_queue {
     apr_uint32_t count;         /* for this queue */
     apr_uint32_t *total;        /* for all chained/related queues */
     struct timeout_queue *next; /* chaining */
+    event_shard_t *shard;       /* owner */
 };
+
 /*
- * Several timeout queues that use different timeouts, so that we always can
- * simply append to the end.
- *   write_completion_q uses vhost's TimeOut
- *   keepalive_q        uses vhost's KeepAliveTimeOut
- *   linger_q           uses MAX_SECS_TO_LINGER
- *   short_linger_q     uses SECONDS_TO_LINGER
+ * Each child runs ListenerShards listener threads (one by default), each
+ * with its own pollset, timeout queues and timers, so that they never
+ * contend with each other.  A connection is pinned to the shard of the CPU
+ * it was received on (SO_INCOMING_CPU), all its keep-alive, write completion
+ * and lingering close states are handled there.  The listening sockets are
+ * polled by every shard.
  */
-static struct timeout_queue *write_completion_q,
-                            *keepalive_q,
-                            *linger_q,
-                            *short_linger_q;
-static volatile apr_time_t  queues_next_expiry;
+struct event_shard_t {
+    int id;
+
+    /*
+     * The pollset for sockets that are in any of the timeout queues.
+     * Currently we use the timeout_mutex to make sure that connections are
+     * added/removed atomically to/from both pollset and a timeout queue.
+     * Otherwise some confusion can happen under high load if timeout queues
+     * and pollset get out of sync.
+     * XXX: It should be possible to make the lock unnecessary in many or
+     * XXX: even all cases.
+     */
+    apr_pollset_t *pollset;
+    ap_uring_t *uring;          /* AsyncIOEngine io_uring, replaces pollset */
+    int is_wakeable;            /* Pollset supports APR_POLLSET_WAKEABLE */
+    apr_pollfd_t *listener_pollfd;
+    int listensocks_disabled;   /* listener_pollfd not polled */
+    apr_thread_t *listener;
+    apr_os_thread_t *listener_os_thread;
+
+    /*
+     * Several timeout queues that use different timeouts, so that we always
+     * can simply append to the end.
+     *   write_completion_q uses vhost's TimeOut
+     *   keepalive_q        uses vhost's KeepAliveTimeOut
+     *   linger_q           uses MAX_SECS_TO_LINGER
+     *   short_linger_q     uses SECONDS_TO_LINGER
+     */
+    apr_thread_mutex_t *timeout_mutex;
+    struct timeout_queue *write_completion_q,
+                         *keepalive_q,
+                         *linger_q,
+                         *short_linger_q;
+    volatile apr_time_t queues_next_expiry;
+
+    /* Timers, see event_get_timer_event() */
+    apr_thread_mutex_t *timer_skiplist_mtx;
+    apr_skiplist *timer_skiplist;
+    APR_RING_HEAD(timer_free_ring_t, timer_event_t) timer_free_ring;
+    volatile apr_time_t timers_next_expiry;
+};
+static event_shard_t *shards;
+
+static APR_INLINE apr_status_t pollset_add(event_shard_t *shard,
+                                           const apr_pollfd_t *pfd)
+{
+    if (shard->uring) {
+        return ap_uring_add(shard->uring, pfd);
+    }
+    return apr_pollset_add(shard->pollset, pfd);
+}
+
+static APR_INLINE apr_status_t pollset_remove(event_shard_t *shard,
+                                              const apr_pollfd_t *pfd)
+{
+    if (shard->uring) {
+        return ap_uring_remove(shard->uring, pfd);
+    }
+    return apr_pollset_remove(shard->pollset, pfd);
+}
+
+static APR_INLINE apr_status_t pollset_poll(event_shard_t *shard,
+                                            apr_interval_time_t timeout,
+                                            apr_int32_t *num,
+                                            const apr_pollfd_t **descriptors)
+{
+    if (shard->uring) {
+        return ap_uring_poll(shard->uring, timeout, num, descriptors);
+    }
+    return apr_pollset_poll(shard->pollset, timeout, num, descriptors);
+}
+
+static APR_INLINE apr_status_t pollset_wakeup(event_shard_t *shard)
+{
+    if (shard->uring) {
+        return ap_uring_wakeup(shard->uring);
+    }
+    return apr_pollset_wakeup(shard->pollset);
+}
 
 /* Prevent extra poll/wakeup calls for timeouts close in the future (queues
  * have the granularity of a second anyway).
@@ -276,7 +362,8 @@ static volatile apr_time_t  queues_next_expiry;
 
 /*
  * Macros for accessing struct timeout_queue.
- * For TO_QUEUE_APPEND and TO_QUEUE_REMOVE, timeout_mutex must be held.
+ * For TO_QUEUE_APPEND and TO_QUEUE_REMOVE, the shard's timeout_mutex must be
+ * held.
  */
 static void TO_QUEUE_APPEND(struct timeout_queue *q, event_conn_state_t *el)
 {
@@ -292,12 +379,12 @@ static void TO_QUEUE_APPEND(struct timeout_queue *q, event_conn_state_t *el)
      */
     el = APR_RING_FIRST(&q->head);
     q_expiry = el->queue_timestamp + q->timeout;
-    next_expiry = queues_next_expiry;
+    next_expiry = q->shard->queues_next_expiry;
     if (!next_expiry || next_expiry > q_expiry + TIMEOUT_FUDGE_FACTOR) {
-        queues_next_expiry = q_expiry;
+        q->shard->queues_next_expiry = q_expiry;
         /* Unblock the poll()ing listener for it to update its timeout. */
-        if (listener_is_wakeable) {
-            apr_pollset_wakeup(event_pollset);
+        if (q->shard->is_wakeable) {
+            pollset_wakeup(q->shard);
         }
     }
 }
@@ -310,7 +397,8 @@ static void TO_QUEUE_REMOVE(struct timeout_queue *q, event_conn_state_t *el)
 }
 
 static struct timeout_queue *TO_QUEUE_MAKE(apr_pool_t *p, apr_time_t t,
-                                           struct timeout_queue *ref)
+                                           struct timeout_queue *ref,
+                                           event_shard_t *shard)
 {
     struct timeout_queue *q;
                                            
@@ -318,6 +406,7 @@ static struct timeout_queue *TO_QUEUE_MAKE(apr_pool_t *p, apr_time_t t,
     APR_RING_INIT(&q->head, event_conn_state_t, timeout_list);
     q->total = (ref) ? ref->total : apr_pcalloc(p, sizeof *q->total);
     q->timeout = t;
+    q->shard = shard;
 
     return q;
 }
@@ -339,6 +428,7 @@ typedef struct
 {
     int pslot;  /* process slot */
     int tslot;  /* worker slot of the thread */
+    int shard;  /* listener shard of the thread */
 } proc_info;
 
 /* Structure used to pass information to the thread responsible for
@@ -347,7 +437,6 @@ typedef struct
 typedef struct
 {
     apr_thread_t **threads;
-    apr_thread_t *listener;
     int child_num_arg;
     apr_threadattr_t *threadattr;
 } thread_starter;
@@ -374,6 +463,7 @@ typedef struct
     void *user_baton;
     apr_array_header_t *pfds;
     timer_event_t *cancel_event; /* If a timeout was requested, a pointer to the timer event */
+    event_shard_t *shard;
     unsigned int signaled :1;
 } socket_callback_baton_t;
 
@@ -432,10 +522,14 @@ static event_child_bucket *all_buckets, /* All listeners buckets */
                           *my_bucket;   /* Current child bucket */
 
 struct event_srv_cfg_s {
-    struct timeout_queue *wc_q,
-                         *ka_q;
+    /* Indexed by shard id */
+    struct timeout_queue **wc_q,
+                         **ka_q;
 };
 
+#define CS_WC_Q(cs) ((cs)->sc->wc_q[(cs)->shard->id])
+#define CS_KA_Q(cs) ((cs)->sc->ka_q[(cs)->shard->id])
+
 #define ID_FROM_CHILD_THREAD(c, t)    ((c * thread_limit) + t)
 
 /* The event MPM respects a couple of runtime flags that can aid
@@ -463,7 +557,6 @@ static apr_pool_t *pchild;      /* Pool for httpd child stuff */
 static pid_t ap_my_pid;         /* Linux getpid() doesn't work except in main
                                    thread. Use this instead */
 static pid_t parent_pid;
-static apr_os_thread_t *listener_os_thread;
 
 /* The LISTENER_SIGNAL signal will be sent from the main thread to the
  * listener thread to wake it up for graceful termination (what a child
@@ -478,18 +571,33 @@ static apr_os_thread_t *listener_os_thread;
  */
 static apr_socket_t **worker_sockets;
 
-static void disable_listensocks(int process_slot)
+/* The process is not accepting anymore once all its shards are not.
+ * Both are called by the shard's own listener only, and do nothing if
+ * the shard is already in the requested state, so that it's counted once.
+ */
+static void disable_listensocks(event_shard_t *shard, int process_slot)
 {
     int i;
+    if (shard->listensocks_disabled) {
+        return;
+    }
+    shard->listensocks_disabled = 1;
     for (i = 0; i < num_listensocks; i++) {
-        apr_pollset_remove(event_pollset, &listener_pollfd[i]);
+        pollset_remove(shard, &shard->listener_pollfd[i]);
+    }
+    if (apr_atomic_inc32(&shards_not_accepting) + 1
+            == (apr_uint32_t)num_shards) {
+        ap_scoreboard_image->parent[process_slot].not_accepting = 1;
     }
-    ap_scoreboard_image->parent[process_slot].not_accepting = 1;
 }
 
-static void enable_listensocks(int process_slot)
+static void enable_listensocks(event_shard_t *shard, int process_slot)
 {
     int i;
+    if (!shard->listensocks_disabled) {
+        return;
+    }
+    shard->listensocks_disabled = 0;
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(00457)
                  "Accepting new connections again: "
                  "%u active conns (%u lingering/%u clogged/%u suspended), "
@@ -500,11 +608,12 @@ static void enable_listensocks(int process_slot)
                  apr_atomic_read32(&suspended_count),
                  ap_queue_info_get_idlers(worker_queue_info));
     for (i = 0; i < num_listensocks; i++)
-        apr_pollset_add(event_pollset, &listener_pollfd[i]);
+        pollset_add(shard, &shard->listener_pollfd[i]);
     /*
      * XXX: This is not yet optimal. If many workers suddenly become available,
      * XXX: the parent may kill some processes off too soon.
      */
+    apr_atomic_dec32(&shards_not_accepting);
     ap_scoreboard_image->parent[process_slot].not_accepting = 0;
 }
 
@@ -521,8 +630,10 @@ static void close_worker_sockets(void)
 
 static void wakeup_listener(void)
 {
+    int i;
+
     listener_may_exit = 1;
-    if (!listener_os_thread) {
+    if (!shards || !shards[0].listener_os_thread) {
         /* XXX there is an obscure path that this doesn't handle perfectly:
          *     right after listener thread is created but before
          *     listener_os_thread is set, the first worker thread hits an
@@ -531,21 +642,27 @@ static void wakeup_listener(void)
         return;
     }
 
-    /* Unblock the listener if it's poll()ing */
-    if (listener_is_wakeable) {
-        apr_pollset_wakeup(event_pollset);
+    /* Unblock the listeners if they're poll()ing */
+    for (i = 0; i < num_shards; i++) {
+        if (shards[i].is_wakeable) {
+            pollset_wakeup(&shards[i]);
+        }
     }
 
-    /* unblock the listener if it's waiting for a worker */
+    /* unblock the listeners if they're waiting for a worker */
     ap_queue_info_term(worker_queue_info);
 
     /*
      * we should just be able to "kill(ap_my_pid, LISTENER_SIGNAL)" on all
-     * platforms and wake up the listener thread since it is the only thread
-     * with SIGHUP unblocked, but that doesn't work on Linux
+     * platforms and wake up the listener threads since they are the only
+     * threads with SIGHUP unblocked, but that doesn't work on Linux
      */
 #ifdef HAVE_PTHREAD_KILL
-    pthread_kill(*listener_os_thread, LISTENER_SIGNAL);
+    for (i = 0; i < num_shards; i++) {
+        if (shards[i].listener_os_thread) {
+            pthread_kill(*shards[i].listener_os_thread, LISTENER_SIGNAL);
+        }
+    }
 #else
     kill(ap_my_pid, LISTENER_SIGNAL);
 #endif
@@ -718,10 +835,14 @@ static apr_status_t decrement_connection_count(void *cs_)
         default:
             break;
     }
-    /* Unblock the listener if it's waiting for connection_count = 0 */
-    if (!apr_atomic_dec32(&connection_count)
-             && listener_is_wakeable && listener_may_exit) {
-        apr_pollset_wakeup(event_pollset);
+    /* Unblock the listeners if they're waiting for connection_count = 0 */
+    if (!apr_atomic_dec32(&connection_count) && listener_may_exit) {
+        int i;
+        for (i = 0; i < num_shards; i++) {
+            if (shards[i].is_wakeable) {
+                pollset_wakeup(&shards[i]);
+            }
+        }
     }
     return APR_SUCCESS;
 }
@@ -871,9 +992,12 @@ static void set_signals(void)
 
 static void notify_suspend(event_conn_state_t *cs)
 {
-    ap_run_suspend_connection(cs->c, cs->r);
+    /* Mark the connection suspended before the hooks run, they may
+     * arrange for it to be resumed (from another thread) already.
+     */
     cs->suspended = 1;
     cs->c->sbh = NULL;
+    ap_run_suspend_connection(cs->c, cs->r);
 }
 
 static void notify_resume(event_conn_state_t *cs, ap_sb_handle_t *sbh)
@@ -903,11 +1027,11 @@ static int start_lingering_close_common(event_conn_state_t *cs, int in_worker)
      * DoS attacks.
      */
     if (apr_table_get(cs->c->notes, "short-lingering-close")) {
-        q = short_linger_q;
+        q = cs->shard->short_linger_q;
         cs->pub.state = CONN_STATE_LINGER_SHORT;
     }
     else {
-        q = linger_q;
+        q = cs->shard->linger_q;
         cs->pub.state = CONN_STATE_LINGER_NORMAL;
     }
     apr_atomic_inc32(&lingering_count);
@@ -921,16 +1045,16 @@ static int start_lingering_close_common(event_conn_state_t *cs, int in_worker)
             cs->pub.sense == CONN_SENSE_WANT_WRITE ? APR_POLLOUT :
                     APR_POLLIN) | APR_POLLHUP | APR_POLLERR;
     cs->pub.sense = CONN_SENSE_DEFAULT;
-    apr_thread_mutex_lock(timeout_mutex);
+    apr_thread_mutex_lock(cs->shard->timeout_mutex);
     TO_QUEUE_APPEND(q, cs);
-    apr_thread_mutex_unlock(timeout_mutex);
-    rv = apr_pollset_add(event_pollset, &cs->pfd);
+    apr_thread_mutex_unlock(cs->shard->timeout_mutex);
+    rv = pollset_add(cs->shard, &cs->pfd);
     if (rv != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rv)) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03092)
                      "start_lingering_close: apr_pollset_add failure");
-        apr_thread_mutex_lock(timeout_mutex);
+        apr_thread_mutex_lock(cs->shard->timeout_mutex);
         TO_QUEUE_REMOVE(q, cs);
-        apr_thread_mutex_unlock(timeout_mutex);
+        apr_thread_mutex_unlock(cs->shard->timeout_mutex);
         apr_socket_close(cs->pfd.desc.s);
         ap_push_pool(worker_queue_info, cs->p);
         return 0;
@@ -941,7 +1065,7 @@ static int start_lingering_close_common(event_conn_state_t *cs, int in_worker)
 /*
  * Close our side of the connection, flushing data to the client first.
  * Pre-condition: cs is not in any timeout queue and not in the pollset,
- *                timeout_mutex is not locked
+ *                the shard's timeout_mutex is not locked
  * return: 0 if connection is fully closed,
  *         1 if connection is lingering
  * May only be called by worker thread.
@@ -961,7 +1085,7 @@ static int start_lingering_close_blocking(event_conn_state_t *cs)
  * This should only be called if there has been an error or if we know
  * that our send buffers are empty.
  * Pre-condition: cs is not in any timeout queue and not in the pollset,
- *                timeout_mutex is not locked
+ *                the shard's timeout_mutex is not locked
  * return: 0 if connection is fully closed,
  *         1 if connection is lingering
  * may be called by listener thread
@@ -1073,6 +1197,46 @@ static int event_post_read_request(request_rec *r)
     return OK;
 }
 
+/*
+ * Shard of the calling thread, for new timers, based on the CPU it runs
+ * on if available (or round robin).
+ */
+static event_shard_t *current_shard(void)
+{
+    if (num_shards > 1) {
+#ifdef HAVE_SCHED_GETCPU
+        int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            return &shards[cpu % num_shards];
+        }
+#endif
+        return &shards[apr_atomic_inc32(&next_shard) % num_shards];
+    }
+    return &shards[0];
+}
+
+/*
+ * Shard of a new connection, based on the CPU which received it (i.e.
+ * where the NIC queue's interrupts are handled), if available.
+ */
+static event_shard_t *select_shard(apr_socket_t *sock)
+{
+#ifdef SO_INCOMING_CPU
+    if (num_shards > 1) {
+        apr_os_sock_t sd;
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+
+        if (apr_os_sock_get(&sd, sock) == APR_SUCCESS
+                && !getsockopt(sd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len)
+                && cpu >= 0) {
+            return &shards[cpu % num_shards];
+        }
+    }
+#endif
+    return current_shard();
+}
+
 /*
  * process one connection in the worker
  */
@@ -1108,6 +1272,7 @@ static void process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * soc
         cs->p = p;
         cs->sc = ap_get_module_config(ap_server_conf->module_config,
                                       &mpm_event_module);
+        cs->shard = select_shard(sock);
         cs->pfd.desc_type = APR_POLL_SOCKET;
         cs->pfd.reqevents = APR_POLLIN;
         cs->pfd.desc.s = sock;
@@ -1200,19 +1365,20 @@ read_request:
             notify_suspend(cs);
             cs->pfd.reqevents = (
                     cs->pub.sense == CONN_SENSE_WANT_READ ? APR_POLLIN :
+                    cs->pub.sense == CONN_SENSE_WANT_ERRQUEUE ? 0 :
                             APR_POLLOUT) | APR_POLLHUP | APR_POLLERR;
             cs->pub.sense = CONN_SENSE_DEFAULT;
-            apr_thread_mutex_lock(timeout_mutex);
-            TO_QUEUE_APPEND(cs->sc->wc_q, cs);
-            apr_thread_mutex_unlock(timeout_mutex);
-            rc = apr_pollset_add(event_pollset, &cs->pfd);
+            apr_thread_mutex_lock(cs->shard->timeout_mutex);
+            TO_QUEUE_APPEND(CS_WC_Q(cs), cs);
+            apr_thread_mutex_unlock(cs->shard->timeout_mutex);
+            rc = pollset_add(cs->shard, &cs->pfd);
             if (rc != APR_SUCCESS) {
                 ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf, APLOGNO(03465)
                              "process_socket: apr_pollset_add failure for "
                              "write completion");
-                apr_thread_mutex_lock(timeout_mutex);
-                TO_QUEUE_REMOVE(cs->sc->wc_q, cs);
-                apr_thread_mutex_unlock(timeout_mutex);
+                apr_thread_mutex_lock(cs->shard->timeout_mutex);
+                TO_QUEUE_REMOVE(CS_WC_Q(cs), cs);
+                apr_thread_mutex_unlock(cs->shard->timeout_mutex);
                 apr_socket_close(cs->pfd.desc.s);
                 ap_push_pool(worker_queue_info, cs->p);
             }
@@ -1250,18 +1416,18 @@ read_request:
 
         /* Add work to pollset. */
         cs->pfd.reqevents = APR_POLLIN;
-        apr_thread_mutex_lock(timeout_mutex);
-        TO_QUEUE_APPEND(cs->sc->ka_q, cs);
-        apr_thread_mutex_unlock(timeout_mutex);
+        apr_thread_mutex_lock(cs->shard->timeout_mutex);
+        TO_QUEUE_APPEND(CS_KA_Q(cs), cs);
+        apr_thread_mutex_unlock(cs->shard->timeout_mutex);
 
-        rc = apr_pollset_add(event_pollset, &cs->pfd);
+        rc = pollset_add(cs->shard, &cs->pfd);
         if (rc != APR_SUCCESS) {
             ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf, APLOGNO(03093)
                          "process_socket: apr_pollset_add failure for "
                          "keep alive");
-            apr_thread_mutex_lock(timeout_mutex);
-            TO_QUEUE_REMOVE(cs->sc->ka_q, cs);
-            apr_thread_mutex_unlock(timeout_mutex);
+            apr_thread_mutex_lock(cs->shard->timeout_mutex);
+            TO_QUEUE_REMOVE(CS_KA_Q(cs), cs);
+            apr_thread_mutex_unlock(cs->shard->timeout_mutex);
             apr_socket_close(cs->pfd.desc.s);
             ap_push_pool(worker_queue_info, cs->p);
             return;
@@ -1293,12 +1459,13 @@ static apr_status_t event_resume_suspended (conn_rec *c)
     cs->queue_timestamp = apr_time_now();
     cs->pfd.reqevents = (
             cs->pub.sense == CONN_SENSE_WANT_READ ? APR_POLLIN :
+            cs->pub.sense == CONN_SENSE_WANT_ERRQUEUE ? 0 :
                     APR_POLLOUT) | APR_POLLHUP | APR_POLLERR;
     cs->pub.sense = CONN_SENSE_DEFAULT;
-    apr_thread_mutex_lock(timeout_mutex);
-    TO_QUEUE_APPEND(cs->sc->wc_q, cs);
-    apr_thread_mutex_unlock(timeout_mutex);
-    apr_pollset_add(event_pollset, &cs->pfd);
+    apr_thread_mutex_lock(cs->shard->timeout_mutex);
+    TO_QUEUE_APPEND(CS_WC_Q(cs), cs);
+    apr_thread_mutex_unlock(cs->shard->timeout_mutex);
+    pollset_add(cs->shard, &cs->pfd);
 
     return OK;
 }
@@ -1315,28 +1482,41 @@ static void check_infinite_requests(void)
     }
     else {
         /* keep going */
-        conns_this_child = APR_INT32_MAX;
+        apr_atomic_set32(&conns_this_child, APR_INT32_MAX);
     }
 }
 
-static void close_listeners(int process_slot, int *closed)
+static void close_listeners(event_shard_t *shard, int process_slot,
+                            int *closed)
 {
     if (!*closed) {
         int i;
-        disable_listensocks(process_slot);
-        ap_close_listeners_ex(my_bucket->listeners);
+        apr_uint32_t n;
+
+        disable_listensocks(shard, process_slot);
         *closed = 1;
-        dying = 1;
-        ap_scoreboard_image->parent[process_slot].quiescing = 1;
-        for (i = 0; i < threads_per_child; ++i) {
-            ap_update_child_status_from_indexes(process_slot, i,
-                                                SERVER_GRACEFUL, NULL);
+
+        /* The listening sockets are polled by all the shards, so the last
+         * one to stop doing so closes them, while the first one takes care
+         * of the process.
+         */
+        n = apr_atomic_inc32(&shards_closed);
+        if (n + 1 == (apr_uint32_t)num_shards) {
+            ap_close_listeners_ex(my_bucket->listeners);
         }
-        /* wake up the main thread */
-        kill(ap_my_pid, SIGTERM);
+        if (n == 0) {
+            dying = 1;
+            ap_scoreboard_image->parent[process_slot].quiescing = 1;
+            for (i = 0; i < threads_per_child; ++i) {
+                ap_update_child_status_from_indexes(process_slot, i,
+                                                    SERVER_GRACEFUL, NULL);
+            }
+            /* wake up the main thread */
+            kill(ap_my_pid, SIGTERM);
 
-        ap_free_idle_pools(worker_queue_info);
-        ap_queue_interrupt_all(worker_queue);
+            ap_free_idle_pools(worker_queue_info);
+            ap_queue_interrupt_all(worker_queue);
+        }
     }
 }
 
@@ -1366,27 +1546,25 @@ static apr_status_t s_socket_add(void *user_baton,
                                  apr_pollfd_t *pfd,
                                  void *serf_baton)
 {
-    s_baton_t *s = (s_baton_t*)user_baton;
     /* XXXXX: recycle listener_poll_types */
     listener_poll_type *pt = ap_malloc(sizeof(*pt));
     pt->type = PT_SERF;
     pt->baton = serf_baton;
     pfd->client_data = pt;
-    return apr_pollset_add(s->pollset, pfd);
+    return pollset_add(&shards[0], pfd);
 }
 
 static apr_status_t s_socket_remove(void *user_baton,
                                     apr_pollfd_t *pfd,
                                     void *serf_baton)
 {
-    s_baton_t *s = (s_baton_t*)user_baton;
     listener_poll_type *pt = pfd->client_data;
     free(pt);
-    return apr_pollset_remove(s->pollset, pfd);
+    return pollset_remove(&shards[0], pfd);
 }
 #endif
 
-static apr_status_t init_pollset(apr_pool_t *p)
+static apr_status_t init_pollset(event_shard_t *shard, apr_pool_t *p)
 {
 #if HAVE_SERF
     s_baton_t *baton = NULL;
@@ -1395,15 +1573,24 @@ static apr_status_t init_pollset(apr_pool_t *p)
     listener_poll_type *pt;
     int i = 0;
 
-    listener_pollfd = apr_palloc(p, sizeof(apr_pollfd_t) * num_listensocks);
+    shard->listener_pollfd = apr_palloc(p, sizeof(apr_pollfd_t)
+                                           * num_listensocks);
     for (lr = my_bucket->listeners; lr != NULL; lr = lr->next, i++) {
         apr_pollfd_t *pfd;
         AP_DEBUG_ASSERT(i < num_listensocks);
-        pfd = &listener_pollfd[i];
+        pfd = &shard->listener_pollfd[i];
         pt = apr_pcalloc(p, sizeof(*pt));
         pfd->desc_type = APR_POLL_SOCKET;
         pfd->desc.s = lr->sd;
         pfd->reqevents = APR_POLLIN;
+#ifdef APR_POLLEXCLUSIVE
+        /* The listening sockets are polled by every shard, let only one
+         * of them be woken up for each incoming connection.
+         */
+        if (num_shards > 1) {
+            pfd->reqevents |= APR_POLLEXCLUSIVE;
+        }
+#endif
 
         pt->type = PT_ACCEPT;
         pt->baton = lr;
@@ -1411,14 +1598,18 @@ static apr_status_t init_pollset(apr_pool_t *p)
         pfd->client_data = pt;
 
         apr_socket_opt_set(pfd->desc.s, APR_SO_NONBLOCK, 1);
-        apr_pollset_add(event_pollset, pfd);
+        pollset_add(shard, pfd);
 
         lr->accept_func = ap_unixd_accept;
     }
 
 #if HAVE_SERF
+    /* serf runs in the first shard only */
+    if (shard->id != 0) {
+        return APR_SUCCESS;
+    }
     baton = apr_pcalloc(p, sizeof(*baton));
-    baton->pollset = event_pollset;
+    baton->pollset = shard->pollset;
     /* TODO: subpools, threads, reuse, etc.  -- currently use malloc() inside :( */
     baton->pool = p;
 
@@ -1443,8 +1634,7 @@ static apr_status_t push_timer2worker(timer_event_t* te)
  * Pre-condition: pfd->cs is neither in pollset nor timeout queue
  * this function may only be called by the listener
  */
-static apr_status_t push2worker(const apr_pollfd_t * pfd,
-                                apr_pollset_t * pollset)
+static apr_status_t push2worker(const apr_pollfd_t * pfd)
 {
     listener_poll_type *pt = (listener_poll_type *) pfd->client_data;
     event_conn_state_t *cs = (event_conn_state_t *) pt->baton;
@@ -1504,12 +1694,6 @@ static void get_worker(int *have_idle_worker_p, int blocking, int *all_busy)
     }
 }
 
-/* Structures to reuse */
-static APR_RING_HEAD(timer_free_ring_t, timer_event_t) timer_free_ring;
-
-static apr_skiplist *timer_skiplist;
-static volatile apr_time_t timers_next_expiry;
-
 /* Same goal as for TIMEOUT_FUDGE_FACTOR (avoid extra poll calls), but applied
  * to timers. Since their timeouts are custom (user defined), we can't be too
  * approximative here (hence using 0.01s).
@@ -1537,9 +1721,8 @@ static int timer_comp(void *a, void *b)
     return ((t1 < t2) ? -1 : 1);
 }
 
-static apr_thread_mutex_t *g_timer_skiplist_mtx;
-
-static timer_event_t * event_get_timer_event(apr_time_t t,
+static timer_event_t * event_get_timer_event(event_shard_t *shard,
+                                             apr_time_t t,
                                              ap_mpm_callback_fn_t *cbfn,
                                              void *baton,
                                              int insert, 
@@ -1550,15 +1733,16 @@ static timer_event_t * event_get_timer_event(apr_time_t t,
 
     /* oh yeah, and make locking smarter/fine grained. */
 
-    apr_thread_mutex_lock(g_timer_skiplist_mtx);
+    apr_thread_mutex_lock(shard->timer_skiplist_mtx);
 
-    if (!APR_RING_EMPTY(&timer_free_ring, timer_event_t, link)) {
-        te = APR_RING_FIRST(&timer_free_ring);
+    if (!APR_RING_EMPTY(&shard->timer_free_ring, timer_event_t, link)) {
+        te = APR_RING_FIRST(&shard->timer_free_ring);
         APR_RING_REMOVE(te, link);
     }
     else {
-        te = apr_skiplist_alloc(timer_skiplist, sizeof(timer_event_t));
+        te = apr_skiplist_alloc(shard->timer_skiplist, sizeof(timer_event_t));
         APR_RING_ELEM_INIT(te, link);
+        te->shard = shard;
     }
 
     te->cbfunc = cbfn;
@@ -1571,31 +1755,41 @@ static timer_event_t * event_get_timer_event(apr_time_t t,
         apr_time_t next_expiry;
 
         /* Okay, add sorted by when.. */
-        apr_skiplist_insert(timer_skiplist, te);
+        apr_skiplist_insert(shard->timer_skiplist, te);
 
         /* Cheaply update the overall timers' next expiry according to
          * this event, if necessary.
          */
-        next_expiry = timers_next_expiry;
+        next_expiry = shard->timers_next_expiry;
         if (!next_expiry || next_expiry > te->when + EVENT_FUDGE_FACTOR) {
-            timers_next_expiry = te->when;
+            shard->timers_next_expiry = te->when;
             /* Unblock the poll()ing listener for it to update its timeout. */
-            if (listener_is_wakeable) {
-                apr_pollset_wakeup(event_pollset);
+            if (shard->is_wakeable) {
+                pollset_wakeup(shard);
             }
         }
     }
-    apr_thread_mutex_unlock(g_timer_skiplist_mtx);
+    apr_thread_mutex_unlock(shard->timer_skiplist_mtx);
 
     return te;
 }
 
+/* Give back a timer event fired by a worker to its shard */
+static void event_put_timer_event(timer_event_t *te)
+{
+    event_shard_t *shard = te->shard;
+
+    apr_thread_mutex_lock(shard->timer_skiplist_mtx);
+    APR_RING_INSERT_TAIL(&shard->timer_free_ring, te, timer_event_t, link);
+    apr_thread_mutex_unlock(shard->timer_skiplist_mtx);
+}
+
 static apr_status_t event_register_timed_callback_ex(apr_time_t t,
                                                   ap_mpm_callback_fn_t *cbfn,
                                                   void *baton, 
                                                   apr_array_header_t *remove)
 {
-    event_get_timer_event(t, cbfn, baton, 1, remove);
+    event_get_timer_event(current_shard(), t, cbfn, baton, 1, remove);
     return APR_SUCCESS;
 }
 
@@ -1616,8 +1810,10 @@ static apr_status_t event_cleanup_poll_callback(void *data)
     for (i = 0; i < pfds->nelts; i++) {
         apr_pollfd_t *pfd = (apr_pollfd_t *)pfds->elts + i;
         if (pfd->client_data) {
+            listener_poll_type *pt = pfd->client_data;
+            socket_callback_baton_t *scb = pt->baton;
             apr_status_t rc;
-            rc = apr_pollset_remove(event_pollset, pfd);
+            rc = pollset_remove(scb->shard, pfd);
             if (rc != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rc)) {
                 final_rc = rc;
             }
@@ -1644,6 +1840,7 @@ static apr_status_t event_register_poll_callback_ex(apr_array_header_t *pfds,
     scb->cbfunc = cbfn;
     scb->user_baton = baton;
     scb->pfds = pfds;
+    scb->shard = current_shard();
 
     apr_pool_pre_cleanup_register(pfds->pool, pfds, event_cleanup_poll_callback);
 
@@ -1655,11 +1852,12 @@ static apr_status_t event_register_poll_callback_ex(apr_array_header_t *pfds,
 
     if (timeout > 0) { 
         /* XXX:  This cancel timer event count fire before the pollset is updated */
-        scb->cancel_event = event_get_timer_event(timeout, tofn, baton, 1, pfds);
+        scb->cancel_event = event_get_timer_event(scb->shard, timeout, tofn,
+                                                  baton, 1, pfds);
     }
     for (i = 0; i < pfds->nelts; i++) {
         apr_pollfd_t *pfd = (apr_pollfd_t *)pfds->elts + i;
-        rc = apr_pollset_add(event_pollset, pfd);
+        rc = pollset_add(scb->shard, pfd);
         if (rc != APR_SUCCESS) {
             final_rc = rc;
         }
@@ -1694,8 +1892,10 @@ static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *
     char dummybuf[2048];
     apr_size_t nbytes;
     apr_status_t rv;
+    event_shard_t *shard = cs->shard;
     struct timeout_queue *q;
-    q = (cs->pub.state == CONN_STATE_LINGER_SHORT) ? short_linger_q : linger_q;
+    q = (cs->pub.state == CONN_STATE_LINGER_SHORT) ? shard->short_linger_q
+                                                   : shard->linger_q;
 
     /* socket is already in non-blocking state */
     do {
@@ -1707,15 +1907,15 @@ static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *
         return;
     }
 
-    rv = apr_pollset_remove(event_pollset, pfd);
+    rv = pollset_remove(shard, pfd);
     AP_DEBUG_ASSERT(rv == APR_SUCCESS);
 
     rv = apr_socket_close(csd);
     AP_DEBUG_ASSERT(rv == APR_SUCCESS);
 
-    apr_thread_mutex_lock(timeout_mutex);
+    apr_thread_mutex_lock(shard->timeout_mutex);
     TO_QUEUE_REMOVE(q, cs);
-    apr_thread_mutex_unlock(timeout_mutex);
+    apr_thread_mutex_unlock(shard->timeout_mutex);
     TO_QUEUE_ELEM_INIT(cs);
 
     ap_push_pool(worker_queue_info, cs->p);
@@ -1724,8 +1924,8 @@ static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *
 }
 
 /* call 'func' for all elements of 'q' with timeout less than 'timeout_time'.
- * Pre-condition: timeout_mutex must already be locked
- * Post-condition: timeout_mutex will be locked again
+ * Pre-condition: the shard's timeout_mutex must already be locked
+ * Post-condition: the shard's timeout_mutex will be locked again
  */
 static void process_timeout_queue(struct timeout_queue *q,
                                   apr_time_t timeout_time,
@@ -1765,15 +1965,15 @@ static void process_timeout_queue(struct timeout_queue *q,
                  * overall queues' next expiry if it's later than this one.
                  */
                 apr_time_t q_expiry = cs->queue_timestamp + qp->timeout;
-                apr_time_t next_expiry = queues_next_expiry;
+                apr_time_t next_expiry = q->shard->queues_next_expiry;
                 if (!next_expiry || next_expiry > q_expiry) {
-                    queues_next_expiry = q_expiry;
+                    q->shard->queues_next_expiry = q_expiry;
                 }
                 break;
             }
 
             last = cs;
-            rv = apr_pollset_remove(event_pollset, &cs->pfd);
+            rv = pollset_remove(q->shard, &cs->pfd);
             if (rv != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rv)) {
                 ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, cs->c, APLOGNO(00473)
                               "apr_pollset_remove failed");
@@ -1795,7 +1995,7 @@ static void process_timeout_queue(struct timeout_queue *q,
     if (!total)
         return;
 
-    apr_thread_mutex_unlock(timeout_mutex);
+    apr_thread_mutex_unlock(q->shard->timeout_mutex);
     first = APR_RING_FIRST(&trash);
     do {
         cs = APR_RING_NEXT(first, timeout_list);
@@ -1803,10 +2003,27 @@ static void process_timeout_queue(struct timeout_queue *q,
         func(first);
         first = cs;
     } while (--total);
-    apr_thread_mutex_lock(timeout_mutex);
+    apr_thread_mutex_lock(q->shard->timeout_mutex);
 }
 
-static void process_keepalive_queue(apr_time_t timeout_time)
+#define SHARD_KEEPALIVE_Q        0
+#define SHARD_WRITE_COMPLETION_Q 1
+static apr_uint32_t shards_queues_total(int which)
+{
+    apr_uint32_t total = 0;
+    int i;
+
+    for (i = 0; i < num_shards; i++) {
+        struct timeout_queue *q = (which == SHARD_KEEPALIVE_Q)
+                                  ? shards[i].keepalive_q
+                                  : shards[i].write_completion_q;
+        total += apr_atomic_read32(q->total);
+    }
+    return total;
+}
+
+static void process_keepalive_queue(event_shard_t *shard,
+                                    apr_time_t timeout_time)
 {
     /* If all workers are busy, we kill older keep-alive connections so
      * that they may connect to another process.
@@ -1814,10 +2031,10 @@ static void process_keepalive_queue(apr_time_t timeout_time)
     if (!timeout_time) {
         ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ap_server_conf,
                      "All workers are busy or dying, will close %u "
-                     "keep-alive connections",
-                     apr_atomic_read32(keepalive_q->total));
+                     "keep-alive connections (shard %d)",
+                     apr_atomic_read32(shard->keepalive_q->total), shard->id);
     }
-    process_timeout_queue(keepalive_q, timeout_time,
+    process_timeout_queue(shard->keepalive_q, timeout_time,
                           start_lingering_close_nonblocking);
 }
 
@@ -1826,6 +2043,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
     apr_status_t rc;
     proc_info *ti = dummy;
     int process_slot = ti->pslot;
+    event_shard_t *shard = &shards[ti->shard];
     struct process_score *ps = ap_get_scoreboard_process(process_slot);
     apr_pool_t *tpool = apr_thread_pool_get(thd);
     int closed = 0, listeners_disabled = 0;
@@ -1835,7 +2053,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
     last_log = apr_time_now();
     free(ti);
 
-    rc = init_pollset(tpool);
+    rc = init_pollset(shard, tpool);
     if (rc != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
                      APLOGNO(03266)
@@ -1861,13 +2079,13 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         int workers_were_busy = 0;
 
         if (listener_may_exit) {
-            close_listeners(process_slot, &closed);
+            close_listeners(shard, process_slot, &closed);
             if (terminate_mode == ST_UNGRACEFUL
                 || apr_atomic_read32(&connection_count) == 0)
                 break;
         }
 
-        if (conns_this_child <= 0)
+        if ((apr_int32_t)apr_atomic_read32(&conns_this_child) <= 0)
             check_infinite_requests();
 
         if (APLOGtrace6(ap_server_conf)) {
@@ -1875,14 +2093,16 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             /* trace log status every second */
             if (now - last_log > apr_time_from_sec(1)) {
                 last_log = now;
-                apr_thread_mutex_lock(timeout_mutex);
+                apr_thread_mutex_lock(shard->timeout_mutex);
                 ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf,
-                             "connections: %u (clogged: %u write-completion: %d "
-                             "keep-alive: %d lingering: %d suspended: %u)",
+                             "shard %d connections: %u (clogged: %u "
+                             "write-completion: %d keep-alive: %d "
+                             "lingering: %d suspended: %u)",
+                             shard->id,
                              apr_atomic_read32(&connection_count),
                              apr_atomic_read32(&clogged_count),
-                             apr_atomic_read32(write_completion_q->total),
-                             apr_atomic_read32(keepalive_q->total),
+                             apr_atomic_read32(shard->write_completion_q->total),
+                             apr_atomic_read32(shard->keepalive_q->total),
                              apr_atomic_read32(&lingering_count),
                              apr_atomic_read32(&suspended_count));
                 if (dying) {
@@ -1891,14 +2111,16 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                                  apr_atomic_read32(&threads_shutdown),
                                  threads_per_child);
                 }
-                apr_thread_mutex_unlock(timeout_mutex);
+                apr_thread_mutex_unlock(shard->timeout_mutex);
             }
         }
 
 #if HAVE_SERF
-        rc = serf_context_prerun(g_serf);
-        if (rc != APR_SUCCESS) {
-            /* TOOD: what should do here? ugh. */
+        if (shard->id == 0) {
+            rc = serf_context_prerun(g_serf);
+            if (rc != APR_SUCCESS) {
+                /* TOOD: what should do here? ugh. */
+            }
         }
 #endif
 
@@ -1915,40 +2137,40 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         /* Push expired timers to a worker, the first remaining one determines
          * the maximum time to poll() below, if any.
          */
-        timeout_time = timers_next_expiry;
+        timeout_time = shard->timers_next_expiry;
         if (timeout_time && timeout_time < now + EVENT_FUDGE_FACTOR) {
-            apr_thread_mutex_lock(g_timer_skiplist_mtx);
-            while ((te = apr_skiplist_peek(timer_skiplist))) {
+            apr_thread_mutex_lock(shard->timer_skiplist_mtx);
+            while ((te = apr_skiplist_peek(shard->timer_skiplist))) {
                 if (te->when > now + EVENT_FUDGE_FACTOR) {
-                    timers_next_expiry = te->when;
+                    shard->timers_next_expiry = te->when;
                     timeout_interval = te->when - now;
                     break;
                 }
-                apr_skiplist_pop(timer_skiplist, NULL);
+                apr_skiplist_pop(shard->timer_skiplist, NULL);
                 if (!te->canceled) { 
                     if (te->remove) {
                         int i;
                         for (i = 0; i < te->remove->nelts; i++) {
                             apr_pollfd_t *pfd;
                             pfd = (apr_pollfd_t *)te->remove->elts + i;
-                            apr_pollset_remove(event_pollset, pfd);
+                            pollset_remove(shard, pfd);
                         }
                     }
                     push_timer2worker(te);
                 }
                 else {
-                    APR_RING_INSERT_TAIL(&timer_free_ring, te,
+                    APR_RING_INSERT_TAIL(&shard->timer_free_ring, te,
                                          timer_event_t, link);
                 }
             }
             if (!te) {
-                timers_next_expiry = 0;
+                shard->timers_next_expiry = 0;
             }
-            apr_thread_mutex_unlock(g_timer_skiplist_mtx);
+            apr_thread_mutex_unlock(shard->timer_skiplist_mtx);
         }
 
         /* Same for queues, use their next expiry, if any. */
-        timeout_time = queues_next_expiry;
+        timeout_time = shard->queues_next_expiry;
         if (timeout_time
                 && (timeout_interval < 0
                     || timeout_time <= now
@@ -1958,13 +2180,13 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
 
         /* When non-wakeable, don't wait more than 100 ms, in any case. */
 #define NON_WAKEABLE_POLL_TIMEOUT apr_time_from_msec(100)
-        if (!listener_is_wakeable
+        if (!shard->is_wakeable
                 && (timeout_interval < 0
                     || timeout_interval > NON_WAKEABLE_POLL_TIMEOUT)) {
             timeout_interval = NON_WAKEABLE_POLL_TIMEOUT;
         }
 
-        rc = apr_pollset_poll(event_pollset, timeout_interval, &num, &out_pfd);
+        rc = pollset_poll(shard, timeout_interval, &num, &out_pfd);
         if (rc != APR_SUCCESS) {
             if (APR_STATUS_IS_EINTR(rc)) {
                 /* Woken up, either update timeouts or shutdown,
@@ -1983,7 +2205,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         }
 
         if (listener_may_exit) {
-            close_listeners(process_slot, &closed);
+            close_listeners(shard, process_slot, &closed);
             if (terminate_mode == ST_UNGRACEFUL
                 || apr_atomic_read32(&connection_count) == 0)
                 break;
@@ -1994,22 +2216,22 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             if (pt->type == PT_CSD) {
                 /* one of the sockets is readable */
                 event_conn_state_t *cs = (event_conn_state_t *) pt->baton;
-                struct timeout_queue *remove_from_q = cs->sc->wc_q;
+                struct timeout_queue *remove_from_q = CS_WC_Q(cs);
                 int blocking = 1;
 
                 switch (cs->pub.state) {
                 case CONN_STATE_CHECK_REQUEST_LINE_READABLE:
                     cs->pub.state = CONN_STATE_READ_REQUEST_LINE;
-                    remove_from_q = cs->sc->ka_q;
+                    remove_from_q = CS_KA_Q(cs);
                     /* don't wait for a worker for a keepalive request */
                     blocking = 0;
                     /* FALL THROUGH */
                 case CONN_STATE_WRITE_COMPLETION:
                     get_worker(&have_idle_worker, blocking,
                                &workers_were_busy);
-                    apr_thread_mutex_lock(timeout_mutex);
+                    apr_thread_mutex_lock(shard->timeout_mutex);
                     TO_QUEUE_REMOVE(remove_from_q, cs);
-                    apr_thread_mutex_unlock(timeout_mutex);
+                    apr_thread_mutex_unlock(shard->timeout_mutex);
 
                     /*
                      * Some of the pollset backends, like KQueue or Epoll
@@ -2017,7 +2239,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                      * therefore, we can accept _SUCCESS or _NOTFOUND,
                      * and we still want to keep going
                      */
-                    rc = apr_pollset_remove(event_pollset, &cs->pfd);
+                    rc = pollset_remove(shard, &cs->pfd);
                     if (rc != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rc)) {
                         ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
                                      APLOGNO(03094) "pollset remove failed");
@@ -2034,7 +2256,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                         start_lingering_close_nonblocking(cs);
                         break;
                     }
-                    rc = push2worker(out_pfd, event_pollset);
+                    rc = push2worker(out_pfd);
                     if (rc != APR_SUCCESS) {
                         ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
                                      ap_server_conf, APLOGNO(03095)
@@ -2060,7 +2282,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                 /* A Listener Socket is ready for an accept() */
                 if (workers_were_busy) {
                     if (!listeners_disabled)
-                        disable_listensocks(process_slot);
+                        disable_listensocks(shard, process_slot);
                     listeners_disabled = 1;
                     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
                                  APLOGNO(03268)
@@ -2075,7 +2297,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                                   + threads_per_child))
                 {
                     if (!listeners_disabled)
-                        disable_listensocks(process_slot);
+                        disable_listensocks(shard, process_slot);
                     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
                                  APLOGNO(03269)
                                  "Too many open connections (%u), "
@@ -2088,7 +2310,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                 }
                 else if (listeners_disabled) {
                     listeners_disabled = 0;
-                    enable_listensocks(process_slot);
+                    enable_listensocks(shard, process_slot);
                 }
                 if (!listeners_disabled) {
                     void *csd = NULL;
@@ -2115,7 +2337,10 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     }
                     apr_pool_tag(ptrans, "transaction");
 
-                    get_worker(&have_idle_worker, 1, &workers_were_busy);
+                    /* The other shards may have been woken up for the same
+                     * connection (and get EAGAIN), so a worker is reserved
+                     * only once the connection is ours.
+                     */
                     rc = lr->accept_func(&csd, lr, ptrans);
 
                     /* later we trash rv and rely on csd to indicate
@@ -2130,7 +2355,8 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     }
 
                     if (csd != NULL) {
-                        conns_this_child--;
+                        apr_atomic_dec32(&conns_this_child);
+                        get_worker(&have_idle_worker, 1, &workers_were_busy);
                         rc = ap_queue_push(worker_queue, csd, NULL, ptrans);
                         if (rc != APR_SUCCESS) {
                             /* trash the connection; we couldn't queue the connected
@@ -2170,7 +2396,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                 /* We only signal once per N sockets with this baton */
                 if (!(baton->signaled)) { 
                     baton->signaled = 1;
-                    te = event_get_timer_event(-1 /* fake timer */, 
+                    te = event_get_timer_event(shard, -1 /* fake timer */, 
                                                baton->cbfunc, 
                                                baton->user_baton, 
                                                0, /* don't insert it */
@@ -2178,7 +2404,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     /* remove all sockets in my set */
                     for (i = 0; i < baton->pfds->nelts; i++) {
                         apr_pollfd_t *pfd = (apr_pollfd_t *)baton->pfds->elts + i;
-                        apr_pollset_remove(event_pollset, pfd);
+                        pollset_remove(shard, pfd);
                         pfd->client_data = NULL;
                     }
 
@@ -2203,42 +2429,42 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             timeout_time = now + TIMEOUT_FUDGE_FACTOR;
 
             /* handle timed out sockets */
-            apr_thread_mutex_lock(timeout_mutex);
+            apr_thread_mutex_lock(shard->timeout_mutex);
 
             /* Processing all the queues below will recompute this. */
-            queues_next_expiry = 0;
+            shard->queues_next_expiry = 0;
 
             /* Step 1: keepalive timeouts */
             if (workers_were_busy || dying) {
-                process_keepalive_queue(0); /* kill'em all \m/ */
+                process_keepalive_queue(shard, 0); /* kill'em all \m/ */
             }
             else {
-                process_keepalive_queue(timeout_time);
+                process_keepalive_queue(shard, timeout_time);
             }
             /* Step 2: write completion timeouts */
-            process_timeout_queue(write_completion_q, timeout_time,
+            process_timeout_queue(shard->write_completion_q, timeout_time,
                                   start_lingering_close_nonblocking);
             /* Step 3: (normal) lingering close completion timeouts */
-            process_timeout_queue(linger_q, timeout_time,
+            process_timeout_queue(shard->linger_q, timeout_time,
                                   stop_lingering_close);
             /* Step 4: (short) lingering close completion timeouts */
-            process_timeout_queue(short_linger_q, timeout_time,
+            process_timeout_queue(shard->short_linger_q, timeout_time,
                                   stop_lingering_close);
 
-            apr_thread_mutex_unlock(timeout_mutex);
+            apr_thread_mutex_unlock(shard->timeout_mutex);
 
-            ps->keep_alive = apr_atomic_read32(keepalive_q->total);
-            ps->write_completion = apr_atomic_read32(write_completion_q->total);
+            ps->keep_alive = shards_queues_total(SHARD_KEEPALIVE_Q);
+            ps->write_completion = shards_queues_total(SHARD_WRITE_COMPLETION_Q);
             ps->connections = apr_atomic_read32(&connection_count);
             ps->suspended = apr_atomic_read32(&suspended_count);
             ps->lingering_close = apr_atomic_read32(&lingering_count);
         }
         else if ((workers_were_busy || dying)
-                 && apr_atomic_read32(keepalive_q->total)) {
-            apr_thread_mutex_lock(timeout_mutex);
-            process_keepalive_queue(0); /* kill'em all \m/ */
-            apr_thread_mutex_unlock(timeout_mutex);
-            ps->keep_alive = 0;
+                 && apr_atomic_read32(shard->keepalive_q->total)) {
+            apr_thread_mutex_lock(shard->timeout_mutex);
+            process_keepalive_queue(shard, 0); /* kill'em all \m/ */
+            apr_thread_mutex_unlock(shard->timeout_mutex);
+            ps->keep_alive = shards_queues_total(SHARD_KEEPALIVE_Q);
         }
 
         if (listeners_disabled && !workers_were_busy
@@ -2250,7 +2476,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                           + threads_per_child)))
         {
             listeners_disabled = 0;
-            enable_listensocks(process_slot);
+            enable_listensocks(shard, process_slot);
         }
         /*
          * XXX: do we need to set some timeout that re-enables the listensocks
@@ -2258,8 +2484,12 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
          */
     }     /* listener main loop */
 
-    close_listeners(process_slot, &closed);
-    ap_queue_term(worker_queue);
+    close_listeners(shard, process_slot, &closed);
+
+    /* The last listener out terminates the workers' queue */
+    if (apr_atomic_inc32(&shards_exited) + 1 == (apr_uint32_t)num_shards) {
+        ap_queue_term(worker_queue);
+    }
 
     apr_thread_exit(thd, APR_SUCCESS);
     return NULL;
@@ -2346,7 +2576,8 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
             break;
         }
 
-        rv = ap_queue_pop_something(worker_queue, &csd, &cs, &ptrans, &te);
+        rv = ap_queue_pop_something(worker_queue, thread_slot,
+                                    &csd, &cs, &ptrans, &te);
 
         if (rv != APR_SUCCESS) {
             /* We get APR_EOF during a graceful shutdown once all the
@@ -2378,11 +2609,7 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
         }
         if (te != NULL) {
             te->cbfunc(te->baton);
-            {
-                apr_thread_mutex_lock(g_timer_skiplist_mtx);
-                APR_RING_INSERT_TAIL(&timer_free_ring, te, timer_event_t, link);
-                apr_thread_mutex_unlock(g_timer_skiplist_mtx);
-            }
+            event_put_timer_event(te);
         }
         else {
             is_idle = 0;
@@ -2418,19 +2645,100 @@ static void create_listener_thread(thread_starter * ts)
     apr_threadattr_t *thread_attr = ts->threadattr;
     proc_info *my_info;
     apr_status_t rv;
+    int i;
 
-    my_info = (proc_info *) ap_malloc(sizeof(proc_info));
-    my_info->pslot = my_child_num;
-    my_info->tslot = -1;      /* listener thread doesn't have a thread slot */
-    rv = apr_thread_create(&ts->listener, thread_attr, listener_thread,
-                           my_info, pchild);
+    for (i = 0; i < num_shards; i++) {
+        my_info = (proc_info *) ap_malloc(sizeof(proc_info));
+        my_info->pslot = my_child_num;
+        my_info->tslot = -1;  /* listener thread doesn't have a thread slot */
+        my_info->shard = i;
+        rv = apr_thread_create(&shards[i].listener, thread_attr,
+                               listener_thread, my_info, pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(00474)
+                         "apr_thread_create: unable to create listener thread");
+            /* let the parent decide how bad this really is */
+            clean_child_exit(APEXIT_CHILDSICK);
+        }
+        apr_os_thread_get(&shards[i].listener_os_thread, shards[i].listener);
+    }
+}
+
+/* Create the timeout mutex and the pollset (or io_uring) of a shard,
+ * before its listener thread starts.
+ */
+static void init_shard(event_shard_t *shard, apr_uint32_t pollset_size)
+{
+    int good_methods[] = {APR_POLLSET_KQUEUE, APR_POLLSET_PORT, APR_POLLSET_EPOLL};
+    apr_status_t rv;
+    int i;
+
+    rv = apr_thread_mutex_create(&shard->timeout_mutex,
+                                 APR_THREAD_MUTEX_DEFAULT, pchild);
     if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(00474)
-                     "apr_thread_create: unable to create listener thread");
-        /* let the parent decide how bad this really is */
-        clean_child_exit(APEXIT_CHILDSICK);
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03102)
+                     "creation of the timeout mutex failed.");
+        clean_child_exit(APEXIT_CHILDFATAL);
+    }
+
+    /* Create the io_uring engine if asked to, falling back to the pollset
+     * if the running kernel does not support it.
+     */
+    shard->uring = NULL;
+    shard->pollset = NULL;
+    shard->is_wakeable = 0;
+    if (async_io_engine == ASYNC_IO_ENGINE_URING) {
+        rv = ap_uring_create(&shard->uring, pollset_size, pchild);
+        if (rv == APR_SUCCESS) {
+            shard->is_wakeable = 1;
+            if (shard->id == 0) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
+                             APLOGNO(03488) "start_threads: Using io_uring "
+                             "(%d shard%s)", num_shards,
+                             num_shards > 1 ? "s" : "");
+            }
+            return;
+        }
+        shard->uring = NULL;
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, ap_server_conf,
+                     APLOGNO(03489) "io_uring initialization failed, "
+                     "falling back to the pollset");
+    }
+
+    /* Create the main pollset */
+    for (i = 0; i < sizeof(good_methods) / sizeof(good_methods[0]); i++) {
+        apr_uint32_t flags = APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY |
+                             APR_POLLSET_NODEFAULT | APR_POLLSET_WAKEABLE;
+        rv = apr_pollset_create_ex(&shard->pollset, pollset_size, pchild,
+                                   flags, good_methods[i]);
+        if (rv == APR_SUCCESS) {
+            shard->is_wakeable = 1;
+            break;
+        }
+        flags &= ~APR_POLLSET_WAKEABLE;
+        rv = apr_pollset_create_ex(&shard->pollset, pollset_size, pchild,
+                                   flags, good_methods[i]);
+        if (rv == APR_SUCCESS) {
+            break;
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        rv = apr_pollset_create(&shard->pollset, pollset_size, pchild,
+                                APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03103)
+                     "apr_pollset_create with Thread Safety failed.");
+        clean_child_exit(APEXIT_CHILDFATAL);
+    }
+
+    if (shard->id == 0) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02471)
+                     "start_threads: Using %s (%swakeable, %d shard%s)",
+                     apr_pollset_method_name(shard->pollset),
+                     shard->is_wakeable ? "" : "not ",
+                     num_shards, num_shards > 1 ? "s" : "");
     }
-    apr_os_thread_get(&listener_os_thread, ts->listener);
 }
 
 /* XXX under some circumstances not understood, children can get stuck
@@ -2452,14 +2760,14 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
     int loops;
     int prev_threads_created;
     int max_recycled_pools = -1;
-    int good_methods[] = {APR_POLLSET_KQUEUE, APR_POLLSET_PORT, APR_POLLSET_EPOLL};
     /* XXX don't we need more to handle K-A or lingering close? */
     const apr_uint32_t pollset_size = threads_per_child * 2;
 
     /* We must create the fd queues before we start up the listener
      * and worker threads. */
     worker_queue = apr_pcalloc(pchild, sizeof(*worker_queue));
-    rv = ap_queue_init(worker_queue, threads_per_child, pchild);
+    rv = ap_queue_init(worker_queue, threads_per_child, threads_per_child,
+                       pchild);
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(03100)
                      "ap_queue_init() failed");
@@ -2481,48 +2789,13 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    /* Create the timeout mutex and main pollset before the listener
-     * thread starts.
+    /* Create the timeout mutex and pollset of each shard before the
+     * listener threads start.
      */
-    rv = apr_thread_mutex_create(&timeout_mutex, APR_THREAD_MUTEX_DEFAULT,
-                                 pchild);
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03102)
-                     "creation of the timeout mutex failed.");
-        clean_child_exit(APEXIT_CHILDFATAL);
+    for (i = 0; i < num_shards; i++) {
+        init_shard(&shards[i], pollset_size);
     }
 
-    /* Create the main pollset */
-    for (i = 0; i < sizeof(good_methods) / sizeof(good_methods[0]); i++) {
-        apr_uint32_t flags = APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY |
-                             APR_POLLSET_NODEFAULT | APR_POLLSET_WAKEABLE;
-        rv = apr_pollset_create_ex(&event_pollset, pollset_size, pchild, flags,
-                                   good_methods[i]);
-        if (rv == APR_SUCCESS) {
-            listener_is_wakeable = 1;
-            break;
-        }
-        flags &= ~APR_POLLSET_WAKEABLE;
-        rv = apr_pollset_create_ex(&event_pollset, pollset_size, pchild, flags,
-                                   good_methods[i]);
-        if (rv == APR_SUCCESS) {
-            break;
-        }
-    }
-    if (rv != APR_SUCCESS) {
-        rv = apr_pollset_create(&event_pollset, pollset_size, pchild,
-                                APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
-    }
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03103)
-                     "apr_pollset_create with Thread Safety failed.");
-        clean_child_exit(APEXIT_CHILDFATAL);
-    }
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02471)
-                 "start_threads: Using %s (%swakeable)",
-                 apr_pollset_method_name(event_pollset),
-                 listener_is_wakeable ? "" : "not ");
     worker_sockets = apr_pcalloc(pchild, threads_per_child
                                  * sizeof(apr_socket_t *));
 
@@ -2599,12 +2872,12 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
     return NULL;
 }
 
-static void join_workers(apr_thread_t * listener, apr_thread_t ** threads)
+static void join_workers(apr_thread_t ** threads)
 {
     int i;
     apr_status_t rv, thread_rv;
 
-    if (listener) {
+    if (shards && shards[0].listener) {
         int iter;
 
         /* deal with a rare timing window which affects waking up the
@@ -2627,10 +2900,15 @@ static void join_workers(apr_thread_t * listener, apr_thread_t ** threads)
                          "the listener thread didn't stop accepting");
         }
         else {
-            rv = apr_thread_join(&thread_rv, listener);
-            if (rv != APR_SUCCESS) {
-                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00476)
-                             "apr_thread_join: unable to join listener thread");
+            for (i = 0; i < num_shards; i++) {
+                if (!shards[i].listener) {
+                    continue;
+                }
+                rv = apr_thread_join(&thread_rv, shards[i].listener);
+                if (rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00476)
+                                 "apr_thread_join: unable to join listener thread");
+                }
             }
         }
     }
@@ -2694,11 +2972,16 @@ static void child_main(int child_num_arg, int child_bucket)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    apr_thread_mutex_create(&g_timer_skiplist_mtx, APR_THREAD_MUTEX_DEFAULT, pchild);
-    APR_RING_INIT(&timer_free_ring, timer_event_t, link);
-    apr_pool_create(&pskip, pchild);
-    apr_skiplist_init(&timer_skiplist, pskip);
-    apr_skiplist_set_compare(timer_skiplist, timer_comp, timer_comp);
+    for (i = 0; i < num_shards; i++) {
+        event_shard_t *shard = &shards[i];
+        apr_thread_mutex_create(&shard->timer_skiplist_mtx,
+                                APR_THREAD_MUTEX_DEFAULT, pchild);
+        APR_RING_INIT(&shard->timer_free_ring, timer_event_t, link);
+        apr_pool_create(&pskip, pchild);
+        apr_skiplist_init(&shard->timer_skiplist, pskip);
+        apr_skiplist_set_compare(shard->timer_skiplist, timer_comp, timer_comp);
+    }
+    shards_closed = shards_exited = shards_not_accepting = 0;
     ap_run_child_init(pchild, ap_server_conf);
 
     /* done with init critical section */
@@ -2715,11 +2998,11 @@ static void child_main(int child_num_arg, int child_bucket)
     }
 
     if (ap_max_requests_per_child) {
-        conns_this_child = ap_max_requests_per_child;
+        apr_atomic_set32(&conns_this_child, ap_max_requests_per_child);
     }
     else {
         /* coding a value of zero means infinity */
-        conns_this_child = APR_INT32_MAX;
+        apr_atomic_set32(&conns_this_child, APR_INT32_MAX);
     }
 
     /* Setup worker threads */
@@ -2745,7 +3028,6 @@ static void child_main(int child_num_arg, int child_bucket)
     }
 
     ts->threads = threads;
-    ts->listener = NULL;
     ts->child_num_arg = child_num_arg;
     ts->threadattr = thread_attr;
 
@@ -2786,7 +3068,7 @@ static void child_main(int child_num_arg, int child_bucket)
          *   If the worker hasn't exited, then this blocks until
          *   they have (then cleans up).
          */
-        join_workers(ts->listener, threads);
+        join_workers(threads);
     }
     else {                      /* !one_process */
         /* remove SIGTERM from the set of blocked signals...  if one of
@@ -2827,7 +3109,7 @@ static void child_main(int child_num_arg, int child_bucket)
          *   If the worker hasn't exited, then this blocks until
          *   they have (then cleans up).
          */
-        join_workers(ts->listener, threads);
+        join_workers(threads);
     }
 
     free(threads);
@@ -3564,6 +3846,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
                             apr_pool_t * ptemp)
 {
     int no_detach, debug, foreground;
+    apr_pollset_t *pollset;
     apr_status_t rv;
     const char *userdata_key = "mpm_event_module";
 
@@ -3600,7 +3883,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
             return HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        rv = apr_pollset_create(&event_pollset, 1, plog,
+        rv = apr_pollset_create(&pollset, 1, plog,
                                 APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
         if (rv != APR_SUCCESS) {
             ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(00495)
@@ -3609,7 +3892,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
                          "Also check system or user limits!");
             return HTTP_INTERNAL_SERVER_ERROR;
         }
-        apr_pollset_destroy(event_pollset);
+        apr_pollset_destroy(pollset);
 
         if (!one_process && !foreground) {
             /* before we detach, setup crash handlers to log to errorlog */
@@ -3635,6 +3918,8 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
     active_daemons_limit = server_limit;
     threads_per_child = DEFAULT_THREADS_PER_CHILD;
     max_workers = active_daemons_limit * threads_per_child;
+    async_io_engine = ASYNC_IO_ENGINE_POLLSET;
+    num_shards = 1;
     had_healthy_child = 0;
     ap_extended_status = 0;
 
@@ -3648,57 +3933,76 @@ static int event_post_config(apr_pool_t *pconf, apr_pool_t *plog,
         struct timeout_queue *tail, *q;
         apr_hash_t *hash;
     } wc, ka;
+    server_rec *sp;
+    event_srv_cfg *sc;
+    int i;
 
     /* Not needed in pre_config stage */
     if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
         return OK;
     }
 
-    wc.tail = ka.tail = NULL;
-    wc.hash = apr_hash_make(ptemp);
-    ka.hash = apr_hash_make(ptemp);
-
-    linger_q = TO_QUEUE_MAKE(pconf, apr_time_from_sec(MAX_SECS_TO_LINGER),
-                             NULL);
-    short_linger_q = TO_QUEUE_MAKE(pconf, apr_time_from_sec(SECONDS_TO_LINGER),
-                                   NULL);
-
-    for (; s; s = s->next) {
-        event_srv_cfg *sc = apr_pcalloc(pconf, sizeof *sc);
-
-        ap_set_module_config(s->module_config, &mpm_event_module, sc);
-        if (!wc.tail) {
-            /* The main server uses the global queues */
-            wc.q = TO_QUEUE_MAKE(pconf, s->timeout, NULL);
-            apr_hash_set(wc.hash, &s->timeout, sizeof s->timeout, wc.q);
-            wc.tail = write_completion_q = wc.q;
-
-            ka.q = TO_QUEUE_MAKE(pconf, s->keep_alive_timeout, NULL);
-            apr_hash_set(ka.hash, &s->keep_alive_timeout,
-                         sizeof s->keep_alive_timeout, ka.q);
-            ka.tail = keepalive_q = ka.q;
-        }
-        else {
-            /* The vhosts use any existing queue with the same timeout,
-             * or their own queue(s) if there isn't */
-            wc.q = apr_hash_get(wc.hash, &s->timeout, sizeof s->timeout);
-            if (!wc.q) {
-                wc.q = TO_QUEUE_MAKE(pconf, s->timeout, wc.tail);
-                apr_hash_set(wc.hash, &s->timeout, sizeof s->timeout, wc.q);
-                wc.tail = wc.tail->next = wc.q;
+    for (sp = s; sp; sp = sp->next) {
+        sc = apr_pcalloc(pconf, sizeof *sc);
+        sc->wc_q = apr_pcalloc(pconf, num_shards * sizeof *sc->wc_q);
+        sc->ka_q = apr_pcalloc(pconf, num_shards * sizeof *sc->ka_q);
+        ap_set_module_config(sp->module_config, &mpm_event_module, sc);
+    }
+
+    shards = apr_pcalloc(pconf, num_shards * sizeof *shards);
+    for (i = 0; i < num_shards; i++) {
+        event_shard_t *shard = &shards[i];
+
+        shard->id = i;
+        shard->linger_q = TO_QUEUE_MAKE(pconf,
+                                        apr_time_from_sec(MAX_SECS_TO_LINGER),
+                                        NULL, shard);
+        shard->short_linger_q = TO_QUEUE_MAKE(pconf,
+                                        apr_time_from_sec(SECONDS_TO_LINGER),
+                                        NULL, shard);
+
+        wc.tail = ka.tail = NULL;
+        wc.hash = apr_hash_make(ptemp);
+        ka.hash = apr_hash_make(ptemp);
+
+        for (sp = s; sp; sp = sp->next) {
+            sc = ap_get_module_config(sp->module_config, &mpm_event_module);
+            if (!wc.tail) {
+                /* The main server uses the shard's global queues */
+                wc.q = TO_QUEUE_MAKE(pconf, sp->timeout, NULL, shard);
+                apr_hash_set(wc.hash, &sp->timeout, sizeof sp->timeout, wc.q);
+                wc.tail = shard->write_completion_q = wc.q;
+
+                ka.q = TO_QUEUE_MAKE(pconf, sp->keep_alive_timeout, NULL,
+                                     shard);
+                apr_hash_set(ka.hash, &sp->keep_alive_timeout,
+                             sizeof sp->keep_alive_timeout, ka.q);
+                ka.tail = shard->keepalive_q = ka.q;
             }
+            else {
+                /* The vhosts use any existing queue with the same timeout,
+                 * or their own queue(s) if there isn't */
+                wc.q = apr_hash_get(wc.hash, &sp->timeout, sizeof sp->timeout);
+                if (!wc.q) {
+                    wc.q = TO_QUEUE_MAKE(pconf, sp->timeout, wc.tail, shard);
+                    apr_hash_set(wc.hash, &sp->timeout, sizeof sp->timeout,
+                                 wc.q);
+                    wc.tail = wc.tail->next = wc.q;
+                }
 
-            ka.q = apr_hash_get(ka.hash, &s->keep_alive_timeout,
-                                sizeof s->keep_alive_timeout);
-            if (!ka.q) {
-                ka.q = TO_QUEUE_MAKE(pconf, s->keep_alive_timeout, ka.tail);
-                apr_hash_set(ka.hash, &s->keep_alive_timeout,
-                             sizeof s->keep_alive_timeout, ka.q);
-                ka.tail = ka.tail->next = ka.q;
+                ka.q = apr_hash_get(ka.hash, &sp->keep_alive_timeout,
+                                    sizeof sp->keep_alive_timeout);
+                if (!ka.q) {
+                    ka.q = TO_QUEUE_MAKE(pconf, sp->keep_alive_timeout,
+                                         ka.tail, shard);
+                    apr_hash_set(ka.hash, &sp->keep_alive_timeout,
+                                 sizeof sp->keep_alive_timeout, ka.q);
+                    ka.tail = ka.tail->next = ka.q;
+                }
             }
+            sc->wc_q[i] = wc.q;
+            sc->ka_q[i] = ka.q;
         }
-        sc->wc_q = wc.q;
-        sc->ka_q = ka.q;
     }
 
     return OK;
@@ -3826,6 +4130,21 @@ static int event_check_config(apr_pool_t *p, apr_pool_t *plog,
         threads_per_child = 1;
     }
 
+    if (num_shards > threads_per_child) {
+        if (startup) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL, APLOGNO(03490)
+                         "WARNING: ListenerShards of %d exceeds ThreadsPerChild "
+                         "of %d, decreasing to match",
+                         num_shards, threads_per_child);
+        } else {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(03491)
+                         "ListenerShards of %d exceeds ThreadsPerChild "
+                         "of %d, decreasing to match",
+                         num_shards, threads_per_child);
+        }
+        num_shards = threads_per_child;
+    }
+
     if (max_workers < threads_per_child) {
         if (startup) {
             ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL, APLOGNO(00511)
@@ -4064,6 +4383,44 @@ static const char *set_worker_factor(cmd_parms * cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_async_io_engine(cmd_parms * cmd, void *dummy,
+                                       const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (!strcasecmp(arg, "pollset")) {
+        async_io_engine = ASYNC_IO_ENGINE_POLLSET;
+    }
+    else if (!strcasecmp(arg, "io_uring")) {
+        if (ap_uring_available() != APR_SUCCESS) {
+            return "AsyncIOEngine io_uring is not supported by this build "
+                   "(liburing was not found at configure time)";
+        }
+        async_io_engine = ASYNC_IO_ENGINE_URING;
+    }
+    else {
+        return "AsyncIOEngine must be either 'pollset' or 'io_uring'";
+    }
+    return NULL;
+}
+
+static const char *set_listener_shards(cmd_parms * cmd, void *dummy,
+                                       const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    num_shards = atoi(arg);
+    if (num_shards < 1) {
+        return "ListenerShards must be at least 1";
+    }
+    return NULL;
+}
 
 static const command_rec event_cmds[] = {
     LISTEN_COMMANDS,
@@ -4087,6 +4444,12 @@ static const command_rec event_cmds[] = {
     AP_INIT_TAKE1("AsyncRequestWorkerFactor", set_worker_factor, NULL, RSRC_CONF,
                   "How many additional connects will be accepted per idle "
                   "worker thread"),
+    AP_INIT_TAKE1("AsyncIOEngine", set_async_io_engine, NULL, RSRC_CONF,
+                  "The listener's I/O engine, either 'pollset' (default) or "
+                  "'io_uring'"),
+    AP_INIT_TAKE1("ListenerShards", set_listener_shards, NULL, RSRC_CONF,
+                  "Number of listener threads per child, each with its own "
+                  "pollset, timeout queues and timers"),
     AP_GRACEFUL_SHUTDOWN_TIMEOUT_COMMAND,
     {NULL}
 };
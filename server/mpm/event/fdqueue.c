@@ -302,67 +302,291 @@ apr_status_t ap_queue_info_term(fd_queue_info_t * queue_info)
     return apr_thread_mutex_unlock(queue_info->idlers_mutex);
 }
 
-/**
- * Detects when the fd_queue_t is full. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
+/*
+ * The queue is a bounded MPMC ring (one sequence number per slot, after
+ * D. Vyukov), so that the listeners pushing and the workers popping never
+ * take a lock.  The workers which find it empty register themselves on a
+ * lock-free idle stack and sleep on their own condition variable, so each
+ * push wakes up exactly one worker (the most recently idle one, likely the
+ * hottest in cache) without any shared mutex.
+ *
+ * A waiter's state tells whether it's on the idle stack, and whether it
+ * still wants to be woken up from there: a worker which finds an element
+ * after registering is left on the stack as STALE (it can't be removed
+ * from the middle), and skipped by the next waker.
  */
-#define ap_queue_full(queue) ((queue)->nelts == (queue)->bounds)
+#define WAITER_RUNNING  0       /* not on the idle stack */
+#define WAITER_STACKED  1       /* on the idle stack, waiting */
+#define WAITER_STALE    2       /* on the idle stack, but busy */
+#define WAITER_SIGNALED 3       /* popped from the stack and woken up */
 
-/**
- * Detects when the fd_queue_t is empty. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
+struct fd_queue_waiter_t
+{
+    apr_uint32_t state;
+    apr_uint32_t next;          /* slot + 1 of the next idle waiter */
+    int interrupted;
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+};
+
+#define IDLE_MASK(queue) ((1u << (queue)->idle_bits) - 1)
+
+static void idle_push(fd_queue_t *queue, int slot)
+{
+    fd_queue_waiter_t *w = &queue->waiters[slot];
+    apr_uint32_t mask = IDLE_MASK(queue), head, tagged;
+
+    for (;;) {
+        head = apr_atomic_read32(&queue->idle_head);
+        apr_atomic_set32(&w->next, head & mask);
+        /* Bump the tag on every change to prevent ABA */
+        tagged = ((head & ~mask) + mask + 1) | (apr_uint32_t)(slot + 1);
+        if (apr_atomic_cas32(&queue->idle_head, tagged, head) == head) {
+            break;
+        }
+    }
+}
+
+static fd_queue_waiter_t *idle_pop(fd_queue_t *queue)
+{
+    apr_uint32_t mask = IDLE_MASK(queue), head, next, tagged;
+    fd_queue_waiter_t *w;
+
+    for (;;) {
+        head = apr_atomic_read32(&queue->idle_head);
+        if (!(head & mask)) {
+            return NULL;
+        }
+        w = &queue->waiters[(head & mask) - 1];
+        next = apr_atomic_read32(&w->next);
+        tagged = ((head & ~mask) + mask + 1) | next;
+        if (apr_atomic_cas32(&queue->idle_head, tagged, head) == head) {
+            return w;
+        }
+    }
+}
+
+/*
+ * Wake up the first waiting worker of the idle stack, dropping the stale
+ * ones.  Returns whether a worker was woken up.
  */
-#define ap_queue_empty(queue) ((queue)->nelts == 0 && APR_RING_EMPTY(&queue->timers ,timer_event_t, link))
+static int queue_wake_one(fd_queue_t *queue, int interrupt)
+{
+    fd_queue_waiter_t *w;
+
+    while ((w = idle_pop(queue))) {
+        for (;;) {
+            apr_uint32_t state = apr_atomic_read32(&w->state);
+            if (state == WAITER_STACKED) {
+                int woken = 0;
+                apr_thread_mutex_lock(w->mutex);
+                if (apr_atomic_cas32(&w->state, WAITER_SIGNALED,
+                                     WAITER_STACKED) == WAITER_STACKED) {
+                    if (interrupt) {
+                        w->interrupted = 1;
+                    }
+                    apr_thread_cond_signal(w->cond);
+                    woken = 1;
+                }
+                apr_thread_mutex_unlock(w->mutex);
+                if (woken) {
+                    return 1;
+                }
+            }
+            else if (apr_atomic_cas32(&w->state, WAITER_RUNNING,
+                                      WAITER_STALE) == WAITER_STALE) {
+                /* Off the stack now, the worker will register again */
+                break;
+            }
+        }
+    }
+    return 0;
+}
 
-/**
- * Callback routine that is called to destroy this
- * fd_queue_t when its pool is destroyed.
+/*
+ * The worker got something to do (or gives up), make sure it won't be
+ * woken up for nothing, and hand over any wakeup it didn't wait for.
  */
-static apr_status_t ap_queue_destroy(void *data)
+static void queue_waiter_busy(fd_queue_t *queue, fd_queue_waiter_t *w)
+{
+    for (;;) {
+        apr_uint32_t state = apr_atomic_read32(&w->state);
+        if (state == WAITER_STACKED) {
+            if (apr_atomic_cas32(&w->state, WAITER_STALE,
+                                 WAITER_STACKED) == WAITER_STACKED) {
+                return;
+            }
+        }
+        else if (state == WAITER_SIGNALED) {
+            apr_atomic_set32(&w->state, WAITER_RUNNING);
+            queue_wake_one(queue, 0);
+            return;
+        }
+        else {
+            return;
+        }
+    }
+}
+
+static int queue_ring_push(fd_queue_t *queue, apr_socket_t *sd,
+                           event_conn_state_t *ecs, apr_pool_t *p,
+                           timer_event_t *te)
 {
-    fd_queue_t *queue = data;
+    fd_queue_elem_t *elem;
+    apr_uint32_t pos, seq;
 
-    /* Ignore errors here, we can't do anything about them anyway.
-     * XXX: We should at least try to signal an error here, it is
-     * indicative of a programmer error. -aaron */
-    apr_thread_cond_destroy(queue->not_empty);
-    apr_thread_mutex_destroy(queue->one_big_mutex);
+    pos = apr_atomic_read32(&queue->in);
+    for (;;) {
+        elem = &queue->data[pos & queue->mask];
+        seq = apr_atomic_read32(&elem->seq);
+        if (seq == pos) {
+            /* The slot is free, claim it */
+            apr_uint32_t cur = apr_atomic_cas32(&queue->in, pos + 1, pos);
+            if (cur == pos) {
+                break;
+            }
+            pos = cur;
+        }
+        else if ((apr_int32_t)(seq - pos) < 0) {
+            return 0; /* full */
+        }
+        else {
+            pos = apr_atomic_read32(&queue->in);
+        }
+    }
 
-    return APR_SUCCESS;
+    elem->sd = sd;
+    elem->ecs = ecs;
+    elem->p = p;
+    elem->te = te;
+    /* Publish (full barrier) */
+    apr_atomic_inc32(&elem->seq);
+
+    return 1;
+}
+
+static int queue_ring_pop(fd_queue_t *queue, apr_socket_t **sd,
+                          event_conn_state_t **ecs, apr_pool_t **p,
+                          timer_event_t **te)
+{
+    fd_queue_elem_t *elem;
+    apr_uint32_t pos, seq;
+
+    pos = apr_atomic_read32(&queue->out);
+    for (;;) {
+        elem = &queue->data[pos & queue->mask];
+        seq = apr_atomic_read32(&elem->seq);
+        if (seq == pos + 1) {
+            /* The slot is filled, claim it */
+            apr_uint32_t cur = apr_atomic_cas32(&queue->out, pos + 1, pos);
+            if (cur == pos) {
+                break;
+            }
+            pos = cur;
+        }
+        else if ((apr_int32_t)(seq - (pos + 1)) < 0) {
+            return 0; /* empty */
+        }
+        else {
+            pos = apr_atomic_read32(&queue->out);
+        }
+    }
+
+    *te = elem->te;
+    if (!elem->te) {
+        *sd = elem->sd;
+        *ecs = elem->ecs;
+        *p = elem->p;
+    }
+#ifdef AP_DEBUG
+    elem->sd = NULL;
+    elem->p = NULL;
+    elem->te = NULL;
+#endif /* AP_DEBUG */
+    /* Release the slot for the next round (full barrier) */
+    apr_atomic_add32(&elem->seq, queue->mask);
+    if (*te) {
+        /* Only now that its slot is free again */
+        apr_atomic_dec32(&queue->ring_timers);
+    }
+
+    return 1;
+}
+
+static int queue_pop(fd_queue_t *queue, apr_socket_t **sd,
+                     event_conn_state_t **ecs, apr_pool_t **p,
+                     timer_event_t **te)
+{
+    if (queue_ring_pop(queue, sd, ecs, p, te)) {
+        return 1;
+    }
+
+    if (apr_atomic_read32(&queue->timers_count)) {
+        int found = 0;
+        apr_thread_mutex_lock(queue->timers_mutex);
+        if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
+            *te = APR_RING_FIRST(&queue->timers);
+            APR_RING_REMOVE(*te, link);
+            apr_atomic_dec32(&queue->timers_count);
+            found = 1;
+        }
+        apr_thread_mutex_unlock(queue->timers_mutex);
+        return found;
+    }
+
+    return 0;
 }
 
 /**
  * Initialize the fd_queue_t.
  */
 apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
-                           apr_pool_t * a)
+                           int num_waiters, apr_pool_t * a)
 {
-    int i;
+    apr_uint32_t bounds, i;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_create(&queue->one_big_mutex,
-                                      APR_THREAD_MUTEX_DEFAULT,
-                                      a)) != APR_SUCCESS) {
-        return rv;
+    /* Leave room for the timers, which are not accounted by the idlers */
+    for (bounds = 2; bounds < (apr_uint32_t)queue_capacity * 2; bounds <<= 1)
+        ;
+    queue->data = apr_pcalloc(a, bounds * sizeof(fd_queue_elem_t));
+    queue->bounds = bounds;
+    queue->mask = bounds - 1;
+    queue->ring_timers = 0;
+    queue->max_ring_timers = bounds - queue_capacity;
+    queue->in = 0;
+    queue->out = 0;
+    for (i = 0; i < bounds; ++i) {
+        queue->data[i].seq = i;
     }
-    if ((rv = apr_thread_cond_create(&queue->not_empty, a)) != APR_SUCCESS) {
-        return rv;
+
+    for (queue->idle_bits = 1;
+         (1u << queue->idle_bits) <= (apr_uint32_t)num_waiters;
+         queue->idle_bits++)
+        ;
+    queue->idle_head = 0;
+    queue->num_waiters = num_waiters;
+    queue->waiters = apr_pcalloc(a, num_waiters * sizeof(fd_queue_waiter_t));
+    for (i = 0; i < (apr_uint32_t)num_waiters; ++i) {
+        fd_queue_waiter_t *w = &queue->waiters[i];
+        if ((rv = apr_thread_mutex_create(&w->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                          a)) != APR_SUCCESS) {
+            return rv;
+        }
+        if ((rv = apr_thread_cond_create(&w->cond, a)) != APR_SUCCESS) {
+            return rv;
+        }
     }
 
     APR_RING_INIT(&queue->timers, timer_event_t, link);
+    queue->timers_count = 0;
+    if ((rv = apr_thread_mutex_create(&queue->timers_mutex,
+                                      APR_THREAD_MUTEX_DEFAULT,
+                                      a)) != APR_SUCCESS) {
+        return rv;
+    }
 
-    queue->data = apr_palloc(a, queue_capacity * sizeof(fd_queue_elem_t));
-    queue->bounds = queue_capacity;
-    queue->nelts = 0;
-    queue->in = 0;
-    queue->out = 0;
-
-    /* Set all the sockets in the queue to NULL */
-    for (i = 0; i < queue_capacity; ++i)
-        queue->data[i].sd = NULL;
-
-    apr_pool_cleanup_register(a, queue, ap_queue_destroy,
-                              apr_pool_cleanup_null);
+    queue->terminated = 0;
 
     return APR_SUCCESS;
 }
@@ -376,149 +600,137 @@ apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
 apr_status_t ap_queue_push(fd_queue_t * queue, apr_socket_t * sd,
                            event_conn_state_t * ecs, apr_pool_t * p)
 {
-    fd_queue_elem_t *elem;
-    apr_status_t rv;
-
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
-
     AP_DEBUG_ASSERT(!queue->terminated);
-    AP_DEBUG_ASSERT(!ap_queue_full(queue));
-
-    elem = &queue->data[queue->in];
-    queue->in++;
-    if (queue->in >= queue->bounds)
-        queue->in -= queue->bounds;
-    elem->sd = sd;
-    elem->ecs = ecs;
-    elem->p = p;
-    queue->nelts++;
-
-    apr_thread_cond_signal(queue->not_empty);
 
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+    if (!queue_ring_push(queue, sd, ecs, p, NULL)) {
+        /* Can't happen with the idlers reservation, since the timers
+         * leave queue_capacity slots to the sockets
+         */
+        AP_DEBUG_ASSERT(0);
+        return APR_EAGAIN;
     }
+    queue_wake_one(queue, 0);
 
     return APR_SUCCESS;
 }
 
 apr_status_t ap_queue_push_timer(fd_queue_t * queue, timer_event_t *te)
 {
-    apr_status_t rv;
-
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
-
     AP_DEBUG_ASSERT(!queue->terminated);
 
-    APR_RING_INSERT_TAIL(&queue->timers, te, timer_event_t, link);
-
-    apr_thread_cond_signal(queue->not_empty);
-
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+    /* Take a ring slot only if it's not one of the sockets' */
+    if (apr_atomic_inc32(&queue->ring_timers) >= queue->max_ring_timers
+            || !queue_ring_push(queue, NULL, NULL, NULL, te)) {
+        apr_atomic_dec32(&queue->ring_timers);
+        apr_thread_mutex_lock(queue->timers_mutex);
+        APR_RING_INSERT_TAIL(&queue->timers, te, timer_event_t, link);
+        apr_atomic_inc32(&queue->timers_count);
+        apr_thread_mutex_unlock(queue->timers_mutex);
     }
+    queue_wake_one(queue, 0);
 
     return APR_SUCCESS;
 }
 
 /**
- * Retrieves the next available socket from the queue. If there are no
- * sockets available, it will block until one becomes available.
- * Once retrieved, the socket is placed into the address specified by
- * 'sd'.
+ * Retrieves the next available socket or timer from the queue. If there
+ * is none available, the worker (identified by its slot) blocks until one
+ * becomes available.  Once retrieved, the socket is placed into the
+ * address specified by 'sd', or the timer into 'te_out'.
  */
-apr_status_t ap_queue_pop_something(fd_queue_t * queue, apr_socket_t ** sd,
+apr_status_t ap_queue_pop_something(fd_queue_t * queue, int slot,
+                                    apr_socket_t ** sd,
                                     event_conn_state_t ** ecs, apr_pool_t ** p,
                                     timer_event_t ** te_out)
 {
-    fd_queue_elem_t *elem;
-    apr_status_t rv;
+    fd_queue_waiter_t *w = &queue->waiters[slot];
+    apr_status_t rv = APR_SUCCESS;
+    int interrupted;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
+    AP_DEBUG_ASSERT(slot >= 0 && slot < queue->num_waiters);
 
-    /* Keep waiting until we wake up and find that the queue is not empty. */
-    if (ap_queue_empty(queue)) {
-        if (!queue->terminated) {
-            apr_thread_cond_wait(queue->not_empty, queue->one_big_mutex);
+    for (;;) {
+        apr_uint32_t state;
+
+        if (queue_pop(queue, sd, ecs, p, te_out)) {
+            break;
         }
-        /* If we wake up and it's still empty, then we were interrupted */
-        if (ap_queue_empty(queue)) {
-            rv = apr_thread_mutex_unlock(queue->one_big_mutex);
-            if (rv != APR_SUCCESS) {
-                return rv;
-            }
-            if (queue->terminated) {
-                return APR_EOF; /* no more elements ever again */
-            }
-            else {
-                return APR_EINTR;
-            }
+        if (queue->terminated) {
+            rv = APR_EOF; /* no more elements ever again */
+            break;
+        }
+
+        /* Register on the idle stack, and check the ring again before
+         * sleeping since a push may have missed us.
+         */
+        state = apr_atomic_read32(&w->state);
+        if (state == WAITER_RUNNING) {
+            apr_atomic_set32(&w->state, WAITER_STACKED);
+            idle_push(queue, slot);
+            continue;
+        }
+        if (state == WAITER_STALE) {
+            /* Still stacked, or dropped (RUNNING) meanwhile */
+            apr_atomic_cas32(&w->state, WAITER_STACKED, WAITER_STALE);
+            continue;
         }
-    }
 
-    *te_out = NULL;
+        apr_thread_mutex_lock(w->mutex);
+        while (apr_atomic_read32(&w->state) == WAITER_STACKED
+               && !w->interrupted && !queue->terminated) {
+            apr_thread_cond_wait(w->cond, w->mutex);
+        }
+        if (apr_atomic_read32(&w->state) == WAITER_SIGNALED) {
+            apr_atomic_set32(&w->state, WAITER_RUNNING);
+        }
+        interrupted = w->interrupted;
+        w->interrupted = 0;
+        apr_thread_mutex_unlock(w->mutex);
 
-    if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
-        *te_out = APR_RING_FIRST(&queue->timers);
-        APR_RING_REMOVE(*te_out, link);
-    }
-    else {
-        elem = &queue->data[queue->out];
-        queue->out++;
-        if (queue->out >= queue->bounds)
-            queue->out -= queue->bounds;
-        queue->nelts--;
-        *sd = elem->sd;
-        *ecs = elem->ecs;
-        *p = elem->p;
-#ifdef AP_DEBUG
-        elem->sd = NULL;
-        elem->p = NULL;
-#endif /* AP_DEBUG */
+        if (interrupted) {
+            rv = APR_EINTR;
+            break;
+        }
     }
 
-    rv = apr_thread_mutex_unlock(queue->one_big_mutex);
+    queue_waiter_busy(queue, w);
     return rv;
 }
 
-static apr_status_t queue_interrupt(fd_queue_t *queue, int all, int term)
+static apr_status_t queue_interrupt_all(fd_queue_t *queue, int term)
 {
-    apr_status_t rv;
+    int i;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
-    /* we must hold one_big_mutex when setting this... otherwise,
-     * we could end up setting it and waking everybody up just after a
-     * would-be popper checks it but right before they block
+    /* Each waiter checks these under its own mutex, so setting them
+     * before taking it can't miss a would-be sleeper.
      */
     if (term) {
         queue->terminated = 1;
     }
-    if (all)
-        apr_thread_cond_broadcast(queue->not_empty);
-    else
-        apr_thread_cond_signal(queue->not_empty);
-    return apr_thread_mutex_unlock(queue->one_big_mutex);
+    for (i = 0; i < queue->num_waiters; ++i) {
+        fd_queue_waiter_t *w = &queue->waiters[i];
+        apr_thread_mutex_lock(w->mutex);
+        if (!term) {
+            w->interrupted = 1;
+        }
+        apr_thread_cond_signal(w->cond);
+        apr_thread_mutex_unlock(w->mutex);
+    }
+    return APR_SUCCESS;
 }
 
 apr_status_t ap_queue_interrupt_all(fd_queue_t * queue)
 {
-    return queue_interrupt(queue, 1, 0);
+    return queue_interrupt_all(queue, 0);
 }
 
 apr_status_t ap_queue_interrupt_one(fd_queue_t * queue)
 {
-    return queue_interrupt(queue, 0, 0);
+    queue_wake_one(queue, 1);
+    return APR_SUCCESS;
 }
 
 apr_status_t ap_queue_term(fd_queue_t * queue)
 {
-    return queue_interrupt(queue, 1, 1);
+    return queue_interrupt_all(queue, 1);
 }
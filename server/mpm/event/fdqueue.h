@@ -41,6 +41,8 @@
 
 typedef struct fd_queue_info_t fd_queue_info_t;
 typedef struct event_conn_state_t event_conn_state_t;
+typedef struct event_shard_t event_shard_t;
+typedef struct timer_event_t timer_event_t;
 
 apr_status_t ap_queue_info_create(fd_queue_info_t ** queue_info,
                                   apr_pool_t * pool, int max_idlers,
@@ -56,14 +58,14 @@ void ap_free_idle_pools(fd_queue_info_t *queue_info);
 
 struct fd_queue_elem_t
 {
+    apr_uint32_t seq;           /* ring position this slot is ready for */
     apr_socket_t *sd;
     apr_pool_t *p;
     event_conn_state_t *ecs;
+    timer_event_t *te;
 };
 typedef struct fd_queue_elem_t fd_queue_elem_t;
 
-typedef struct timer_event_t timer_event_t;
-
 struct timer_event_t
 {
     APR_RING_ENTRY(timer_event_t) link;
@@ -72,19 +74,44 @@ struct timer_event_t
     void *baton;
     int canceled;
     apr_array_header_t *remove;
+    event_shard_t *shard;
 };
 
+typedef struct fd_queue_waiter_t fd_queue_waiter_t;
+
+/* Pad the hot shared words of the queue onto their own cache line */
+#define FD_QUEUE_CACHE_LINE 64
+
 struct fd_queue_t
 {
-    APR_RING_HEAD(timers_t, timer_event_t) timers;
+    /* Bounded MPMC ring of sockets and timers, power of two sized */
     fd_queue_elem_t *data;
-    unsigned int nelts;
-    unsigned int bounds;
-    unsigned int in;
-    unsigned int out;
-    apr_thread_mutex_t *one_big_mutex;
-    apr_thread_cond_t *not_empty;
-    int terminated;
+    apr_uint32_t bounds;
+    apr_uint32_t mask;
+    char pad0[FD_QUEUE_CACHE_LINE];
+    apr_uint32_t in;            /* next position to push */
+    char pad1[FD_QUEUE_CACHE_LINE];
+    apr_uint32_t out;           /* next position to pop */
+    char pad2[FD_QUEUE_CACHE_LINE];
+
+    /* Idle stack of the workers waiting for an element */
+    apr_uint32_t idle_head;     /* (ABA tag << idle_bits) | (slot + 1) */
+    apr_uint32_t idle_bits;
+    fd_queue_waiter_t *waiters;
+    int num_waiters;
+
+    /* Timers in the ring, limited so that queue_capacity slots always
+     * remain for the sockets (which the idlers reservation accounts)
+     */
+    apr_uint32_t ring_timers;
+    apr_uint32_t max_ring_timers;
+
+    /* Timers which did not fit in the ring */
+    APR_RING_HEAD(timers_t, timer_event_t) timers;
+    apr_uint32_t timers_count;
+    apr_thread_mutex_t *timers_mutex;
+
+    volatile int terminated;
 };
 typedef struct fd_queue_t fd_queue_t;
 
@@ -93,11 +120,12 @@ void ap_push_pool(fd_queue_info_t * queue_info,
                                     apr_pool_t * pool_to_recycle);
 
 apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
-                           apr_pool_t * a);
+                           int num_waiters, apr_pool_t * a);
 apr_status_t ap_queue_push(fd_queue_t * queue, apr_socket_t * sd,
                            event_conn_state_t * ecs, apr_pool_t * p);
 apr_status_t ap_queue_push_timer(fd_queue_t *queue, timer_event_t *te);
-apr_status_t ap_queue_pop_something(fd_queue_t * queue, apr_socket_t ** sd,
+apr_status_t ap_queue_pop_something(fd_queue_t * queue, int slot,
+                                    apr_socket_t ** sd,
                                     event_conn_state_t ** ecs, apr_pool_t ** p,
                                     timer_event_t ** te);
 apr_status_t ap_queue_interrupt_all(fd_queue_t * queue);
@@ -0,0 +1,503 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uring.h"
+
+#if HAVE_LIBURING
+
+#include "apr_hash.h"
+#include "apr_ring.h"
+#include "apr_portable.h"
+#include "apr_thread_mutex.h"
+
+#include <string.h>
+#if APR_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <liburing.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/* Minimal number of SQEs, whatever the results set size */
+#define URING_MIN_ENTRIES 256
+
+typedef struct uring_op_t uring_op_t;
+struct uring_op_t
+{
+    APR_RING_ENTRY(uring_op_t) link;
+    const apr_pollfd_t *pfd;    /* NULL when removed while still armed */
+    apr_int16_t reqevents;
+    int fd;
+    int armed;                  /* poll request in flight */
+};
+APR_RING_HEAD(uring_ops_t, uring_op_t);
+
+struct ap_uring_t
+{
+    struct io_uring ring;
+    apr_pool_t *pool;
+    apr_thread_mutex_t *mutex;  /* for the SQ and everything below */
+    apr_hash_t *ops;            /* fd => registered uring_op_t */
+    struct uring_ops_t fired;   /* delivered ops to re-arm */
+    struct uring_ops_t removed; /* removed ops still to cancel */
+    struct uring_ops_t spare;   /* recycled ops */
+    apr_pollfd_t *result_set;
+    apr_uint32_t size;
+    uring_op_t wakeup_op;
+    int wakeup_fd;
+};
+
+static unsigned int get_uring_event(apr_int16_t event)
+{
+    unsigned int rv = 0;
+
+    if (event & APR_POLLIN)
+        rv |= POLLIN;
+    if (event & APR_POLLPRI)
+        rv |= POLLPRI;
+    if (event & APR_POLLOUT)
+        rv |= POLLOUT;
+#ifdef APR_POLLEXCLUSIVE
+    /* Ignored by kernels not supporting it for io_uring polls */
+    if (event & APR_POLLEXCLUSIVE)
+        rv |= EPOLLEXCLUSIVE;
+#endif
+    /* POLLERR and POLLHUP are always reported */
+
+    return rv;
+}
+
+static apr_int16_t get_apr_event(int event)
+{
+    apr_int16_t rv = 0;
+
+    if (event & POLLIN)
+        rv |= APR_POLLIN;
+    if (event & POLLPRI)
+        rv |= APR_POLLPRI;
+    if (event & POLLOUT)
+        rv |= APR_POLLOUT;
+    if (event & POLLERR)
+        rv |= APR_POLLERR;
+    if (event & POLLHUP)
+        rv |= APR_POLLHUP;
+    if (event & POLLNVAL)
+        rv |= APR_POLLNVAL;
+
+    return rv;
+}
+
+static apr_status_t get_pollfd_fd(const apr_pollfd_t *pfd, int *fd)
+{
+    if (pfd->desc_type == APR_POLL_SOCKET) {
+        return apr_os_sock_get(fd, pfd->desc.s);
+    }
+    if (pfd->desc_type == APR_POLL_FILE) {
+        return apr_os_file_get(fd, pfd->desc.f);
+    }
+    return APR_EBADF;
+}
+
+static uring_op_t *op_alloc(ap_uring_t *uring)
+{
+    uring_op_t *op;
+
+    if (!APR_RING_EMPTY(&uring->spare, uring_op_t, link)) {
+        op = APR_RING_FIRST(&uring->spare);
+        APR_RING_REMOVE(op, link);
+    }
+    else {
+        op = apr_palloc(uring->pool, sizeof(*op));
+    }
+    APR_RING_ELEM_INIT(op, link);
+    op->armed = 0;
+    return op;
+}
+
+static void op_recycle(ap_uring_t *uring, uring_op_t *op)
+{
+    op->pfd = NULL;
+    APR_RING_INSERT_TAIL(&uring->spare, op, uring_op_t, link);
+}
+
+/* Pre-condition: mutex locked */
+static struct io_uring_sqe *get_sqe(ap_uring_t *uring)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&uring->ring);
+    if (!sqe) {
+        /* SQ full, flush it to the kernel and retry */
+        io_uring_submit(&uring->ring);
+        sqe = io_uring_get_sqe(&uring->ring);
+    }
+    return sqe;
+}
+
+/* Pre-condition: mutex locked */
+static apr_status_t op_arm(ap_uring_t *uring, uring_op_t *op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = get_sqe(uring);
+    if (!sqe) {
+        return APR_ENOSPC;
+    }
+    io_uring_prep_poll_add(sqe, op->fd, get_uring_event(op->reqevents));
+    io_uring_sqe_set_data(sqe, op);
+    op->armed = 1;
+    return APR_SUCCESS;
+}
+
+/* Pre-condition: mutex locked */
+static apr_status_t op_cancel(ap_uring_t *uring, uring_op_t *op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = get_sqe(uring);
+    if (!sqe) {
+        return APR_ENOSPC;
+    }
+    /* IORING_OP_POLL_REMOVE addresses the poll by its user_data,
+     * prepared by hand since liburing changed the prototype of
+     * io_uring_prep_poll_remove() over time.
+     */
+    io_uring_prep_rw(IORING_OP_POLL_REMOVE, sqe, -1, NULL, 0, 0);
+    sqe->addr = (__u64)(uintptr_t)op;
+    io_uring_sqe_set_data(sqe, NULL);
+    return APR_SUCCESS;
+}
+
+static apr_status_t uring_cleanup(void *data)
+{
+    ap_uring_t *uring = data;
+
+    io_uring_queue_exit(&uring->ring);
+    close(uring->wakeup_fd);
+    return APR_SUCCESS;
+}
+
+apr_status_t ap_uring_available(void)
+{
+    return APR_SUCCESS;
+}
+
+apr_status_t ap_uring_create(ap_uring_t **puring, apr_uint32_t size,
+                             apr_pool_t *p)
+{
+    struct io_uring_params params;
+    ap_uring_t *uring;
+    apr_uint32_t entries = URING_MIN_ENTRIES;
+    apr_status_t rv;
+    int ret;
+
+    while (entries < size) {
+        entries <<= 1;
+    }
+
+    uring = apr_pcalloc(p, sizeof(*uring));
+    uring->pool = p;
+    uring->size = size;
+    uring->result_set = apr_palloc(p, size * sizeof(apr_pollfd_t));
+    uring->ops = apr_hash_make(p);
+    APR_RING_INIT(&uring->fired, uring_op_t, link);
+    APR_RING_INIT(&uring->removed, uring_op_t, link);
+    APR_RING_INIT(&uring->spare, uring_op_t, link);
+
+    rv = apr_thread_mutex_create(&uring->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    uring->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (uring->wakeup_fd < 0) {
+        return apr_get_os_error();
+    }
+
+    /* Each registered descriptor has at most one poll request in flight,
+     * plus its cancelation, so let the CQ be large enough to not overflow
+     * in the common case (the kernel backlogs otherwise).
+     */
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    ret = io_uring_queue_init_params(entries, &uring->ring, &params);
+    if (ret < 0) {
+        close(uring->wakeup_fd);
+        return APR_FROM_OS_ERROR(-ret);
+    }
+    /* Waiting with a timeout must not touch the SQ (owned by the workers
+     * too), which requires IORING_ENTER_EXT_ARG (Linux 5.11+).
+     */
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        io_uring_queue_exit(&uring->ring);
+        close(uring->wakeup_fd);
+        return APR_ENOTIMPL;
+    }
+    apr_pool_cleanup_register(p, uring, uring_cleanup, apr_pool_cleanup_null);
+
+    APR_RING_ELEM_INIT(&uring->wakeup_op, link);
+    uring->wakeup_op.fd = uring->wakeup_fd;
+    uring->wakeup_op.reqevents = APR_POLLIN;
+    rv = op_arm(uring, &uring->wakeup_op);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    io_uring_submit(&uring->ring);
+
+    *puring = uring;
+    return APR_SUCCESS;
+}
+
+apr_status_t ap_uring_add(ap_uring_t *uring, const apr_pollfd_t *pfd)
+{
+    uring_op_t *op;
+    apr_status_t rv;
+    int fd;
+
+    rv = get_pollfd_fd(pfd, &fd);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    apr_thread_mutex_lock(uring->mutex);
+    if (apr_hash_get(uring->ops, &fd, sizeof(fd))) {
+        rv = APR_EEXIST;
+    }
+    else {
+        op = op_alloc(uring);
+        op->pfd = pfd;
+        op->fd = fd;
+        op->reqevents = pfd->reqevents;
+        rv = op_arm(uring, op);
+        if (rv == APR_SUCCESS) {
+            apr_hash_set(uring->ops, &op->fd, sizeof(op->fd), op);
+            /* This replaces the epoll_ctl(ADD) syscall; should the submit
+             * fail (kernel resources shortage), the SQE stays queued and
+             * is flushed by the next ap_uring_poll() anyway.
+             */
+            io_uring_submit(&uring->ring);
+        }
+        else {
+            op_recycle(uring, op);
+        }
+    }
+    apr_thread_mutex_unlock(uring->mutex);
+
+    return rv;
+}
+
+apr_status_t ap_uring_remove(ap_uring_t *uring, const apr_pollfd_t *pfd)
+{
+    uring_op_t *op;
+    apr_status_t rv;
+    int fd;
+
+    rv = get_pollfd_fd(pfd, &fd);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    apr_thread_mutex_lock(uring->mutex);
+    op = apr_hash_get(uring->ops, &fd, sizeof(fd));
+    if (!op) {
+        rv = APR_NOTFOUND;
+    }
+    else {
+        apr_hash_set(uring->ops, &fd, sizeof(fd), NULL);
+        if (op->armed) {
+            /* Still in flight: cancel it, the op is recycled when its
+             * completion (-ECANCELED or not) is reaped by the listener.
+             * Until then the kernel holds a reference on the file, hence
+             * the immediate submit. Should no SQE be available, the op
+             * can't be recycled before its completion either, so the
+             * cancelation is retried by the next ap_uring_poll().
+             */
+            op->pfd = NULL;
+            if (op_cancel(uring, op) == APR_SUCCESS) {
+                io_uring_submit(&uring->ring);
+            }
+            else {
+                APR_RING_INSERT_TAIL(&uring->removed, op, uring_op_t, link);
+            }
+        }
+        else {
+            /* Fired already (oneshot), nothing to tell the kernel; this
+             * is the common case for the listener, and the syscall saved
+             * compared to epoll_ctl(DEL).
+             */
+            APR_RING_REMOVE(op, link);
+            op_recycle(uring, op);
+        }
+    }
+    apr_thread_mutex_unlock(uring->mutex);
+
+    return rv;
+}
+
+apr_status_t ap_uring_poll(ap_uring_t *uring, apr_interval_time_t timeout,
+                           apr_int32_t *num,
+                           const apr_pollfd_t **descriptors)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head, count = 0;
+    apr_int32_t n = 0;
+    int woken = 0, ret;
+    uring_op_t *op;
+
+    *num = 0;
+
+    /* Re-arm the descriptors which fired last time and were not removed
+     * since (level-triggered semantics, like the pollset), batched with
+     * any pending cancelation in a single submit.
+     */
+    apr_thread_mutex_lock(uring->mutex);
+    while (!APR_RING_EMPTY(&uring->removed, uring_op_t, link)) {
+        op = APR_RING_FIRST(&uring->removed);
+        if (op_cancel(uring, op) != APR_SUCCESS) {
+            break;
+        }
+        APR_RING_REMOVE(op, link);
+        APR_RING_ELEM_INIT(op, link);
+    }
+    while (!APR_RING_EMPTY(&uring->fired, uring_op_t, link)) {
+        op = APR_RING_FIRST(&uring->fired);
+        APR_RING_REMOVE(op, link);
+        APR_RING_ELEM_INIT(op, link);
+        if (op_arm(uring, op) != APR_SUCCESS) {
+            APR_RING_INSERT_HEAD(&uring->fired, op, uring_op_t, link);
+            break;
+        }
+    }
+    io_uring_submit(&uring->ring);
+    apr_thread_mutex_unlock(uring->mutex);
+
+    if (timeout < 0) {
+        ret = io_uring_wait_cqe(&uring->ring, &cqe);
+    }
+    else {
+        struct __kernel_timespec ts;
+        ts.tv_sec = apr_time_sec(timeout);
+        ts.tv_nsec = apr_time_usec(timeout) * 1000;
+        ret = io_uring_wait_cqe_timeout(&uring->ring, &cqe, &ts);
+    }
+    if (ret < 0) {
+        if (ret == -ETIME) {
+            return APR_TIMEUP;
+        }
+        return APR_FROM_OS_ERROR(-ret);
+    }
+
+    apr_thread_mutex_lock(uring->mutex);
+    io_uring_for_each_cqe(&uring->ring, head, cqe) {
+        if (n == (apr_int32_t)uring->size) {
+            /* Leave the remaining ones for the next call */
+            break;
+        }
+        count++;
+
+        op = io_uring_cqe_get_data(cqe);
+        if (!op) {
+            /* Completion of a POLL_REMOVE */
+            continue;
+        }
+        op->armed = 0;
+        if (op == &uring->wakeup_op) {
+            apr_uint64_t val;
+            while (read(uring->wakeup_fd, &val, sizeof(val)) > 0)
+                ;
+            APR_RING_INSERT_TAIL(&uring->fired, op, uring_op_t, link);
+            woken = 1;
+            continue;
+        }
+        if (!op->pfd) {
+            /* Removed while armed, this is the last we hear of it */
+            if (APR_RING_NEXT(op, link) != op) {
+                /* completed before its cancelation was queued */
+                APR_RING_REMOVE(op, link);
+            }
+            op_recycle(uring, op);
+            continue;
+        }
+
+        uring->result_set[n] = *op->pfd;
+        uring->result_set[n].rtnevents = (cqe->res < 0) ? APR_POLLERR
+                                         : get_apr_event(cqe->res);
+        n++;
+        APR_RING_INSERT_TAIL(&uring->fired, op, uring_op_t, link);
+    }
+    io_uring_cq_advance(&uring->ring, count);
+    apr_thread_mutex_unlock(uring->mutex);
+
+    if (!n) {
+        return woken ? APR_EINTR : APR_TIMEUP;
+    }
+    *num = n;
+    *descriptors = uring->result_set;
+    return APR_SUCCESS;
+}
+
+apr_status_t ap_uring_wakeup(ap_uring_t *uring)
+{
+    apr_uint64_t val = 1;
+
+    if (write(uring->wakeup_fd, &val, sizeof(val)) < 0) {
+        apr_status_t rv = apr_get_os_error();
+        /* The counter being saturated means a wakeup is pending anyway */
+        if (!APR_STATUS_IS_EAGAIN(rv)) {
+            return rv;
+        }
+    }
+    return APR_SUCCESS;
+}
+
+#else /* !HAVE_LIBURING */
+
+apr_status_t ap_uring_available(void)
+{
+    return APR_ENOTIMPL;
+}
+
+apr_status_t ap_uring_create(ap_uring_t **uring, apr_uint32_t size,
+                             apr_pool_t *p)
+{
+    return APR_ENOTIMPL;
+}
+
+apr_status_t ap_uring_add(ap_uring_t *uring, const apr_pollfd_t *pfd)
+{
+    return APR_ENOTIMPL;
+}
+
+apr_status_t ap_uring_remove(ap_uring_t *uring, const apr_pollfd_t *pfd)
+{
+    return APR_ENOTIMPL;
+}
+
+apr_status_t ap_uring_poll(ap_uring_t *uring, apr_interval_time_t timeout,
+                           apr_int32_t *num,
+                           const apr_pollfd_t **descriptors)
+{
+    return APR_ENOTIMPL;
+}
+
+apr_status_t ap_uring_wakeup(ap_uring_t *uring)
+{
+    return APR_ENOTIMPL;
+}
+
+#endif /* HAVE_LIBURING */
@@ -0,0 +1,81 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  event/uring.h
+ * @brief io_uring completion engine declarations
+ *
+ * The engine mimics the subset of the apr_pollset API used by the event
+ * MPM (THREADSAFE, NOCOPY and WAKEABLE semantics), but is driven by
+ * io_uring poll requests: registrations from the workers are submitted
+ * as SQEs, the listener reaps the completions, and descriptors which
+ * fired are removed implicitly (oneshot) unless re-armed in the same
+ * batch as the next wait.
+ *
+ * @addtogroup APACHE_MPM_EVENT
+ * @{
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include "httpd.h"
+#include "apr_poll.h"
+
+typedef struct ap_uring_t ap_uring_t;
+
+/**
+ * Check whether the engine can be used on this build/system.
+ * @return APR_SUCCESS if available, APR_ENOTIMPL otherwise.
+ */
+apr_status_t ap_uring_available(void);
+
+/**
+ * Create an io_uring engine.
+ * @param uring The engine created
+ * @param size The maximum number of results returned by ap_uring_poll()
+ * @param p The pool the engine is bound to
+ */
+apr_status_t ap_uring_create(ap_uring_t **uring, apr_uint32_t size,
+                             apr_pool_t *p);
+
+/**
+ * Register a descriptor, like apr_pollset_add() with APR_POLLSET_NOCOPY.
+ * Returns APR_EEXIST if the descriptor is already registered.
+ */
+apr_status_t ap_uring_add(ap_uring_t *uring, const apr_pollfd_t *pfd);
+
+/**
+ * Unregister a descriptor, like apr_pollset_remove().
+ * Returns APR_NOTFOUND if the descriptor is not registered.
+ */
+apr_status_t ap_uring_remove(ap_uring_t *uring, const apr_pollfd_t *pfd);
+
+/**
+ * Wait for completions, like apr_pollset_poll().  Only one thread (the
+ * listener) may call this function.
+ */
+apr_status_t ap_uring_poll(ap_uring_t *uring, apr_interval_time_t timeout,
+                           apr_int32_t *num,
+                           const apr_pollfd_t **descriptors);
+
+/**
+ * Interrupt a blocking ap_uring_poll(), which then returns APR_EINTR.
+ */
+apr_status_t ap_uring_wakeup(ap_uring_t *uring);
+
+#endif /* URING_H */
+/** @} */
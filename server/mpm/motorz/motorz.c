@@ -418,6 +418,7 @@ read_request:
 
                 scon->pfd.reqevents = (
                                        scon->cs.sense == CONN_SENSE_WANT_READ ? APR_POLLIN :
+                                       scon->cs.sense == CONN_SENSE_WANT_ERRQUEUE ? 0 :
                                        APR_POLLOUT) | APR_POLLHUP | APR_POLLERR;
                 scon->cs.sense = CONN_SENSE_DEFAULT;
 
@@ -927,6 +927,111 @@ static int table_do_fn_check_lengths(void *r_, const char *key,
     return 0;
 }
 
+/* In the order of ap_known_header_e */
+#define KNOWN_HEADER(name) { name, sizeof(name) - 1 }
+static const struct {
+    const char *name;
+    apr_size_t len;
+} known_headers[AP_KNOWN_HEADERS_COUNT] = {
+    KNOWN_HEADER("Host"),
+    KNOWN_HEADER("Connection"),
+    KNOWN_HEADER("Upgrade"),
+    KNOWN_HEADER("Content-Length"),
+    KNOWN_HEADER("Content-Type"),
+    KNOWN_HEADER("Transfer-Encoding"),
+    KNOWN_HEADER("Expect"),
+    KNOWN_HEADER("Accept-Encoding"),
+    KNOWN_HEADER("Range"),
+    KNOWN_HEADER("Cookie"),
+    KNOWN_HEADER("User-Agent")
+};
+
+/* Position of the known headers in r->headers_in, valid as long as the
+ * table has the same entries; the last key tells whether the entries
+ * changed (a removal followed by an addition) for the same count.
+ */
+struct ap_known_headers_t {
+    const apr_table_t *table;
+    int nelts;
+    const char *last_key;
+    int index[AP_KNOWN_HEADERS_COUNT];     /* -1 if not present */
+    const char *key[AP_KNOWN_HEADERS_COUNT];
+};
+
+static void index_known_headers(struct ap_known_headers_t *kh,
+                                const apr_table_t *t)
+{
+    const apr_array_header_t *arr = apr_table_elts(t);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    int i, k;
+
+    kh->table = t;
+    kh->nelts = arr->nelts;
+    kh->last_key = arr->nelts ? elts[arr->nelts - 1].key : NULL;
+    for (k = 0; k < AP_KNOWN_HEADERS_COUNT; ++k) {
+        kh->index[k] = -1;
+    }
+
+    for (i = 0; i < arr->nelts; ++i) {
+        apr_size_t len = strlen(elts[i].key);
+
+        for (k = 0; k < AP_KNOWN_HEADERS_COUNT; ++k) {
+            /* first one wins, like apr_table_get() */
+            if (known_headers[k].len == len && kh->index[k] < 0
+                    && !ap_cstr_casecmp(elts[i].key, known_headers[k].name)) {
+                kh->index[k] = i;
+                kh->key[k] = elts[i].key;
+                break;
+            }
+        }
+    }
+}
+
+static struct ap_known_headers_t *get_known_headers(request_rec *r)
+{
+    core_request_config *req_cfg;
+
+    /* not for the fake requests (e.g. proxy backend responses) */
+    if (!r->request_config
+            || !(req_cfg = ap_get_core_module_config(r->request_config))) {
+        return NULL;
+    }
+    if (!req_cfg->known_headers_in) {
+        req_cfg->known_headers_in = apr_pcalloc(r->pool,
+                                        sizeof(struct ap_known_headers_t));
+    }
+    return req_cfg->known_headers_in;
+}
+
+AP_DECLARE(const char *) ap_get_known_header_in(request_rec *r,
+                                                ap_known_header_e which)
+{
+    struct ap_known_headers_t *kh;
+    const apr_array_header_t *arr;
+    const apr_table_entry_t *elts;
+    int i;
+
+    AP_DEBUG_ASSERT(which < AP_KNOWN_HEADERS_COUNT);
+
+    if (!(kh = get_known_headers(r))) {
+        return apr_table_get(r->headers_in, known_headers[which].name);
+    }
+
+    arr = apr_table_elts(r->headers_in);
+    elts = (const apr_table_entry_t *)arr->elts;
+    if (kh->table != r->headers_in || kh->nelts != arr->nelts
+            || (arr->nelts && kh->last_key != elts[arr->nelts - 1].key)) {
+        index_known_headers(kh, r->headers_in);
+    }
+    i = kh->index[which];
+    if (i >= 0 && elts[i].key != kh->key[which]) {
+        index_known_headers(kh, r->headers_in);
+        i = kh->index[which];
+    }
+
+    return (i >= 0) ? elts[i].val : NULL;
+}
+
 AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb)
 {
     char *last_field = NULL;
@@ -1185,6 +1290,14 @@ AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb
 
     /* enforce LimitRequestFieldSize for merged headers */
     apr_table_do(table_do_fn_check_lengths, r, r->headers_in, NULL);
+
+    /* index the known headers while the table is hot */
+    {
+        struct ap_known_headers_t *kh = get_known_headers(r);
+        if (kh) {
+            index_known_headers(kh, r->headers_in);
+        }
+    }
 }
 
 AP_DECLARE(void) ap_get_mime_headers(request_rec *r)
@@ -1328,7 +1441,7 @@ request_rec *ap_read_request(conn_rec *conn)
             goto traceout;
         }
 
-        tenc = apr_table_get(r->headers_in, "Transfer-Encoding");
+        tenc = ap_get_known_header_in(r, AP_KNOWN_HEADER_TRANSFER_ENCODING);
         if (tenc) {
             /* http://tools.ietf.org/html/draft-ietf-httpbis-p1-messaging-23
              * Section 3.3.3.3: "If a Transfer-Encoding header field is
@@ -1381,7 +1494,7 @@ request_rec *ap_read_request(conn_rec *conn)
 
     if ((!r->hostname && (r->proto_num >= HTTP_VERSION(1, 1)))
         || ((r->proto_num == HTTP_VERSION(1, 1))
-            && !apr_table_get(r->headers_in, "Host"))) {
+            && !ap_get_known_header_in(r, AP_KNOWN_HEADER_HOST))) {
         /*
          * Client sent us an HTTP/1.1 or later request without telling us the
          * hostname, either with a full URL or a Host: header. We therefore
@@ -1414,7 +1527,7 @@ request_rec *ap_read_request(conn_rec *conn)
         goto traceout;
     }
 
-    if (((expect = apr_table_get(r->headers_in, "Expect")) != NULL)
+    if (((expect = ap_get_known_header_in(r, AP_KNOWN_HEADER_EXPECT)) != NULL)
         && (expect[0] != '\0')) {
         /*
          * The Expect header field was added to HTTP/1.1 after RFC 2068
@@ -1499,8 +1612,9 @@ AP_DECLARE(void) ap_set_sub_req_protocol(request_rec *rnew,
     /* did the original request have a body?  (e.g. POST w/SSI tags)
      * if so, make sure the subrequest doesn't inherit body headers
      */
-    if (!r->kept_body && (apr_table_get(r->headers_in, "Content-Length")
-        || apr_table_get(r->headers_in, "Transfer-Encoding"))) {
+    if (!r->kept_body
+        && (ap_get_known_header_in(r, AP_KNOWN_HEADER_CONTENT_LENGTH)
+            || ap_get_known_header_in(r, AP_KNOWN_HEADER_TRANSFER_ENCODING))) {
         strip_headers_request_body(rnew);
     }
     rnew->subprocess_env  = apr_table_copy(rnew->pool, r->subprocess_env);
@@ -28,6 +28,11 @@
 #include "apr_strings.h"
 #include "apr_file_io.h"
 #include "apr_fnmatch.h"
+#include "apr_hash.h"
+#include "apr_atomic.h"
+#if APR_HAS_THREADS
+#include "apr_thread_rwlock.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -435,6 +440,194 @@ static walk_cache_t *prep_walk_cache(apr_size_t t, request_rec *r)
     return cache;
 }
 
+/* The walk caches above only live as long as the request, so each new
+ * request merges the same sections again.  The merge of two given
+ * per-dir configs always gives the same result though, and when both
+ * are configuration sections (or results of such merges), which live
+ * as long as the child, the result can be kept in the child for the
+ * next requests.  This is the merge cache, bounded to the first
+ * PerDirMergeCacheSize merges (no eviction, merged configs may still be
+ * in use by other requests).  The .htaccess configs live in the request
+ * pool, so merges involving them are never cached.
+ */
+#ifndef AP_DEFAULT_MERGE_CACHE_SIZE
+#define AP_DEFAULT_MERGE_CACHE_SIZE 1024
+#endif
+
+typedef struct merge_cache_key_t {
+    const ap_conf_vector_t *base;
+    const ap_conf_vector_t *add;
+} merge_cache_key_t;
+
+typedef struct merge_cache_t {
+    apr_pool_t *pool;
+    apr_hash_t *stable;         /* the configs living as long as the child */
+    apr_hash_t *merged;         /* merge_cache_key_t => ap_conf_vector_t */
+#if APR_HAS_THREADS
+    apr_thread_rwlock_t *lock;
+#endif
+    apr_uint32_t size;
+    apr_uint32_t entries;
+    volatile apr_uint32_t hits;
+    volatile apr_uint32_t misses;
+} merge_cache_t;
+
+static merge_cache_t *merge_cache = NULL;
+
+#if APR_HAS_THREADS
+#define MERGE_CACHE_RDLOCK(mc)  apr_thread_rwlock_rdlock((mc)->lock)
+#define MERGE_CACHE_WRLOCK(mc)  apr_thread_rwlock_wrlock((mc)->lock)
+#define MERGE_CACHE_UNLOCK(mc)  apr_thread_rwlock_unlock((mc)->lock)
+#else
+#define MERGE_CACHE_RDLOCK(mc)
+#define MERGE_CACHE_WRLOCK(mc)
+#define MERGE_CACHE_UNLOCK(mc)
+#endif
+
+static void merge_cache_add_stable(merge_cache_t *mc, ap_conf_vector_t *conf);
+
+static void merge_cache_add_sections(merge_cache_t *mc,
+                                     apr_array_header_t *sections)
+{
+    int i;
+
+    if (sections) {
+        ap_conf_vector_t **sec_ent = (ap_conf_vector_t **)sections->elts;
+        for (i = 0; i < sections->nelts; ++i) {
+            merge_cache_add_stable(mc, sec_ent[i]);
+        }
+    }
+}
+
+static void merge_cache_add_stable(merge_cache_t *mc, ap_conf_vector_t *conf)
+{
+    core_dir_config *dconf;
+    ap_conf_vector_t **key;
+
+    if (!conf || apr_hash_get(mc->stable, &conf, sizeof(conf))) {
+        return;
+    }
+    key = apr_palloc(mc->pool, sizeof(*key));
+    *key = conf;
+    apr_hash_set(mc->stable, key, sizeof(*key), conf);
+
+    /* the <If> sections walked by ap_if_walk() */
+    dconf = ap_get_core_module_config(conf);
+    if (dconf) {
+        merge_cache_add_sections(mc, dconf->sec_if);
+    }
+}
+
+static apr_status_t merge_cache_cleanup(void *dummy)
+{
+    merge_cache = NULL;
+    return APR_SUCCESS;
+}
+
+AP_DECLARE(void) ap_init_merge_cache(apr_pool_t *pchild, server_rec *s)
+{
+    core_server_config *sconf = ap_get_core_module_config(s->module_config);
+    merge_cache_t *mc;
+    int size;
+
+    size = sconf->merge_cache_size_set ? sconf->merge_cache_size
+                                       : AP_DEFAULT_MERGE_CACHE_SIZE;
+    if (size <= 0) {
+        return;
+    }
+
+    mc = apr_pcalloc(pchild, sizeof(*mc));
+#if APR_HAS_THREADS
+    if (apr_thread_rwlock_create(&mc->lock, pchild) != APR_SUCCESS) {
+        return;
+    }
+#endif
+    apr_pool_create(&mc->pool, pchild);
+    apr_pool_tag(mc->pool, "merge_cache");
+    mc->stable = apr_hash_make(mc->pool);
+    mc->merged = apr_hash_make(mc->pool);
+    mc->size = size;
+
+    for (; s; s = s->next) {
+        sconf = ap_get_core_module_config(s->module_config);
+        merge_cache_add_stable(mc, s->lookup_defaults);
+        merge_cache_add_sections(mc, sconf->sec_dir);
+        merge_cache_add_sections(mc, sconf->sec_url);
+        merge_cache_add_sections(mc, sconf->sec_file);
+    }
+
+    merge_cache = mc;
+    apr_pool_cleanup_register(pchild, NULL, merge_cache_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+AP_DECLARE(void) ap_get_merge_cache_stats(ap_merge_cache_stats_t *stats)
+{
+    merge_cache_t *mc = merge_cache;
+
+    memset(stats, 0, sizeof(*stats));
+    if (mc) {
+        stats->hits = apr_atomic_read32(&mc->hits);
+        stats->misses = apr_atomic_read32(&mc->misses);
+        MERGE_CACHE_RDLOCK(mc);
+        stats->entries = mc->entries;
+        MERGE_CACHE_UNLOCK(mc);
+        stats->size = mc->size;
+    }
+}
+
+/* ap_merge_per_dir_configs(), through the merge cache when possible */
+static ap_conf_vector_t *merge_per_dir_configs(request_rec *r,
+                                               ap_conf_vector_t *base,
+                                               ap_conf_vector_t *new_conf)
+{
+    merge_cache_t *mc = merge_cache;
+    merge_cache_key_t key, *cached_key;
+    ap_conf_vector_t *merged;
+    int stable;
+
+    if (!mc) {
+        return ap_merge_per_dir_configs(r->pool, base, new_conf);
+    }
+
+    key.base = base;
+    key.add = new_conf;
+
+    MERGE_CACHE_RDLOCK(mc);
+    merged = apr_hash_get(mc->merged, &key, sizeof(key));
+    stable = (merged
+              || (apr_hash_get(mc->stable, &base, sizeof(base))
+                  && apr_hash_get(mc->stable, &new_conf, sizeof(new_conf))));
+    MERGE_CACHE_UNLOCK(mc);
+
+    if (merged) {
+        apr_atomic_inc32(&mc->hits);
+        return merged;
+    }
+    if (!stable) {
+        return ap_merge_per_dir_configs(r->pool, base, new_conf);
+    }
+    apr_atomic_inc32(&mc->misses);
+
+    /* The merge is done with the lock held since the pool is shared */
+    MERGE_CACHE_WRLOCK(mc);
+    merged = apr_hash_get(mc->merged, &key, sizeof(key));
+    if (!merged && mc->entries < mc->size) {
+        merged = ap_merge_per_dir_configs(mc->pool, base, new_conf);
+        cached_key = apr_pmemdup(mc->pool, &key, sizeof(key));
+        apr_hash_set(mc->merged, cached_key, sizeof(*cached_key), merged);
+        merge_cache_add_stable(mc, merged);
+        mc->entries++;
+    }
+    MERGE_CACHE_UNLOCK(mc);
+
+    if (!merged) {
+        /* cache full */
+        merged = ap_merge_per_dir_configs(r->pool, base, new_conf);
+    }
+    return merged;
+}
+
 /*****************************************************************
  *
  * Getting and checking directory configuration.  Also checks the
@@ -986,9 +1179,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
                 }
 
                 if (now_merged) {
-                    now_merged = ap_merge_per_dir_configs(r->pool,
-                                                          now_merged,
-                                                          sec_ent[sec_idx]);
+                    now_merged = merge_per_dir_configs(r,
+                                                       now_merged,
+                                                       sec_ent[sec_idx]);
                 }
                 else {
                     now_merged = sec_ent[sec_idx];
@@ -1056,9 +1249,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
                 }
 
                 if (now_merged) {
-                    now_merged = ap_merge_per_dir_configs(r->pool,
-                                                          now_merged,
-                                                          htaccess_conf);
+                    now_merged = merge_per_dir_configs(r,
+                                                       now_merged,
+                                                       htaccess_conf);
                 }
                 else {
                     now_merged = htaccess_conf;
@@ -1294,9 +1487,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
             }
 
             if (now_merged) {
-                now_merged = ap_merge_per_dir_configs(r->pool,
-                                                      now_merged,
-                                                      sec_ent[sec_idx]);
+                now_merged = merge_per_dir_configs(r,
+                                                   now_merged,
+                                                   sec_ent[sec_idx]);
             }
             else {
                 now_merged = sec_ent[sec_idx];
@@ -1373,9 +1566,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_per_dir_configs(r,
+                                                  r->per_dir_config,
+                                                  now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -1533,9 +1726,9 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
             }
 
             if (now_merged) {
-                now_merged = ap_merge_per_dir_configs(r->pool,
-                                                      now_merged,
-                                                      sec_ent[sec_idx]);
+                now_merged = merge_per_dir_configs(r,
+                                                   now_merged,
+                                                   sec_ent[sec_idx]);
             }
             else {
                 now_merged = sec_ent[sec_idx];
@@ -1576,9 +1769,9 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_per_dir_configs(r,
+                                                  r->per_dir_config,
+                                                  now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -1729,9 +1922,9 @@ AP_DECLARE(int) ap_file_walk(request_rec *r)
             }
 
             if (now_merged) {
-                now_merged = ap_merge_per_dir_configs(r->pool,
-                                                      now_merged,
-                                                      sec_ent[sec_idx]);
+                now_merged = merge_per_dir_configs(r,
+                                                   now_merged,
+                                                   sec_ent[sec_idx]);
             }
             else {
                 now_merged = sec_ent[sec_idx];
@@ -1772,9 +1965,9 @@ AP_DECLARE(int) ap_file_walk(request_rec *r)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_per_dir_configs(r,
+                                                  r->per_dir_config,
+                                                  now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -1866,9 +2059,9 @@ AP_DECLARE(int) ap_if_walk(request_rec *r)
         }
 
         if (now_merged) {
-            now_merged = ap_merge_per_dir_configs(r->pool,
-                                                  now_merged,
-                                                  sec_ent[sec_idx]);
+            now_merged = merge_per_dir_configs(r,
+                                               now_merged,
+                                               sec_ent[sec_idx]);
         }
         else {
             now_merged = sec_ent[sec_idx];
@@ -1904,9 +2097,9 @@ AP_DECLARE(int) ap_if_walk(request_rec *r)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_per_dir_configs(r,
+                                                  r->per_dir_config,
+                                                  now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -73,6 +73,13 @@
  * To make that more efficient we encode a lookup table.  The test_char_table
  * is generated automatically by gen_test_char.c.
  */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || __GNUC__ > 4 \
+        || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define AP_SCAN_SIMD 1
+#define TEST_CHAR_WANT_NIBBLES
+#include <immintrin.h>
+#endif
 #include "test_char.h"
 
 /* we assume the folks using this ensure 0 <= c < 256... which means
@@ -1594,12 +1601,116 @@ AP_DECLARE(const char *) ap_parse_token_list_strict(apr_pool_t *p,
     return NULL;
 }
 
+/* The HTTP scanners below are run on every request line and header, so
+ * on x86 they classify 16 (SSSE3) or 32 (AVX2) characters at once using
+ * the nibble tables generated from test_char_table, the implementation
+ * being picked at runtime.  The loads are aligned, so never cross a page
+ * boundary past the terminating NUL (which all the scans stop at).
+ */
+#ifdef AP_SCAN_SIMD
+
+#define SCAN_SIMD_NONE  0
+#define SCAN_SIMD_SSSE3 1
+#define SCAN_SIMD_AVX2  2
+
+static int scan_simd_level = -1;
+
+static int get_scan_simd_level(void)
+{
+    /* racy but idempotent */
+    if (scan_simd_level < 0) {
+        __builtin_cpu_init();
+        scan_simd_level = __builtin_cpu_supports("avx2") ? SCAN_SIMD_AVX2
+                        : __builtin_cpu_supports("ssse3") ? SCAN_SIMD_SSSE3
+                        : SCAN_SIMD_NONE;
+    }
+    return scan_simd_level;
+}
+
+/* Return the first character of ptr which is (stop_in != 0) or is not
+ * (stop_in == 0) in the class described by nibbles.
+ */
+__attribute__((target("ssse3")))
+static const char *scan_ssse3(const char *ptr,
+                              const unsigned char nibbles[2][16],
+                              int stop_in)
+{
+    const __m128i lo_tbl = _mm_loadu_si128((const __m128i *)nibbles[0]);
+    const __m128i hi_tbl = _mm_loadu_si128((const __m128i *)nibbles[1]);
+    const __m128i low4 = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    const char *p = (const char *)((apr_uintptr_t)ptr & ~(apr_uintptr_t)15);
+    unsigned int skip = (unsigned int)(ptr - p);
+
+    for (;;) {
+        __m128i v = _mm_load_si128((const __m128i *)p);
+        __m128i lo = _mm_and_si128(v, low4);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low4);
+        __m128i in = _mm_and_si128(_mm_shuffle_epi8(lo_tbl, lo),
+                                   _mm_shuffle_epi8(hi_tbl, hi));
+        unsigned int out = _mm_movemask_epi8(_mm_cmpeq_epi8(in, zero));
+        unsigned int stop = (stop_in ? ~out & 0xffffu : out) & (~0u << skip);
+
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 16;
+        skip = 0;
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *ptr,
+                             const unsigned char nibbles[2][16],
+                             int stop_in)
+{
+    const __m256i lo_tbl = _mm256_broadcastsi128_si256(
+                            _mm_loadu_si128((const __m128i *)nibbles[0]));
+    const __m256i hi_tbl = _mm256_broadcastsi128_si256(
+                            _mm_loadu_si128((const __m128i *)nibbles[1]));
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    const char *p = (const char *)((apr_uintptr_t)ptr & ~(apr_uintptr_t)31);
+    unsigned int skip = (unsigned int)(ptr - p);
+
+    for (;;) {
+        __m256i v = _mm256_load_si256((const __m256i *)p);
+        __m256i lo = _mm256_and_si256(v, low4);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low4);
+        __m256i in = _mm256_and_si256(_mm256_shuffle_epi8(lo_tbl, lo),
+                                      _mm256_shuffle_epi8(hi_tbl, hi));
+        unsigned int out = (unsigned int)_mm256_movemask_epi8(
+                                            _mm256_cmpeq_epi8(in, zero));
+        unsigned int stop = (stop_in ? ~out : out) & (~0u << skip);
+
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 32;
+        skip = 0;
+    }
+}
+
+#define SCAN_SIMD(ptr, nibbles, stop_in) do { \
+    switch (get_scan_simd_level()) { \
+    case SCAN_SIMD_AVX2: \
+        return scan_avx2(ptr, nibbles, stop_in); \
+    case SCAN_SIMD_SSSE3: \
+        return scan_ssse3(ptr, nibbles, stop_in); \
+    } \
+} while (0)
+#else
+#define SCAN_SIMD(ptr, nibbles, stop_in)
+#endif /* AP_SCAN_SIMD */
+
 /* Scan a string for HTTP VCHAR/obs-text characters including HT and SP
  * (as used in header values, for example, in RFC 7230 section 3.2)
  * returning the pointer to the first non-HT ASCII ctrl character.
  */
 AP_DECLARE(const char *) ap_scan_http_field_content(const char *ptr)
 {
+    SCAN_SIMD(ptr, test_char_nibbles_http_ctrls, 1);
+
     for ( ; !TEST_CHAR(*ptr, T_HTTP_CTRLS); ++ptr) ;
 
     return ptr;
@@ -1610,6 +1721,8 @@ AP_DECLARE(const char *) ap_scan_http_field_content(const char *ptr)
  */
 AP_DECLARE(const char *) ap_scan_http_token(const char *ptr)
 {
+    SCAN_SIMD(ptr, test_char_nibbles_http_token_stop, 1);
+
     for ( ; !TEST_CHAR(*ptr, T_HTTP_TOKEN_STOP); ++ptr) ;
 
     return ptr;
@@ -1620,6 +1733,8 @@ AP_DECLARE(const char *) ap_scan_http_token(const char *ptr)
  */
 AP_DECLARE(const char *) ap_scan_vchar_obstext(const char *ptr)
 {
+    SCAN_SIMD(ptr, test_char_nibbles_vchar_obstext, 0);
+
     for ( ; TEST_CHAR(*ptr, T_VCHAR_OBSTEXT); ++ptr) ;
 
     return ptr;
@@ -2570,8 +2685,10 @@ AP_DECLARE(int) ap_request_has_body(request_rec *r)
 
     has_body = (!r->header_only
                 && (r->kept_body
-                    || apr_table_get(r->headers_in, "Transfer-Encoding")
-                    || ( (cls = apr_table_get(r->headers_in, "Content-Length"))
+                    || ap_get_known_header_in(r,
+                                        AP_KNOWN_HEADER_TRANSFER_ENCODING)
+                    || ( (cls = ap_get_known_header_in(r,
+                                        AP_KNOWN_HEADER_CONTENT_LENGTH))
                         && (apr_strtoff(&cl, cls, &estr, 10) == APR_SUCCESS)
                         && (!*estr)
                         && (cl > 0) )
@@ -2677,7 +2794,7 @@ AP_DECLARE(int) ap_parse_form_data(request_rec *r, ap_filter_t *f,
     *ptr = pairs;
 
     /* sanity check - we only support forms for now */
-    ct = apr_table_get(r->headers_in, "Content-Type");
+    ct = ap_get_known_header_in(r, AP_KNOWN_HEADER_CONTENT_TYPE);
     if (!ct || ap_cstr_casecmpn("application/x-www-form-urlencoded", ct, 33)) {
         return ap_discard_request_body(r);
     }
@@ -51,6 +51,43 @@ struct exploded_time_cache_element {
 static struct exploded_time_cache_element exploded_cache_localtime[TIME_CACHE_SIZE];
 static struct exploded_time_cache_element exploded_cache_gmt[TIME_CACHE_SIZE];
 
+/* Formats of the timestamps cached per second (in a thread local cache
+ * if available), see recent_time_str()
+ */
+#define TIME_STR_RFC822   0     /* "Sat, 08 Jan 2000 18:31:41 GMT" */
+#define TIME_STR_CTIME    1     /* "Sat Jan 08 19:31:41 2000" */
+#define TIME_STR_COMPACT  2     /* "2000-01-08 19:31:41" */
+#define TIME_STR_CLF      3     /* "[08/Jan/2000:19:31:41 +0100]" */
+#define TIME_STR_COUNT    4
+#define TIME_STR_SIZE     32
+
+/* Where the sub second goes in the ctime and compact formats */
+#define TIME_STR_USEC_OFFSET 19
+
+#ifdef AP_THREAD_LOCAL
+/* Each thread keeps the last second it exploded or formatted, which
+ * avoids both the formatting and the snapshot of the shared ring above
+ * (whose cache lines bounce between CPUs every second) for the common
+ * case of a thread handling many requests within the same second.
+ */
+struct thread_exploded_time {
+    apr_int64_t t;
+    int valid;
+    apr_time_exp_t xt;
+};
+
+struct thread_formatted_time {
+    apr_int64_t t;
+    int valid;
+    char str[TIME_STR_SIZE];
+};
+
+static AP_THREAD_LOCAL struct {
+    struct thread_exploded_time exploded[2];    /* localtime, gmt */
+    struct thread_formatted_time formatted[TIME_STR_COUNT];
+} thread_time_cache;
+#endif
+
 
 static apr_status_t cached_explode(apr_time_exp_t *xt, apr_time_t t,
                                    struct exploded_time_cache_element *cache,
@@ -60,6 +97,16 @@ static apr_status_t cached_explode(apr_time_exp_t *xt, apr_time_t t,
     struct exploded_time_cache_element *cache_element =
         &(cache[seconds & TIME_CACHE_MASK]);
     struct exploded_time_cache_element cache_element_snapshot;
+#ifdef AP_THREAD_LOCAL
+    struct thread_exploded_time *mine =
+        &thread_time_cache.exploded[use_gmt ? 1 : 0];
+
+    if (mine->valid && mine->t == seconds) {
+        memcpy(xt, &mine->xt, sizeof(apr_time_exp_t));
+        xt->tm_usec = (int)apr_time_usec(t);
+        return APR_SUCCESS;
+    }
+#endif
 
     /* The cache is implemented as a ring buffer.  Each second,
      * it uses a different element in the buffer.  The timestamp
@@ -138,6 +185,11 @@ static apr_status_t cached_explode(apr_time_exp_t *xt, apr_time_t t,
         memcpy(&(cache_element->xt), xt, sizeof(apr_time_exp_t));
         cache_element->t_validate = seconds;
     }
+#ifdef AP_THREAD_LOCAL
+    memcpy(&mine->xt, xt, sizeof(apr_time_exp_t));
+    mine->t = seconds;
+    mine->valid = 1;
+#endif
     xt->tm_usec = (int)apr_time_usec(t);
     return APR_SUCCESS;
 }
@@ -155,6 +207,157 @@ AP_DECLARE(apr_status_t) ap_explode_recent_gmt(apr_time_exp_t * tm,
     return cached_explode(tm, t, exploded_cache_gmt, 1);
 }
 
+static char *format_year(char *date_str, int real_year)
+{
+    /* This routine isn't y10k ready. */
+    *date_str++ = real_year / 1000 + '0';
+    *date_str++ = real_year % 1000 / 100 + '0';
+    *date_str++ = real_year % 100 / 10 + '0';
+    *date_str++ = real_year % 10 + '0';
+    return date_str;
+}
+
+static char *format_2digits(char *date_str, int n)
+{
+    *date_str++ = n / 10 + '0';
+    *date_str++ = n % 10 + '0';
+    return date_str;
+}
+
+static char *format_hms(char *date_str, const apr_time_exp_t *xt)
+{
+    date_str = format_2digits(date_str, xt->tm_hour);
+    *date_str++ = ':';
+    date_str = format_2digits(date_str, xt->tm_min);
+    *date_str++ = ':';
+    return format_2digits(date_str, xt->tm_sec);
+}
+
+static char *format_sname(char *date_str, const char *s)
+{
+    *date_str++ = *s++;
+    *date_str++ = *s++;
+    *date_str++ = *s++;
+    return date_str;
+}
+
+/* ### This code is a clone of apr_rfc822_date() and apr_ctime() (the
+ * latter with the additional compact and CLF formats), working on an
+ * exploded time.
+ */
+static void format_time_str(char *date_str, const apr_time_exp_t *xt,
+                            int which)
+{
+    int real_year = 1900 + xt->tm_year;
+
+    switch (which) {
+    case TIME_STR_RFC822:
+        /* example: "Sat, 08 Jan 2000 18:31:41 GMT" */
+        /*           12345678901234567890123456789  */
+        date_str = format_sname(date_str, apr_day_snames[xt->tm_wday]);
+        *date_str++ = ',';
+        *date_str++ = ' ';
+        date_str = format_2digits(date_str, xt->tm_mday);
+        *date_str++ = ' ';
+        date_str = format_sname(date_str, apr_month_snames[xt->tm_mon]);
+        *date_str++ = ' ';
+        date_str = format_year(date_str, real_year);
+        *date_str++ = ' ';
+        date_str = format_hms(date_str, xt);
+        *date_str++ = ' ';
+        *date_str++ = 'G';
+        *date_str++ = 'M';
+        *date_str++ = 'T';
+        break;
+
+    case TIME_STR_CTIME:
+        /* example: "Wed Jun 30 21:49:08 1993" */
+        /*           123456789012345678901234  */
+        date_str = format_sname(date_str, apr_day_snames[xt->tm_wday]);
+        *date_str++ = ' ';
+        date_str = format_sname(date_str, apr_month_snames[xt->tm_mon]);
+        *date_str++ = ' ';
+        date_str = format_2digits(date_str, xt->tm_mday);
+        *date_str++ = ' ';
+        date_str = format_hms(date_str, xt);
+        *date_str++ = ' ';
+        date_str = format_year(date_str, real_year);
+        break;
+
+    case TIME_STR_COMPACT:
+        /* example: "1993-06-30 21:49:08" */
+        /*           1234567890123456789  */
+        date_str = format_year(date_str, real_year);
+        *date_str++ = '-';
+        date_str = format_2digits(date_str, xt->tm_mon + 1);
+        *date_str++ = '-';
+        date_str = format_2digits(date_str, xt->tm_mday);
+        *date_str++ = ' ';
+        date_str = format_hms(date_str, xt);
+        break;
+
+    case TIME_STR_CLF: {
+        /* example: "[08/Jan/2000:19:31:41 +0100]" */
+        /*           1234567890123456789012345678  */
+        int timz = xt->tm_gmtoff;
+
+        *date_str++ = '[';
+        date_str = format_2digits(date_str, xt->tm_mday);
+        *date_str++ = '/';
+        date_str = format_sname(date_str, apr_month_snames[xt->tm_mon]);
+        *date_str++ = '/';
+        date_str = format_year(date_str, real_year);
+        *date_str++ = ':';
+        date_str = format_hms(date_str, xt);
+        *date_str++ = ' ';
+        if (timz < 0) {
+            timz = -timz;
+            *date_str++ = '-';
+        }
+        else {
+            *date_str++ = '+';
+        }
+        date_str = format_2digits(date_str, timz / (60*60));
+        date_str = format_2digits(date_str, (timz % (60*60)) / 60);
+        *date_str++ = ']';
+        break;
+    }
+    }
+    *date_str++ = 0;
+}
+
+/* Format the given time, in GMT for TIME_STR_RFC822 and in local time
+ * otherwise.  Returns the cached string of this thread for the second,
+ * or buf (of TIME_STR_SIZE) if there is no thread local cache.
+ */
+static const char *recent_time_str(char *buf, apr_time_t t, int which)
+{
+    apr_time_exp_t xt;
+#ifdef AP_THREAD_LOCAL
+    apr_int64_t seconds = apr_time_sec(t);
+    struct thread_formatted_time *mine = &thread_time_cache.formatted[which];
+
+    if (mine->valid && mine->t == seconds) {
+        return mine->str;
+    }
+    buf = mine->str;
+#endif
+
+    if (which == TIME_STR_RFC822) {
+        ap_explode_recent_gmt(&xt, t);
+    }
+    else {
+        ap_explode_recent_localtime(&xt, t);
+    }
+    format_time_str(buf, &xt, which);
+
+#ifdef AP_THREAD_LOCAL
+    mine->t = seconds;
+    mine->valid = 1;
+#endif
+    return buf;
+}
+
 AP_DECLARE(apr_status_t) ap_recent_ctime(char *date_str, apr_time_t t)
 {
     int len = APR_CTIME_LEN;
@@ -164,12 +367,8 @@ AP_DECLARE(apr_status_t) ap_recent_ctime(char *date_str, apr_time_t t)
 AP_DECLARE(apr_status_t) ap_recent_ctime_ex(char *date_str, apr_time_t t,
                                             int option, int *len)
 {
-    /* ### This code is a clone of apr_ctime(), except that it
-     * uses ap_explode_recent_localtime() instead of apr_time_exp_lt().
-     */
-    apr_time_exp_t xt;
+    char buf[TIME_STR_SIZE];
     const char *s;
-    int real_year;
     int needed;
 
 
@@ -199,111 +398,41 @@ AP_DECLARE(apr_status_t) ap_recent_ctime_ex(char *date_str, apr_time_t t,
     /* example for compact format: "1993-06-30 21:49:08" */
     /*                              1234567890123456789  */
 
-    ap_explode_recent_localtime(&xt, t);
-    real_year = 1900 + xt.tm_year;
-    if (option & AP_CTIME_OPTION_COMPACT) {
-        int real_month = xt.tm_mon + 1;
-        *date_str++ = real_year / 1000 + '0';
-        *date_str++ = real_year % 1000 / 100 + '0';
-        *date_str++ = real_year % 100 / 10 + '0';
-        *date_str++ = real_year % 10 + '0';
-        *date_str++ = '-';
-        *date_str++ = real_month / 10 + '0';
-        *date_str++ = real_month % 10 + '0';
-        *date_str++ = '-';
-    }
-    else {
-        s = &apr_day_snames[xt.tm_wday][0];
-        *date_str++ = *s++;
-        *date_str++ = *s++;
-        *date_str++ = *s++;
-        *date_str++ = ' ';
-        s = &apr_month_snames[xt.tm_mon][0];
-        *date_str++ = *s++;
-        *date_str++ = *s++;
-        *date_str++ = *s++;
-        *date_str++ = ' ';
-    }
-    *date_str++ = xt.tm_mday / 10 + '0';
-    *date_str++ = xt.tm_mday % 10 + '0';
-    *date_str++ = ' ';
-    *date_str++ = xt.tm_hour / 10 + '0';
-    *date_str++ = xt.tm_hour % 10 + '0';
-    *date_str++ = ':';
-    *date_str++ = xt.tm_min / 10 + '0';
-    *date_str++ = xt.tm_min % 10 + '0';
-    *date_str++ = ':';
-    *date_str++ = xt.tm_sec / 10 + '0';
-    *date_str++ = xt.tm_sec % 10 + '0';
+    s = recent_time_str(buf, t, (option & AP_CTIME_OPTION_COMPACT)
+                                ? TIME_STR_COMPACT : TIME_STR_CTIME);
+    memcpy(date_str, s, TIME_STR_USEC_OFFSET);
+    date_str += TIME_STR_USEC_OFFSET;
     if (option & AP_CTIME_OPTION_USEC) {
         int div;
-        int usec = (int)xt.tm_usec;
+        int usec = (int)apr_time_usec(t);
         *date_str++ = '.';
         for (div=100000; div>0; div=div/10) {
             *date_str++ = usec / div + '0';
             usec = usec % div;
         }
     }
-    if (!(option & AP_CTIME_OPTION_COMPACT)) {
-        *date_str++ = ' ';
-        *date_str++ = real_year / 1000 + '0';
-        *date_str++ = real_year % 1000 / 100 + '0';
-        *date_str++ = real_year % 100 / 10 + '0';
-        *date_str++ = real_year % 10 + '0';
-    }
-    *date_str++ = 0;
+    /* the year in the ctime() format, or just the trailing \0 */
+    strcpy(date_str, s + TIME_STR_USEC_OFFSET);
 
     return APR_SUCCESS;
 }
 
 AP_DECLARE(apr_status_t) ap_recent_rfc822_date(char *date_str, apr_time_t t)
 {
-    /* ### This code is a clone of apr_rfc822_date(), except that it
-     * uses ap_explode_recent_gmt() instead of apr_time_exp_gmt().
-     */
-    apr_time_exp_t xt;
-    const char *s;
-    int real_year;
+    const char *s = recent_time_str(date_str, t, TIME_STR_RFC822);
 
-    ap_explode_recent_gmt(&xt, t);
+    if (s != date_str) {
+        memcpy(date_str, s, APR_RFC822_DATE_LEN);
+    }
+    return APR_SUCCESS;
+}
 
-    /* example: "Sat, 08 Jan 2000 18:31:41 GMT" */
-    /*           12345678901234567890123456789  */
+AP_DECLARE(apr_status_t) ap_recent_clf_date(char *date_str, apr_time_t t)
+{
+    char buf[TIME_STR_SIZE];
+    const char *s = recent_time_str(buf, t, TIME_STR_CLF);
 
-    s = &apr_day_snames[xt.tm_wday][0];
-    *date_str++ = *s++;
-    *date_str++ = *s++;
-    *date_str++ = *s++;
-    *date_str++ = ',';
-    *date_str++ = ' ';
-    *date_str++ = xt.tm_mday / 10 + '0';
-    *date_str++ = xt.tm_mday % 10 + '0';
-    *date_str++ = ' ';
-    s = &apr_month_snames[xt.tm_mon][0];
-    *date_str++ = *s++;
-    *date_str++ = *s++;
-    *date_str++ = *s++;
-    *date_str++ = ' ';
-    real_year = 1900 + xt.tm_year;
-    /* This routine isn't y10k ready. */
-    *date_str++ = real_year / 1000 + '0';
-    *date_str++ = real_year % 1000 / 100 + '0';
-    *date_str++ = real_year % 100 / 10 + '0';
-    *date_str++ = real_year % 10 + '0';
-    *date_str++ = ' ';
-    *date_str++ = xt.tm_hour / 10 + '0';
-    *date_str++ = xt.tm_hour % 10 + '0';
-    *date_str++ = ':';
-    *date_str++ = xt.tm_min / 10 + '0';
-    *date_str++ = xt.tm_min % 10 + '0';
-    *date_str++ = ':';
-    *date_str++ = xt.tm_sec / 10 + '0';
-    *date_str++ = xt.tm_sec % 10 + '0';
-    *date_str++ = ' ';
-    *date_str++ = 'G';
-    *date_str++ = 'M';
-    *date_str++ = 'T';
-    *date_str++ = 0;
+    memcpy(date_str, s, AP_CLF_DATE_LEN);
     return APR_SUCCESS;
 }
 
@@ -23,6 +23,7 @@
 #include "apr.h"
 #include "apr_strings.h"
 #include "apr_lib.h"
+#include "apr_hash.h"
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -52,11 +53,44 @@
  * lists of name-vhosts.
  */
 typedef struct name_chain name_chain;
+typedef struct name_index name_index;
 struct name_chain {
     name_chain *next;
     server_addr_rec *sar;       /* the record causing it to be in
                                  * this chain (needed for port comparisons) */
     server_rec *server;         /* the server to use on a match */
+    name_index *index;          /* non-NULL on the head of long chains, to
+                                 * look up the names without walking them */
+};
+
+/* An entry of the name index: the name_chain element (and its position
+ * in the chain) whose server has the name, or whose sar has the virthost.
+ * Entries of the same name are kept in the order of the chain, so that
+ * the first one matching the port is the one the walk would find.
+ */
+typedef struct {
+    int pos;
+    name_chain *src;
+    const char *pattern;        /* for the unindexed wildcard aliases */
+} name_entry;
+
+/* Wildcard aliases of the form "*.domain", by reversed labels of domain */
+typedef struct name_trie name_trie;
+struct name_trie {
+    apr_hash_t *children;       /* label => name_trie */
+    apr_array_header_t *wilds;  /* name_entry of "*.<labels up to here>" */
+};
+
+struct name_index {
+    apr_hash_t *names;          /* lowercase ServerName and ServerAlias
+                                 * => array of name_entry */
+    apr_hash_t *virthosts;      /* lowercase VirtualHost name
+                                 * => array of name_entry */
+    name_trie *wilds;           /* "*.domain" ServerAlias */
+    apr_array_header_t *patterns;   /* any other wildcard ServerAlias */
+    int nentries;               /* length of the chain */
+    int nwilds;                 /* number of name_entry in the trie */
+    int nnodes;                 /* number of nodes in the trie */
 };
 
 /* meta-list of ip addresses.  Each server_rec can be in possibly multiple
@@ -94,6 +128,11 @@ static ipaddr_chain *iphash_table[IPHASH_TABLE_SIZE];
 /* dump out statistics about the hash function */
 /* #define IPHASH_STATISTICS */
 
+/* Chains of name-vhosts at least this long are indexed */
+#ifndef NAME_INDEX_MIN_CHAIN
+#define NAME_INDEX_MIN_CHAIN 16
+#endif
+
 /* list of the _default_ servers */
 static ipaddr_chain *default_list;
 
@@ -117,7 +156,9 @@ static int vhost_check_config(apr_pool_t *p, apr_pool_t *plog,
  * ipaddr_chain record.  We tuck away the ipaddr_chain record in the
  * conn_rec field vhost_lookup_data.  Later on after the headers we get a
  * second chance, and we use the name_chain to figure out what name-vhost
- * matches the headers.
+ * matches the headers.  For long name_chains, the names are looked up in
+ * the name_index of the head of the chain instead, which gives the same
+ * server as walking the chain would.
  *
  * If there was no ip address match in the iphash_table then do a lookup
  * in the default_list.
@@ -316,7 +357,26 @@ static void dump_iphash_statistics(server_rec *main_s)
                       total, count[IPHASH_TABLE_SIZE - 1]);
     /* Intentional no APLOGNO */
     /* buf provides APLOGNO */
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, main_s, buf);
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, main_s, "%s", buf);
+
+    /* occupancy of the name indexes */
+    for (i = 0; i <= IPHASH_TABLE_SIZE; ++i) {
+        for (src = (i < IPHASH_TABLE_SIZE) ? iphash_table[i] : default_list;
+             src; src = src->next) {
+            name_index *ni = src->names ? src->names->index : NULL;
+            if (ni) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, main_s,
+                             APLOGNO(03498) "name index for %pI: "
+                             "%d entries, %u names, %u virthosts, "
+                             "%d wildcards in %d trie nodes, "
+                             "%d unindexed wildcards",
+                             src->sar->host_addr, ni->nentries,
+                             apr_hash_count(ni->names),
+                             apr_hash_count(ni->virthosts),
+                             ni->nwilds, ni->nnodes, ni->patterns->nelts);
+            }
+        }
+    }
 }
 #endif
 
@@ -373,6 +433,7 @@ static name_chain *new_name_chain(apr_pool_t *p,
     new->server = s;
     new->sar = sar;
     new->next = NULL;
+    new->index = NULL;
     return new;
 }
 
@@ -551,6 +612,150 @@ static void add_name_vhost_config(apr_pool_t *p, server_rec *main_s,
    }
 }
 
+static void add_name_entry(apr_array_header_t *arr, int pos,
+                           name_chain *src, const char *pattern)
+{
+    name_entry *e;
+
+    /* the same name for the same server (e.g. ServerName and ServerAlias) */
+    if (arr->nelts && APR_ARRAY_IDX(arr, arr->nelts - 1, name_entry).pos == pos
+            && !pattern) {
+        return;
+    }
+    e = apr_array_push(arr);
+    e->pos = pos;
+    e->src = src;
+    e->pattern = pattern;
+}
+
+static void add_name_hash(apr_pool_t *p, apr_hash_t *h, const char *name,
+                          int pos, name_chain *src)
+{
+    apr_array_header_t *arr;
+    char *key;
+
+    key = apr_pstrdup(p, name);
+    ap_str_tolower(key);
+    arr = apr_hash_get(h, key, APR_HASH_KEY_STRING);
+    if (!arr) {
+        arr = apr_array_make(p, 1, sizeof(name_entry));
+        apr_hash_set(h, key, APR_HASH_KEY_STRING, arr);
+    }
+    add_name_entry(arr, pos, src, NULL);
+}
+
+static name_trie *new_name_trie(apr_pool_t *p)
+{
+    name_trie *node = apr_palloc(p, sizeof(*node));
+    node->children = apr_hash_make(p);
+    node->wilds = NULL;
+    return node;
+}
+
+static void add_name_wild(apr_pool_t *p, name_index *ni, const char *pattern,
+                          int pos, name_chain *src)
+{
+    const char *domain, *label, *end;
+    name_trie *node;
+
+    /* only "*.domain" is indexed, others are matched one by one */
+    if (pattern[0] != '*' || pattern[1] != '.' || !pattern[2]
+            || strpbrk(pattern + 2, "*?")) {
+        add_name_entry(ni->patterns, pos, src, pattern);
+        return;
+    }
+
+    node = ni->wilds;
+    domain = pattern + 2;
+    end = domain + strlen(domain);
+    for (;;) {
+        name_trie *child;
+        char *key;
+
+        for (label = end; label > domain && label[-1] != '.'; --label)
+            ;
+        key = apr_pstrmemdup(p, label, end - label);
+        ap_str_tolower(key);
+        child = apr_hash_get(node->children, key, end - label);
+        if (!child) {
+            child = new_name_trie(p);
+            apr_hash_set(node->children, key, end - label, child);
+            ni->nnodes++;
+        }
+        node = child;
+        if (label == domain) {
+            break;
+        }
+        end = label - 1;
+    }
+
+    if (!node->wilds) {
+        node->wilds = apr_array_make(p, 1, sizeof(name_entry));
+    }
+    add_name_entry(node->wilds, pos, src, NULL);
+    ni->nwilds++;
+}
+
+/* Index the names of a name_chain, the walk is in check_hostalias() */
+static name_index *build_name_index(apr_pool_t *p, name_chain *names)
+{
+    name_index *ni;
+    name_chain *src;
+    int pos, i;
+
+    ni = apr_pcalloc(p, sizeof(*ni));
+    ni->names = apr_hash_make(p);
+    ni->virthosts = apr_hash_make(p);
+    ni->wilds = new_name_trie(p);
+    ni->patterns = apr_array_make(p, 0, sizeof(name_entry));
+
+    /* Each element is indexed, the ones of the same server which are
+     * adjacent in the chain may not all match the port of the connection.
+     */
+    for (src = names, pos = 0; src; src = src->next, ++pos) {
+        server_rec *s = src->server;
+        char **name;
+
+        add_name_hash(p, ni->names, s->server_hostname, pos, src);
+        if (s->names) {
+            name = (char **)s->names->elts;
+            for (i = 0; i < s->names->nelts; ++i) {
+                if (name[i]) {
+                    add_name_hash(p, ni->names, name[i], pos, src);
+                }
+            }
+        }
+        if (s->wild_names) {
+            name = (char **)s->wild_names->elts;
+            for (i = 0; i < s->wild_names->nelts; ++i) {
+                if (name[i]) {
+                    add_name_wild(p, ni, name[i], pos, src);
+                }
+            }
+        }
+        add_name_hash(p, ni->virthosts, src->sar->virthost, pos, src);
+    }
+    ni->nentries = pos;
+
+    return ni;
+}
+
+static void index_name_chains(apr_pool_t *p, ipaddr_chain *ic)
+{
+    for (; ic; ic = ic->next) {
+        name_chain *src;
+        int n = 0;
+
+        for (src = ic->names; src && n < NAME_INDEX_MIN_CHAIN;
+             src = src->next) {
+            ++n;
+        }
+        if (n >= NAME_INDEX_MIN_CHAIN) {
+            ic->names->index = build_name_index(p, ic->names);
+        }
+    }
+}
+
 /* compile the tables and such we need to do the run-time vhost lookups */
 AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
 {
@@ -667,6 +872,12 @@ AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
         }
     }
 
+    /* the name-vhosts are all known now */
+    for (i = 0; i < IPHASH_TABLE_SIZE; ++i) {
+        index_name_chains(p, iphash_table[i]);
+    }
+    index_name_chains(p, default_list);
+
 #ifdef IPHASH_STATISTICS
     dump_iphash_statistics(main_s);
 #endif
@@ -976,6 +1187,80 @@ AP_DECLARE(int) ap_matches_request_vhost(request_rec *r, const char *host,
 }
 
 
+/* The first entry matching the port, if it precedes *best */
+static void first_name_entry(const apr_array_header_t *arr, apr_port_t port,
+                             const name_entry **best)
+{
+    int i;
+
+    for (i = 0; i < arr->nelts; ++i) {
+        const name_entry *e = &APR_ARRAY_IDX(arr, i, name_entry);
+        if (*best && e->pos >= (*best)->pos) {
+            break;
+        }
+        if (e->src->sar->host_port == 0 || port == e->src->sar->host_port) {
+            *best = e;
+            break;
+        }
+    }
+}
+
+/* Same as the walk of check_hostalias() below, host is lowercase */
+static server_rec *lookup_name_index(const name_index *ni, const char *host,
+                                     apr_port_t port)
+{
+    const name_entry *best = NULL;
+    const apr_array_header_t *arr;
+    const name_trie *node;
+    const char *label, *end;
+    int i;
+
+    /* ServerName and ServerAlias */
+    arr = apr_hash_get(ni->names, host, APR_HASH_KEY_STRING);
+    if (arr) {
+        first_name_entry(arr, port, &best);
+    }
+
+    /* "*.domain" ServerAlias, for each domain host is a subdomain of */
+    node = ni->wilds;
+    end = host + strlen(host);
+    for (;;) {
+        for (label = end; label > host && label[-1] != '.'; --label)
+            ;
+        node = apr_hash_get(node->children, label, end - label);
+        if (!node || label == host) {
+            break;
+        }
+        if (node->wilds) {
+            first_name_entry(node->wilds, port, &best);
+        }
+        end = label - 1;
+    }
+
+    /* any other wildcard ServerAlias */
+    for (i = 0; i < ni->patterns->nelts; ++i) {
+        const name_entry *e = &APR_ARRAY_IDX(ni->patterns, i, name_entry);
+        if (best && e->pos >= best->pos) {
+            break;
+        }
+        if ((e->src->sar->host_port == 0 || port == e->src->sar->host_port)
+                && !ap_strcasecmp_match(host, e->pattern)) {
+            best = e;
+            break;
+        }
+    }
+
+    /* Fallback: does it match the virthost from the sar? */
+    if (!best) {
+        arr = apr_hash_get(ni->virthosts, host, APR_HASH_KEY_STRING);
+        if (arr) {
+            first_name_entry(arr, port, &best);
+        }
+    }
+
+    return best ? best->src->server : NULL;
+}
+
 static void check_hostalias(request_rec *r)
 {
     /*
@@ -1003,6 +1288,15 @@ static void check_hostalias(request_rec *r)
 
     port = r->connection->local_addr->port;
 
+    src = r->connection->vhost_lookup_data;
+    if (src->index) {
+        s = lookup_name_index(src->index, host, port);
+        if (s) {
+            goto found;
+        }
+        return;
+    }
+
     /* Recall that the name_chain is a list of server_addr_recs, some of
      * whose ports may not match.  Also each server may appear more than
      * once in the chain -- specifically, it will appear once for each
@@ -1139,7 +1433,7 @@ static APR_INLINE const char *construct_host_header(request_rec *r,
 AP_DECLARE(void) ap_update_vhost_from_headers(request_rec *r)
 {
     core_server_config *conf = ap_get_core_module_config(r->server->module_config);
-    const char *host_header = apr_table_get(r->headers_in, "Host");
+    const char *host_header = ap_get_known_header_in(r, AP_KNOWN_HEADER_HOST);
     int is_v6literal = 0;
     int have_hostname_from_url = 0;
 
@@ -0,0 +1,235 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This program times the request line and header field scanners of
+ * ../server/util.c (ap_scan_http_token(), ap_scan_http_field_content()
+ * and ap_scan_vchar_obstext(), vectorized where available) against the
+ * byte at a time loops they replace, on typical browser requests.  The
+ * results of both are compared too.
+ *
+ * Build httpd first, then something like:
+ *
+     gcc -O2 -I../include -I../os/unix -I../server \
+            `apr-1-config --includes --cppflags` `apu-1-config --includes` \
+            -o time-scan time-scan.c \
+            ../server/.libs/libmain.a ../os/unix/.libs/libos.a \
+            `apu-1-config --link-ld --libs` `apr-1-config --link-ld --libs` \
+            -lpcre
+ *
+ * Usage: time-scan [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_general.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+#include "httpd.h"
+#include "http_config.h"
+#include "test_char.h"
+
+/*
+ * Dummy a bunch of stuff just to get a link
+ */
+module *ap_prelinked_modules[] = { NULL };
+module *ap_preloaded_modules[] = { NULL };
+ap_module_symbol_t ap_prelinked_module_symbols[] = { { NULL, NULL } };
+
+#define TEST_CHAR(c, f) (test_char_table[(unsigned char)(c)] & (f))
+
+static const char *ref_scan_http_token(const char *ptr)
+{
+    for ( ; !TEST_CHAR(*ptr, T_HTTP_TOKEN_STOP); ++ptr) ;
+    return ptr;
+}
+
+static const char *ref_scan_http_field_content(const char *ptr)
+{
+    for ( ; !TEST_CHAR(*ptr, T_HTTP_CTRLS); ++ptr) ;
+    return ptr;
+}
+
+static const char *ref_scan_vchar_obstext(const char *ptr)
+{
+    for ( ; TEST_CHAR(*ptr, T_VCHAR_OBSTEXT); ++ptr) ;
+    return ptr;
+}
+
+typedef struct {
+    const char *(*token)(const char *);
+    const char *(*field)(const char *);
+    const char *(*vchar)(const char *);
+} scanners_t;
+
+static const scanners_t ref_scanners = {
+    ref_scan_http_token, ref_scan_http_field_content, ref_scan_vchar_obstext
+};
+static const scanners_t ap_scanners = {
+    ap_scan_http_token, ap_scan_http_field_content, ap_scan_vchar_obstext
+};
+
+static const char *const chrome[] = {
+    "GET /static/js/main.4f2c9a1b.chunk.js?v=20161018 HTTP/1.1",
+    "Host: www.example.com",
+    "Connection: keep-alive",
+    "Pragma: no-cache",
+    "Cache-Control: no-cache",
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) "
+        "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/54.0.2840.71 "
+        "Safari/537.36",
+    "Accept: */*",
+    "Referer: https://www.example.com/products/list?category=shoes&page=2",
+    "Accept-Encoding: gzip, deflate, sdch, br",
+    "Accept-Language: en-US,en;q=0.8,fr;q=0.6,de;q=0.4",
+    "Cookie: _ga=GA1.2.1234567890.1476789012; _gid=GA1.2.987654321."
+        "1476789012; session=eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9."
+        "eyJzdWIiOiIxMjM0NTY3ODkwIiwibmFtZSI6IkpvaG4gRG9lIn0; "
+        "prefs=lang%3Den%26currency%3DUSD",
+    NULL
+};
+
+static const char *const firefox[] = {
+    "GET /api/v2/items/8431?fields=id,name,price,stock HTTP/1.1",
+    "Host: api.example.com",
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:49.0) Gecko/20100101 "
+        "Firefox/49.0",
+    "Accept: application/json, text/javascript, */*; q=0.01",
+    "Accept-Language: en-US,en;q=0.5",
+    "Accept-Encoding: gzip, deflate, br",
+    "X-Requested-With: XMLHttpRequest",
+    "Referer: https://www.example.com/item/8431",
+    "Cookie: session=8d2f1c0e7b5a4c3e9f1a2b3c4d5e6f70; theme=dark",
+    "DNT: 1",
+    "Connection: keep-alive",
+    NULL
+};
+
+static const char *const safari[] = {
+    "GET /images/banner@2x.png HTTP/1.1",
+    "Host: cdn.example.com",
+    "Accept: image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5",
+    "If-None-Match: \"5a1b-53f2c9d1e8a40\"",
+    "If-Modified-Since: Tue, 18 Oct 2016 09:12:45 GMT",
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_12) "
+        "AppleWebKit/602.1.50 (KHTML, like Gecko) Version/10.0 "
+        "Safari/602.1.50",
+    "Accept-Language: en-us",
+    "Referer: https://www.example.com/",
+    "Accept-Encoding: gzip, deflate",
+    "Connection: keep-alive",
+    NULL
+};
+
+static const char *const *const requests[] = { chrome, firefox, safari };
+#define NUM_REQUESTS (sizeof(requests) / sizeof(requests[0]))
+
+/* Tokenize the request line and the header fields like read_request_line()
+ * and ap_get_mime_headers_core() do in strict mode.
+ */
+static apr_size_t parse(char *const *lines, const scanners_t *scan)
+{
+    apr_size_t sum = 0;
+    const char *s, *e;
+
+    /* Request line: method, URI, protocol */
+    s = lines[0];
+    e = scan->token(s);
+    sum += e - s;
+    s = e + 1;
+    e = scan->vchar(s);
+    sum += e - s;
+    s = e + 1;
+    e = scan->vchar(s);
+    sum += e - s;
+
+    /* Fields: token ':' OWS field-content */
+    for (++lines; *lines; ++lines) {
+        s = *lines;
+        e = scan->token(s);
+        sum += e - s;
+        for (s = e + 1; *s == ' ' || *s == '\t'; ++s)
+            ;
+        e = scan->field(s);
+        sum += e - s;
+    }
+
+    return sum;
+}
+
+static apr_interval_time_t run(char **const *reqs, int iterations,
+                               const scanners_t *scan, apr_size_t *sum)
+{
+    apr_time_t start = apr_time_now();
+    int i;
+    apr_size_t n;
+
+    *sum = 0;
+    for (i = 0; i < iterations; ++i) {
+        for (n = 0; n < NUM_REQUESTS; ++n) {
+            *sum += parse(reqs[n], scan);
+        }
+    }
+    return apr_time_now() - start;
+}
+
+int main(int argc, const char *const argv[])
+{
+    apr_pool_t *p;
+    char **reqs[NUM_REQUESTS];
+    int iterations = (argc > 1) ? atoi(argv[1]) : 1000000;
+    apr_size_t n, bytes = 0, lines = 0, ref_sum, ap_sum;
+    apr_interval_time_t ref_time, ap_time;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    atexit(apr_terminate);
+    apr_pool_create(&p, NULL);
+
+    /* Copy the requests into pool memory, as ap_rgetline() does */
+    for (n = 0; n < NUM_REQUESTS; ++n) {
+        apr_size_t i, count;
+
+        for (count = 0; requests[n][count]; ++count)
+            ;
+        reqs[n] = apr_pcalloc(p, (count + 1) * sizeof(char *));
+        for (i = 0; i < count; ++i) {
+            reqs[n][i] = apr_pstrdup(p, requests[n][i]);
+            bytes += strlen(reqs[n][i]);
+        }
+        lines += count;
+    }
+
+    ref_time = run(reqs, iterations, &ref_scanners, &ref_sum);
+    ap_time = run(reqs, iterations, &ap_scanners, &ap_sum);
+
+    if (ref_sum != ap_sum) {
+        fprintf(stderr, "scanned lengths differ: %" APR_SIZE_T_FMT
+                " != %" APR_SIZE_T_FMT "\n", ap_sum, ref_sum);
+        return 1;
+    }
+
+    printf("%d iterations of %" APR_SIZE_T_FMT " requests (%" APR_SIZE_T_FMT
+           " lines, %" APR_SIZE_T_FMT " bytes)\n",
+           iterations, (apr_size_t)NUM_REQUESTS, lines, bytes);
+    printf("byte at a time: %8.2f ns/line %8.1f MB/s\n",
+           (double)ref_time * 1000 / ((double)iterations * lines),
+           (double)bytes * iterations / (ref_time ? ref_time : 1));
+    printf("ap_scan_*():    %8.2f ns/line %8.1f MB/s\n",
+           (double)ap_time * 1000 / ((double)iterations * lines),
+           (double)bytes * iterations / (ap_time ? ap_time : 1));
+
+    return 0;
+}